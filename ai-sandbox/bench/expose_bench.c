@@ -0,0 +1,269 @@
+/*
+ * expose_bench.c - Cost of relaying exposed ports (expose.c)
+ *
+ * Measures bulk throughput and 1-byte round-trip latency over plain
+ * loopback TCP, through the splice() relay used for expose_ports, and
+ * through a read()/write() relay for comparison, so the numbers show
+ * what forwarding a sandbox port adds to a direct connection.
+ *
+ * Build and run: make bench   (no root needed)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "expose.h"
+
+#define BULK_BYTES   (2048L << 20)
+#define BULK_CHUNK   (256 << 10)
+#define PINGS        20000
+
+typedef void (*RelayFn)(int a, int b);
+
+typedef struct {
+    int listen_fd;
+    int target_port;            /* relay: where to connect */
+    RelayFn relay;
+    void (*serve)(int fd);      /* server: what to do with a connection */
+} Service;
+
+typedef struct {
+    int fd;
+    const Service *svc;
+} Accepted;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void nodelay(int fd)
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+static int connect_port(int port)
+{
+    struct sockaddr_in sin;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0)
+    {
+        perror("connect");
+        exit(1);
+    }
+    nodelay(fd);
+    return fd;
+}
+
+/* Discard everything, then close: the client's EOF wait covers the drain */
+static void serve_sink(int fd)
+{
+    static __thread char buf[BULK_CHUNK];
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+}
+
+static void serve_echo(int fd)
+{
+    char c;
+    while (read(fd, &c, 1) == 1 && write(fd, &c, 1) == 1)
+        ;
+}
+
+/* What expose.c would do with read()/write() instead of splice() */
+static void copy_relay(int a, int b)
+{
+    static __thread char buf[BULK_CHUNK];
+    int fds[2] = { a, b };
+    fd_set set;
+
+    for (;;)
+    {
+        FD_ZERO(&set);
+        FD_SET(a, &set);
+        FD_SET(b, &set);
+        if (select((a > b ? a : b) + 1, &set, NULL, NULL, NULL) < 0)
+            return;
+        for (int i = 0; i < 2; i++)
+        {
+            if (!FD_ISSET(fds[i], &set))
+                continue;
+            ssize_t n = read(fds[i], buf, sizeof(buf));
+            if (n <= 0)
+                return;
+            for (ssize_t off = 0; off < n;)
+            {
+                ssize_t w = write(fds[!i], buf + off, n - off);
+                if (w <= 0)
+                    return;
+                off += w;
+            }
+        }
+    }
+}
+
+static void *handle(void *arg)
+{
+    Accepted *acc = arg;
+    const Service *svc = acc->svc;
+
+    nodelay(acc->fd);
+    if (svc->relay)
+    {
+        int up = connect_port(svc->target_port);
+        svc->relay(acc->fd, up);
+        close(up);
+    }
+    else
+    {
+        svc->serve(acc->fd);
+    }
+    close(acc->fd);
+    free(acc);
+    return NULL;
+}
+
+static void *accept_loop(void *arg)
+{
+    Service *svc = arg;
+
+    for (;;)
+    {
+        Accepted *acc = malloc(sizeof(*acc));
+        acc->svc = svc;
+        acc->fd = accept(svc->listen_fd, NULL, NULL);
+        if (acc->fd < 0)
+        {
+            free(acc);
+            continue;
+        }
+        pthread_t t;
+        pthread_create(&t, NULL, handle, acc);
+        pthread_detach(t);
+    }
+    return NULL;
+}
+
+/* Start a service on an ephemeral loopback port; returns the port */
+static int start_service(Service *svc)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    svc->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (bind(svc->listen_fd, (struct sockaddr *)&sin, sizeof(sin)) != 0 ||
+        listen(svc->listen_fd, 16) != 0 ||
+        getsockname(svc->listen_fd, (struct sockaddr *)&sin, &len) != 0)
+    {
+        perror("listen");
+        exit(1);
+    }
+
+    pthread_t t;
+    pthread_create(&t, NULL, accept_loop, svc);
+    pthread_detach(t);
+    return ntohs(sin.sin_port);
+}
+
+static double bulk_gbit(int port)
+{
+    static char buf[BULK_CHUNK];
+    int fd = connect_port(port);
+    double start = now_s();
+
+    for (long sent = 0; sent < BULK_BYTES;)
+    {
+        ssize_t n = write(fd, buf, sizeof(buf));
+        if (n <= 0)
+        {
+            perror("write");
+            exit(1);
+        }
+        sent += n;
+    }
+    shutdown(fd, SHUT_WR);
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+
+    double secs = now_s() - start;
+    close(fd);
+    return BULK_BYTES * 8 / secs / 1e9;
+}
+
+static double rtt_us(int port)
+{
+    int fd = connect_port(port);
+    char c = 'x';
+    double start = now_s();
+
+    for (int i = 0; i < PINGS; i++)
+    {
+        if (write(fd, &c, 1) != 1 || read(fd, &c, 1) != 1)
+        {
+            perror("ping");
+            exit(1);
+        }
+    }
+
+    double us = (now_s() - start) * 1e6 / PINGS;
+    close(fd);
+    return us;
+}
+
+int main(void)
+{
+    static Service sink = { .serve = serve_sink };
+    static Service echo = { .serve = serve_echo };
+    static Service splice_sink = { .relay = splice_relay };
+    static Service splice_echo = { .relay = splice_relay };
+    static Service copy_sink = { .relay = copy_relay };
+    static Service copy_echo = { .relay = copy_relay };
+
+    /* Like the exposer: a peer going away is an error return, not a kill */
+    signal(SIGPIPE, SIG_IGN);
+
+    int sink_port = start_service(&sink);
+    int echo_port = start_service(&echo);
+    splice_sink.target_port = copy_sink.target_port = sink_port;
+    splice_echo.target_port = copy_echo.target_port = echo_port;
+
+    struct {
+        const char *name;
+        int bulk_port;
+        int echo_port;
+    } paths[] = {
+        { "loopback (direct)", sink_port, echo_port },
+        { "splice relay", start_service(&splice_sink), start_service(&splice_echo) },
+        { "read/write relay", start_service(&copy_sink), start_service(&copy_echo) },
+    };
+
+    printf("%-20s %14s %14s\n", "path", "throughput", "round trip");
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++)
+    {
+        double gbit = bulk_gbit(paths[i].bulk_port);
+        double us = rtt_us(paths[i].echo_port);
+        printf("%-20s %9.2f Gbit/s %11.1f us\n", paths[i].name, gbit, us);
+    }
+    return 0;
+}
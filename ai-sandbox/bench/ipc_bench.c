@@ -0,0 +1,299 @@
+/*
+ * ipc_bench.c - Cost of the host <-> sandbox IPC channel (ipc.c)
+ *
+ * Measures the round trip of a small tool-call-sized message over the
+ * channel's Unix sockets and over loopback TCP (what the veth path
+ * costs at best), and the time to hand over a large payload through
+ * a stream socket versus as a sealed memfd passed with SCM_RIGHTS.
+ *
+ * Build and run: make bench   (no root needed)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ipc.h"
+
+#define CALL_BYTES      256
+#define CALLS           20000
+#define PAYLOAD_BYTES   (64L << 20)
+#define PAYLOADS        16
+#define PAGE            4096
+
+static char sock_dir[] = "/tmp/ipc_bench.XXXXXX";
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    for (size_t off = 0; off < len;)
+    {
+        ssize_t n = read(fd, (char *)buf + off, len - off);
+        if (n <= 0)
+            return -1;
+        off += n;
+    }
+    return 0;
+}
+
+/* Read every page of a payload, as a consumer would at the least */
+static unsigned long touch(const unsigned char *p, size_t len)
+{
+    unsigned long sum = 0;
+    for (size_t off = 0; off < len; off += PAGE)
+        sum += p[off];
+    return sum;
+}
+
+/* ---------- Servers (the sandbox side) ---------- */
+
+static void serve_echo(int fd)
+{
+    char buf[CALL_BYTES];
+    ssize_t n;
+
+    while ((n = ipc_recv(fd, buf, sizeof(buf), NULL, NULL)) > 0)
+    {
+        if (ipc_send(fd, buf, n, NULL, 0) != 0)
+            return;
+    }
+}
+
+static void serve_stream_payload(int fd)
+{
+    unsigned char *buf = malloc(PAYLOAD_BYTES);
+    char ack = 0;
+
+    while (read_full(fd, buf, PAYLOAD_BYTES) == 0)
+    {
+        ack = (char)touch(buf, PAYLOAD_BYTES);
+        if (write(fd, &ack, 1) != 1)
+            break;
+    }
+    free(buf);
+}
+
+static void serve_memfd_payload(int fd)
+{
+    char ack;
+    int payload, nfds = 1;
+
+    while (ipc_recv(fd, &ack, 1, &payload, &nfds) > 0 && nfds == 1)
+    {
+        size_t len;
+        unsigned char *map = ipc_payload_map(payload, &len);
+        close(payload);
+        if (!map)
+            break;
+        ack = (char)touch(map, len);
+        munmap(map, len);
+        if (write(fd, &ack, 1) != 1)
+            break;
+        nfds = 1;
+    }
+}
+
+typedef struct {
+    int listen_fd;
+    void (*serve)(int fd);
+} Server;
+
+static void *serve_one(void *arg)
+{
+    Server *srv = arg;
+    int fd = accept(srv->listen_fd, NULL, NULL);
+
+    if (fd >= 0)
+    {
+        srv->serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+static void start_server(Server *srv)
+{
+    pthread_t t;
+    if (listen(srv->listen_fd, 4) != 0)
+    {
+        perror("listen");
+        exit(1);
+    }
+    pthread_create(&t, NULL, serve_one, srv);
+    pthread_detach(t);
+}
+
+/* ---------- Connections ---------- */
+
+static int unix_pair(int type, const char *name, Server *srv)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s", sock_dir, name);
+
+    srv->listen_fd = socket(AF_UNIX, type, 0);
+    if (bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        perror("bind");
+        exit(1);
+    }
+    start_server(srv);
+
+    int fd = socket(AF_UNIX, type, 0);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+static int tcp_pair(Server *srv)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    int one = 1;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    srv->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (bind(srv->listen_fd, (struct sockaddr *)&sin, sizeof(sin)) != 0 ||
+        getsockname(srv->listen_fd, (struct sockaddr *)&sin, &len) != 0)
+    {
+        perror("bind");
+        exit(1);
+    }
+    start_server(srv);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0)
+    {
+        perror("connect");
+        exit(1);
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+/* ---------- Measurements ---------- */
+
+static double call_us(int fd, int stream)
+{
+    char buf[CALL_BYTES];
+    memset(buf, 'x', sizeof(buf));
+    double start = now_s();
+
+    for (int i = 0; i < CALLS; i++)
+    {
+        if (ipc_send(fd, buf, sizeof(buf), NULL, 0) != 0 ||
+            (stream ? read_full(fd, buf, sizeof(buf)) : ipc_recv(fd, buf, sizeof(buf), NULL, NULL) <= 0))
+        {
+            perror("call");
+            exit(1);
+        }
+    }
+    return (now_s() - start) * 1e6 / CALLS;
+}
+
+static double stream_payload_ms(int fd, const char *data)
+{
+    char ack;
+    double start = now_s();
+
+    for (int i = 0; i < PAYLOADS; i++)
+    {
+        if (ipc_send(fd, data, PAYLOAD_BYTES, NULL, 0) != 0 || read(fd, &ack, 1) != 1)
+        {
+            perror("payload");
+            exit(1);
+        }
+    }
+    return (now_s() - start) * 1e3 / PAYLOADS;
+}
+
+/* built: the sender already has the payload in a memfd, as it would if it wrote it there */
+static double memfd_payload_ms(int fd, const char *data, int built)
+{
+    char ack = 0;
+    int payload = built ? ipc_payload_create(data, PAYLOAD_BYTES) : -1;
+    double start = now_s();
+
+    for (int i = 0; i < PAYLOADS; i++)
+    {
+        if (!built)
+            payload = ipc_payload_create(data, PAYLOAD_BYTES);
+        if (payload < 0 || ipc_send(fd, &ack, 1, &payload, 1) != 0 || read(fd, &ack, 1) != 1)
+        {
+            perror("payload");
+            exit(1);
+        }
+        if (!built)
+            close(payload);
+    }
+    double ms = (now_s() - start) * 1e3 / PAYLOADS;
+    if (built)
+        close(payload);
+    return ms;
+}
+
+int main(void)
+{
+    static Server echo_stream = { .serve = serve_echo };
+    static Server echo_seq = { .serve = serve_echo };
+    static Server echo_tcp = { .serve = serve_echo };
+    static Server stream_payload = { .serve = serve_stream_payload };
+    static Server memfd_payload = { .serve = serve_memfd_payload };
+
+    signal(SIGPIPE, SIG_IGN);
+    if (!mkdtemp(sock_dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    printf("%-28s %12s\n", "tool call (256 bytes)", "round trip");
+    printf("%-28s %9.1f us\n", "unix stream",
+           call_us(unix_pair(SOCK_STREAM, "stream", &echo_stream), 1));
+    printf("%-28s %9.1f us\n", "unix seqpacket",
+           call_us(unix_pair(SOCK_SEQPACKET, "seqpacket", &echo_seq), 0));
+    printf("%-28s %9.1f us\n", "tcp loopback", call_us(tcp_pair(&echo_tcp), 1));
+
+    char *data = malloc(PAYLOAD_BYTES);
+    memset(data, 'p', PAYLOAD_BYTES);
+
+    printf("\n%-28s %12s\n", "payload (64 MiB)", "handover");
+    printf("%-28s %9.1f ms\n", "unix stream",
+           stream_payload_ms(unix_pair(SOCK_STREAM, "bulk", &stream_payload), data));
+    int memfd_fd = unix_pair(SOCK_SEQPACKET, "memfd", &memfd_payload);
+    printf("%-28s %9.1f ms\n", "memfd, copied in + passed", memfd_payload_ms(memfd_fd, data, 0));
+    printf("%-28s %9.1f ms\n", "memfd, already built", memfd_payload_ms(memfd_fd, data, 1));
+
+    free(data);
+    const char *names[] = { "stream", "seqpacket", "bulk", "memfd" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        char path[128];
+        snprintf(path, sizeof(path), "%s/%s", sock_dir, names[i]);
+        unlink(path);
+    }
+    rmdir(sock_dir);
+    return 0;
+}
@@ -6,6 +6,7 @@ A modern, user-friendly interface for managing AI sandboxes
 import streamlit as st
 import json
 import os
+import socket
 import subprocess
 import yaml
 from pathlib import Path
@@ -13,6 +14,10 @@ from datetime import datetime
 
 # Configuration
 STATE_FILE = "/var/lib/ai-sandbox/sessions.json"
+FLOW_LOG_DIR = "/var/lib/ai-sandbox/flows"
+HISTORY_FILE = "/var/lib/ai-sandbox/history.jsonl"
+SESSION_RUN_DIR = "/run/ai-sandbox/sessions"
+CGROUP2_MOUNTS = ("/sys/fs/cgroup", "/sys/fs/cgroup/unified")
 DEFAULT_POLICY_PATH = "/etc/ai-sandbox/default-policy.yaml"
 
 # Page configuration
@@ -58,6 +63,11 @@ st.markdown("""
         font-weight: 600;
     }
     
+    .status-frozen {
+        color: #38bdf8;
+        font-weight: 600;
+    }
+    
     /* Headers */
     .main-header {
         background: linear-gradient(90deg, #6366f1, #8b5cf6);
@@ -135,6 +145,109 @@ def load_sessions():
     return []
 
 
+def read_veth_counters(veth):
+    """Read host-side veth counters for a session (rx = sent by sandbox)"""
+    counters = {}
+    if not veth:
+        return counters
+    for name in ("rx_bytes", "tx_bytes"):
+        try:
+            with open(f"/sys/class/net/{veth}/statistics/{name}") as f:
+                counters[name] = int(f.read().strip())
+        except (OSError, ValueError):
+            pass
+    return counters
+
+
+def load_flows(pid, limit=200):
+    """Last `limit` records of a session's flow log (newest last)"""
+    path = os.path.join(FLOW_LOG_DIR, f"{pid}.jsonl")
+    try:
+        with open(path, 'rb') as f:
+            # Only the tail matters; don't read a long-running session's whole log
+            f.seek(0, os.SEEK_END)
+            f.seek(max(0, f.tell() - limit * 256))
+            lines = f.read().decode(errors='replace').splitlines()[-limit:]
+    except OSError:
+        return []
+    flows = []
+    for line in lines:
+        try:
+            flows.append(json.loads(line))
+        except json.JSONDecodeError:
+            pass    # partial first line after seeking
+    return flows
+
+
+def load_history(limit=20):
+    """Most recently ended sessions, newest first"""
+    try:
+        with open(HISTORY_FILE) as f:
+            lines = f.readlines()[-limit:]
+    except OSError:
+        return []
+    history = []
+    for line in reversed(lines):
+        try:
+            history.append(json.loads(line))
+        except json.JSONDecodeError:
+            pass
+    return history
+
+
+def load_placement(pid):
+    """Live CPU/memory-node placement of a session (cpu_cores), or None"""
+    try:
+        with open(os.path.join(SESSION_RUN_DIR, str(pid), "placement")) as f:
+            fields = dict(l.rstrip("\n").split("=", 1) for l in f if "=" in l)
+    except OSError:
+        return None
+    if not fields.get("cpus"):
+        return None
+    return f"CPUs {fields['cpus']} (node {fields.get('mems', '?')})"
+
+
+def session_frozen(pid):
+    """True if the session's cgroup is frozen (idle_freeze or ai-run freeze)"""
+    try:
+        with open(f"/proc/{pid}/cgroup") as f:
+            path = next((l[3:].strip() for l in f if l.startswith("0::")), None)
+    except OSError:
+        return False
+    if not path:
+        return False
+    for mount in CGROUP2_MOUNTS:
+        try:
+            with open(f"{mount}{path}/cgroup.events") as f:
+                return "frozen 1" in f.read()
+        except OSError:
+            continue
+    return False
+
+
+def session_control(pid, command):
+    """Send freeze/thaw/status to a session's control socket; returns its reply"""
+    path = os.path.join(SESSION_RUN_DIR, str(pid), "control")
+    try:
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+            sock.settimeout(2)
+            sock.connect(path)
+            sock.sendall(f"{command}\n".encode())
+            return sock.recv(64).decode().strip()
+    except OSError as e:
+        st.error(f"Could not reach session {pid}: {e}")
+        return None
+
+
+def format_bytes(value):
+    """Human readable byte count"""
+    for unit in ("B", "KB", "MB", "GB"):
+        if value < 1024:
+            return f"{value:.0f} {unit}"
+        value /= 1024
+    return f"{value:.1f} TB"
+
+
 def load_policy(policy_path):
     """Load policy YAML file"""
     try:
@@ -258,6 +371,18 @@ def render_dashboard():
     else:
         for session in sessions:
             if session.get('status') == 'running':
+                counters = read_veth_counters(session.get('veth'))
+                traffic = "N/A"
+                if counters:
+                    traffic = "{} sent / {} received".format(
+                        format_bytes(counters.get('rx_bytes', 0)),
+                        format_bytes(counters.get('tx_bytes', 0)))
+                flows = load_flows(session.get('pid'))
+                rejected = len([f for f in flows if f.get('verdict') == 'reject'])
+                frozen = session_frozen(session.get('pid'))
+                placement = load_placement(session.get('pid')) or "any CPU"
+                status = ('<span class="status-frozen">* Frozen (idle)</span>' if frozen
+                          else '<span class="status-running">* Running</span>')
                 with st.container():
                     st.markdown(f"""
                     <div class="sandbox-card">
@@ -266,9 +391,29 @@ def render_dashboard():
                         <p><strong>Policy:</strong> <code>{session.get('policy', 'N/A')}</code></p>
                         <p><strong>Directory:</strong> <code>{session.get('cwd', 'N/A')}</code></p>
                         <p><strong>Started:</strong> {session.get('started', 'N/A')}</p>
-                        <p><span class="status-running">* Running</span></p>
+                        <p><strong>Network:</strong> {traffic}</p>
+                        <p><strong>Placement:</strong> {placement}</p>
+                        <p><strong>Blocked attempts (recent):</strong> {rejected}</p>
+                        <p>{status}</p>
                     </div>
                     """, unsafe_allow_html=True)
+                    pid = session.get('pid')
+                    if frozen:
+                        if st.button("Thaw", key=f"thaw_{pid}"):
+                            session_control(pid, "thaw")
+                            st.rerun()
+                    elif st.button("Freeze", key=f"freeze_{pid}"):
+                        session_control(pid, "freeze")
+                        st.rerun()
+                    if flows:
+                        with st.expander(f"Network flows ({len(flows)} recent)"):
+                            st.dataframe(list(reversed(flows)), use_container_width=True)
+    
+    # Ended sessions, with the limit that stopped them
+    history = load_history()
+    if history:
+        with st.expander(f"Recently ended sessions ({len(history)})"):
+            st.dataframe(history, use_container_width=True)
     
     # Refresh button
     if st.button("Refresh"):
@@ -338,7 +483,7 @@ def render_policy_editor():
                         with col_d:
                             st.text_input(f"Domain {i+1}", value=domain, key=f"wl_{i}", disabled=True)
                     
-                    new_domain = st.text_input("Add new domain/IP", key="new_domain")
+                    new_domain = st.text_input("Add new domain/IP (host[:ports] or CIDR[:ports])", key="new_domain")
                     if st.button("+ Add Domain") and new_domain:
                         whitelist.append(new_domain)
                         policy['network_whitelist'] = whitelist
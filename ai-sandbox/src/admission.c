@@ -0,0 +1,383 @@
+/*
+ * admission.c - Pressure-driven admission control for sandbox launches
+ *
+ * WHY: Starting another sandbox on a host that is already stalling on
+ * memory or I/O slows every session down, and past a point the host
+ * spends its time reclaiming and thrashing instead of running agents.
+ * Launches should slow down before that, not all go through at once.
+ *
+ * HOW IT WORKS:
+ * 1. Pressure is PSI's "some avg10" - the share of the last 10 seconds
+ *    in which at least one task stalled - for memory, I/O and CPU, from
+ *    /proc/pressure/ and from the ai-sandbox cgroup (all sessions
+ *    together); the worse of the two counts
+ * 2. Below every admit_*_pressure threshold, with nobody queued, a
+ *    launch goes straight through
+ * 3. Otherwise it takes a numbered ticket in ADMISSION_DIR. Only the
+ *    oldest live ticket may go, once pressure is back under the
+ *    thresholds and ADMISSION_SPACING_MS after the last queued launch,
+ *    so launches trickle out at the rate the host absorbs them
+ * 4. A launch is rejected when the queue already holds admit_max_queue
+ *    tickets or it waited admit_max_wait seconds, and fails fast
+ *    instead of piling up behind a host that won't recover
+ * 5. Counters (admitted, rejected, wait times) live in
+ *    ADMISSION_DIR/metrics; "ai-run stats" prints them with the queue
+ *    depth. Tickets of an ai-run that died are dropped by whoever
+ *    looks at the queue next
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "admission.h"
+#include "cgroup.h"
+
+#define ADMISSION_LOCK    ADMISSION_DIR "/lock"
+#define ADMISSION_METRICS ADMISSION_DIR "/metrics"
+
+typedef struct {
+    double memory;
+    double io;
+    double cpu;
+} Pressure;
+
+typedef struct {
+    unsigned long next_ticket;
+    unsigned long admitted;
+    unsigned long rejected;
+    unsigned long queued;           /* launches that had to wait */
+    unsigned long long wait_ms_total;
+    unsigned long long wait_ms_max;
+    unsigned long long wait_ms_last;
+    unsigned long long last_queued_admit_ms;
+} AdmissionMetrics;
+
+static unsigned long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* "some avg10=1.23 avg60=..." -> 1.23, -1 if the file isn't there */
+static double read_pressure(const char *path)
+{
+    char line[256];
+    double value = -1;
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "some avg10=%lf", &value) == 1)
+            break;
+    }
+    fclose(f);
+    return value;
+}
+
+static double worst(double a, double b)
+{
+    return a > b ? a : b;
+}
+
+static void sample_pressure(Pressure *p)
+{
+    char base[128];
+    char path[192];
+
+    p->memory = read_pressure("/proc/pressure/memory");
+    p->io = read_pressure("/proc/pressure/io");
+    p->cpu = read_pressure("/proc/pressure/cpu");
+
+    if (sandbox_cgroup_parent(base, sizeof(base)) != 0)
+        return;
+    snprintf(path, sizeof(path), "%s/memory.pressure", base);
+    p->memory = worst(p->memory, read_pressure(path));
+    snprintf(path, sizeof(path), "%s/io.pressure", base);
+    p->io = worst(p->io, read_pressure(path));
+    snprintf(path, sizeof(path), "%s/cpu.pressure", base);
+    p->cpu = worst(p->cpu, read_pressure(path));
+}
+
+/* Describe the first threshold exceeded; 0 if all are met */
+static int over_threshold(const Policy *policy, const Pressure *p, char *why, size_t len)
+{
+    if (policy->admit_memory_pressure > 0 && p->memory >= policy->admit_memory_pressure)
+        snprintf(why, len, "memory pressure %.1f%% >= %d%%", p->memory, policy->admit_memory_pressure);
+    else if (policy->admit_io_pressure > 0 && p->io >= policy->admit_io_pressure)
+        snprintf(why, len, "I/O pressure %.1f%% >= %d%%", p->io, policy->admit_io_pressure);
+    else if (policy->admit_cpu_pressure > 0 && p->cpu >= policy->admit_cpu_pressure)
+        snprintf(why, len, "CPU pressure %.1f%% >= %d%%", p->cpu, policy->admit_cpu_pressure);
+    else
+        return 0;
+    return 1;
+}
+
+static int lock_admission(void)
+{
+    mkdir("/run/ai-sandbox", 0755);
+    mkdir(ADMISSION_DIR, 0755);
+
+    int fd = open(ADMISSION_LOCK, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    if (flock(fd, LOCK_EX) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void read_metrics(AdmissionMetrics *m)
+{
+    char key[32];
+    unsigned long long value;
+
+    memset(m, 0, sizeof(*m));
+    FILE *f = fopen(ADMISSION_METRICS, "r");
+    if (!f)
+        return;
+    while (fscanf(f, "%31[^=]=%llu\n", key, &value) == 2)
+    {
+        if (strcmp(key, "next_ticket") == 0) m->next_ticket = value;
+        else if (strcmp(key, "admitted") == 0) m->admitted = value;
+        else if (strcmp(key, "rejected") == 0) m->rejected = value;
+        else if (strcmp(key, "queued") == 0) m->queued = value;
+        else if (strcmp(key, "wait_ms_total") == 0) m->wait_ms_total = value;
+        else if (strcmp(key, "wait_ms_max") == 0) m->wait_ms_max = value;
+        else if (strcmp(key, "wait_ms_last") == 0) m->wait_ms_last = value;
+        else if (strcmp(key, "last_queued_admit_ms") == 0) m->last_queued_admit_ms = value;
+    }
+    fclose(f);
+}
+
+static void write_metrics(const AdmissionMetrics *m)
+{
+    FILE *f = fopen(ADMISSION_METRICS ".tmp", "w");
+    if (!f)
+        return;
+    fprintf(f, "next_ticket=%lu\nadmitted=%lu\nrejected=%lu\nqueued=%lu\n"
+               "wait_ms_total=%llu\nwait_ms_max=%llu\nwait_ms_last=%llu\n"
+               "last_queued_admit_ms=%llu\n",
+            m->next_ticket, m->admitted, m->rejected, m->queued,
+            m->wait_ms_total, m->wait_ms_max, m->wait_ms_last, m->last_queued_admit_ms);
+    if (fclose(f) == 0)
+        rename(ADMISSION_METRICS ".tmp", ADMISSION_METRICS);
+}
+
+/*
+ * Oldest live ticket and how many are waiting. Tickets are
+ * "q-<number>" files holding the pid of the ai-run that took them.
+ * Caller holds the lock.
+ */
+static unsigned long scan_queue(int *depth)
+{
+    char path[320];
+    unsigned long head = 0;
+
+    *depth = 0;
+    DIR *d = opendir(ADMISSION_DIR);
+    if (!d)
+        return 0;
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+        unsigned long ticket;
+        int pid = 0;
+
+        if (sscanf(ent->d_name, "q-%lu", &ticket) != 1)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", ADMISSION_DIR, ent->d_name);
+        FILE *f = fopen(path, "r");
+        if (f)
+        {
+            if (fscanf(f, "%d", &pid) != 1)
+                pid = 0;
+            fclose(f);
+        }
+        if (pid <= 0 || (kill(pid, 0) != 0 && errno == ESRCH))
+        {
+            unlink(path);
+            continue;
+        }
+        (*depth)++;
+        if (head == 0 || ticket < head)
+            head = ticket;
+    }
+    closedir(d);
+    return head;
+}
+
+static void ticket_path(unsigned long ticket, char *out, size_t len)
+{
+    snprintf(out, len, "%s/q-%010lu", ADMISSION_DIR, ticket);
+}
+
+/* Count the outcome; a queued launch also leaves the queue here */
+static void finish(int lock, unsigned long ticket, int admitted, unsigned long long waited)
+{
+    AdmissionMetrics m;
+    char path[320];
+
+    if (lock < 0)
+        return;
+    read_metrics(&m);
+    if (admitted)
+        m.admitted++;
+    else
+        m.rejected++;
+
+    /* Wait times cover queued launches only, whether they got in or gave up */
+    if (ticket)
+    {
+        m.queued++;
+        m.wait_ms_total += waited;
+        m.wait_ms_last = waited;
+        if (waited > m.wait_ms_max)
+            m.wait_ms_max = waited;
+        if (admitted)
+            m.last_queued_admit_ms = now_ms();
+        ticket_path(ticket, path, sizeof(path));
+        unlink(path);
+    }
+    write_metrics(&m);
+    close(lock);
+}
+
+int admission_wait(const Policy *policy)
+{
+    Pressure p;
+    AdmissionMetrics m;
+    char why[96];
+    char path[320];
+    int depth;
+
+    if (policy->admit_memory_pressure <= 0 && policy->admit_io_pressure <= 0 &&
+        policy->admit_cpu_pressure <= 0)
+        return 0;
+
+    sample_pressure(&p);
+    int over = over_threshold(policy, &p, why, sizeof(why));
+
+    /* Rootless without /run access: thresholds only, no shared queue */
+    int lock = lock_admission();
+    if (lock < 0)
+    {
+        if (!over)
+            return 0;
+        fprintf(stderr, "[!] Host under pressure (%s) - not starting sandbox\n", why);
+        return -1;
+    }
+
+    scan_queue(&depth);
+    if (!over && depth == 0)
+    {
+        finish(lock, 0, 1, 0);
+        return 0;
+    }
+    if (policy->admit_max_queue > 0 && depth >= policy->admit_max_queue)
+    {
+        fprintf(stderr, "[!] Launch queue full (%d waiting) - not starting sandbox\n", depth);
+        finish(lock, 0, 0, 0);
+        return -1;
+    }
+    if (over && policy->admit_max_wait == 0)
+    {
+        fprintf(stderr, "[!] Host under pressure (%s) - not starting sandbox\n", why);
+        finish(lock, 0, 0, 0);
+        return -1;
+    }
+
+    read_metrics(&m);
+    unsigned long ticket = ++m.next_ticket;
+    write_metrics(&m);
+    ticket_path(ticket, path, sizeof(path));
+    /* Without its ticket this launch could never reach the head of the queue */
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        fprintf(stderr, "[!] Could not join the launch queue (%s: %s) - not starting sandbox\n",
+                path, strerror(errno));
+        finish(lock, 0, 0, 0);
+        return -1;
+    }
+    fprintf(f, "%d\n", getpid());
+    fclose(f);
+    close(lock);
+
+    printf("[+] %s - waiting in the launch queue (position %d)\n",
+           over ? why : "other launches queued", depth + 1);
+    fflush(stdout);
+
+    unsigned long long start = now_ms();
+    for (;;)
+    {
+        usleep(ADMISSION_POLL_MS * 1000);
+
+        unsigned long long waited = now_ms() - start;
+        lock = lock_admission();
+        if (lock < 0)
+            return 0;
+
+        if (scan_queue(&depth) == ticket)
+        {
+            read_metrics(&m);
+            sample_pressure(&p);
+            over = over_threshold(policy, &p, why, sizeof(why));
+            if (!over && now_ms() >= m.last_queued_admit_ms + ADMISSION_SPACING_MS)
+            {
+                finish(lock, ticket, 1, waited);
+                printf("[+] Admitted after %.1fs in the launch queue\n", waited / 1000.0);
+                return 0;
+            }
+        }
+
+        if (policy->admit_max_wait > 0 && waited >= (unsigned long long)policy->admit_max_wait * 1000)
+        {
+            finish(lock, ticket, 0, waited);
+            fprintf(stderr, "[!] Still queued after %ds%s%s - not starting sandbox\n",
+                    policy->admit_max_wait, over ? ": " : "", over ? why : "");
+            return -1;
+        }
+        close(lock);
+    }
+}
+
+void print_admission_stats(void)
+{
+    AdmissionMetrics m;
+    Pressure p;
+    int depth = 0;
+
+    int lock = lock_admission();
+    if (lock >= 0)
+    {
+        scan_queue(&depth);
+        read_metrics(&m);
+        close(lock);
+    }
+    else
+    {
+        read_metrics(&m);
+    }
+    sample_pressure(&p);
+
+    printf("{\"admission\":{\"queue_depth\":%d,\"admitted\":%lu,\"rejected\":%lu,\"queued\":%lu,"
+           "\"wait_ms_avg\":%llu,\"wait_ms_max\":%llu,\"wait_ms_last\":%llu,"
+           "\"memory_pressure\":%.2f,\"io_pressure\":%.2f,\"cpu_pressure\":%.2f}}\n",
+           depth, m.admitted, m.rejected, m.queued,
+           m.queued ? m.wait_ms_total / m.queued : 0, m.wait_ms_max, m.wait_ms_last,
+           p.memory, p.io, p.cpu);
+}
@@ -0,0 +1,27 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include "policy.h"
+
+/* Launch queue, counters and lock shared by every ai-run on the host */
+#define ADMISSION_DIR "/run/ai-sandbox/admission"
+
+/* How often a queued launch looks at the queue and the pressure */
+#define ADMISSION_POLL_MS 500
+
+/* Launches let out of the queue are at least this far apart, so the
+ * pressure of the last one shows before the next goes */
+#define ADMISSION_SPACING_MS 2000
+
+/*
+ * Wait until the host and the running sandboxes are below the policy's
+ * PSI thresholds (admit_*_pressure), in launch order with any other
+ * waiting ai-run. Returns 0 when the launch may go ahead, -1 when it
+ * is rejected (queue full or admit_max_wait exceeded).
+ */
+int admission_wait(const Policy *policy);
+
+/* Queue depth, wait times and current pressure as one JSON line */
+void print_admission_stats(void);
+
+#endif
@@ -0,0 +1,398 @@
+/*
+ * cgroup.c - Per-session cgroup (cgroup v2)
+ *
+ * WHY: Waiting for the shell only accounts for the shell. Anything the
+ * agent started in the background (dev servers, watchers, stuck
+ * builds) outlives the session, keeps using CPU and holds on to the
+ * sandbox's network namespace and veth.
+ *
+ * HOW IT WORKS:
+ * 1. Before the clone, ai-run creates <cgroup2>/ai-sandbox/<its pid>
+ *    and the sandbox is cloned straight into it (CLONE_INTO_CGROUP),
+ *    so nothing it forks can start outside
+ * 2. At session end one write to cgroup.kill SIGKILLs every process
+ *    in it - the kernel walks the tree, we don't, however many there
+ *    are. Kernels before 5.14 fall back to signalling cgroup.procs
+ * 3. The directory is removed once cgroup.events reports it empty;
+ *    "ai-run destroy" removes those left by an ai-run that was killed
+ *
+ * The sandbox's PID namespace (namespace.c) kills the same tree when
+ * its init exits; the cgroup covers processes that entered the
+ * sandbox from outside and hosts where the namespace is not enough.
+ *
+ * The same cgroup is what the session monitor (monitor.c) freezes
+ * when the session goes idle: cgroup.freeze stops the whole tree
+ * without signals the processes could notice, and memory.reclaim
+ * pushes its pages out to swap/zswap while it sleeps.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include "cgroup.h"
+
+#define CGROUP_EMPTY_TIMEOUT_MS 2000
+
+/*
+ * cgroup2 is either the whole of /sys/fs/cgroup or, on hybrid
+ * systems, mounted at /sys/fs/cgroup/unified
+ */
+static int cgroup2_mount(char *out, size_t len)
+{
+    static const char *candidates[] = { "/sys/fs/cgroup", "/sys/fs/cgroup/unified", NULL };
+    struct statfs sfs;
+
+    for (int i = 0; candidates[i]; i++)
+    {
+        if (statfs(candidates[i], &sfs) == 0 && sfs.f_type == CGROUP2_SUPER_MAGIC)
+        {
+            snprintf(out, len, "%s", candidates[i]);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Our own cgroup2 path ("0::/user.slice/...") relative to the mount */
+static int own_cgroup(char *out, size_t len)
+{
+    char line[384];
+    int found = -1;
+
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (!f)
+        return -1;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        if (strncmp(line, "0::", 3) == 0)
+        {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(out, len, "%s", strcmp(line + 3, "/") == 0 ? "" : line + 3);
+            found = 0;
+            break;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+static int write_cgroup_file(const char *dir, const char *file, const char *data)
+{
+    char path[640];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    ssize_t len = (ssize_t)strlen(data);
+    ssize_t n = write(fd, data, len);
+    close(fd);
+    return n == len ? 0 : -1;
+}
+
+/* First number in a cgroup file, or the one after "key " if key is set */
+static long long read_cgroup_value(const char *dir, const char *file, const char *key)
+{
+    char path[640];
+    char line[256];
+    long long value = -1;
+    size_t klen = key ? strlen(key) : 0;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        if (!key)
+        {
+            value = strtoll(line, NULL, 10);
+            break;
+        }
+        if (strncmp(line, key, klen) == 0 && line[klen] == ' ')
+        {
+            value = strtoll(line + klen + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+int sandbox_cgroup_parent(char *out, size_t len)
+{
+    char mnt[64];
+
+    if (cgroup2_mount(mnt, sizeof(mnt)) != 0)
+        return -1;
+    snprintf(out, len, "%s/%s", mnt, SANDBOX_CGROUP_NAME);
+    return 0;
+}
+
+int sandbox_cgroup_create(SandboxCgroup *cg, int rootless)
+{
+    char mnt[64];
+    char own[384];
+    char base[128];
+
+    cg->path[0] = '\0';
+    cg->dir_fd = -1;
+
+    if (cgroup2_mount(mnt, sizeof(mnt)) != 0)
+    {
+        printf("[!] No cgroup2 hierarchy - session end relies on the PID namespace alone\n");
+        return -1;
+    }
+
+    if (!rootless)
+    {
+        snprintf(base, sizeof(base), "%s/%s", mnt, SANDBOX_CGROUP_NAME);
+        if (mkdir(base, 0755) != 0 && errno != EEXIST)
+        {
+            printf("[!] Warning: Could not create %s (%s)\n", base, strerror(errno));
+            return -1;
+        }
+        /* memory.* (idle_reclaim) and cpuset.* (placement) in the session
+         * cgroups; fails harmlessly where the root doesn't delegate them */
+        write_cgroup_file(base, "cgroup.subtree_control", "+memory");
+        write_cgroup_file(base, "cgroup.subtree_control", "+cpuset");
+        snprintf(cg->path, sizeof(cg->path), "%s/%d", base, getpid());
+    }
+    else
+    {
+        /* Writable only if our cgroup was delegated (systemd user services) */
+        if (own_cgroup(own, sizeof(own)) != 0)
+            return -1;
+        snprintf(cg->path, sizeof(cg->path), "%s%s/%s-%d", mnt, own, SANDBOX_CGROUP_NAME, getpid());
+    }
+
+    if (mkdir(cg->path, 0755) != 0 && errno != EEXIST)
+    {
+        if (rootless)
+            printf("[!] No delegated cgroup - session end relies on the PID namespace alone\n");
+        else
+            printf("[!] Warning: Could not create cgroup %s (%s)\n", cg->path, strerror(errno));
+        cg->path[0] = '\0';
+        return -1;
+    }
+
+    cg->dir_fd = open(cg->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return 0;
+}
+
+int sandbox_cgroup_add(const SandboxCgroup *cg, pid_t pid)
+{
+    char buf[32];
+
+    if (!cg->path[0])
+        return -1;
+
+    snprintf(buf, sizeof(buf), "%d", pid);
+    if (write_cgroup_file(cg->path, "cgroup.procs", buf) != 0)
+    {
+        printf("[!] Warning: Could not move sandbox into %s (%s)\n", cg->path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Signal what cgroup.procs lists right now; returns how many, -1 on error */
+static int signal_cgroup_path(const char *dir, int sig)
+{
+    char path[640];
+    int pid, signalled = 0;
+
+    snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    while (fscanf(f, "%d", &pid) == 1)
+    {
+        if (sig == 0 || kill(pid, sig) == 0)
+            signalled++;
+    }
+    fclose(f);
+    return signalled;
+}
+
+/*
+ * Send SIGKILL to every process in the cgroup
+ *
+ * cgroup.kill does it in the kernel, including processes forked while
+ * the kill is running. Without it (before 5.14), signal what
+ * cgroup.procs lists and repeat until nothing new shows up.
+ */
+static int kill_cgroup_path(const char *dir)
+{
+    if (write_cgroup_file(dir, "cgroup.kill", "1") == 0)
+        return 0;
+
+    for (int round = 0; round < 16; round++)
+    {
+        int signalled = signal_cgroup_path(dir, SIGKILL);
+
+        if (signalled < 0)
+            return -1;
+        if (signalled == 0)
+            return 0;
+        usleep(10000);
+    }
+    return -1;
+}
+
+int sandbox_cgroup_kill(const SandboxCgroup *cg)
+{
+    if (!cg->path[0])
+        return -1;
+    return kill_cgroup_path(cg->path);
+}
+
+int sandbox_cgroup_signal(const SandboxCgroup *cg, int sig)
+{
+    if (!cg->path[0])
+        return -1;
+    return signal_cgroup_path(cg->path, sig);
+}
+
+int sandbox_cgroup_freeze(const SandboxCgroup *cg, int frozen)
+{
+    if (!cg->path[0])
+        return -1;
+    return write_cgroup_file(cg->path, "cgroup.freeze", frozen ? "1" : "0");
+}
+
+int sandbox_cgroup_frozen(const SandboxCgroup *cg)
+{
+    if (!cg->path[0])
+        return 0;
+    return read_cgroup_value(cg->path, "cgroup.events", "frozen") == 1;
+}
+
+long long sandbox_cgroup_cpu_usec(const SandboxCgroup *cg)
+{
+    if (!cg->path[0])
+        return -1;
+    return read_cgroup_value(cg->path, "cpu.stat", "usage_usec");
+}
+
+/*
+ * Ask for everything the cgroup has charged. The kernel reclaims what
+ * it can (to swap, compressed if zswap is on) and fails with EAGAIN
+ * when it falls short, which still counts - report what actually left.
+ */
+long long sandbox_cgroup_reclaim(const SandboxCgroup *cg)
+{
+    char buf[32];
+
+    if (!cg->path[0])
+        return -1;
+
+    long long before = read_cgroup_value(cg->path, "memory.current", NULL);
+    if (before <= 0)
+        return -1;
+
+    snprintf(buf, sizeof(buf), "%lld", before);
+    if (write_cgroup_file(cg->path, "memory.reclaim", buf) != 0 && errno != EAGAIN)
+        return -1;
+
+    long long after = read_cgroup_value(cg->path, "memory.current", NULL);
+    return after >= 0 && after < before ? before - after : 0;
+}
+
+/* "populated 0" in cgroup.events; changes wake poll() with POLLPRI */
+static void wait_cgroup_empty(const char *dir, int timeout_ms)
+{
+    char path[640];
+    char buf[256];
+    struct timespec start, now;
+
+    snprintf(path, sizeof(path), "%s/cgroup.events", dir);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;)
+    {
+        ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+        if (n <= 0)
+            break;
+        buf[n] = '\0';
+        if (strstr(buf, "populated 0"))
+            break;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int elapsed = (int)((now.tv_sec - start.tv_sec) * 1000 +
+                            (now.tv_nsec - start.tv_nsec) / 1000000);
+        if (elapsed >= timeout_ms)
+            break;
+
+        struct pollfd pfd = { .fd = fd, .events = POLLPRI };
+        poll(&pfd, 1, timeout_ms - elapsed);
+    }
+    close(fd);
+}
+
+void sandbox_cgroup_remove(SandboxCgroup *cg)
+{
+    if (cg->dir_fd >= 0)
+    {
+        close(cg->dir_fd);
+        cg->dir_fd = -1;
+    }
+    if (!cg->path[0])
+        return;
+
+    wait_cgroup_empty(cg->path, CGROUP_EMPTY_TIMEOUT_MS);
+    if (rmdir(cg->path) != 0 && errno != ENOENT)
+        printf("[!] Warning: Could not remove cgroup %s (%s)\n", cg->path, strerror(errno));
+    cg->path[0] = '\0';
+}
+
+int gc_sandbox_cgroups(void)
+{
+    char mnt[64];
+    char base[128];
+    char path[640];
+    int removed = 0;
+
+    if (cgroup2_mount(mnt, sizeof(mnt)) != 0)
+        return 0;
+
+    snprintf(base, sizeof(base), "%s/%s", mnt, SANDBOX_CGROUP_NAME);
+    DIR *d = opendir(base);
+    if (!d)
+        return 0;
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+        char *end;
+        long owner = strtol(ent->d_name, &end, 10);
+
+        /* Named after the ai-run that created it; skip live sessions */
+        if (*end != '\0' || owner <= 0 || kill((pid_t)owner, 0) == 0 || errno != ESRCH)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", base, ent->d_name);
+        kill_cgroup_path(path);
+        wait_cgroup_empty(path, CGROUP_EMPTY_TIMEOUT_MS);
+        if (rmdir(path) == 0)
+            removed++;
+    }
+    closedir(d);
+    return removed;
+}
@@ -0,0 +1,53 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Parent of all per-session cgroups (root mode), under the cgroup2 mount */
+#define SANDBOX_CGROUP_NAME "ai-sandbox"
+
+/* One session's cgroup: <cgroup2 mount>/ai-sandbox/<ai-run pid> */
+typedef struct {
+    char path[512];     /* "" = no cgroup */
+    int dir_fd;         /* for CLONE_INTO_CGROUP, -1 if unused */
+} SandboxCgroup;
+
+/* <cgroup2 mount>/SANDBOX_CGROUP_NAME, whether or not it exists yet */
+int sandbox_cgroup_parent(char *out, size_t len);
+
+/*
+ * Create the session cgroup. Root: under SANDBOX_CGROUP_NAME.
+ * Rootless: below our own cgroup, which only works if it was
+ * delegated to us (systemd user services are). Returns 0 or -1.
+ */
+int sandbox_cgroup_create(SandboxCgroup *cg, int rootless);
+
+/* Move a process in (fallback when it wasn't cloned straight into it) */
+int sandbox_cgroup_add(const SandboxCgroup *cg, pid_t pid);
+
+/* SIGKILL everything in the cgroup with one write (cgroup.kill) */
+int sandbox_cgroup_kill(const SandboxCgroup *cg);
+
+/* Send sig to every process in it now (0 = just count); how many, or -1 */
+int sandbox_cgroup_signal(const SandboxCgroup *cg, int sig);
+
+/* Freeze (1) or thaw (0) the whole tree (cgroup.freeze); the freeze
+ * completes asynchronously, sandbox_cgroup_frozen says when it has */
+int sandbox_cgroup_freeze(const SandboxCgroup *cg, int frozen);
+int sandbox_cgroup_frozen(const SandboxCgroup *cg);
+
+/* CPU time the cgroup has used (cpu.stat usage_usec), -1 if unknown */
+long long sandbox_cgroup_cpu_usec(const SandboxCgroup *cg);
+
+/* Reclaim the cgroup's memory (memory.reclaim); bytes freed, -1 if
+ * the memory controller isn't enabled for it */
+long long sandbox_cgroup_reclaim(const SandboxCgroup *cg);
+
+/* Wait (bounded) for the cgroup to empty, then remove it */
+void sandbox_cgroup_remove(SandboxCgroup *cg);
+
+/* Remove session cgroups whose ai-run is gone; returns how many */
+int gc_sandbox_cgroups(void);
+
+#endif
@@ -0,0 +1,763 @@
+/*
+ * dns.c - Per-session caching DNS stub on the host end of the veth
+ *
+ * WHY: Every sandbox used to bind one shared /tmp/sandbox_resolv.conf
+ * naming 8.8.8.8, so concurrent sessions raced on the file, and every
+ * lookup went out through NAT to the internet - pip alone resolves the
+ * same index host dozens of times per install.
+ *
+ * HOW IT WORKS:
+ * 1. Before the clone, ai-run binds UDP and TCP port 53 on the host
+ *    veth address (IP_FREEBIND: the veth doesn't exist yet), and the
+ *    sandbox gets a private resolv.conf naming that address
+ * 2. A forked helper answers UDP queries from a fixed-size cache keyed
+ *    by the question and the RD, CD and EDNS DO bits. A hit is the
+ *    stored answer with the client's ID and spelling of the name, and
+ *    TTLs aged by the time it has spent in the cache
+ * 3. Misses go to dns_upstream, each from its own connected socket,
+ *    so the source port is random and only the upstream can answer.
+ *    Identical queries in flight share one upstream request
+ * 4. Answers are kept for their smallest TTL (at most CACHE_MAX_TTL).
+ *    Truncated answers, SERVFAIL and the like are passed on but not
+ *    kept. TCP (clients retrying a truncated answer) is relayed as is
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include "dns.h"
+#include "reload.h"
+
+#ifndef SYS_close_range
+#define SYS_close_range 436
+#endif
+
+#define DNS_PORT        53
+#define DNS_HEADER_LEN  12
+#define DNS_MSG_MAX     4096
+#define DNS_NAME_MAX    255
+#define DNS_TYPE_OPT    41
+
+/* Flags byte, wire-format name in lower case, type and class */
+#define DNS_KEY_MAX     (1 + DNS_NAME_MAX + 4)
+#define KEY_RD          0x01
+#define KEY_CD          0x02
+#define KEY_EDNS        0x04
+#define KEY_DO          0x08
+
+#define CACHE_SLOTS     1024
+#define CACHE_MAX_TTL   3600
+#define MAX_PENDING     128
+#define MAX_WAITERS     8
+#define MAX_TCP_RELAYS  32
+#define UPSTREAM_TIMEOUT_MS 3000
+#define TCP_IDLE_TIMEOUT_MS 10000
+
+typedef struct {
+    unsigned char key[DNS_KEY_MAX];
+    int key_len;
+    unsigned char *msg;         /* NULL = empty slot */
+    int len;
+    long stored;                /* monotonic seconds */
+    long expires;
+} CacheEntry;
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    unsigned char id[2];        /* the client's query ID */
+} Waiter;
+
+/* A query sent upstream and the clients waiting for its answer */
+typedef struct {
+    int fd;                     /* connected to the upstream, -1 = free */
+    unsigned char key[DNS_KEY_MAX];
+    int key_len;
+    unsigned char id[2];        /* the ID we sent */
+    long deadline;              /* monotonic ms */
+    Waiter waiters[MAX_WAITERS];
+    int waiter_count;
+} Pending;
+
+static CacheEntry cache[CACHE_SLOTS];
+static Pending pending[MAX_PENDING];
+static struct sockaddr_storage upstream;
+static socklen_t upstream_len;
+static int tcp_relays;
+static volatile sig_atomic_t stopping;
+
+static unsigned long stat_queries, stat_hits, stat_forwarded, stat_failed;
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static unsigned get16(const unsigned char *p)
+{
+    return (unsigned)p[0] << 8 | p[1];
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* ---------- Messages ---------- */
+
+/* Offset just past the (possibly compressed) name at off, or -1 */
+static int skip_name(const unsigned char *msg, int len, int off)
+{
+    while (off < len)
+    {
+        unsigned char l = msg[off];
+        if ((l & 0xC0) == 0xC0)
+            return off + 2 <= len ? off + 2 : -1;
+        if (l & 0xC0)
+            return -1;
+        off += 1 + l;
+        if (l == 0)
+            return off;
+    }
+    return -1;
+}
+
+/*
+ * The single question of msg as name (lower case), type and class into
+ * out; *qend is set just past it. Returns its length, or -1.
+ */
+static int parse_question(const unsigned char *msg, int len, unsigned char *out, int *qend)
+{
+    int off = DNS_HEADER_LEN;
+    int k = 0;
+
+    if (len < DNS_HEADER_LEN || get16(msg + 4) != 1)
+        return -1;
+
+    for (;;)
+    {
+        /* Nothing in a question is compressed */
+        if (off >= len || (msg[off] & 0xC0))
+            return -1;
+        int l = msg[off];
+        if (off + 1 + l > len || k + 1 + l > DNS_NAME_MAX)
+            return -1;
+        out[k++] = (unsigned char)l;
+        for (int i = 1; i <= l; i++)
+        {
+            unsigned char c = msg[off + i];
+            out[k++] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+        }
+        off += 1 + l;
+        if (l == 0)
+            break;
+    }
+
+    if (off + 4 > len)
+        return -1;
+    memcpy(out + k, msg + off, 4);
+    *qend = off + 4;
+    return k + 4;
+}
+
+/*
+ * Cache key of a standard query for one name, or -1 for anything else
+ * (answers, other opcodes, garbage). *qend as for parse_question.
+ */
+static int query_key(const unsigned char *msg, int len, unsigned char *key, int *qend)
+{
+    if (len < DNS_HEADER_LEN || (msg[2] & 0x80) || (msg[2] & 0x78))
+        return -1;
+
+    int k = parse_question(msg, len, key + 1, qend);
+    if (k < 0)
+        return -1;
+    key[0] = ((msg[2] & 0x01) ? KEY_RD : 0) | ((msg[3] & 0x10) ? KEY_CD : 0);
+
+    /* EDNS: an OPT record (the DO bit is in its TTL field) */
+    int count = get16(msg + 6) + get16(msg + 8) + get16(msg + 10);
+    int off = *qend;
+    for (int i = 0; i < count; i++)
+    {
+        off = skip_name(msg, len, off);
+        if (off < 0 || off + 10 > len)
+            return -1;
+        if (get16(msg + off) == DNS_TYPE_OPT)
+        {
+            key[0] |= KEY_EDNS;
+            if (msg[off + 6] & 0x80)
+                key[0] |= KEY_DO;
+        }
+        off += 10 + get16(msg + off + 8);
+        if (off > len)
+            return -1;
+    }
+    return k + 1;
+}
+
+/*
+ * Walk the records after the question: take age seconds off every TTL
+ * and note the smallest left (the OPT record's TTL field holds flags,
+ * not a TTL). Returns the number of records seen, or -1 if malformed.
+ */
+static int age_records(unsigned char *msg, int len, int qend, long age, long *min_ttl)
+{
+    int count = get16(msg + 6) + get16(msg + 8) + get16(msg + 10);
+    int records = 0;
+    int off = qend;
+
+    *min_ttl = CACHE_MAX_TTL;
+    for (int i = 0; i < count; i++)
+    {
+        off = skip_name(msg, len, off);
+        if (off < 0 || off + 10 > len)
+            return -1;
+        if (get16(msg + off) != DNS_TYPE_OPT)
+        {
+            unsigned char *t = msg + off + 4;
+            unsigned long ttl = (unsigned long)t[0] << 24 | t[1] << 16 | t[2] << 8 | t[3];
+
+            /* RFC 2181: a TTL with the top bit set counts as zero */
+            long left = ttl > 0x7fffffffUL ? 0 : (long)ttl - age;
+            if (left < 0)
+                left = 0;
+            if (age > 0)
+            {
+                t[0] = (unsigned char)(left >> 24);
+                t[1] = (unsigned char)(left >> 16);
+                t[2] = (unsigned char)(left >> 8);
+                t[3] = (unsigned char)left;
+            }
+            if (left < *min_ttl)
+                *min_ttl = left;
+            records++;
+        }
+        off += 10 + get16(msg + off + 8);
+        if (off > len)
+            return -1;
+    }
+    return records;
+}
+
+/* ---------- Cache ---------- */
+
+static CacheEntry *cache_slot(const unsigned char *key, int key_len)
+{
+    unsigned h = 2166136261u;
+
+    for (int i = 0; i < key_len; i++)
+    {
+        h ^= key[i];
+        h *= 16777619u;
+    }
+    return &cache[h % CACHE_SLOTS];
+}
+
+/*
+ * Build the answer to query from the cache into reply. Returns its
+ * length, or 0 on a miss.
+ */
+static int cache_lookup(const unsigned char *query, int qend, const unsigned char *key, int key_len,
+                        unsigned char *reply)
+{
+    CacheEntry *e = cache_slot(key, key_len);
+    long now = now_ms() / 1000;
+    long min_ttl;
+
+    if (!e->msg || e->key_len != key_len || memcmp(e->key, key, key_len) != 0 || now >= e->expires)
+        return 0;
+
+    /* Same question, so the same length: the client's ID and spelling */
+    memcpy(reply, e->msg, e->len);
+    memcpy(reply, query, 2);
+    memcpy(reply + DNS_HEADER_LEN, query + DNS_HEADER_LEN, qend - DNS_HEADER_LEN);
+    age_records(reply, e->len, qend, now - e->stored, &min_ttl);
+    return e->len;
+}
+
+static void cache_store(const unsigned char *key, int key_len, const unsigned char *msg, int len,
+                        long ttl)
+{
+    CacheEntry *e = cache_slot(key, key_len);
+    unsigned char *copy = malloc(len);
+
+    if (!copy)
+        return;
+    memcpy(copy, msg, len);
+
+    /* One entry per slot: the newest answer wins */
+    free(e->msg);
+    memcpy(e->key, key, key_len);
+    e->key_len = key_len;
+    e->msg = copy;
+    e->len = len;
+    e->stored = now_ms() / 1000;
+    e->expires = e->stored + ttl;
+}
+
+/* ---------- Upstream ---------- */
+
+static void finish_pending(Pending *p)
+{
+    close(p->fd);
+    p->fd = -1;
+}
+
+static void add_waiter(Pending *p, const unsigned char *query, const struct sockaddr_storage *from,
+                       socklen_t from_len)
+{
+    /* Beyond MAX_WAITERS the client just retries */
+    if (p->waiter_count == MAX_WAITERS)
+        return;
+
+    Waiter *w = &p->waiters[p->waiter_count++];
+    w->addr = *from;
+    w->addr_len = from_len;
+    memcpy(w->id, query, 2);
+}
+
+static void forward(unsigned char *query, int len, const unsigned char *key, int key_len,
+                    const struct sockaddr_storage *from, socklen_t from_len)
+{
+    Pending *p = NULL;
+
+    for (int i = 0; i < MAX_PENDING; i++)
+    {
+        Pending *q = &pending[i];
+        if (q->fd >= 0 && q->key_len == key_len && memcmp(q->key, key, key_len) == 0)
+        {
+            /* Already on its way */
+            add_waiter(q, query, from, from_len);
+            return;
+        }
+        if (q->fd < 0 && !p)
+            p = q;
+    }
+    if (!p)
+    {
+        stat_failed++;
+        return;
+    }
+
+    int fd = socket(upstream.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        stat_failed++;
+        return;
+    }
+    if (connect(fd, (struct sockaddr *)&upstream, upstream_len) != 0)
+    {
+        close(fd);
+        stat_failed++;
+        return;
+    }
+
+    p->fd = fd;
+    p->waiter_count = 0;
+    add_waiter(p, query, from, from_len);
+    memcpy(p->key, key, key_len);
+    p->key_len = key_len;
+    if (getrandom(p->id, sizeof(p->id), 0) != (ssize_t)sizeof(p->id))
+    {
+        p->id[0] = (unsigned char)rand();
+        p->id[1] = (unsigned char)rand();
+    }
+    p->deadline = now_ms() + UPSTREAM_TIMEOUT_MS;
+
+    memcpy(query, p->id, 2);
+    if (send(fd, query, len, 0) != len)
+    {
+        finish_pending(p);
+        stat_failed++;
+        return;
+    }
+    stat_forwarded++;
+}
+
+static void handle_answer(int listen_fd, Pending *p)
+{
+    unsigned char msg[DNS_MSG_MAX];
+    unsigned char question[DNS_KEY_MAX];
+    int qend = 0;
+
+    ssize_t len = recv(p->fd, msg, sizeof(msg), 0);
+    if (len < 0)
+    {
+        /* ICMP unreachable and the like: let the clients time out */
+        if (errno != EAGAIN && errno != EINTR)
+        {
+            finish_pending(p);
+            stat_failed++;
+        }
+        return;
+    }
+
+    /* Anything but the answer to our question is ignored */
+    if (len < DNS_HEADER_LEN || !(msg[2] & 0x80) || memcmp(msg, p->id, 2) != 0)
+        return;
+    int has_question = get16(msg + 4) != 0;
+    if (has_question &&
+        (parse_question(msg, len, question, &qend) != p->key_len - 1 ||
+         memcmp(question, p->key + 1, p->key_len - 1) != 0))
+        return;
+
+    int rcode = msg[3] & 0x0F;
+    int truncated = msg[2] & 0x02;
+    if (has_question && !truncated && (rcode == 0 || rcode == 3))
+    {
+        /* NOERROR or NXDOMAIN; a negative answer is kept for its SOA's TTL */
+        long ttl;
+        if (age_records(msg, len, qend, 0, &ttl) > 0 && ttl > 0)
+            cache_store(p->key, p->key_len, msg, len, ttl);
+    }
+
+    for (int i = 0; i < p->waiter_count; i++)
+    {
+        Waiter *w = &p->waiters[i];
+        memcpy(msg, w->id, 2);
+        sendto(listen_fd, msg, len, 0, (struct sockaddr *)&w->addr, w->addr_len);
+    }
+    finish_pending(p);
+}
+
+/* ---------- Sandbox side ---------- */
+
+static void handle_queries(int fd)
+{
+    unsigned char msg[DNS_MSG_MAX];
+    unsigned char reply[DNS_MSG_MAX];
+    unsigned char key[DNS_KEY_MAX];
+
+    /* Drain a burst, then give upstream answers a turn */
+    for (int burst = 0; burst < 64; burst++)
+    {
+        struct sockaddr_storage from;
+        socklen_t from_len = sizeof(from);
+        int qend;
+
+        ssize_t len = recvfrom(fd, msg, sizeof(msg), 0, (struct sockaddr *)&from, &from_len);
+        if (len < 0)
+            return;
+
+        int key_len = query_key(msg, len, key, &qend);
+        if (key_len < 0)
+            continue;
+        stat_queries++;
+
+        int n = cache_lookup(msg, qend, key, key_len, reply);
+        if (n > 0)
+        {
+            stat_hits++;
+            sendto(fd, reply, n, 0, (struct sockaddr *)&from, from_len);
+            continue;
+        }
+        forward(msg, len, key, key_len, &from, from_len);
+    }
+}
+
+static void *relay_tcp(void *arg)
+{
+    int client = (int)(intptr_t)arg;
+    char buf[DNS_MSG_MAX];
+
+    int up = socket(upstream.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (up >= 0)
+    {
+        /* Also bounds connect() */
+        struct timeval tv = { UPSTREAM_TIMEOUT_MS / 1000, 0 };
+        setsockopt(up, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        if (connect(up, (struct sockaddr *)&upstream, upstream_len) == 0)
+        {
+            struct pollfd pfds[2] = {
+                { .fd = client, .events = POLLIN },
+                { .fd = up, .events = POLLIN },
+            };
+            while (poll(pfds, 2, TCP_IDLE_TIMEOUT_MS) > 0)
+            {
+                int from = pfds[0].revents ? 0 : 1;
+                ssize_t n = read(pfds[from].fd, buf, sizeof(buf));
+                if (n <= 0 || write_all(pfds[!from].fd, buf, n) != 0)
+                    break;
+            }
+        }
+        close(up);
+    }
+
+    close(client);
+    __atomic_fetch_sub(&tcp_relays, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void accept_tcp(int listen_fd)
+{
+    int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client < 0)
+        return;
+
+    if (__atomic_fetch_add(&tcp_relays, 1, __ATOMIC_RELAXED) >= MAX_TCP_RELAYS)
+    {
+        __atomic_fetch_sub(&tcp_relays, 1, __ATOMIC_RELAXED);
+        close(client);
+        return;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, relay_tcp, (void *)(intptr_t)client) != 0)
+    {
+        __atomic_fetch_sub(&tcp_relays, 1, __ATOMIC_RELAXED);
+        close(client);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/* ---------- Helper process ---------- */
+
+static void on_sigterm(int sig)
+{
+    (void)sig;
+    stopping = 1;
+}
+
+static void stub_main(int udp_fd, int tcp_fd, pid_t session_pid, pid_t owner)
+{
+    struct pollfd pfds[2 + MAX_PENDING];
+    Pending *polled[MAX_PENDING];
+    char log_path[256];
+
+    /* The sandbox shell owns the terminal: log to the session directory */
+    snprintf(log_path, sizeof(log_path), "%s/%d/dns.log", SESSION_RUN_DIR, session_pid);
+    int log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0)
+        log_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    dup2(log_fd, STDOUT_FILENO);
+    dup2(log_fd, STDERR_FILENO);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGTERM, on_sigterm);
+    for (int i = 0; i < MAX_PENDING; i++)
+        pending[i].fd = -1;
+
+    /* Forked from a startup thread: watch ai-run itself, like the proxy */
+    while (!stopping && getppid() == owner)
+    {
+        long now = now_ms();
+        int timeout = 1000;
+        int n = 2;
+
+        pfds[0] = (struct pollfd){ .fd = udp_fd, .events = POLLIN };
+        pfds[1] = (struct pollfd){ .fd = tcp_fd, .events = POLLIN };
+        for (int i = 0; i < MAX_PENDING; i++)
+        {
+            Pending *p = &pending[i];
+            if (p->fd < 0)
+                continue;
+            if (now >= p->deadline)
+            {
+                finish_pending(p);
+                stat_failed++;
+                continue;
+            }
+            if (p->deadline - now < timeout)
+                timeout = (int)(p->deadline - now);
+            polled[n - 2] = p;
+            pfds[n++] = (struct pollfd){ .fd = p->fd, .events = POLLIN };
+        }
+
+        if (poll(pfds, n, timeout) <= 0)
+            continue;
+
+        for (int i = 2; i < n; i++)
+        {
+            if (pfds[i].revents)
+                handle_answer(udp_fd, polled[i - 2]);
+        }
+        if (pfds[0].revents & POLLIN)
+            handle_queries(udp_fd);
+        if (pfds[1].revents & POLLIN)
+            accept_tcp(tcp_fd);
+    }
+
+    printf("[+] DNS: %lu queries, %lu from cache, %lu forwarded, %lu failed\n",
+           stat_queries, stat_hits, stat_forwarded, stat_failed);
+}
+
+static int bind_stub(int type, const struct sockaddr_in *addr)
+{
+    int one = 1;
+
+    int fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    /* Sessions sharing a network namespace also share its host address */
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_IP, IP_FREEBIND, &one, sizeof(one));
+
+    if (bind(fd, (const struct sockaddr *)addr, sizeof(*addr)) == -1 ||
+        (type == SOCK_STREAM && listen(fd, 64) == -1))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int dns_stub_listen(const char *listen_ip, int fds[2])
+{
+    struct sockaddr_in addr;
+
+    fds[0] = fds[1] = -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(DNS_PORT);
+    if (inet_pton(AF_INET, listen_ip, &addr.sin_addr) != 1)
+        return -1;
+
+    fds[0] = bind_stub(SOCK_DGRAM, &addr);
+    if (fds[0] >= 0)
+        fds[1] = bind_stub(SOCK_STREAM, &addr);
+    if (fds[1] < 0)
+    {
+        fprintf(stderr, "[!] DNS stub cannot listen on %s:%d: %s\n",
+                listen_ip, DNS_PORT, strerror(errno));
+        if (fds[0] >= 0)
+            close(fds[0]);
+        fds[0] = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static int upstream_sockaddr(const Policy *policy, struct sockaddr_storage *ss, socklen_t *len)
+{
+    const char *spec = policy->dns_upstream[0] ? policy->dns_upstream : DNS_DEFAULT_UPSTREAM;
+    unsigned char addr[16];
+    int family, port;
+
+    if (parse_dns_server(spec, &family, addr, &port) != 0)
+        return -1;
+
+    memset(ss, 0, sizeof(*ss));
+    if (family == AF_INET)
+    {
+        struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        memcpy(&sin->sin_addr, addr, 4);
+        *len = sizeof(*sin);
+    }
+    else
+    {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        memcpy(&sin6->sin6_addr, addr, 16);
+        *len = sizeof(*sin6);
+    }
+    return 0;
+}
+
+pid_t start_dns_stub(int fds[2], const char *listen_ip, const Policy *policy, pid_t session_pid)
+{
+    pid_t pid = -1;
+
+    if (upstream_sockaddr(policy, &upstream, &upstream_len) != 0)
+    {
+        fprintf(stderr, "[!] Invalid dns_upstream: %s\n", policy->dns_upstream);
+    }
+    else
+    {
+        fflush(NULL);
+        pid = fork();
+        if (pid < 0)
+            perror("fork(dns)");
+    }
+
+    if (pid == 0)
+    {
+        /* Don't hold the session's locks or pidfds open */
+        pid_t owner = getppid();
+        dup2(fds[0], 3);
+        dup2(fds[1], 4);
+        if (syscall(SYS_close_range, 5, ~0U, 0) != 0)
+        {
+            for (int i = 5; i < 1024; i++)
+                close(i);
+        }
+
+        stub_main(3, 4, session_pid, owner);
+        _exit(0);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    fds[0] = fds[1] = -1;
+    if (pid > 0)
+    {
+        printf("[+] DNS cache on %s:%d (upstream %s)\n", listen_ip, DNS_PORT,
+               policy->dns_upstream[0] ? policy->dns_upstream : DNS_DEFAULT_UPSTREAM);
+    }
+    return pid;
+}
+
+void stop_dns_stub(pid_t stub_pid)
+{
+    if (stub_pid <= 0)
+        return;
+
+    kill(stub_pid, SIGTERM);
+    waitpid(stub_pid, NULL, 0);
+}
+
+void dns_upstream_address(const Policy *policy, char *out, size_t out_len)
+{
+    const char *spec = policy->dns_upstream[0] ? policy->dns_upstream : DNS_DEFAULT_UPSTREAM;
+    unsigned char addr[16];
+    int family, port;
+
+    /* resolv.conf has no port: only the address carries over */
+    if (parse_dns_server(spec, &family, addr, &port) != 0 ||
+        !inet_ntop(family, addr, out, (socklen_t)out_len))
+    {
+        snprintf(out, out_len, "%s", DNS_DEFAULT_UPSTREAM);
+        return;
+    }
+    if (port != 53)
+        fprintf(stderr, "[!] Warning: DNS stub unavailable and resolv.conf can't name port %d - "
+                        "the sandbox asks %s on port 53 instead of dns_upstream %s\n",
+                port, out, spec);
+}
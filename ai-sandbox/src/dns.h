@@ -0,0 +1,26 @@
+#ifndef DNS_H
+#define DNS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "policy.h"
+
+/*
+ * Bind the session's DNS stub to UDP and TCP port 53 on listen_ip,
+ * which need not be configured yet (the veth comes later). fds[0] is
+ * UDP, fds[1] TCP. Returns 0, or -1 with both left at -1.
+ */
+int dns_stub_listen(const char *listen_ip, int fds[2]);
+
+/*
+ * Serve the sandbox from a forked helper: answers from the cache,
+ * misses forwarded to the policy's dns_upstream. The caller's copies
+ * of fds are closed. Returns the helper's pid, or -1.
+ */
+pid_t start_dns_stub(int fds[2], const char *listen_ip, const Policy *policy, pid_t session_pid);
+void stop_dns_stub(pid_t stub_pid);
+
+/* The policy's upstream address, for a resolv.conf without the stub */
+void dns_upstream_address(const Policy *policy, char *out, size_t out_len);
+
+#endif
@@ -0,0 +1,405 @@
+/*
+ * expose.c - Reach servers inside the sandbox from the host (expose_ports)
+ *
+ * WHY: Agents start dev servers inside the sandbox, but nothing on the
+ * host can reach them: the sandbox firewall drops inbound traffic and
+ * the host only NATs what leaves. Most dev servers also bind only
+ * 127.0.0.1, which no DNAT on the veth could reach anyway.
+ *
+ * HOW IT WORKS:
+ * 1. ai-run listens on 127.0.0.1:<host port> for each expose_ports
+ *    entry, so only the host itself can connect
+ * 2. A forked helper enters the sandbox's network namespace (rootless:
+ *    its user namespace first). The listening sockets stay in the
+ *    host's; every socket created from then on is the sandbox's
+ * 3. Each accepted connection is paired with a connect() to
+ *    127.0.0.1:<sandbox port> inside the sandbox. The firewall always
+ *    allows loopback, so it needs no inbound rule, and "network: none"
+ *    sandboxes work too
+ * 4. One thread per connection moves the bytes with splice() through
+ *    one pipe per direction: socket -> pipe -> socket, without passing
+ *    through user memory
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include "expose.h"
+#include "reload.h"
+
+#ifndef SYS_close_range
+#define SYS_close_range 436
+#endif
+
+/* The default pipe capacity; larger pipes measured no faster (make bench) */
+#define RELAY_PIPE_SIZE (64 << 10)
+
+typedef struct {
+    int client;
+    int port;                   /* in the sandbox */
+} Conn;
+
+/* One direction of a relayed connection */
+typedef struct {
+    int from;
+    int to;
+    int pipe[2];
+    size_t queued;              /* read from 'from', not yet written to 'to' */
+    int eof;                    /* 'from' is done sending */
+    int shut;                   /* ...and 'to' has been told, once drained */
+    int full;                   /* pipe took nothing from a readable 'from' */
+} Flow;
+
+/* ---------- Relay ---------- */
+
+/*
+ * Move what is ready: top the pipe up from 'from', then drain as much
+ * of it as 'to' takes. readable: poll reported POLLIN on 'from'.
+ * Returns -1 if either socket failed.
+ *
+ * A pipe holds a fixed number of buffers, not bytes: many small
+ * segments fill it well below RELAY_PIPE_SIZE. EAGAIN from a readable
+ * socket means exactly that, and reading stays off until a drain.
+ */
+static int flow_step(Flow *f, int readable)
+{
+    if (!f->eof && !f->full && f->queued < RELAY_PIPE_SIZE)
+    {
+        ssize_t n = splice(f->from, NULL, f->pipe[1], NULL, RELAY_PIPE_SIZE - f->queued,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0)
+        {
+            f->queued += n;
+        }
+        else if (n == 0)
+        {
+            f->eof = 1;
+        }
+        else if (errno == EAGAIN && readable && f->queued > 0)
+        {
+            f->full = 1;
+        }
+        else if (errno != EAGAIN && errno != EINTR)
+        {
+            return -1;
+        }
+    }
+
+    while (f->queued > 0)
+    {
+        ssize_t n = splice(f->pipe[0], NULL, f->to, NULL, f->queued,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0)
+        {
+            f->queued -= n;
+            f->full = 0;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            break;
+        else
+            return -1;
+    }
+
+    /* Pass the half-close on after the last byte */
+    if (f->eof && f->queued == 0 && !f->shut)
+    {
+        shutdown(f->to, SHUT_WR);
+        f->shut = 1;
+    }
+    return 0;
+}
+
+void splice_relay(int a, int b)
+{
+    Flow flows[2] = {
+        { .from = a, .to = b, .pipe = { -1, -1 } },
+        { .from = b, .to = a, .pipe = { -1, -1 } },
+    };
+    struct pollfd pfds[2] = { { .fd = a }, { .fd = b } };
+
+    if (pipe2(flows[0].pipe, O_CLOEXEC) != 0 || pipe2(flows[1].pipe, O_CLOEXEC) != 0)
+        goto out;
+    fcntl(a, F_SETFL, fcntl(a, F_GETFL) | O_NONBLOCK);
+    fcntl(b, F_SETFL, fcntl(b, F_GETFL) | O_NONBLOCK);
+
+    for (;;)
+    {
+        if (flow_step(&flows[0], pfds[0].revents & POLLIN) != 0 ||
+            flow_step(&flows[1], pfds[1].revents & POLLIN) != 0)
+            break;
+        if (flows[0].shut && flows[1].shut)
+            break;
+
+        /* Wait to read while the pipe has room, to write while it has data */
+        pfds[0] = (struct pollfd){ .fd = a };
+        pfds[1] = (struct pollfd){ .fd = b };
+        for (int i = 0; i < 2; i++)
+        {
+            Flow *f = &flows[i];
+            if (f->queued)
+                pfds[!i].events |= POLLOUT;
+            if (!f->eof && !f->full && f->queued < RELAY_PIPE_SIZE)
+                pfds[i].events |= POLLIN;
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            /* A hung-up socket we don't wait on would wake us for nothing */
+            if (!pfds[i].events)
+                pfds[i].fd = -1;
+        }
+        if (poll(pfds, 2, -1) < 0 && errno != EINTR)
+            break;
+    }
+
+out:
+    for (int i = 0; i < 2; i++)
+    {
+        if (flows[i].pipe[0] >= 0)
+            close(flows[i].pipe[0]);
+        if (flows[i].pipe[1] >= 0)
+            close(flows[i].pipe[1]);
+    }
+}
+
+/* ---------- Helper process ---------- */
+
+static void *handle_conn(void *arg)
+{
+    Conn *c = arg;
+    struct sockaddr_in sin;
+    int one = 1;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(c->port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    /* Created after setns(), so this one is the sandbox's */
+    int up = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (up >= 0 && connect(up, (struct sockaddr *)&sin, sizeof(sin)) == 0)
+    {
+        /* Don't let Nagle add a delay the client didn't ask for */
+        setsockopt(c->client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(up, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        splice_relay(c->client, up);
+    }
+    else
+    {
+        printf("[!] Sandbox port %d: %s\n", c->port, strerror(errno));
+    }
+
+    if (up >= 0)
+        close(up);
+    close(c->client);
+    free(c);
+    return NULL;
+}
+
+static void exposer_main(const int *listeners, const int *ports, int count, int user_fd, int net_fd,
+                         pid_t session_pid, pid_t owner)
+{
+    struct pollfd pfds[MAX_EXPOSED_PORTS];
+    char log_path[256];
+
+    /* The sandbox shell owns the terminal: log to the session directory */
+    snprintf(log_path, sizeof(log_path), "%s/%d/expose.log", SESSION_RUN_DIR, session_pid);
+    int log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0)
+        log_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    dup2(log_fd, STDOUT_FILENO);
+    dup2(log_fd, STDERR_FILENO);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((user_fd >= 0 && setns(user_fd, CLONE_NEWUSER) != 0) || setns(net_fd, CLONE_NEWNET) != 0)
+    {
+        printf("[!] Cannot enter the sandbox network namespace: %s\n", strerror(errno));
+        return;
+    }
+    if (user_fd >= 0)
+        close(user_fd);
+    close(net_fd);
+
+    /* Forked from a startup thread: watch ai-run itself, like the proxy */
+    while (getppid() == owner)
+    {
+        for (int i = 0; i < count; i++)
+            pfds[i] = (struct pollfd){ .fd = listeners[i], .events = POLLIN };
+        if (poll(pfds, count, 1000) <= 0)
+            continue;
+
+        for (int i = 0; i < count; i++)
+        {
+            if (!(pfds[i].revents & POLLIN))
+                continue;
+
+            int client = accept4(listeners[i], NULL, NULL, SOCK_CLOEXEC);
+            if (client < 0)
+                continue;
+            Conn *c = malloc(sizeof(*c));
+            if (!c)
+            {
+                close(client);
+                continue;
+            }
+            c->client = client;
+            c->port = ports[i];
+
+            pthread_t thread;
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            if (pthread_create(&thread, &attr, handle_conn, c) != 0)
+            {
+                close(client);
+                free(c);
+            }
+            pthread_attr_destroy(&attr);
+        }
+    }
+}
+
+static int listen_loopback(int port)
+{
+    struct sockaddr_in sin;
+    int one = 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 || listen(fd, 128) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+pid_t start_port_exposer(const Policy *policy, pid_t sandbox_pid, int netns_fd, int rootless)
+{
+    int listeners[MAX_EXPOSED_PORTS];
+    int ports[MAX_EXPOSED_PORTS];
+    int host_ports[MAX_EXPOSED_PORTS];
+    int count = 0;
+    char path[64];
+
+    for (int i = 0; i < policy->expose_count; i++)
+    {
+        int fd = listen_loopback(policy->expose_ports[i].host);
+        if (fd < 0)
+        {
+            fprintf(stderr, "[!] Cannot expose 127.0.0.1:%d: %s\n",
+                    policy->expose_ports[i].host, strerror(errno));
+            continue;
+        }
+        listeners[count] = fd;
+        ports[count] = policy->expose_ports[i].sandbox;
+        host_ports[count] = policy->expose_ports[i].host;
+        count++;
+    }
+    if (count == 0)
+        return 0;
+
+    /* The helper joins these; a shared namespace is pinned, not the child's yet */
+    int user_fd = -1;
+    int net_fd;
+    if (netns_fd >= 0)
+    {
+        net_fd = fcntl(netns_fd, F_DUPFD_CLOEXEC, 0);
+    }
+    else
+    {
+        snprintf(path, sizeof(path), "/proc/%d/ns/net", sandbox_pid);
+        net_fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (rootless)
+    {
+        snprintf(path, sizeof(path), "/proc/%d/ns/user", sandbox_pid);
+        user_fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+
+    pid_t pid = -1;
+    if (net_fd < 0 || (rootless && user_fd < 0))
+    {
+        perror("open sandbox namespace");
+    }
+    else
+    {
+        fflush(NULL);
+        pid = fork();
+        if (pid < 0)
+            perror("fork(expose)");
+    }
+
+    if (pid == 0)
+    {
+        /*
+         * Don't hold the session's locks or pidfds open: park what we
+         * keep above the low fds, move it down to 3.., close the rest
+         */
+        pid_t owner = getppid();
+        int keep[MAX_EXPOSED_PORTS + 2];
+        int n = 0;
+
+        for (int i = 0; i < count; i++)
+            keep[n++] = fcntl(listeners[i], F_DUPFD, 100);
+        keep[n++] = fcntl(net_fd, F_DUPFD, 100);
+        if (user_fd >= 0)
+            keep[n++] = fcntl(user_fd, F_DUPFD, 100);
+        for (int i = 0; i < n; i++)
+            dup2(keep[i], 3 + i);
+        if (syscall(SYS_close_range, 3 + n, ~0U, 0) != 0)
+        {
+            for (int i = 3 + n; i < 1024; i++)
+                close(i);
+        }
+
+        for (int i = 0; i < count; i++)
+            listeners[i] = 3 + i;
+        exposer_main(listeners, ports, count, user_fd >= 0 ? 3 + count + 1 : -1, 3 + count,
+                     sandbox_pid, owner);
+        _exit(0);
+    }
+
+    for (int i = 0; i < count; i++)
+        close(listeners[i]);
+    if (net_fd >= 0)
+        close(net_fd);
+    if (user_fd >= 0)
+        close(user_fd);
+    if (pid < 0)
+        return -1;
+
+    for (int i = 0; i < count; i++)
+        printf("[+] Exposed 127.0.0.1:%d -> sandbox port %d\n", host_ports[i], ports[i]);
+    return pid;
+}
+
+void stop_port_exposer(pid_t exposer_pid)
+{
+    if (exposer_pid <= 0)
+        return;
+
+    kill(exposer_pid, SIGTERM);
+    waitpid(exposer_pid, NULL, 0);
+}
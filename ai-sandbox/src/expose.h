@@ -0,0 +1,24 @@
+#ifndef EXPOSE_H
+#define EXPOSE_H
+
+#include <sys/types.h>
+#include "policy.h"
+
+/*
+ * Listen on 127.0.0.1:<host> for every expose_ports entry and relay
+ * connections to 127.0.0.1:<sandbox> from a forked helper inside the
+ * sandbox's network namespace: netns_fd if >= 0 (a pinned, shared
+ * namespace), otherwise that of sandbox_pid. Rootless, the helper
+ * enters the sandbox's user namespace first. Returns the helper's pid,
+ * 0 if no port could be exposed, or -1.
+ */
+pid_t start_port_exposer(const Policy *policy, pid_t sandbox_pid, int netns_fd, int rootless);
+void stop_port_exposer(pid_t exposer_pid);
+
+/*
+ * Copy between two connected TCP sockets with splice() until both
+ * directions are finished or one fails. Closes neither socket.
+ */
+void splice_relay(int a, int b);
+
+#endif
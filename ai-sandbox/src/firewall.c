@@ -3,7 +3,17 @@
 #include <string.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <stdarg.h>
+#include <unistd.h>
 #include "firewall.h"
+#include "flowlog.h"
+#include "whitelist.h"
+
+/* Chain holding the compiled whitelist; OUTPUT jumps to it */
+#define WHITELIST_CHAIN "WHITELIST"
+
+/* ipset names: "wl<pid of the process that built them>-<set>" */
+#define WL_SET_PREFIX "wl"
 
 /*
  * Execute a shell command
@@ -13,31 +23,133 @@ static int run_cmd(const char *cmd)
     return system(cmd);
 }
 
+/* iptables for IPv4 rules, ip6tables for IPv6 */
+static const char *xtables(int v6)
+{
+    return v6 ? "ip6tables" : "iptables";
+}
+
 /*
- * Resolve a domain name to IP addresses and add iptables rules
- * 
- * WHY NEEDED:
- * - iptables can only filter by IP, not domain name
- * - We resolve domain -> IP(s) at sandbox start
- * - Add rules for each resolved IP
- *
- * LIMITATION:
- * - If domain IPs change after start, won't be updated
- * - CDNs/load balancers may have many IPs
+ * Run one iptables or ip6tables command, given without the binary
  */
-static int whitelist_domain(const char *domain)
+static int run_rule(int v6, const char *fmt, ...)
 {
-    struct addrinfo hints, *res, *p;
-    char ip_str[INET6_ADDRSTRLEN];
     char cmd[512];
-    int resolved = 0;
+    va_list ap;
+
+    int len = snprintf(cmd, sizeof(cmd), "%s ", xtables(v6));
+    va_start(ap, fmt);
+    vsnprintf(cmd + len, sizeof(cmd) - len, fmt, ap);
+    va_end(ap);
+    return run_cmd(cmd);
+}
+
+/*
+ * Growable buffer for iptables-restore input
+ */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} RuleBuf;
+
+static void rb_append(RuleBuf *rb, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    int need = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (need < 0)
+        return;
+
+    if (rb->len + (size_t)need + 1 > rb->cap)
+    {
+        size_t cap = rb->cap ? rb->cap * 2 : 1024;
+        while (cap < rb->len + (size_t)need + 1)
+            cap *= 2;
+        char *data = realloc(rb->data, cap);
+        if (!data)
+            return;
+        rb->data = data;
+        rb->cap = cap;
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(rb->data + rb->len, rb->cap - rb->len, fmt, ap);
+    va_end(ap);
+    rb->len += (size_t)need;
+}
+
+/*
+ * Whitelist rules of both families, each applied in one transaction
+ */
+typedef struct {
+    RuleBuf v4;
+    RuleBuf v6;
+    int ipv6;           /* policy has IPv6; otherwise IPv6 entries are skipped */
+} RuleSet;
+
+/*
+ * Apply a batch of rules in one iptables-restore transaction
+ */
+static int iptables_restore(const RuleBuf *rb, int v6)
+{
+    char cmd[64];
+
+    snprintf(cmd, sizeof(cmd), "%s-restore --noflush", xtables(v6));
+    FILE *p = popen(cmd, "w");
+    if (!p)
+    {
+        perror("popen iptables-restore");
+        return -1;
+    }
+    if (rb->data)
+        fputs(rb->data, p);
+    return pclose(p) == 0 ? 0 : -1;
+}
+
+static void rules_begin(RuleSet *rs, int ipv6)
+{
+    memset(rs, 0, sizeof(*rs));
+    rs->ipv6 = ipv6;
+    rb_append(&rs->v4, "*filter\n");
+    rb_append(&rs->v6, "*filter\n");
+}
+
+/*
+ * Commit both batches (IPv6 only when the policy has it) and free them
+ */
+static int rules_apply(RuleSet *rs)
+{
+    int ret = 0;
+
+    rb_append(&rs->v4, "COMMIT\n");
+    rb_append(&rs->v6, "COMMIT\n");
+    if (iptables_restore(&rs->v4, 0) != 0)
+        ret = -1;
+    if (rs->ipv6 && iptables_restore(&rs->v6, 1) != 0)
+        ret = -1;
+    free(rs->v4.data);
+    free(rs->v6.data);
+    return ret;
+}
+
+/*
+ * Resolve a domain name to its IPv4 addresses, and IPv6 ones if the
+ * sandbox has IPv6
+ * Sets out->count to the number found (0 if resolution failed)
+ */
+static int resolve_domain(const char *domain, ResolvedEntry *out, int ipv6)
+{
+    struct addrinfo hints, *res, *p;
+
+    out->count = 0;
 
     memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;      /* IPv4 or IPv6 */
+    hints.ai_family = ipv6 ? AF_UNSPEC : AF_INET;
     hints.ai_socktype = SOCK_STREAM;
 
-    printf("[+] Resolving: %s\n", domain);
-
     int status = getaddrinfo(domain, NULL, &hints, &res);
     if (status != 0)
     {
@@ -45,76 +157,243 @@ static int whitelist_domain(const char *domain)
         return -1;
     }
 
-    for (p = res; p != NULL; p = p->ai_next)
+    for (p = res; p != NULL && out->count < MAX_RESOLVED_ADDRS; p = p->ai_next)
+    {
+        const void *addr = p->ai_family == AF_INET6
+                         ? (const void *)&((struct sockaddr_in6 *)p->ai_addr)->sin6_addr
+                         : (const void *)&((struct sockaddr_in *)p->ai_addr)->sin_addr;
+
+        /* getaddrinfo lists an address once per socktype */
+        inet_ntop(p->ai_family, addr, out->addrs[out->count], sizeof(out->addrs[0]));
+        int dup = 0;
+        for (int i = 0; i < out->count && !dup; i++)
+            dup = strcmp(out->addrs[i], out->addrs[out->count]) == 0;
+        if (!dup)
+            out->count++;
+    }
+
+    freeaddrinfo(res);
+    return 0;
+}
+
+/*
+ * Addresses for every domain in the whitelist
+ * 
+ * WHY NEEDED:
+ * - iptables can only filter by IP, not domain name
+ * - We resolve domain -> IP(s) at sandbox start
+ * - Rules are compiled from the resolved IPs
+ *
+ * LIMITATION:
+ * - If domain IPs change after start, won't be updated (until reload)
+ * - CDNs/load balancers may have many IPs
+ * - IPv6 results are only asked for when the sandbox has IPv6
+ *
+ * Domains resolved ahead of time (resolved->entries[i].count >= 0)
+ * keep those addresses and are not looked up again here.
+ */
+static void resolve_entries(const Policy *policy, const ResolvedWhitelist *resolved,
+                            ResolvedWhitelist *out)
+{
+    WhitelistTarget t;
+
+    for (int i = 0; i < MAX_PATHS; i++)
+    {
+        out->entries[i].count = -1;
+    }
+
+    for (int i = 0; i < policy->whitelist_count; i++)
     {
-        void *addr;
+        const char *entry = policy->network_whitelist[i];
+        ResolvedEntry *re = &out->entries[i];
+
+        if (parse_whitelist_entry(entry, &t) != 0)
+        {
+            fprintf(stderr, "[!] Skipping invalid whitelist entry: %s\n", entry);
+            continue;
+        }
+        if (t.family == AF_INET6 && !policy->ipv6)
+        {
+            fprintf(stderr, "[!] Skipping IPv6 address %s (policy has ipv6 off)\n", entry);
+            continue;
+        }
+        if (t.family)
+        {
+            printf("[+] Whitelisting: %s\n", entry);
+            continue;
+        }
 
-        if (p->ai_family == AF_INET)
+        if (resolved && resolved->entries[i].count >= 0)
         {
-            struct sockaddr_in *ipv4 = (struct sockaddr_in *)p->ai_addr;
-            addr = &(ipv4->sin_addr);
+            *re = resolved->entries[i];
         }
         else
         {
-            struct sockaddr_in6 *ipv6 = (struct sockaddr_in6 *)p->ai_addr;
-            addr = &(ipv6->sin6_addr);
+            printf("[+] Resolving: %s\n", t.host);
+            resolve_domain(t.host, re, policy->ipv6);
         }
+        for (int j = 0; j < re->count; j++)
+        {
+            printf("    -> Allowed: %s (%s)\n", re->addrs[j], entry);
+        }
+    }
+}
 
-        inet_ntop(p->ai_family, addr, ip_str, sizeof(ip_str));
-        
-        /* Add iptables rule for this IP - INSERT at top for priority */
-        snprintf(cmd, sizeof(cmd),
-                 "iptables -I OUTPUT 1 -d %s -p tcp --dport 443 -j ACCEPT 2>/dev/null",
-                 ip_str);
-        run_cmd(cmd);
-        
-        snprintf(cmd, sizeof(cmd),
-                 "iptables -I OUTPUT 1 -d %s -p tcp --dport 80 -j ACCEPT 2>/dev/null",
-                 ip_str);
-        run_cmd(cmd);
+/* Where for_each_cidr output goes while building a batch */
+typedef struct {
+    RuleBuf *rb;
+    const char *set;        /* ipset to add to, or NULL for plain rules */
+    const char *ports;
+} CidrTarget;
 
-        printf("    -> Allowed: %s (%s)\n", ip_str, domain);
-        resolved++;
-    }
+static void add_cidr(const char *cidr, void *arg)
+{
+    CidrTarget *ct = arg;
 
-    freeaddrinfo(res);
-    return resolved > 0 ? 0 : -1;
+    if (ct->set)
+        rb_append(ct->rb, "add %s %s\n", ct->set, cidr);
+    else
+        rb_append(ct->rb, "-A " WHITELIST_CHAIN " -d %s -p tcp%s -j ACCEPT\n", cidr, ct->ports);
+}
+
+/* " --dport 443", " --dport 8000:8100", or "" for every port */
+static void port_match(const WhitelistSet *set, char *out, size_t len)
+{
+    if (set->port_lo == 1 && set->port_hi == 65535)
+        out[0] = '\0';
+    else if (set->port_lo == set->port_hi)
+        snprintf(out, len, " --dport %d", set->port_lo);
+    else
+        snprintf(out, len, " --dport %d:%d", set->port_lo, set->port_hi);
+}
+
+static int ipset_restore(const RuleBuf *rb)
+{
+    FILE *p = popen("ipset restore >/dev/null 2>&1", "w");
+    if (!p)
+        return -1;
+    if (rb->data)
+        fputs(rb->data, p);
+    return pclose(p) == 0 ? 0 : -1;
 }
 
 /*
- * Check if a string looks like an IP address
+ * Destroy whitelist sets: those of other generations (keep) once the
+ * rules using them are gone, or this generation's (!keep) if its
+ * rules could not be installed
  */
-static int is_ip_address(const char *str)
+static void destroy_sets(const char *prefix, int keep)
 {
-    struct in_addr ipv4;
-    struct in6_addr ipv6;
-    
-    return (inet_pton(AF_INET, str, &ipv4) == 1 ||
-            inet_pton(AF_INET6, str, &ipv6) == 1);
+    char name[64];
+    char cmd[128];
+    size_t len = strlen(prefix);
+
+    FILE *p = popen("ipset list -n 2>/dev/null", "r");
+    if (!p)
+        return;
+    while (fgets(name, sizeof(name), p))
+    {
+        name[strcspn(name, "\n")] = '\0';
+        if (strncmp(name, WL_SET_PREFIX, strlen(WL_SET_PREFIX)) != 0)
+            continue;
+        if ((strncmp(name, prefix, len) == 0) == keep)
+            continue;
+        snprintf(cmd, sizeof(cmd), "ipset destroy %s 2>/dev/null", name);
+        run_cmd(cmd);
+    }
+    pclose(p);
 }
 
 /*
- * Whitelist an IP address directly
+ * Compile the whitelist and load it into WHITELIST_CHAIN
+ *
+ * HOW IT WORKS:
+ * - compile_whitelist() (whitelist.c) merges every entry into a few
+ *   sets, one per port range, of non-overlapping address ranges
+ * - Each set becomes one ipset (hash:net) and one rule matching it,
+ *   so the rules a new connection walks don't grow with the policy.
+ *   Without ipset, each set's ranges become the fewest CIDR rules
+ * - The chain is replaced in one iptables-restore per family, then
+ *   the sets it used before are destroyed: a reload never shows the
+ *   sandbox a half-built whitelist
  */
-static int whitelist_ip(const char *ip)
+static int apply_whitelist(const Policy *policy, const ResolvedWhitelist *resolved)
 {
-    char cmd[512];
-    
-    printf("[+] Whitelisting IP: %s\n", ip);
-    
-    /* Allow HTTPS - INSERT at top for priority */
-    snprintf(cmd, sizeof(cmd),
-             "iptables -I OUTPUT 1 -d %s -p tcp --dport 443 -j ACCEPT",
-             ip);
-    run_cmd(cmd);
-    
-    /* Allow HTTP */
-    snprintf(cmd, sizeof(cmd),
-             "iptables -I OUTPUT 1 -d %s -p tcp --dport 80 -j ACCEPT",
-             ip);
-    run_cmd(cmd);
-    
-    return 0;
+    ResolvedWhitelist addrs;
+    CompiledWhitelist wl;
+    RuleBuf sets = {0};
+    char prefix[32];
+    char ports[32];
+    char set[48];
+    int ranges = 0;
+    int ret = -1;
+
+    resolve_entries(policy, resolved, &addrs);
+    if (compile_whitelist(policy, &addrs, policy->ipv6, &wl) != 0)
+    {
+        fprintf(stderr, "[!] Failed to compile whitelist\n");
+        return -1;
+    }
+
+    snprintf(prefix, sizeof(prefix), WL_SET_PREFIX "%d-", (int)getpid());
+    for (int i = 0; i < wl.count; i++)
+    {
+        snprintf(set, sizeof(set), "%s%d", prefix, i);
+        rb_append(&sets, "create %s hash:net family %s maxelem 65536\n", set,
+                  wl.sets[i].family == AF_INET6 ? "inet6" : "inet");
+        for (int j = 0; j < wl.sets[i].count; j++)
+        {
+            CidrTarget ct = { &sets, set, "" };
+            for_each_cidr(wl.sets[i].family, &wl.sets[i].ranges[j], add_cidr, &ct);
+        }
+        ranges += wl.sets[i].count;
+    }
+    int use_ipset = wl.count > 0 && ipset_restore(&sets) == 0;
+    free(sets.data);
+
+    /* With ipset first; plain rules if that (or its iptables match) fails */
+    for (int attempt = use_ipset ? 0 : 1; attempt < 2 && ret != 0; attempt++)
+    {
+        RuleSet rs;
+
+        rules_begin(&rs, policy->ipv6);
+        rb_append(&rs.v4, ":" WHITELIST_CHAIN " - [0:0]\n");
+        rb_append(&rs.v6, ":" WHITELIST_CHAIN " - [0:0]\n");
+        for (int i = 0; i < wl.count; i++)
+        {
+            RuleBuf *rb = wl.sets[i].family == AF_INET6 ? &rs.v6 : &rs.v4;
+
+            port_match(&wl.sets[i], ports, sizeof(ports));
+            if (attempt == 0)
+            {
+                rb_append(rb, "-A " WHITELIST_CHAIN " -p tcp -m set --match-set %s%d dst%s -j ACCEPT\n",
+                          prefix, i, ports);
+                continue;
+            }
+            for (int j = 0; j < wl.sets[i].count; j++)
+            {
+                CidrTarget ct = { rb, NULL, ports };
+                for_each_cidr(wl.sets[i].family, &wl.sets[i].ranges[j], add_cidr, &ct);
+            }
+        }
+        ret = rules_apply(&rs);
+        use_ipset = attempt == 0 && ret == 0;
+    }
+
+    /* Old generation out; or ours, if it never got used */
+    destroy_sets(prefix, use_ipset);
+
+    if (ret == 0)
+    {
+        printf("[+] Whitelist compiled: %d entries -> %d port ranges, %d address ranges (%s)\n",
+               policy->whitelist_count, wl.count, ranges, use_ipset ? "ipset" : "iptables rules");
+    }
+    else
+    {
+        fprintf(stderr, "[!] Failed to apply whitelist rules\n");
+    }
+    free_compiled_whitelist(&wl);
+    return ret;
 }
 
 /*
@@ -124,7 +403,7 @@ static int whitelist_ip(const char *ip)
  * 1. Flush all rules
  * 2. Set default policy to DROP (blocks everything not explicitly allowed)
  * 3. Allow loopback, DNS, ICMP
- * 4. For whitelisted domains: INSERT ACCEPT rules at TOP
+ * 4. Whitelist (hosts, CIDRs, ports): compiled into WHITELIST_CHAIN
  * 5. REJECT (not DROP) HTTP/HTTPS to give fast failure
  * 
  * REJECT vs DROP:
@@ -133,76 +412,194 @@ static int whitelist_ip(const char *ip)
  */
 int setup_firewall_with_policy(const Policy *policy)
 {
-    printf("[+] Applying firewall rules from policy...\n");
+    return setup_firewall_resolved(policy, NULL);
+}
+
+/*
+ * Resolve every domain in the whitelist up front
+ *
+ * WHY: Lookups from inside the sandbox have to wait until its veth,
+ * route and NAT exist. Resolving on the host instead lets the
+ * lookups run while the network is still being built, and the
+ * firewall can then be installed without touching the network.
+ */
+int resolve_whitelist(const Policy *policy, ResolvedWhitelist *out)
+{
+    for (int i = 0; i < MAX_PATHS; i++)
+    {
+        out->entries[i].count = -1;
+    }
+
+    for (int i = 0; i < policy->whitelist_count; i++)
+    {
+        WhitelistTarget t;
 
+        if (parse_whitelist_entry(policy->network_whitelist[i], &t) == 0 && !t.family)
+            resolve_domain(t.host, &out->entries[i], policy->ipv6);
+    }
+
+    return 0;
+}
+
+/*
+ * Flush and default-DROP one family, keeping loopback and replies
+ */
+static int reset_chains(int v6)
+{
     /* Flush any existing rules */
-    run_cmd("iptables -F 2>/dev/null");
-    run_cmd("iptables -X 2>/dev/null");
+    run_rule(v6, "-F 2>/dev/null");
+    run_rule(v6, "-X 2>/dev/null");
 
     /* Set default policies to DROP - this is the fail-safe */
-    run_cmd("iptables -P INPUT DROP");
-    run_cmd("iptables -P OUTPUT DROP");
-    run_cmd("iptables -P FORWARD DROP");
+    if (run_rule(v6, "-P INPUT DROP") != 0 ||
+        run_rule(v6, "-P OUTPUT DROP") != 0 ||
+        run_rule(v6, "-P FORWARD DROP") != 0)
+    {
+        fprintf(stderr, "[!] Failed to set default DROP policies%s\n", v6 ? " (IPv6)" : "");
+        return -1;
+    }
 
     /* === ALLOW RULES (order matters - first match wins) === */
 
     /* Allow ALL loopback traffic */
-    run_cmd("iptables -A INPUT -i lo -j ACCEPT");
-    run_cmd("iptables -A OUTPUT -o lo -j ACCEPT");
+    run_rule(v6, "-A INPUT -i lo -j ACCEPT");
+    run_rule(v6, "-A OUTPUT -o lo -j ACCEPT");
 
     /* Allow established and related connections (for replies to allowed traffic) */
-    run_cmd("iptables -A INPUT -m conntrack --ctstate ESTABLISHED,RELATED -j ACCEPT");
-    run_cmd("iptables -A OUTPUT -m conntrack --ctstate ESTABLISHED,RELATED -j ACCEPT");
+    run_rule(v6, "-A INPUT -m conntrack --ctstate ESTABLISHED,RELATED -j ACCEPT");
+    run_rule(v6, "-A OUTPUT -m conntrack --ctstate ESTABLISHED,RELATED -j ACCEPT");
+
+    return 0;
+}
+
+/*
+ * Flush, default-DROP, then the rules every ruleset starts with:
+ * loopback, replies, DNS and ICMP
+ */
+static int setup_base_rules(int v6)
+{
+    if (reset_chains(v6) != 0)
+        return -1;
 
     /* Allow DNS (required for domain resolution) */
-    run_cmd("iptables -A OUTPUT -p udp --dport 53 -j ACCEPT");
-    run_cmd("iptables -A OUTPUT -p tcp --dport 53 -j ACCEPT");
+    run_rule(v6, "-A OUTPUT -p udp --dport 53 -j ACCEPT");
+    run_rule(v6, "-A OUTPUT -p tcp --dport 53 -j ACCEPT");
+
+    /* Allow ICMP (ping) - useful for debugging; IPv6 also needs it for
+     * neighbour discovery */
+    run_rule(v6, "-A OUTPUT -p %s -j ACCEPT", v6 ? "ipv6-icmp" : "icmp");
+    run_rule(v6, "-A INPUT -p %s -j ACCEPT", v6 ? "ipv6-icmp" : "icmp");
+
+    return 0;
+}
 
-    /* Allow ICMP (ping) - useful for debugging */
-    run_cmd("iptables -A OUTPUT -p icmp -j ACCEPT");
-    run_cmd("iptables -A INPUT -p icmp -j ACCEPT");
+/*
+ * Final catch-all REJECT for any other traffic
+ */
+static void add_final_rejects(int v6)
+{
+    run_rule(v6, "-A OUTPUT -p tcp -j REJECT --reject-with tcp-reset");
+    run_rule(v6, "-A OUTPUT -p udp -j REJECT --reject-with %s",
+             v6 ? "icmp6-port-unreachable" : "icmp-port-unreachable");
+}
+
+/*
+ * IPv6 for a policy without "ipv6: true"
+ *
+ * WHY: The sandbox has no IPv6 address or route (network.c), but a
+ * client trying an IPv6 literal or racing IPv6 against IPv4 (Happy
+ * Eyeballs) must fail on the spot rather than wait for a timeout, and
+ * IPv6 must never be a way around the IPv4 whitelist. Everything but
+ * loopback is rejected: TCP with a RST, the rest with ICMPv6.
+ */
+static void block_ipv6(void)
+{
+    /* Kernel without IPv6 (or no ip6tables): nothing to close */
+    if (reset_chains(1) != 0)
+        return;
+    run_rule(1, "-A OUTPUT -p tcp -j REJECT --reject-with tcp-reset");
+    run_rule(1, "-A OUTPUT -j REJECT --reject-with icmp6-adm-prohibited");
+}
 
-    /* Process whitelist from policy - these get priority via INSERT */
+/*
+ * Both families with the base rules; IPv6 is closed instead unless the
+ * policy has it
+ */
+static int setup_families(const Policy *policy)
+{
+    if (setup_base_rules(0) != 0)
+        return -1;
+    if (!policy->ipv6)
+    {
+        block_ipv6();
+        return 0;
+    }
+    return setup_base_rules(1);
+}
+
+/*
+ * Copy what is about to be rejected to the flow logger (flowlog.c).
+ * NFLOG doesn't terminate, so the REJECT rules after it still apply;
+ * the limit keeps a retry loop from flooding the log.
+ */
+static void add_reject_logging(const Policy *policy, int v6)
+{
+    if (!policy->flow_log)
+        return;
+
+    run_rule(v6, "-A OUTPUT -m limit --limit 50/s --limit-burst 100 "
+                 "-j NFLOG --nflog-group %d --nflog-prefix %s",
+             FLOW_NFLOG_GROUP, FLOW_NFLOG_PREFIX);
+}
+
+/*
+ * Same as setup_firewall_with_policy, using pre-resolved domains
+ * where available (resolved may be NULL)
+ */
+int setup_firewall_resolved(const Policy *policy, const ResolvedWhitelist *resolved)
+{
+    printf("[+] Applying firewall rules from policy...\n");
+
+    if (setup_families(policy) != 0)
+        return -1;
+
+    /* Whitelist chain, checked before the web rules below */
+    for (int v6 = 0; v6 <= policy->ipv6; v6++)
+    {
+        run_rule(v6, "-N " WHITELIST_CHAIN);
+        run_rule(v6, "-A OUTPUT -j " WHITELIST_CHAIN);
+    }
     if (policy->whitelist_count > 0)
     {
         printf("[+] Processing network whitelist (%d entries)...\n", policy->whitelist_count);
-        
-        for (int i = 0; i < policy->whitelist_count; i++)
-        {
-            const char *entry = policy->network_whitelist[i];
-            
-            if (is_ip_address(entry))
-            {
-                whitelist_ip(entry);
-            }
-            else
-            {
-                /* Treat as domain name */
-                whitelist_domain(entry);
-            }
-        }
+        apply_whitelist(policy, resolved);
     }
     
-    /* If allow_all_https is set OR no whitelist provided, allow all HTTPS/HTTP */
-    if (policy->allow_all_https || policy->whitelist_count == 0)
-    {
-        printf("[+] Allowing all HTTPS/HTTP traffic\n");
-        run_cmd("iptables -A OUTPUT -p tcp --dport 443 -j ACCEPT");
-        run_cmd("iptables -A OUTPUT -p tcp --dport 80 -j ACCEPT");
-    }
-    else
+    for (int v6 = 0; v6 <= policy->ipv6; v6++)
     {
-        /* === REJECT RULES (fast failure for non-whitelisted) === */
-        /* REJECT sends RST packet = immediate "Connection refused" */
-        printf("[+] Adding REJECT rules for non-whitelisted traffic\n");
-        run_cmd("iptables -A OUTPUT -p tcp --dport 443 -j REJECT --reject-with tcp-reset");
-        run_cmd("iptables -A OUTPUT -p tcp --dport 80 -j REJECT --reject-with tcp-reset");
+        /* If allow_all_https is set OR no whitelist provided, allow all HTTPS/HTTP */
+        if (policy->allow_all_https || policy->whitelist_count == 0)
+        {
+            if (!v6)
+                printf("[+] Allowing all HTTPS/HTTP traffic\n");
+            run_rule(v6, "-A OUTPUT -p tcp --dport 443 -j ACCEPT");
+            run_rule(v6, "-A OUTPUT -p tcp --dport 80 -j ACCEPT");
+            add_reject_logging(policy, v6);
+        }
+        else
+        {
+            /* === REJECT RULES (fast failure for non-whitelisted) === */
+            /* REJECT sends RST packet = immediate "Connection refused" */
+            if (!v6)
+                printf("[+] Adding REJECT rules for non-whitelisted traffic\n");
+            add_reject_logging(policy, v6);
+            run_rule(v6, "-A OUTPUT -p tcp --dport 443 -j REJECT --reject-with tcp-reset");
+            run_rule(v6, "-A OUTPUT -p tcp --dport 80 -j REJECT --reject-with tcp-reset");
+        }
+        
+        add_final_rejects(v6);
     }
 
-    /* Final catch-all REJECT for any other traffic */
-    run_cmd("iptables -A OUTPUT -p tcp -j REJECT --reject-with tcp-reset");
-    run_cmd("iptables -A OUTPUT -p udp -j REJECT --reject-with icmp-port-unreachable");
-
     printf("[+] Firewall configured:\n");
     printf("    - Default: REJECT (immediate failure)\n");
     printf("    - Allow: loopback, DNS, ICMP\n");
@@ -218,10 +615,37 @@ int setup_firewall_with_policy(const Policy *policy)
     {
         printf("    - HTTP/HTTPS: whitelist only (others rejected)\n");
     }
+    printf("    - IPv6: %s\n", policy->ipv6 ? "same rules as IPv4" : "all rejected");
 
     return 0;
 }
 
+/*
+ * Firewall for package_proxy mode: web traffic may only go to the
+ * host-side proxy, which applies the whitelist by hostname
+ */
+int setup_firewall_proxy(const Policy *policy, const char *proxy_ip, int proxy_port)
+{
+    printf("[+] Applying firewall rules (package proxy)...\n");
+
+    if (setup_families(policy) != 0)
+        return -1;
+
+    /* The proxy listens on the IPv4 host address only */
+    run_rule(0, "-A OUTPUT -d %s -p tcp --dport %d -j ACCEPT", proxy_ip, proxy_port);
+    for (int v6 = 0; v6 <= policy->ipv6; v6++)
+    {
+        add_reject_logging(policy, v6);
+        add_final_rejects(v6);
+    }
+
+    printf("[+] Firewall configured:\n");
+    printf("    - Default: REJECT (immediate failure)\n");
+    printf("    - Allow: loopback, DNS, ICMP\n");
+    printf("    - HTTP/HTTPS: only via proxy %s:%d\n", proxy_ip, proxy_port);
+    return 0;
+}
+
 /*
  * Legacy setup - allows all HTTPS (backwards compatibility)
  */
@@ -231,6 +655,8 @@ int setup_firewall(void)
     default_policy.whitelist_count = 0;
     default_policy.allow_all_https = 1;
     default_policy.network_mode = NET_POLICY_DENY;
+    default_policy.flow_log = 0;
+    default_policy.ipv6 = 0;
     
     return setup_firewall_with_policy(&default_policy);
 }
@@ -240,10 +666,90 @@ int setup_firewall(void)
  */
 int cleanup_firewall(void)
 {
-    run_cmd("iptables -F 2>/dev/null");
-    run_cmd("iptables -X 2>/dev/null");
-    run_cmd("iptables -P INPUT ACCEPT");
-    run_cmd("iptables -P OUTPUT ACCEPT");
-    run_cmd("iptables -P FORWARD ACCEPT");
+    for (int v6 = 0; v6 <= 1; v6++)
+    {
+        run_rule(v6, "-F 2>/dev/null");
+        run_rule(v6, "-X 2>/dev/null");
+        run_rule(v6, "-P INPUT ACCEPT 2>/dev/null");
+        run_rule(v6, "-P OUTPUT ACCEPT 2>/dev/null");
+        run_rule(v6, "-P FORWARD ACCEPT 2>/dev/null");
+    }
     return 0;
 }
+
+/*
+ * Does this policy fall back to "all HTTP/HTTPS allowed"?
+ */
+static int allows_all_web(const Policy *policy)
+{
+    return policy->allow_all_https || policy->whitelist_count == 0;
+}
+
+static int has_entry(const Policy *policy, const char *entry)
+{
+    for (int i = 0; i < policy->whitelist_count; i++)
+    {
+        if (strcmp(policy->network_whitelist[i], entry) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Switch a running sandbox to a new whitelist
+ *
+ * Must run inside the sandbox network namespace. The whole whitelist
+ * is compiled again (domains are looked up anew, so changed DNS
+ * answers are picked up as well) and swapped in with one
+ * iptables-restore per family, so the sandbox never sees a
+ * half-updated whitelist. If the policy flips between whitelist mode
+ * and allow-all mode the ruleset is rebuilt instead. ipv6 is fixed
+ * for the session (the addresses are set up at start), so the old
+ * policy's value stays. resolved: domains looked up beforehand (on the
+ * host), or NULL to look them up here.
+ */
+int update_firewall_whitelist(const Policy *old_policy, const Policy *new_policy,
+                              const ResolvedWhitelist *resolved)
+{
+    Policy next = *new_policy;
+    int added = 0, removed = 0;
+
+    next.ipv6 = old_policy->ipv6;
+    if (allows_all_web(old_policy) != allows_all_web(new_policy))
+    {
+        printf("[+] Whitelist mode changed, rebuilding firewall...\n");
+        return setup_firewall_resolved(&next, resolved);
+    }
+
+    for (int i = 0; i < old_policy->whitelist_count; i++)
+    {
+        const char *entry = old_policy->network_whitelist[i];
+        if (!has_entry(new_policy, entry))
+        {
+            printf("[+] Removing from whitelist: %s\n", entry);
+            removed++;
+        }
+    }
+    for (int i = 0; i < new_policy->whitelist_count; i++)
+    {
+        const char *entry = new_policy->network_whitelist[i];
+        if (!has_entry(old_policy, entry))
+        {
+            printf("[+] Adding to whitelist: %s\n", entry);
+            added++;
+        }
+    }
+
+    if (added + removed == 0)
+    {
+        printf("[+] Whitelist unchanged\n");
+        return 0;
+    }
+
+    int ret = apply_whitelist(&next, resolved);
+    if (ret != 0)
+        fprintf(stderr, "[!] Failed to apply whitelist changes\n");
+    else
+        printf("[+] Whitelist updated: %d added, %d removed\n", added, removed);
+    return ret;
+}
@@ -1,11 +1,36 @@
 #ifndef FIREWALL_H
 #define FIREWALL_H
 
+#include <netinet/in.h>
 #include "policy.h"
 
+#define MAX_RESOLVED_ADDRS 16
+
+/* Addresses of one whitelisted domain (count -1 = not resolved yet) */
+typedef struct {
+    int  count;
+    char addrs[MAX_RESOLVED_ADDRS][INET6_ADDRSTRLEN];
+} ResolvedEntry;
+
+/* Flat, so it can live in memory shared with the sandbox child */
+typedef struct {
+    ResolvedEntry entries[MAX_PATHS];
+} ResolvedWhitelist;
+
 /* Setup firewall rules inside sandbox namespace using policy */
 int setup_firewall_with_policy(const Policy *policy);
 
+/* Resolve whitelisted domains ahead of time (e.g. on the host) */
+int resolve_whitelist(const Policy *policy, ResolvedWhitelist *out);
+int setup_firewall_resolved(const Policy *policy, const ResolvedWhitelist *resolved);
+
+/* Allow web traffic only to the host-side package proxy (package_proxy) */
+int setup_firewall_proxy(const Policy *policy, const char *proxy_ip, int proxy_port);
+
+/* Apply only the whitelist changes between two policies (hot reload; resolved may be NULL) */
+int update_firewall_whitelist(const Policy *old_policy, const Policy *new_policy,
+                              const ResolvedWhitelist *resolved);
+
 /* Legacy function - sets up basic firewall (allows all HTTPS) */
 int setup_firewall(void);
 
@@ -0,0 +1,761 @@
+/*
+ * flowlog.c - Per-session network flow log
+ *
+ * WHY: The firewall's REJECT rules fail fast but silently - when an
+ * agent is slow or blocked there is no record of what it tried to
+ * reach. Packet capture would see everything but costs too much to
+ * leave on.
+ *
+ * HOW IT WORKS:
+ * 1. The firewall hands packets it is about to reject to NFLOG group
+ *    FLOW_NFLOG_GROUP (rate-limited, first 64 bytes only)
+ * 2. A helper forked by ai-run joins the sandbox network namespace and
+ *    opens two netfilter netlink sockets: NFLOG for rejected attempts
+ *    and conntrack DESTROY events for finished connections, which
+ *    carry byte counters and start/stop timestamps - one message per
+ *    connection, nothing per packet. Only connections from the
+ *    session's sandbox addresses are kept, so traffic towards the
+ *    sandbox (or of another netfilter user in it) stays out
+ * 3. The netlink thread only decodes into a fixed-size ring; the main
+ *    thread drains it once a second (or when it is 3/4 full) and
+ *    appends JSON lines to FLOW_LOG_DIR/<pid>.jsonl in one write
+ * 4. If the ring or the socket overflows, records are dropped and
+ *    counted instead of slowing down the sandbox
+ * 5. NFLOG groups are per network namespace and take one listener:
+ *    sessions joining a shared namespace (reuse_network_namespace)
+ *    find it taken by the session that built it and log connections
+ *    only
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <endian.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/netlink.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_log.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include "flowlog.h"
+
+#ifndef SYS_close_range
+#define SYS_close_range 436
+#endif
+
+#define FLOW_RING_SIZE  4096
+#define FLOW_LOG_MAX    (16L * 1024 * 1024)    /* rotate to .1 beyond this */
+#define FLOW_COPY_RANGE 64                      /* IP + TCP/UDP header */
+
+typedef enum {
+    FLOW_ACCEPT,
+    FLOW_REJECT
+} FlowVerdict;
+
+typedef struct {
+    time_t ts;
+    unsigned char family;
+    unsigned char proto;
+    unsigned char verdict;
+    unsigned char dst[16];
+    uint16_t dport;
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    int64_t duration_ms;    /* -1 if the kernel has no timestamps */
+} FlowRecord;
+
+static FlowRecord ring[FLOW_RING_SIZE];
+static unsigned long ring_head, ring_tail;
+static unsigned long ring_dropped;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static int wake_fd = -1;
+static volatile sig_atomic_t stopping;
+
+/* Source addresses of the session's sandbox (set before the fork) */
+static unsigned char own_v4[4], own_v6[16];
+static int have_v4, have_v6;
+
+/* ---------- Ring ---------- */
+
+static void wake_writer(void)
+{
+    uint64_t one = 1;
+    ssize_t n = write(wake_fd, &one, sizeof(one));
+    (void)n;
+}
+
+static void ring_push(const FlowRecord *rec)
+{
+    unsigned long used;
+
+    pthread_mutex_lock(&ring_lock);
+    used = ring_head - ring_tail;
+    if (used >= FLOW_RING_SIZE)
+    {
+        ring_dropped++;
+    }
+    else
+    {
+        ring[ring_head % FLOW_RING_SIZE] = *rec;
+        ring_head++;
+        used++;
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    if (used == FLOW_RING_SIZE * 3 / 4)
+        wake_writer();
+}
+
+static void ring_count_drop(void)
+{
+    pthread_mutex_lock(&ring_lock);
+    ring_dropped++;
+    pthread_mutex_unlock(&ring_lock);
+}
+
+/* ---------- Netlink decoding ---------- */
+
+/*
+ * Index a run of netlink attributes by type (tb must have max+1 slots)
+ */
+static void parse_attrs(const void *data, size_t len, const struct nlattr **tb, int max)
+{
+    const char *p = data;
+
+    memset(tb, 0, sizeof(*tb) * (size_t)(max + 1));
+    while (len >= NLA_HDRLEN)
+    {
+        const struct nlattr *nla = (const struct nlattr *)p;
+        if (nla->nla_len < NLA_HDRLEN || nla->nla_len > len)
+            break;
+
+        int type = nla->nla_type & NLA_TYPE_MASK;
+        if (type <= max)
+            tb[type] = nla;
+
+        size_t step = NLA_ALIGN(nla->nla_len);
+        if (step >= len)
+            break;
+        p += step;
+        len -= step;
+    }
+}
+
+static void parse_nested(const struct nlattr *nla, const struct nlattr **tb, int max)
+{
+    parse_attrs((const char *)nla + NLA_HDRLEN, nla->nla_len - NLA_HDRLEN, tb, max);
+}
+
+static const void *attr_data(const struct nlattr *nla)
+{
+    return (const char *)nla + NLA_HDRLEN;
+}
+
+static uint64_t attr_be64(const struct nlattr *nla)
+{
+    uint64_t v;
+    memcpy(&v, attr_data(nla), sizeof(v));
+    return be64toh(v);
+}
+
+static uint16_t attr_be16(const struct nlattr *nla)
+{
+    uint16_t v;
+    memcpy(&v, attr_data(nla), sizeof(v));
+    return ntohs(v);
+}
+
+static int is_loopback(const FlowRecord *rec)
+{
+    static const unsigned char v6_loopback[16] = { [15] = 1 };
+
+    if (rec->family == AF_INET)
+        return rec->dst[0] == 127;
+    return memcmp(rec->dst, v6_loopback, 16) == 0;
+}
+
+/*
+ * Did the sandbox open this connection? Without known addresses
+ * (rootless) everything in the namespace is the sandbox's.
+ */
+static int from_sandbox(int family, const struct nlattr *const *ip)
+{
+    if (!have_v4 && !have_v6)
+        return 1;
+    if (family == AF_INET)
+        return have_v4 && ip[CTA_IP_V4_SRC] &&
+               memcmp(attr_data(ip[CTA_IP_V4_SRC]), own_v4, 4) == 0;
+    if (family == AF_INET6)
+        return have_v6 && ip[CTA_IP_V6_SRC] &&
+               memcmp(attr_data(ip[CTA_IP_V6_SRC]), own_v6, 16) == 0;
+    return 0;
+}
+
+/*
+ * Conntrack DESTROY event: one finished connection with its counters
+ */
+static void handle_conntrack(const struct nlmsghdr *nlh)
+{
+    const struct nfgenmsg *nfg = NLMSG_DATA(nlh);
+    const struct nlattr *tb[CTA_MAX + 1];
+    const struct nlattr *tuple[CTA_TUPLE_MAX + 1];
+    const struct nlattr *ip[CTA_IP_MAX + 1];
+    const struct nlattr *proto[CTA_PROTO_MAX + 1];
+    FlowRecord rec;
+
+    if (nlh->nlmsg_len < NLMSG_SPACE(sizeof(*nfg)))
+        return;
+    parse_attrs((const char *)nfg + NLMSG_ALIGN(sizeof(*nfg)),
+                nlh->nlmsg_len - NLMSG_SPACE(sizeof(*nfg)), tb, CTA_MAX);
+    if (!tb[CTA_TUPLE_ORIG])
+        return;
+
+    parse_nested(tb[CTA_TUPLE_ORIG], tuple, CTA_TUPLE_MAX);
+    if (!tuple[CTA_TUPLE_IP] || !tuple[CTA_TUPLE_PROTO])
+        return;
+    parse_nested(tuple[CTA_TUPLE_IP], ip, CTA_IP_MAX);
+    parse_nested(tuple[CTA_TUPLE_PROTO], proto, CTA_PROTO_MAX);
+    if (!from_sandbox(nfg->nfgen_family, ip))
+        return;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.ts = time(NULL);
+    rec.family = nfg->nfgen_family;
+    rec.verdict = FLOW_ACCEPT;
+    rec.duration_ms = -1;
+
+    if (rec.family == AF_INET && ip[CTA_IP_V4_DST])
+        memcpy(rec.dst, attr_data(ip[CTA_IP_V4_DST]), 4);
+    else if (rec.family == AF_INET6 && ip[CTA_IP_V6_DST])
+        memcpy(rec.dst, attr_data(ip[CTA_IP_V6_DST]), 16);
+    else
+        return;
+    if (is_loopback(&rec))
+        return;
+
+    if (proto[CTA_PROTO_NUM])
+        rec.proto = *(const uint8_t *)attr_data(proto[CTA_PROTO_NUM]);
+    if (proto[CTA_PROTO_DST_PORT])
+        rec.dport = attr_be16(proto[CTA_PROTO_DST_PORT]);
+
+    /* Present when nf_conntrack_acct / nf_conntrack_timestamp are on */
+    const struct nlattr *counters[CTA_COUNTERS_MAX + 1];
+    if (tb[CTA_COUNTERS_ORIG])
+    {
+        parse_nested(tb[CTA_COUNTERS_ORIG], counters, CTA_COUNTERS_MAX);
+        if (counters[CTA_COUNTERS_BYTES])
+            rec.bytes_out = attr_be64(counters[CTA_COUNTERS_BYTES]);
+    }
+    if (tb[CTA_COUNTERS_REPLY])
+    {
+        parse_nested(tb[CTA_COUNTERS_REPLY], counters, CTA_COUNTERS_MAX);
+        if (counters[CTA_COUNTERS_BYTES])
+            rec.bytes_in = attr_be64(counters[CTA_COUNTERS_BYTES]);
+    }
+    if (tb[CTA_TIMESTAMP])
+    {
+        const struct nlattr *stamp[CTA_TIMESTAMP_MAX + 1];
+        parse_nested(tb[CTA_TIMESTAMP], stamp, CTA_TIMESTAMP_MAX);
+        if (stamp[CTA_TIMESTAMP_START] && stamp[CTA_TIMESTAMP_STOP])
+        {
+            uint64_t start = attr_be64(stamp[CTA_TIMESTAMP_START]);
+            uint64_t stop = attr_be64(stamp[CTA_TIMESTAMP_STOP]);
+            if (stop >= start)
+                rec.duration_ms = (int64_t)((stop - start) / 1000000);
+        }
+    }
+
+    ring_push(&rec);
+}
+
+/*
+ * NFLOG packet: a connection attempt the firewall is rejecting
+ */
+static void handle_nflog(const struct nlmsghdr *nlh)
+{
+    const struct nfgenmsg *nfg = NLMSG_DATA(nlh);
+    const struct nlattr *tb[NFULA_MAX + 1];
+    FlowRecord rec;
+
+    if (nlh->nlmsg_len < NLMSG_SPACE(sizeof(*nfg)))
+        return;
+    parse_attrs((const char *)nfg + NLMSG_ALIGN(sizeof(*nfg)),
+                nlh->nlmsg_len - NLMSG_SPACE(sizeof(*nfg)), tb, NFULA_MAX);
+    if (!tb[NFULA_PAYLOAD])
+        return;
+
+    const unsigned char *pkt = attr_data(tb[NFULA_PAYLOAD]);
+    size_t len = tb[NFULA_PAYLOAD]->nla_len - NLA_HDRLEN;
+    size_t l4;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.ts = time(NULL);
+    rec.verdict = FLOW_REJECT;
+    rec.duration_ms = -1;
+
+    if (len >= 20 && (pkt[0] >> 4) == 4)
+    {
+        rec.family = AF_INET;
+        rec.proto = pkt[9];
+        memcpy(rec.dst, pkt + 16, 4);
+        l4 = (size_t)(pkt[0] & 0x0f) * 4;
+    }
+    else if (len >= 40 && (pkt[0] >> 4) == 6)
+    {
+        rec.family = AF_INET6;
+        rec.proto = pkt[6];     /* extension headers are not followed */
+        memcpy(rec.dst, pkt + 24, 16);
+        l4 = 40;
+    }
+    else
+    {
+        return;
+    }
+
+    if ((rec.proto == IPPROTO_TCP || rec.proto == IPPROTO_UDP) && len >= l4 + 4)
+        rec.dport = (uint16_t)(pkt[l4 + 2] << 8 | pkt[l4 + 3]);
+
+    ring_push(&rec);
+}
+
+static void handle_messages(const char *buf, ssize_t len)
+{
+    for (const struct nlmsghdr *nlh = (const struct nlmsghdr *)buf;
+         NLMSG_OK(nlh, (size_t)len); nlh = NLMSG_NEXT(nlh, len))
+    {
+        int subsys = NFNL_SUBSYS_ID(nlh->nlmsg_type);
+        int type = NFNL_MSG_TYPE(nlh->nlmsg_type);
+
+        if (subsys == NFNL_SUBSYS_CTNETLINK && type == IPCTNL_MSG_CT_DELETE)
+            handle_conntrack(nlh);
+        else if (subsys == NFNL_SUBSYS_ULOG && type == NFULNL_MSG_PACKET)
+            handle_nflog(nlh);
+    }
+}
+
+typedef struct {
+    int ct_fd;
+    int log_fd;
+} NetlinkFds;
+
+static void *netlink_thread(void *arg)
+{
+    NetlinkFds *fds = arg;
+    struct pollfd pfds[2] = {
+        { .fd = fds->ct_fd, .events = POLLIN },
+        { .fd = fds->log_fd, .events = POLLIN },
+    };
+    static char buf[65536];
+
+    for (;;)
+    {
+        if (poll(pfds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (int i = 0; i < 2; i++)
+        {
+            if (pfds[i].fd < 0 || !(pfds[i].revents & POLLIN))
+                continue;
+
+            ssize_t n = recv(pfds[i].fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if (n > 0)
+                handle_messages(buf, n);
+            else if (n < 0 && errno == ENOBUFS)
+                ring_count_drop();      /* kernel dropped events: socket overran */
+        }
+    }
+    return NULL;
+}
+
+/* ---------- Netlink setup ---------- */
+
+static int open_netfilter_socket(unsigned groups)
+{
+    struct sockaddr_nl sa = { .nl_family = AF_NETLINK, .nl_groups = groups };
+    int rcvbuf = 4 << 20;
+
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER);
+    if (fd < 0)
+        return -1;
+
+    /* Bursts of short connections must not overrun the socket */
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) != 0)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Send one NFLOG config attribute for our group and wait for the ack
+ */
+static int nflog_config(int fd, uint16_t attr_type, const void *data, size_t len)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct nfgenmsg nfg;
+        char attrs[32];
+    } req;
+    char reply[1024];
+
+    memset(&req, 0, sizeof(req));
+    struct nlattr *nla = (struct nlattr *)req.attrs;
+    nla->nla_type = attr_type;
+    nla->nla_len = (uint16_t)(NLA_HDRLEN + len);
+    memcpy(req.attrs + NLA_HDRLEN, data, len);
+
+    req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct nfgenmsg)) + NLA_ALIGN(nla->nla_len);
+    req.nlh.nlmsg_type = (NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_CONFIG;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    req.nfg.nfgen_family = AF_UNSPEC;
+    req.nfg.version = NFNETLINK_V0;
+    req.nfg.res_id = htons(FLOW_NFLOG_GROUP);
+
+    if (send(fd, &req, req.nlh.nlmsg_len, 0) < 0)
+        return -1;
+
+    ssize_t n = recv(fd, reply, sizeof(reply), 0);
+    const struct nlmsghdr *ack = (const struct nlmsghdr *)reply;
+    if (n < (ssize_t)NLMSG_LENGTH(sizeof(struct nlmsgerr)) || ack->nlmsg_type != NLMSG_ERROR)
+        return -1;
+
+    const struct nlmsgerr *err = NLMSG_DATA(ack);
+    errno = -err->error;
+    return err->error == 0 ? 0 : -1;
+}
+
+static int open_nflog(void)
+{
+    struct nfulnl_msg_config_cmd cmd = { .command = NFULNL_CFG_CMD_BIND };
+    struct nfulnl_msg_config_mode mode = {
+        .copy_range = htonl(FLOW_COPY_RANGE),
+        .copy_mode = NFULNL_COPY_PACKET,
+    };
+
+    int fd = open_netfilter_socket(0);
+    if (fd < 0)
+        return -1;
+
+    if (nflog_config(fd, NFULA_CFG_CMD, &cmd, sizeof(cmd)) != 0 ||
+        nflog_config(fd, NFULA_CFG_MODE, &mode, sizeof(mode)) != 0)
+    {
+        int saved = errno;      /* EBUSY: the group already has a listener */
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Byte counters and timestamps are off by default; both are per
+ * network namespace, so this only changes the sandbox's
+ */
+static void enable_conntrack_extensions(void)
+{
+    const char *knobs[] = {
+        "/proc/sys/net/netfilter/nf_conntrack_acct",
+        "/proc/sys/net/netfilter/nf_conntrack_timestamp",
+    };
+
+    for (size_t i = 0; i < sizeof(knobs) / sizeof(knobs[0]); i++)
+    {
+        int fd = open(knobs[i], O_WRONLY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            ssize_t n = write(fd, "1", 1);
+            (void)n;
+            close(fd);
+        }
+    }
+}
+
+/* ---------- Writer ---------- */
+
+static const char *proto_name(unsigned char proto, char *buf, size_t len)
+{
+    switch (proto)
+    {
+        case IPPROTO_TCP:    return "tcp";
+        case IPPROTO_UDP:    return "udp";
+        case IPPROTO_ICMP:   return "icmp";
+        case IPPROTO_ICMPV6: return "icmpv6";
+        default:
+            snprintf(buf, len, "%u", proto);
+            return buf;
+    }
+}
+
+static size_t format_record(const FlowRecord *rec, char *out, size_t len)
+{
+    char ts[32], dst[INET6_ADDRSTRLEN], pbuf[8];
+    struct tm tm;
+    int n;
+
+    localtime_r(&rec->ts, &tm);
+    strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
+    inet_ntop(rec->family, rec->dst, dst, sizeof(dst));
+
+    n = snprintf(out, len, "{\"ts\":\"%s\",\"verdict\":\"%s\",\"proto\":\"%s\",\"dst\":\"%s\",\"port\":%u",
+                 ts, rec->verdict == FLOW_REJECT ? "reject" : "accept",
+                 proto_name(rec->proto, pbuf, sizeof(pbuf)), dst, rec->dport);
+    if (n > 0 && (size_t)n < len && rec->verdict == FLOW_ACCEPT)
+    {
+        n += snprintf(out + n, len - (size_t)n, ",\"bytes_out\":%llu,\"bytes_in\":%llu",
+                      (unsigned long long)rec->bytes_out, (unsigned long long)rec->bytes_in);
+        if ((size_t)n < len && rec->duration_ms >= 0)
+            n += snprintf(out + n, len - (size_t)n, ",\"duration_ms\":%lld",
+                          (long long)rec->duration_ms);
+    }
+    if (n > 0 && (size_t)n < len)
+        n += snprintf(out + n, len - (size_t)n, "}\n");
+    return n > 0 && (size_t)n < len ? (size_t)n : 0;
+}
+
+/*
+ * Move everything in the ring to the log with a single write
+ */
+static void drain_ring(int *log_fd, const char *log_path)
+{
+    static FlowRecord batch[FLOW_RING_SIZE];
+    static char text[FLOW_RING_SIZE * 256 + 128];
+    unsigned long count, dropped;
+    size_t len = 0;
+
+    pthread_mutex_lock(&ring_lock);
+    count = ring_head - ring_tail;
+    for (unsigned long i = 0; i < count; i++)
+        batch[i] = ring[(ring_tail + i) % FLOW_RING_SIZE];
+    ring_tail = ring_head;
+    dropped = ring_dropped;
+    ring_dropped = 0;
+    pthread_mutex_unlock(&ring_lock);
+
+    for (unsigned long i = 0; i < count; i++)
+        len += format_record(&batch[i], text + len, sizeof(text) - len);
+
+    if (dropped > 0)
+    {
+        char ts[32];
+        time_t now = time(NULL);
+        struct tm tm;
+
+        localtime_r(&now, &tm);
+        strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
+        len += (size_t)snprintf(text + len, sizeof(text) - len,
+                                "{\"ts\":\"%s\",\"verdict\":\"dropped\",\"count\":%lu}\n", ts, dropped);
+    }
+    if (len == 0)
+        return;
+
+    ssize_t n = write(*log_fd, text, len);
+    (void)n;
+
+    /* Keep one previous generation, so a busy session can't fill the disk */
+    struct stat st;
+    if (fstat(*log_fd, &st) == 0 && st.st_size > FLOW_LOG_MAX)
+    {
+        char old_path[300];
+        snprintf(old_path, sizeof(old_path), "%s.1", log_path);
+        if (rename(log_path, old_path) == 0)
+        {
+            int fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd >= 0)
+            {
+                close(*log_fd);
+                *log_fd = fd;
+            }
+        }
+    }
+}
+
+static void on_term(int sig)
+{
+    (void)sig;
+    stopping = 1;
+    wake_writer();
+}
+
+/* ---------- Helper process ---------- */
+
+/*
+ * Runs in the forked helper. fds 3..5 are the log, the netns and
+ * (optionally) the userns; ready_fd is told once we are listening.
+ */
+static void logger_main(const char *log_path, int ready_fd, int join_userns, pid_t owner)
+{
+    NetlinkFds fds;
+    pthread_t thread;
+    int log_fd = 3;
+    char ok = 1;
+
+    if (join_userns && setns(5, CLONE_NEWUSER) != 0)
+        return;
+    if (setns(4, CLONE_NEWNET) != 0)
+        return;
+    close(4);
+    close(5);
+
+    enable_conntrack_extensions();
+
+    fds.ct_fd = open_netfilter_socket(1u << (NFNLGRP_CONNTRACK_DESTROY - 1));
+    fds.log_fd = open_nflog();
+    if (fds.log_fd < 0 && errno == EBUSY)
+        fprintf(stderr, "[!] Flow log: rejected attempts in this shared network namespace "
+                        "go to the log of the session that built it\n");
+    if (fds.ct_fd < 0 && fds.log_fd < 0)
+        return;
+
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0 || pthread_create(&thread, NULL, netlink_thread, &fds) != 0)
+        return;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_term;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    if (write(ready_fd, &ok, 1) != 1)
+        return;
+    close(ready_fd);
+
+    /* Forked from a startup thread: PDEATHSIG would fire when it ends */
+    while (!stopping && getppid() == owner)
+    {
+        struct pollfd pfd = { .fd = wake_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 1000) > 0)
+        {
+            uint64_t v;
+            ssize_t n = read(wake_fd, &v, sizeof(v));
+            (void)n;
+        }
+        drain_ring(&log_fd, log_path);
+    }
+
+    drain_ring(&log_fd, log_path);
+}
+
+pid_t start_flow_logger(pid_t sandbox_pid, int netns_fd, int join_userns, const SandboxNet *net)
+{
+    char path[256];
+    int pipefd[2];
+    int log_fd, ns_fd, user_fd = -1;
+
+    mkdir("/var/lib/ai-sandbox", 0755);
+    mkdir(FLOW_LOG_DIR, 0755);
+    snprintf(path, sizeof(path), "%s/%d.jsonl", FLOW_LOG_DIR, sandbox_pid);
+
+    /* Opened here, with host credentials, before joining any namespace */
+    log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0)
+    {
+        fprintf(stderr, "[!] Flow log disabled: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    have_v4 = net && inet_pton(AF_INET, net->sandbox_ip, own_v4) == 1;
+    have_v6 = net && inet_pton(AF_INET6, net->sandbox_ip6, own_v6) == 1;
+
+    char ns_path[64];
+    if (netns_fd >= 0)
+    {
+        ns_fd = dup(netns_fd);
+    }
+    else
+    {
+        snprintf(ns_path, sizeof(ns_path), "/proc/%d/ns/net", sandbox_pid);
+        ns_fd = open(ns_path, O_RDONLY | O_CLOEXEC);
+    }
+    if (join_userns)
+    {
+        snprintf(ns_path, sizeof(ns_path), "/proc/%d/ns/user", sandbox_pid);
+        user_fd = open(ns_path, O_RDONLY | O_CLOEXEC);
+    }
+    if (ns_fd < 0 || (join_userns && user_fd < 0) || pipe2(pipefd, O_CLOEXEC) != 0)
+    {
+        perror("flow log");
+        close(log_fd);
+        if (ns_fd >= 0)
+            close(ns_fd);
+        if (user_fd >= 0)
+            close(user_fd);
+        return -1;
+    }
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        /* Keep nothing of the parent open but our fds, at fixed numbers */
+        pid_t owner = getppid();
+        int high[4] = {
+            fcntl(log_fd, F_DUPFD, 16),
+            fcntl(ns_fd, F_DUPFD, 16),
+            fcntl(user_fd >= 0 ? user_fd : ns_fd, F_DUPFD, 16),
+            fcntl(pipefd[1], F_DUPFD, 16),
+        };
+        for (int i = 0; i < 4; i++)
+            dup2(high[i], 3 + i);
+        if (syscall(SYS_close_range, 7, ~0U, 0) != 0)
+        {
+            for (int i = 7; i < 1024; i++)
+                close(i);
+        }
+
+        logger_main(path, 6, join_userns, owner);
+        _exit(0);
+    }
+
+    close(pipefd[1]);
+    close(log_fd);
+    close(ns_fd);
+    if (user_fd >= 0)
+        close(user_fd);
+
+    /* Wait until it is subscribed, so the first connection is logged */
+    char ok = 0;
+    struct pollfd pfd = { .fd = pipefd[0], .events = POLLIN };
+    if (pid > 0 && poll(&pfd, 1, 2000) > 0 && read(pipefd[0], &ok, 1) == 1)
+    {
+        close(pipefd[0]);
+        printf("[+] Flow log: %s\n", path);
+        return pid;
+    }
+
+    close(pipefd[0]);
+    fprintf(stderr, "[!] Flow logger failed to start (netfilter netlink unavailable?)\n");
+    if (pid > 0)
+        stop_flow_logger(pid);
+    return -1;
+}
+
+void stop_flow_logger(pid_t logger_pid)
+{
+    if (logger_pid <= 0)
+        return;
+
+    kill(logger_pid, SIGTERM);
+    waitpid(logger_pid, NULL, 0);
+}
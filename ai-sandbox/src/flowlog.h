@@ -0,0 +1,24 @@
+#ifndef FLOWLOG_H
+#define FLOWLOG_H
+
+#include <sys/types.h>
+#include "network.h"
+
+/* Per-session connection log (policy: flow_log), one JSON object per line */
+#define FLOW_LOG_DIR      "/var/lib/ai-sandbox/flows"
+#define FLOW_NFLOG_GROUP  7
+#define FLOW_NFLOG_PREFIX "aisb-reject"
+
+/*
+ * Fork a helper that joins the sandbox network namespace (netns_fd,
+ * or the one of sandbox_pid if -1) and logs every finished connection
+ * and every rejected attempt to FLOW_LOG_DIR/<sandbox_pid>.jsonl.
+ * join_userns: enter the sandbox user namespace first (rootless).
+ * net: only connections from its sandbox addresses are logged (NULL:
+ * everything in the namespace).
+ * Returns the helper's pid once it is listening, or -1.
+ */
+pid_t start_flow_logger(pid_t sandbox_pid, int netns_fd, int join_userns, const SandboxNet *net);
+void stop_flow_logger(pid_t logger_pid);
+
+#endif
@@ -0,0 +1,334 @@
+/*
+ * ipc.c - Host <-> sandbox channel for tool calls
+ *
+ * WHY: An orchestrator on the host that drives the agent inside the
+ * sandbox would otherwise talk to it over the network: through the
+ * veth and NAT, with a firewall hole for it, and not at all with
+ * "network: none". A Unix socket needs none of that - the network
+ * namespace doesn't apply to sockets found through the filesystem -
+ * and a round trip over one costs microseconds.
+ *
+ * HOW IT WORKS:
+ * 1. Before the clone, ai-run creates a directory for the session
+ *    (IPC_RUN_DIR/.new-<ai-run pid>, rootless under $XDG_RUNTIME_DIR),
+ *    owned by the real user and mode 0700
+ * 2. The sandbox bind-mounts it at SANDBOX_IPC_DIR, the same fixed
+ *    path in every session, and finds it in $AI_SANDBOX_IPC. On the
+ *    host root the bind also covers every other session's directory
+ * 3. Once it is bound the host renames it to IPC_RUN_DIR/<pid>, the
+ *    pid "ai-run list" shows ("ai-run ipc <pid>" prints the path)
+ * 4. Either side creates sockets in it; the host listening and the
+ *    sandbox connecting works both rootless and with sudo, where what
+ *    the sandbox creates belongs to root
+ * 5. ipc_send()/ipc_recv() carry descriptors along with a message
+ *    (SCM_RIGHTS). Large payloads go in a sealed memfd: copied once
+ *    by the sender, mapped by the receiver, never through the socket
+ *
+ * The directory is removed with the session, whatever is left in it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <pwd.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "ipc.h"
+
+#define IPC_STAGING_PREFIX ".new-"
+
+/* $XDG_RUNTIME_DIR/ai-sandbox-ipc, or -1 without one */
+static int rootless_base(char *out, size_t out_len)
+{
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+
+    if (!runtime || runtime[0] != '/')
+        return -1;
+    snprintf(out, out_len, "%s/ai-sandbox-ipc", runtime);
+    return 0;
+}
+
+static int base_dir(int rootless, char *out, size_t out_len)
+{
+    if (rootless)
+        return rootless_base(out, out_len);
+    snprintf(out, out_len, "%s", IPC_RUN_DIR);
+    return 0;
+}
+
+int ipc_channel_create(const char *user, int rootless, char *out, size_t out_len)
+{
+    char base[256];
+
+    if (base_dir(rootless, base, sizeof(base)) != 0)
+    {
+        printf("[!] No $XDG_RUNTIME_DIR - sandbox gets no IPC channel\n");
+        return -1;
+    }
+    if (!rootless)
+        mkdir("/run/ai-sandbox", 0755);
+    mkdir(base, 0755);
+
+    snprintf(out, out_len, "%s/" IPC_STAGING_PREFIX "%d", base, getpid());
+    ipc_channel_remove(out);    /* left by an earlier ai-run with our pid */
+    if (mkdir(out, 0700) != 0)
+    {
+        printf("[!] Could not create IPC channel %s: %s\n", out, strerror(errno));
+        return -1;
+    }
+
+    /* Under sudo the orchestrator is the real user, not root */
+    struct passwd *pw = rootless ? NULL : getpwnam(user);
+    if (pw && chown(out, pw->pw_uid, pw->pw_gid) != 0)
+        printf("[!] Warning: Could not hand IPC channel to %s: %s\n", user, strerror(errno));
+    return 0;
+}
+
+int ipc_channel_bind(const char *host_dir)
+{
+    /* Host root, rootless: only works if a root session made the mount point */
+    mkdir("/run/ai-sandbox", 0755);
+    mkdir(SANDBOX_IPC_DIR, 0755);
+
+    if (mount(host_dir, SANDBOX_IPC_DIR, NULL, MS_BIND, NULL) != 0)
+    {
+        printf("[!] Warning: Could not bind IPC channel at %s (%s)\n",
+               SANDBOX_IPC_DIR, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int ipc_channel_publish(char *dir, size_t dir_len, pid_t pid)
+{
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s", dir);
+    char *slash = strrchr(path, '/');
+    if (!slash)
+        return -1;
+    snprintf(slash + 1, sizeof(path) - (slash + 1 - path), "%d", pid);
+
+    if (rename(dir, path) != 0)
+    {
+        printf("[!] Warning: IPC channel stays at %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    snprintf(dir, dir_len, "%s", path);
+    return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+    (void)sb;
+    (void)flag;
+    (void)ftw;
+    remove(path);
+    return 0;
+}
+
+void ipc_channel_remove(const char *dir)
+{
+    if (dir[0])
+        nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS | FTW_MOUNT);
+}
+
+int ipc_channel_path(pid_t pid, char *out, size_t out_len)
+{
+    char base[256];
+    struct stat st;
+
+    for (int rootless = 0; rootless <= 1; rootless++)
+    {
+        if (base_dir(rootless, base, sizeof(base)) != 0)
+            continue;
+        snprintf(out, out_len, "%s/%d", base, pid);
+        if (stat(out, &st) == 0 && S_ISDIR(st.st_mode))
+            return 0;
+    }
+    return -1;
+}
+
+int gc_ipc_channels(void)
+{
+    char path[512];
+    int removed = 0;
+
+    DIR *dir = opendir(IPC_RUN_DIR);
+    if (!dir)
+        return 0;
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        /* <sandbox pid>, or still staged under the pid of its ai-run */
+        const char *name = ent->d_name;
+        if (strncmp(name, IPC_STAGING_PREFIX, strlen(IPC_STAGING_PREFIX)) == 0)
+            name += strlen(IPC_STAGING_PREFIX);
+
+        char *end;
+        long pid = strtol(name, &end, 10);
+        if (end == name || *end != '\0' || pid <= 0 || kill((pid_t)pid, 0) == 0 || errno != ESRCH)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", IPC_RUN_DIR, ent->d_name);
+        ipc_channel_remove(path);
+        removed++;
+    }
+    closedir(dir);
+    return removed;
+}
+
+/* ---------- Messages ---------- */
+
+int ipc_send(int sock, const void *buf, size_t len, const int *fds, int nfds)
+{
+    union {
+        char buf[CMSG_SPACE(IPC_MAX_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } cbuf;
+    struct iovec iov = { (void *)buf, len };
+    struct msghdr msg;
+
+    if (nfds < 0 || nfds > IPC_MAX_FDS)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0)
+    {
+        memset(&cbuf, 0, sizeof(cbuf));
+        msg.msg_control = cbuf.buf;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+
+    /* Descriptors ride on the first chunk; a stream socket may take the rest later */
+    size_t sent = 0;
+    do
+    {
+        ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        sent += n;
+        iov.iov_base = (char *)buf + sent;
+        iov.iov_len = len - sent;
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
+    } while (sent < len);
+    return 0;
+}
+
+ssize_t ipc_recv(int sock, void *buf, size_t len, int *fds, int *nfds)
+{
+    union {
+        char buf[CMSG_SPACE(IPC_MAX_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } cbuf;
+    struct iovec iov = { buf, len };
+    struct msghdr msg;
+    int want = nfds ? *nfds : 0;
+    int got = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf.buf;
+    msg.msg_controllen = sizeof(cbuf.buf);
+
+    ssize_t n;
+    do
+    {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    /* Anything the caller has no room for is closed, not leaked */
+    for (struct cmsghdr *cmsg = n >= 0 ? CMSG_FIRSTHDR(&msg) : NULL; cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count; i++)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (got < want)
+                fds[got++] = fd;
+            else
+                close(fd);
+        }
+    }
+
+    if (nfds)
+        *nfds = got;
+    return n;
+}
+
+/* ---------- Payloads ---------- */
+
+int ipc_payload_create(const void *data, size_t len)
+{
+    int fd = memfd_create("ai-sandbox-payload", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return -1;
+
+    for (size_t off = 0; off < len;)
+    {
+        ssize_t n = write(fd, (const char *)data + off, len - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            close(fd);
+            return -1;
+        }
+        off += n;
+    }
+
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void *ipc_payload_map(int fd, size_t *len)
+{
+    struct stat st;
+    int seals = fcntl(fd, F_GET_SEALS);
+
+    /* Unsealed, the sender could still rewrite it or truncate it under us (SIGBUS) */
+    if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) != (F_SEAL_SHRINK | F_SEAL_WRITE))
+        return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        return NULL;
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    *len = st.st_size;
+    return map;
+}
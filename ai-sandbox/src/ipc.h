@@ -0,0 +1,64 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Host side: one directory per session, named by the sandbox's pid */
+#define IPC_RUN_DIR "/run/ai-sandbox/ipc"
+/* Where the sandbox sees its own (and nothing of other sessions') */
+#define SANDBOX_IPC_DIR "/run/ai-sandbox/ipc"
+/* Set in the sandbox's environment to SANDBOX_IPC_DIR */
+#define IPC_ENV "AI_SANDBOX_IPC"
+
+/* Most descriptors one ipc_send() carries */
+#define IPC_MAX_FDS 16
+
+/*
+ * Create the session's channel directory, owned by user and mode 0700,
+ * under a staging name (the sandbox's pid isn't known before the
+ * clone). Rootless it lives under $XDG_RUNTIME_DIR. Writes its path
+ * to out; returns 0, or -1 if there is nowhere to put it.
+ */
+int ipc_channel_create(const char *user, int rootless, char *out, size_t out_len);
+
+/* Bind host_dir at SANDBOX_IPC_DIR in the current mount namespace */
+int ipc_channel_bind(const char *host_dir);
+
+/* Rename the directory to the sandbox's pid once it is bound; dir is updated */
+int ipc_channel_publish(char *dir, size_t dir_len, pid_t pid);
+
+/* Remove the directory and whatever the session left in it */
+void ipc_channel_remove(const char *dir);
+
+/* Host path of a running session's channel ("ai-run ipc <pid>") */
+int ipc_channel_path(pid_t pid, char *out, size_t out_len);
+
+/* Remove channels of sessions whose ai-run is gone; returns how many */
+int gc_ipc_channels(void);
+
+/*
+ * Send len bytes plus nfds descriptors (SCM_RIGHTS) as one message.
+ * Returns 0 once all of buf is sent, -1 on error.
+ */
+int ipc_send(int sock, const void *buf, size_t len, const int *fds, int nfds);
+
+/*
+ * Receive one message into buf, and up to *nfds descriptors (close-on-
+ * exec) into fds; *nfds is set to how many arrived. Returns the byte
+ * count (0 once the peer is gone), or -1.
+ */
+ssize_t ipc_recv(int sock, void *buf, size_t len, int *fds, int *nfds);
+
+/*
+ * Large payloads: copy data into a sealed memfd to pass with ipc_send()
+ * instead of through the socket. The receiver maps it read-only, and
+ * the seals guarantee the sender can no longer change or shrink it.
+ * Returns the fd, or -1.
+ */
+int ipc_payload_create(const void *data, size_t len);
+
+/* Map a received payload; NULL if it isn't a sealed memfd. munmap() when done */
+void *ipc_payload_map(int fd, size_t *len);
+
+#endif
@@ -0,0 +1,519 @@
+/*
+ * layer.c - Content-addressed read-only layers shared by sandboxes
+ *
+ * HOW IT WORKS:
+ * 1. "ai-run layer add <dir|image.squashfs> [name]" hashes the content
+ *    (SHA-256 over the sorted tree, or over the image bytes) and copies
+ *    it into /var/lib/ai-sandbox/layers/<digest>/ - adding the same
+ *    content twice is a no-op
+ * 2. Names are symlinks in layers/names/ pointing at a digest, so a
+ *    name can be moved to a newer build without touching sessions
+ *    that still use the old one
+ * 3. Policies list "layers: - <name|digest>:/mount/point"; each
+ *    session bind-mounts the layer read-only. Directory layers are
+ *    the same inodes for every session, squashfs images are
+ *    loop-mounted once on the host under /run/ai-sandbox/layers/, so
+ *    either way N sandboxes share one copy in the page cache
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mount.h>
+#include "layer.h"
+#include "sha256.h"
+
+#define LAYER_NAMES_DIR LAYER_STORE_DIR "/names"
+#define SQUASHFS_MAGIC  "hsqs"
+
+/*
+ * Execute a shell command
+ */
+static int run_cmd(const char *cmd)
+{
+    return system(cmd);
+}
+
+/*
+ * Paths end up inside single-quoted shell arguments
+ */
+static int is_safe_path(const char *path)
+{
+    return path[0] != '\0' && strchr(path, '\'') == NULL && strlen(path) < 1024;
+}
+
+static int is_digest(const char *s)
+{
+    if (strlen(s) != SHA256_HEX_LEN - 1)
+        return 0;
+    for (const char *p = s; *p; p++)
+    {
+        if (!((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f')))
+            return 0;
+    }
+    return 1;
+}
+
+static int is_valid_name(const char *name)
+{
+    if (name[0] == '\0' || name[0] == '.' || strlen(name) >= 64)
+        return 0;
+    for (const char *p = name; *p; p++)
+    {
+        if (*p == '/' || *p == ':' || *p == '\'' || *p <= ' ')
+            return 0;
+    }
+    return 1;
+}
+
+/* ---------- Content digest ---------- */
+
+static int by_name(const struct dirent **a, const struct dirent **b)
+{
+    /* Byte order, not locale order: the digest must not depend on LANG */
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+static int hash_file(Sha256 *ctx, const char *path)
+{
+    char buf[65536];
+    ssize_t n;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        sha256_update(ctx, buf, (size_t)n);
+
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+/*
+ * Hash a directory tree: for every entry in sorted order its type,
+ * permission bits and relative path, then the file content or
+ * symlink target. Owners and timestamps are left out so the same
+ * toolchain built twice gets the same digest.
+ */
+static int hash_tree(Sha256 *ctx, const char *root, const char *rel)
+{
+    char dir[PATH_MAX];
+    struct dirent **names;
+    int rc = 0;
+
+    snprintf(dir, sizeof(dir), "%s%s%s", root, rel[0] ? "/" : "", rel);
+
+    int n = scandir(dir, &names, NULL, by_name);
+    if (n < 0)
+    {
+        perror(dir);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        const char *name = names[i]->d_name;
+        char child_rel[PATH_MAX];
+        char child[2 * PATH_MAX];
+        char header[PATH_MAX + 32];
+        struct stat st;
+
+        if (rc != 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        {
+            free(names[i]);
+            continue;
+        }
+
+        snprintf(child_rel, sizeof(child_rel), "%s%s%s", rel, rel[0] ? "/" : "", name);
+        snprintf(child, sizeof(child), "%s/%s", root, child_rel);
+        free(names[i]);
+
+        if (lstat(child, &st) != 0)
+        {
+            perror(child);
+            rc = -1;
+            continue;
+        }
+
+        char type = S_ISDIR(st.st_mode) ? 'd' : S_ISREG(st.st_mode) ? 'f' :
+                    S_ISLNK(st.st_mode) ? 'l' : 'o';
+        int len = snprintf(header, sizeof(header), "%c %04o %s", type,
+                           (unsigned)(st.st_mode & 07777), child_rel);
+        sha256_update(ctx, header, (size_t)len + 1);
+
+        if (type == 'f')
+        {
+            rc = hash_file(ctx, child);
+        }
+        else if (type == 'l')
+        {
+            char target[PATH_MAX];
+            ssize_t tl = readlink(child, target, sizeof(target));
+            if (tl < 0)
+                rc = -1;
+            else
+                sha256_update(ctx, target, (size_t)tl);
+        }
+        else if (type == 'd')
+        {
+            rc = hash_tree(ctx, root, child_rel);
+        }
+    }
+
+    free(names);
+    return rc;
+}
+
+static int is_squashfs(const char *path)
+{
+    char magic[4];
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    ssize_t n = read(fd, magic, sizeof(magic));
+    close(fd);
+
+    return n == 4 && memcmp(magic, SQUASHFS_MAGIC, 4) == 0;
+}
+
+/* ---------- Store ---------- */
+
+/*
+ * Map a name or digest prefix to a full digest
+ */
+static int find_digest(const char *ref, char digest[SHA256_HEX_LEN])
+{
+    char path[PATH_MAX];
+    char target[PATH_MAX];
+
+    /* Name first */
+    if (is_valid_name(ref))
+    {
+        snprintf(path, sizeof(path), "%s/%s", LAYER_NAMES_DIR, ref);
+        ssize_t n = readlink(path, target, sizeof(target) - 1);
+        if (n > 0)
+        {
+            target[n] = '\0';
+            if (is_digest(target))
+            {
+                memcpy(digest, target, SHA256_HEX_LEN - 1);
+                digest[SHA256_HEX_LEN - 1] = '\0';
+                return 0;
+            }
+        }
+    }
+
+    /* Then a unique digest prefix */
+    size_t len = strlen(ref);
+    int matches = 0;
+    DIR *dir = opendir(LAYER_STORE_DIR);
+    if (!dir)
+        return -1;
+
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL)
+    {
+        if (is_digest(de->d_name) && len >= 6 && strncmp(de->d_name, ref, len) == 0)
+        {
+            memcpy(digest, de->d_name, SHA256_HEX_LEN - 1);
+            digest[SHA256_HEX_LEN - 1] = '\0';
+            matches++;
+        }
+    }
+    closedir(dir);
+
+    if (matches > 1)
+        fprintf(stderr, "[!] Layer reference '%s' is ambiguous\n", ref);
+    return matches == 1 ? 0 : -1;
+}
+
+/*
+ * Point a name at a digest (atomically replaces an existing name)
+ */
+static int set_layer_name(const char *name, const char *digest)
+{
+    char link_path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+
+    mkdir(LAYER_NAMES_DIR, 0755);
+    snprintf(link_path, sizeof(link_path), "%s/%s", LAYER_NAMES_DIR, name);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.%d", LAYER_NAMES_DIR, name, getpid());
+
+    unlink(tmp_path);
+    if (symlink(digest, tmp_path) != 0 || rename(tmp_path, link_path) != 0)
+    {
+        perror("layer name");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int layer_add(const char *source, const char *name)
+{
+    struct stat st;
+    Sha256 ctx;
+    char digest[SHA256_HEX_LEN];
+    char final_dir[PATH_MAX];
+    char tmp_dir[PATH_MAX];
+    char cmd[2 * PATH_MAX + 64];
+    int is_dir;
+
+    if (!is_safe_path(source) || stat(source, &st) != 0)
+    {
+        fprintf(stderr, "[!] Cannot use layer source: %s\n", source);
+        return -1;
+    }
+    if (name && !is_valid_name(name))
+    {
+        fprintf(stderr, "[!] Invalid layer name: %s\n", name);
+        return -1;
+    }
+
+    is_dir = S_ISDIR(st.st_mode);
+    if (!is_dir && !(S_ISREG(st.st_mode) && is_squashfs(source)))
+    {
+        fprintf(stderr, "[!] Layer source must be a directory or a squashfs image\n");
+        return -1;
+    }
+
+    printf("[+] Hashing %s...\n", source);
+    sha256_init(&ctx);
+    sha256_update(&ctx, is_dir ? "dir" : "squashfs", is_dir ? 4 : 9);
+    if ((is_dir ? hash_tree(&ctx, source, "") : hash_file(&ctx, source)) != 0)
+    {
+        fprintf(stderr, "[!] Failed to read %s\n", source);
+        return -1;
+    }
+    sha256_final_hex(&ctx, digest);
+
+    mkdir("/var/lib/ai-sandbox", 0755);
+    mkdir(LAYER_STORE_DIR, 0755);
+    snprintf(final_dir, sizeof(final_dir), "%s/%s", LAYER_STORE_DIR, digest);
+
+    if (access(final_dir, F_OK) == 0)
+    {
+        printf("[+] Layer already in store: %s\n", digest);
+    }
+    else
+    {
+        /* Copy next to the final location, then publish with one rename */
+        snprintf(tmp_dir, sizeof(tmp_dir), "%s/.tmp-%d", LAYER_STORE_DIR, getpid());
+        if (mkdir(tmp_dir, 0755) != 0)
+        {
+            perror("mkdir layer");
+            return -1;
+        }
+
+        if (is_dir)
+            snprintf(cmd, sizeof(cmd), "cp -a '%s/.' '%s/rootfs'", source, tmp_dir);
+        else
+            snprintf(cmd, sizeof(cmd), "cp '%s' '%s/image.squashfs'", source, tmp_dir);
+
+        if (run_cmd(cmd) != 0 || rename(tmp_dir, final_dir) != 0)
+        {
+            fprintf(stderr, "[!] Failed to copy layer into the store\n");
+            snprintf(cmd, sizeof(cmd), "rm -rf '%s'", tmp_dir);
+            run_cmd(cmd);
+            return -1;
+        }
+        printf("[+] Added layer %s (%s)\n", digest, is_dir ? "directory" : "squashfs");
+    }
+
+    if (name && set_layer_name(name, digest) == 0)
+        printf("[+] Name: %s\n", name);
+
+    return 0;
+}
+
+/*
+ * Is path the root of a mount? (different device than its parent)
+ */
+static int is_mountpoint(const char *path)
+{
+    char parent[PATH_MAX];
+    struct stat st, pst;
+
+    snprintf(parent, sizeof(parent), "%s/..", path);
+    return stat(path, &st) == 0 && stat(parent, &pst) == 0 && st.st_dev != pst.st_dev;
+}
+
+int layer_list(void)
+{
+    DIR *dir = opendir(LAYER_STORE_DIR);
+    if (!dir)
+    {
+        printf("No layers (store %s is empty)\n", LAYER_STORE_DIR);
+        return 0;
+    }
+
+    printf("%-14s %-9s %s\n", "DIGEST", "TYPE", "NAMES");
+
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL)
+    {
+        char path[PATH_MAX];
+        char names[512] = "";
+        struct stat st;
+
+        if (!is_digest(de->d_name))
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s/rootfs", LAYER_STORE_DIR, de->d_name);
+        int is_dir = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+
+        /* Collect names pointing at this digest */
+        DIR *ndir = opendir(LAYER_NAMES_DIR);
+        struct dirent *ne;
+        while (ndir && (ne = readdir(ndir)) != NULL)
+        {
+            char link_path[PATH_MAX];
+            char target[PATH_MAX];
+
+            if (ne->d_name[0] == '.')
+                continue;
+            snprintf(link_path, sizeof(link_path), "%s/%s", LAYER_NAMES_DIR, ne->d_name);
+            ssize_t n = readlink(link_path, target, sizeof(target) - 1);
+            if (n > 0)
+            {
+                target[n] = '\0';
+                if (strcmp(target, de->d_name) == 0 && strlen(names) + strlen(ne->d_name) + 2 < sizeof(names))
+                {
+                    if (names[0])
+                        strcat(names, ",");
+                    strcat(names, ne->d_name);
+                }
+            }
+        }
+        if (ndir)
+            closedir(ndir);
+
+        snprintf(path, sizeof(path), "%s/%s", LAYER_MOUNT_DIR, de->d_name);
+        printf("%.12s   %-9s %s\n", de->d_name,
+               is_dir ? "dir" : (is_mountpoint(path) ? "squashfs*" : "squashfs"),
+               names[0] ? names : "-");
+    }
+    closedir(dir);
+
+    printf("(* = mounted on the host)\n");
+    return 0;
+}
+
+int layer_remove(const char *ref)
+{
+    char digest[SHA256_HEX_LEN];
+    char path[PATH_MAX];
+    char cmd[PATH_MAX + 32];
+
+    if (find_digest(ref, digest) != 0)
+    {
+        fprintf(stderr, "[!] No such layer: %s\n", ref);
+        return -1;
+    }
+
+    /* Running sandboxes keep their own bind; detach the shared mount lazily */
+    snprintf(path, sizeof(path), "%s/%s", LAYER_MOUNT_DIR, digest);
+    if (is_mountpoint(path))
+        umount2(path, MNT_DETACH);
+    rmdir(path);
+
+    /* Drop names that point at it */
+    DIR *ndir = opendir(LAYER_NAMES_DIR);
+    struct dirent *ne;
+    while (ndir && (ne = readdir(ndir)) != NULL)
+    {
+        char link_path[PATH_MAX];
+        char target[PATH_MAX];
+
+        snprintf(link_path, sizeof(link_path), "%s/%s", LAYER_NAMES_DIR, ne->d_name);
+        ssize_t n = readlink(link_path, target, sizeof(target) - 1);
+        if (n > 0)
+        {
+            target[n] = '\0';
+            if (strcmp(target, digest) == 0)
+                unlink(link_path);
+        }
+    }
+    if (ndir)
+        closedir(ndir);
+
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s/%s'", LAYER_STORE_DIR, digest);
+    if (run_cmd(cmd) != 0)
+    {
+        fprintf(stderr, "[!] Failed to remove layer %s\n", digest);
+        return -1;
+    }
+
+    printf("[+] Removed layer %s\n", digest);
+    return 0;
+}
+
+/*
+ * Loop-mount a squashfs layer on the host, once for all sessions
+ */
+static int mount_squashfs_layer(const char *digest, char *path, size_t path_len)
+{
+    char image[PATH_MAX];
+    char cmd[2 * PATH_MAX + 64];
+
+    snprintf(path, path_len, "%s/%s", LAYER_MOUNT_DIR, digest);
+    if (is_mountpoint(path))
+        return 0;
+
+    if (geteuid() != 0)
+    {
+        fprintf(stderr, "[!] Layer %.12s is a squashfs image that is not mounted yet; "
+                        "run one sandbox with sudo first\n", digest);
+        return -1;
+    }
+
+    mkdir("/run/ai-sandbox", 0755);
+    mkdir(LAYER_MOUNT_DIR, 0755);
+
+    /* Serialize with other sessions starting on the same layer */
+    int lock = open(LAYER_MOUNT_DIR "/.lock", O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock >= 0)
+        flock(lock, LOCK_EX);
+
+    int rc = 0;
+    if (!is_mountpoint(path))
+    {
+        snprintf(image, sizeof(image), "%s/%s/image.squashfs", LAYER_STORE_DIR, digest);
+        mkdir(path, 0755);
+        snprintf(cmd, sizeof(cmd), "mount -t squashfs -o loop,ro,nodev,nosuid '%s' '%s'", image, path);
+        rc = run_cmd(cmd) == 0 ? 0 : -1;
+        if (rc != 0)
+            fprintf(stderr, "[!] Failed to mount layer %.12s\n", digest);
+    }
+
+    if (lock >= 0)
+        close(lock);
+    return rc;
+}
+
+int layer_resolve(const char *ref, char *path, size_t path_len)
+{
+    char digest[SHA256_HEX_LEN];
+    struct stat st;
+
+    if (find_digest(ref, digest) != 0)
+    {
+        fprintf(stderr, "[!] No such layer: %s (see 'ai-run layer list')\n", ref);
+        return -1;
+    }
+
+    snprintf(path, path_len, "%s/%s/rootfs", LAYER_STORE_DIR, digest);
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+        return 0;
+
+    return mount_squashfs_layer(digest, path, path_len);
+}
@@ -0,0 +1,22 @@
+#ifndef LAYER_H
+#define LAYER_H
+
+#include <stddef.h>
+
+/* Content-addressed store of read-only layers (directories or squashfs images) */
+#define LAYER_STORE_DIR "/var/lib/ai-sandbox/layers"
+#define LAYER_MOUNT_DIR "/run/ai-sandbox/layers"
+
+/* ai-run layer add|list|rm */
+int layer_add(const char *source, const char *name);
+int layer_list(void);
+int layer_remove(const char *ref);
+
+/*
+ * Find a layer by name or digest prefix and return the directory to
+ * bind into a sandbox. Squashfs images are loop-mounted once on the
+ * host and shared by every session (needs root the first time).
+ */
+int layer_resolve(const char *ref, char *path, size_t path_len);
+
+#endif
@@ -2,20 +2,48 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <time.h>
 #include <pwd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
 
 #include "namespace.h"
 #include "policy.h"
 #include "network.h"
 #include "firewall.h"
 #include "seccomp.h"
+#include "reload.h"
+#include "phases.h"
+#include "layer.h"
+#include "proxy.h"
+#include "flowlog.h"
+#include "supervisor.h"
+#include "cgroup.h"
+#include "monitor.h"
+#include "placement.h"
+#include "admission.h"
+#include "dns.h"
+#include "expose.h"
+#include "ipc.h"
+
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
 
 /* State file for tracking active sessions */
 #define STATE_FILE "/var/lib/ai-sandbox/sessions.json"
+#define HISTORY_FILE "/var/lib/ai-sandbox/history.jsonl"
 
 /* ---------- Utility ---------- */
 
@@ -31,6 +59,13 @@ void check_root(void)
 const char *get_real_user(void)
 {
     const char *user = getenv("SUDO_USER");
+    if (!user && geteuid() != 0)
+    {
+        /* Rootless: we already are the real user */
+        struct passwd *pw = getpwuid(getuid());
+        if (pw)
+            user = pw->pw_name;
+    }
     if (!user)
     {
         fprintf(stderr, "[!] Error: Run using sudo\n");
@@ -48,12 +83,24 @@ void print_usage(void)
         "  ai-run create              Create policy.yaml in current directory\n"
         "  ai-run run <policy.yaml>   Start sandbox with given policy\n"
         "  ai-run gui                 Open web dashboard (auto-installs deps)\n"
+        "  ai-run reload <pid> <policy.yaml>\n"
+        "                             Apply policy changes to a running sandbox\n"
         "  ai-run list                List active sandbox sessions\n"
-        "  ai-run destroy             Cleanup sandbox resources\n"
+        "  ai-run stats               Traffic and admission counters (JSON)\n"
+        "  ai-run destroy             Cleanup resources of dead sandboxes\n"
+        "  ai-run freeze|thaw|status <pid>\n"
+        "                             Freeze, resume or query a running sandbox\n"
+        "  ai-run ipc <pid>           Print the host path of a sandbox's IPC channel\n"
+        "  ai-run layer add <dir|image.squashfs> [name]\n"
+        "                             Import a read-only layer into the store\n"
+        "  ai-run layer list          List stored layers\n"
+        "  ai-run layer rm <name|digest>\n"
+        "                             Remove a layer\n"
         "\n"
         "Examples:\n"
         "  ai-run create              # Create policy in current folder\n"
         "  sudo ai-run run policy.yaml\n"
+        "  ai-run run policy.yaml     # Rootless (user namespace + slirp4netns)\n"
         "  sudo ai-run gui            # Open dashboard\n"
         "\n");
 }
@@ -63,7 +110,8 @@ void print_usage(void)
 /*
  * Register a new sandbox session in the state file
  */
-void register_session(pid_t pid, const char *policy_file, const char *user, const char *cwd)
+void register_session(pid_t pid, const char *policy_file, const char *user, const char *cwd,
+                      const char *veth, const SessionPlacement *placement)
 {
     FILE *f = fopen(STATE_FILE, "r");
     char buffer[4096] = {0};
@@ -83,7 +131,9 @@ void register_session(pid_t pid, const char *policy_file, const char *user, cons
     f = fopen(STATE_FILE, "w");
     if (!f)
     {
-        /* State dir might not exist, that's OK */
+        /* Not fatal: no install.sh yet, or rootless without write access */
+        printf("[!] Warning: Could not register session in %s (%s) - "
+               "'ai-run list' and the dashboard won't show it\n", STATE_FILE, strerror(errno));
         return;
     }
     
@@ -100,8 +150,8 @@ void register_session(pid_t pid, const char *policy_file, const char *user, cons
         fprintf(f, "{\"sessions\":[\n");
     }
     
-    fprintf(f, "  {\"pid\":%d,\"user\":\"%s\",\"policy\":\"%s\",\"cwd\":\"%s\",\"started\":\"%s\",\"status\":\"running\"}\n",
-            pid, user, policy_file, cwd, timestamp);
+    fprintf(f, "  {\"pid\":%d,\"user\":\"%s\",\"policy\":\"%s\",\"cwd\":\"%s\",\"started\":\"%s\",\"veth\":\"%s\",\"cpus\":\"%s\",\"mems\":\"%s\",\"status\":\"running\"}\n",
+            pid, user, policy_file, cwd, timestamp, veth, placement->cpus, placement->mems);
     fprintf(f, "]}");
     fclose(f);
 }
@@ -136,6 +186,31 @@ void unregister_session(pid_t pid)
     }
 }
 
+/*
+ * Append the record of a finished session to the history file: how
+ * long it ran, and why it ended ("exit" or the limit that stopped it)
+ */
+void record_session_end(pid_t pid, const char *policy_file, const char *user,
+                        const SessionMonitor *mon)
+{
+    FILE *f = fopen(HISTORY_FILE, "a");
+    if (!f)
+    {
+        /* State dir might not exist, that's OK */
+        return;
+    }
+    
+    time_t now = time(NULL);
+    char timestamp[64];
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    
+    fprintf(f, "{\"pid\":%d,\"user\":\"%s\",\"policy\":\"%s\",\"ended\":\"%s\","
+               "\"wall_seconds\":%ld,\"cpu_seconds\":%ld,\"frozen_seconds\":%ld,\"reason\":\"%s\"}\n",
+            pid, user, policy_file, timestamp, mon->wall_seconds, mon->cpu_seconds,
+            mon->frozen_seconds, mon->end_reason[0] ? mon->end_reason : "exit");
+    fclose(f);
+}
+
 /*
  * List active sessions
  */
@@ -213,40 +288,596 @@ void create_default_policy(void)
 }
 
 /*
- * Signal synchronization between parent and child
- * Child waits for SIGUSR1 from parent after veth is configured
+ * Signal the sandbox through its pidfd (immune to pid reuse),
+ * falling back to kill() when no pidfd was returned
  */
-static volatile sig_atomic_t veth_ready = 0;
+static int signal_sandbox(int pidfd, pid_t pid, int sig)
+{
+    if (pidfd >= 0)
+        return (int)syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+    return kill(pid, sig);
+}
+
+/*
+ * Everything the startup phases work on. Set up before the clone,
+ * so parent and child each have their own copy at the same address.
+ */
+typedef struct {
+    Policy policy;
+    const char *policy_file;
+    char cwd[512];              /* workspace */
+    char real_user[256];
+    uid_t real_uid;
+    gid_t real_gid;
+    int rootless;
+    int offline;
+    int host_net;               /* veth + NAT on the host (root only) */
+    int proxy;                  /* web traffic only via the package proxy */
+    SandboxNet net;
+    char netns_hash[32];        /* reuse_network_namespace key, or "" */
+    int shared_fd;              /* pinned netns being joined, or -1 */
+    int published;
+    pid_t pid;                  /* sandbox pid (parent side) */
+    pid_t slirp_pid;
+    int slirp_exit_fd;
+    pid_t proxy_pid;
+    pid_t flowlog_pid;
+    int dns_fds[2];             /* DNS stub sockets (UDP, TCP), bound before the clone */
+    pid_t dns_pid;
+    pid_t expose_pid;
+    char dns_server[64];        /* nameserver in the sandbox's resolv.conf */
+    char ipc_dir[512];          /* host side of the IPC channel, or "" */
+    dev_t ipc_dev;              /* ...and its identity, to tell whether it got bound */
+    ino_t ipc_ino;
+    ResolvedWhitelist *resolved;    /* shared mapping, filled by the parent */
+    BindMount layers[MAX_PATHS];    /* resolved "layers:" entries */
+    int layer_count;
+    SeccompProgram seccomp;
+    int audit_chan[2];          /* seccomp listener hand-off, sandbox -> ai-run */
+    pid_t owner;                /* ai-run itself (not visible from the PID namespace) */
+    int owner_fd;               /* pidfd of owner, inherited by the child */
+    SandboxCgroup cgroup;
+    SessionPlacement placement; /* cpu_cores: where it runs ("" = anywhere) */
+} SandboxStartup;
+
+/* ---------- Host-side startup phases (parent) ---------- */
+
+static int phase_map_user(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    if (setup_user_mapping(st->pid, st->real_uid, st->real_gid) != 0)
+    {
+        fprintf(stderr, "[!] Failed to map user namespace\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int phase_resolve(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    printf("[+] Resolving whitelist on the host...\n");
+    return resolve_whitelist(&st->policy, st->resolved);
+}
+
+static int phase_veth(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    if (setup_veth_from_host(&st->net, st->pid) != 0)
+    {
+        fprintf(stderr, "[!] Failed to setup veth pair\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int phase_nat(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    /* Setup NAT for internet access (per-session chain) */
+    setup_nat(&st->net);
+    return 0;
+}
+
+static int phase_shaping(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    /* Bandwidth limits on the host end (policy: egress_rate) */
+    setup_traffic_shaping(&st->net);
+    return 0;
+}
 
-void sigusr1_handler(int sig)
+static int phase_slirp(void *arg)
 {
-    (void)sig;
-    veth_ready = 1;
+    SandboxStartup *st = arg;
+    
+    st->slirp_pid = start_user_network(st->pid, st->policy.ipv6, &st->slirp_exit_fd);
+    if (st->slirp_pid < 0)
+    {
+        printf("[!] slirp4netns unavailable - sandbox will have loopback only\n");
+    }
+    return 0;
+}
+
+static int phase_proxy(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    /* The sandbox firewall only lets web traffic reach this */
+    st->proxy_pid = start_package_proxy(st->net.host_ip, &st->policy, st->pid);
+    return st->proxy_pid > 0 ? 0 : -1;
+}
+
+static int phase_dns_stub(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    /* Not fatal either: resolv.conf already names it, clients time out */
+    st->dns_pid = start_dns_stub(st->dns_fds, st->net.host_ip, &st->policy, st->pid);
+    return 0;
+}
+
+static int phase_expose(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    /* Not fatal: the sandbox works without its ports reachable */
+    st->expose_pid = start_port_exposer(&st->policy, st->pid, st->shared_fd, st->rootless);
+    return 0;
+}
+
+static int phase_flowlog(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    /* Not fatal: the sandbox works the same without its log */
+    st->flowlog_pid = start_flow_logger(st->pid, st->shared_fd, st->rootless,
+                                        st->host_net ? &st->net : NULL);
+    return 0;
+}
+
+static int phase_register(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    /* Register session for dashboard tracking */
+    register_session(st->pid, st->policy_file, st->real_user, st->cwd,
+                     st->host_net ? st->net.veth_host : "", &st->placement);
+    save_session_state(st->pid, st->policy_file, st->real_user);
+    return 0;
+}
+
+static int phase_ipc_publish(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    /* Bound in the sandbox by now: from here on it is found by the session's pid */
+    ipc_channel_publish(st->ipc_dir, sizeof(st->ipc_dir), st->pid);
+    printf("[+] IPC channel: %s (sandbox: %s)\n", st->ipc_dir, SANDBOX_IPC_DIR);
+    return 0;
+}
+
+static int phase_publish(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    /* Pin the fully configured namespace for later sessions */
+    st->published = shared_netns_publish(st->netns_hash, st->pid, &st->net) == 0;
+    return 0;
+}
+
+/* ---------- Sandbox-side startup phases (child) ---------- */
+
+static int phase_mounts(void *arg)
+{
+    (void)arg;
+    
+    /* Mount namespace came with the clone - detach it from the host */
+    if (make_mounts_private() != 0)
+        return -1;
+    
+    /* Also came with the clone: show only the sandbox's own processes */
+    mount_pid_proc();
+    return 0;
+}
+
+static int phase_rootfs(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    return setup_minimal_rootfs(strcmp(st->cwd, "unknown") ? st->cwd : NULL, st->real_user,
+                                st->layers, st->layer_count, st->ipc_dir[0] ? st->ipc_dir : NULL);
+}
+
+static int phase_layers(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    return bind_layers(st->layers, st->layer_count);
+}
+
+static int phase_hide(void *arg)
+{
+    SandboxStartup *st = arg;
+    char resolved[MAX_PATHS][512];
+    const char *paths[MAX_PATHS];
+    
+    for (int i = 0; i < st->policy.protected_count; i++)
+    {
+        resolve_protected_path(st->policy.protected_files[i], st->real_user,
+                               resolved[i], sizeof(resolved[i]));
+        paths[i] = resolved[i];
+    }
+    
+    /* One mount plan for all entries instead of a mount() per path */
+    return hide_paths(paths, st->policy.protected_count);
+}
+
+static int phase_ipc(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    /* Not fatal: tool calls can still fall back to the network */
+    ipc_channel_bind(st->ipc_dir);
+    return 0;
+}
+
+static int phase_dns(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    setup_dns(st->dns_server);
+    return 0;
+}
+
+static int phase_loopback(void *arg)
+{
+    (void)arg;
+    
+    setup_loopback();
+    return 0;
+}
+
+static int phase_sandbox_net(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    setup_veth_in_sandbox(&st->net);
+    return 0;
+}
+
+static int phase_firewall(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    int rc = st->proxy ? setup_firewall_proxy(&st->policy, st->net.host_ip, PROXY_PORT)
+                       : setup_firewall_resolved(&st->policy, st->resolved);
+    unlink(getenv("XTABLES_LOCKFILE"));
+    
+    /* Rootless has no host-side rules behind it, so fail closed */
+    if (rc != 0 && st->rootless)
+    {
+        fprintf(stderr, "[!] Firewall setup failed, refusing to start\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int phase_seccomp(void *arg)
+{
+    SandboxStartup *st = arg;
+    
+    /* Compile only: the filter is loaded on the main thread before exec */
+    compile_seccomp_filter(&st->policy, &st->seccomp);
+    return 0;
 }
 
 void run_sandbox(const char *policy_file)
 {
-    check_root();
+    SandboxStartup st;
+    memset(&st, 0, sizeof(st));
+    st.policy_file = policy_file;
+    st.shared_fd = -1;
+    st.slirp_exit_fd = -1;
+    st.dns_fds[0] = st.dns_fds[1] = -1;
+    st.audit_chan[0] = st.audit_chan[1] = -1;
+    st.owner = getpid();
+    st.owner_fd = (int)syscall(SYS_pidfd_open, st.owner, 0);
+    
+    /*
+     * Without root we build everything inside a user namespace and
+     * route traffic through slirp4netns instead of veth + host NAT.
+     */
+    st.rootless = geteuid() != 0;
+    st.real_uid = getuid();
+    st.real_gid = getgid();
+    
+    /* Resolve now: inside the user namespace we are uid 0 */
+    snprintf(st.real_user, sizeof(st.real_user), "%s", get_real_user());
+    
+    if (getcwd(st.cwd, sizeof(st.cwd)) == NULL)
+    {
+        strcpy(st.cwd, "unknown");
+    }
     
     /* Load policy first (before fork) */
-    Policy policy;
-    if (load_policy(policy_file, &policy) != 0)
+    if (load_policy(policy_file, &st.policy) != 0)
     {
         fprintf(stderr, "Failed to load policy\n");
         exit(EXIT_FAILURE);
     }
     
-    print_policy(&policy);
+    print_policy(&st.policy);
+    
+    /* Wait for the host to have room for another session */
+    if (admission_wait(&st.policy) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    
+    /*
+     * Namespace reuse: sessions with an identical network policy share
+     * one pinned netns. The lock is held until we either attach to an
+     * existing namespace or have published the one we are building.
+     */
+    int netns_lock = -1;
+    
+    /* network: none - nothing on the host side at all */
+    st.offline = st.policy.loopback_only;
+    
+    /* Host-side veth, NAT and shaping need root */
+    st.host_net = !st.offline && !st.rootless;
+    st.proxy = st.host_net && st.policy.package_proxy;
+    
+    if (st.rootless)
+    {
+        printf("[+] Rootless mode (user namespace)\n");
+        if (st.policy.reuse_netns || st.policy.egress_rate[0] || st.policy.max_connections > 0 ||
+            st.policy.package_proxy)
+        {
+            printf("[!] Warning: reuse_network_namespace, egress_rate, max_connections "
+                   "and package_proxy need root and are ignored\n");
+        }
+    }
+    
+    /* IPv6 only where the host has it to pass on (see host_has_ipv6) */
+    if (st.policy.ipv6 && !st.offline && !host_has_ipv6())
+    {
+        printf("[!] Host has no IPv6 default route - sandbox gets IPv4 only\n");
+        st.policy.ipv6 = 0;
+    }
+    
+    /*
+     * Reserve this session's veth names, subnet and NAT chain. Done
+     * before taking the namespace lock because allocation may need to
+     * garbage-collect other (possibly shared) slots.
+     */
+    if (st.host_net && alloc_sandbox_net(&st.net) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    memcpy(st.net.egress_rate, st.policy.egress_rate, sizeof(st.net.egress_rate));
+    memcpy(st.net.egress_burst, st.policy.egress_burst, sizeof(st.net.egress_burst));
+    st.net.max_connections = st.policy.max_connections;
+    st.net.ipv6 = st.policy.ipv6;
+    
+    if (st.policy.reuse_netns && st.host_net)
+    {
+        policy_network_hash(&st.policy, st.netns_hash, sizeof(st.netns_hash));
+        netns_lock = shared_netns_lock(st.netns_hash);
+        st.shared_fd = shared_netns_acquire(st.netns_hash);
+        
+        if (st.shared_fd >= 0)
+        {
+            /* Joining: host side already belongs to the pinned namespace */
+            release_sandbox_net(&st.net);
+            sandbox_net_from_slot(shared_netns_slot(st.netns_hash), &st.net);
+            if (netns_lock >= 0)
+            {
+                close(netns_lock);
+                netns_lock = -1;
+            }
+        }
+    }
+    
+    /*
+     * DNS: bind the session's caching stub now - the veth address need
+     * not exist yet - so the child knows what its resolv.conf names.
+     * Rootless (slirp4netns) has no host address to offer; there, and
+     * if port 53 is taken, the sandbox asks the upstream itself.
+     */
+    if (!st.offline)
+    {
+        if (st.host_net && dns_stub_listen(st.net.host_ip, st.dns_fds) == 0)
+            snprintf(st.dns_server, sizeof(st.dns_server), "%s", st.net.host_ip);
+        else
+            dns_upstream_address(&st.policy, st.dns_server, sizeof(st.dns_server));
+    }
+    
+    /*
+     * IPC channel: the directory has to exist before the clone for the
+     * child to bind it; it gets the sandbox's pid as its name later
+     */
+    struct stat ipc_stat;
+    if (ipc_channel_create(st.real_user, st.rootless, st.ipc_dir, sizeof(st.ipc_dir)) == 0 &&
+        stat(st.ipc_dir, &ipc_stat) == 0)
+    {
+        st.ipc_dev = ipc_stat.st_dev;
+        st.ipc_ino = ipc_stat.st_ino;
+    }
+    else
+    {
+        st.ipc_dir[0] = '\0';
+    }
+    
+    /*
+     * Look layers up in the store now: squashfs images get mounted on
+     * the host (once, shared by all sessions) before the child exists.
+     */
+    for (int i = 0; i < st.policy.layer_count; i++)
+    {
+        char ref[MAX_LEN];
+        BindMount *bind = &st.layers[st.layer_count];
+        
+        snprintf(ref, sizeof(ref), "%s", st.policy.layers[i]);
+        char *target = strchr(ref, ':');
+        *target++ = '\0';
+        
+        if (layer_resolve(ref, bind->source, sizeof(bind->source)) != 0)
+        {
+            printf("[!] Warning: Layer '%s' unavailable, skipping\n", ref);
+            continue;
+        }
+        snprintf(bind->target, sizeof(bind->target), "%s", target);
+        st.layer_count++;
+    }
+    
+    /* Whitelist lookups done by the parent, read by the child's firewall */
+    st.resolved = mmap(NULL, sizeof(ResolvedWhitelist), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (st.resolved == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < MAX_PATHS; i++)
+    {
+        st.resolved->entries[i].count = -1;
+    }
+    
+    /*
+     * Startup as a dependency graph: anything not linked below runs
+     * concurrently, across both processes. The child needs the veth
+     * only for its address/route, and nothing but the shell needs NAT.
+     */
+    PhaseBoard *board = phase_board_create();
+    if (!board)
+    {
+        exit(EXIT_FAILURE);
+    }
+    
+    int build_net = !st.offline && st.shared_fd < 0;
+    int ph_map = -1, ph_resolve = -1, ph_veth = -1, ph_nat = -1, ph_shaping = -1;
+    int ph_slirp = -1, ph_mounts, ph_rootfs = -1, ph_layers = -1, ph_hide, ph_dns = -1, ph_lo = -1;
+    int ph_snet = -1, ph_fw = -1, ph_seccomp, ph_ready, ph_register, ph_proxy = -1;
+    int ph_flowlog = -1, ph_dns_stub = -1, ph_expose = -1, ph_ipc = -1, ph_ipc_publish = -1;
+    
+    /* Rootless: nothing in the child may run before the uid/gid maps exist */
+    if (st.rootless)
+        ph_map = phase_add(board, "map-user", PHASE_HOST, phase_map_user, &st, 0);
+    unsigned mapped = PHASE_DEP(ph_map);
+    
+    /* With the package proxy the whitelist is checked by name, not by address */
+    if (build_net && st.policy.whitelist_count > 0 && !st.proxy)
+        ph_resolve = phase_add(board, "resolve", PHASE_HOST, phase_resolve, &st, 0);
+    if (build_net && st.host_net)
+    {
+        ph_veth = phase_add(board, "veth", PHASE_HOST, phase_veth, &st, 0);
+        ph_nat = phase_add(board, "nat", PHASE_HOST, phase_nat, &st, PHASE_DEP(ph_veth));
+        ph_shaping = phase_add(board, "shaping", PHASE_HOST, phase_shaping, &st, PHASE_DEP(ph_veth));
+    }
+    if (build_net && st.rootless)
+        ph_slirp = phase_add(board, "slirp4netns", PHASE_HOST, phase_slirp, &st, mapped);
+    ph_register = phase_add(board, "register", PHASE_HOST, phase_register, &st, 0);
+    
+    /* Binds the host end of the veth and logs into the session directory */
+    if (st.proxy)
+        ph_proxy = phase_add(board, "proxy", PHASE_HOST, phase_proxy, &st,
+                             PHASE_DEP(ph_veth) | PHASE_DEP(ph_register));
+    
+    /* Logs into the session directory, like the proxy */
+    if (st.dns_fds[0] >= 0)
+        ph_dns_stub = phase_add(board, "dns-stub", PHASE_HOST, phase_dns_stub, &st,
+                                PHASE_DEP(ph_register));
+    
+    /* Enters the sandbox's namespaces (rootless: once they are mapped) */
+    if (st.policy.expose_count > 0)
+        ph_expose = phase_add(board, "expose", PHASE_HOST, phase_expose, &st,
+                              mapped | PHASE_DEP(ph_register));
+    
+    /* Subscribes to the sandbox's netfilter events before the shell starts */
+    if (!st.offline && st.policy.flow_log)
+        ph_flowlog = phase_add(board, "flow-log", PHASE_HOST, phase_flowlog, &st, mapped);
+    
+    ph_mounts = phase_add(board, "mounts", PHASE_SANDBOX, phase_mounts, &st, mapped);
+    
+    /*
+     * rootfs: minimal swaps the root under everything else - anything
+     * that touches paths or execs a helper has to wait for it
+     */
+    if (st.policy.minimal_rootfs)
+        ph_rootfs = phase_add(board, "rootfs", PHASE_SANDBOX, phase_rootfs, &st, PHASE_DEP(ph_mounts));
+    unsigned fs_ready = PHASE_DEP(ph_mounts) | PHASE_DEP(ph_rootfs);
+    
+    /* The minimal root binds layers itself; on the host root they go first
+     * so protected paths inside a layer's mount point are still hidden */
+    if (!st.policy.minimal_rootfs && st.layer_count > 0)
+        ph_layers = phase_add(board, "layers", PHASE_SANDBOX, phase_layers, &st, fs_ready);
+    
+    ph_hide = phase_add(board, "hide", PHASE_SANDBOX, phase_hide, &st,
+                        fs_ready | PHASE_DEP(ph_layers));
+    
+    /* The minimal root binds the IPC channel itself; renamed once bound */
+    if (st.ipc_dir[0] && !st.policy.minimal_rootfs)
+        ph_ipc = phase_add(board, "ipc", PHASE_SANDBOX, phase_ipc, &st, fs_ready);
+    if (st.ipc_dir[0])
+        ph_ipc_publish = phase_add(board, "ipc-publish", PHASE_HOST, phase_ipc_publish, &st,
+                                   PHASE_DEP(ph_ipc) | PHASE_DEP(ph_rootfs));
+    if (!st.offline)
+        ph_dns = phase_add(board, "dns", PHASE_SANDBOX, phase_dns, &st, fs_ready);
+    if (st.offline || build_net)
+        ph_lo = phase_add(board, "loopback", PHASE_SANDBOX, phase_loopback, &st, mapped);
+    if (build_net && st.host_net)
+        ph_snet = phase_add(board, "sandbox-net", PHASE_SANDBOX, phase_sandbox_net, &st,
+                            PHASE_DEP(ph_veth) | PHASE_DEP(ph_rootfs));
+    if (build_net)
+        ph_fw = phase_add(board, "firewall", PHASE_SANDBOX, phase_firewall, &st,
+                          mapped | PHASE_DEP(ph_resolve) | PHASE_DEP(ph_rootfs));
+    ph_seccomp = phase_add(board, "seccomp", PHASE_SANDBOX, phase_seccomp, &st, 0);
+    ph_ready = phase_add(board, "ready", PHASE_SANDBOX, NULL, NULL,
+                         PHASE_DEP(ph_hide) | PHASE_DEP(ph_dns) | PHASE_DEP(ph_lo) |
+                         PHASE_DEP(ph_snet) | PHASE_DEP(ph_fw) | PHASE_DEP(ph_seccomp) |
+                         PHASE_DEP(ph_nat) | PHASE_DEP(ph_shaping) | PHASE_DEP(ph_slirp) |
+                         PHASE_DEP(ph_proxy) | PHASE_DEP(ph_flowlog) | PHASE_DEP(ph_dns_stub) |
+                         PHASE_DEP(ph_expose) | PHASE_DEP(ph_ipc) | PHASE_DEP(ph_ipc_publish));
+    
+    if (build_net && st.netns_hash[0])
+        phase_add(board, "publish", PHASE_HOST, phase_publish, &st, PHASE_DEP(ph_ready));
+    
+    /* Audited syscalls: the child sends its seccomp listener back over this */
+    if (st.policy.audited_syscalls_count > 0 &&
+        socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, st.audit_chan) != 0)
+    {
+        perror("socketpair");
+        exit(EXIT_FAILURE);
+    }
+    
+    /* Everything the session starts lives in here, so it can all be killed at once */
+    sandbox_cgroup_create(&st.cgroup, st.rootless);
     
-    /* Setup signal handler for synchronization */
-    signal(SIGUSR1, sigusr1_handler);
+    /*
+     * Clone the child straight into its namespaces. A joining session
+     * keeps the host netns here and setns()es into the shared one.
+     * The child is PID 1 of its own PID namespace: when it exits,
+     * the kernel kills everything the session left running.
+     */
+    unsigned long ns_flags = CLONE_NEWNS | CLONE_NEWIPC | CLONE_NEWUTS | CLONE_NEWPID;
+    if (st.shared_fd < 0)
+        ns_flags |= CLONE_NEWNET;
+    if (st.rootless)
+        ns_flags |= CLONE_NEWUSER;
     
-    /* Fork: parent stays in host namespace, child enters sandbox */
-    pid_t pid = fork();
+    int pidfd = -1;
+    int cgroup_fd = st.cgroup.dir_fd;
+    pid_t pid = clone_sandbox(ns_flags, &cgroup_fd, &pidfd);
     
     if (pid < 0)
     {
-        perror("fork");
         exit(EXIT_FAILURE);
     }
     
@@ -254,131 +885,337 @@ void run_sandbox(const char *policy_file)
     {
         /* ======== CHILD PROCESS (becomes the sandbox) ======== */
         
-        /* 1. Create mount namespace for filesystem isolation */
-        create_mount_namespace();
+        /* Lock stays with the parent; closing our copy does not unlock it */
+        if (netns_lock >= 0)
+            close(netns_lock);
+        if (st.audit_chan[0] >= 0)
+            close(st.audit_chan[0]);
         
-        /* 2. Create network namespace */
-        create_network_namespace();
+        /* The DNS stub's sockets belong to the host netns, not to sandbox root */
+        for (int i = 0; i < 2; i++)
+        {
+            if (st.dns_fds[i] >= 0)
+                close(st.dns_fds[i]);
+        }
         
-        /* 3. Signal parent that we're in the new namespace */
-        kill(getppid(), SIGUSR1);
+        /*
+         * Die with ai-run instead of running on unsupervised. The pidfd
+         * was opened before the clone - from in here its pid is 0 -
+         * and also lets our phases notice if it dies mid-setup.
+         */
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        struct pollfd owner_poll = { .fd = st.owner_fd, .events = POLLIN };
+        if (st.owner_fd >= 0 && poll(&owner_poll, 1, 0) > 0)
+            exit(EXIT_FAILURE);
         
-        /* 4. Wait for parent to setup veth pair */
-        printf("[*] Waiting for network configuration...\n");
-        while (!veth_ready)
+        /* Network already configured: join it (per-thread, so before the phases) */
+        if (st.shared_fd >= 0 && join_network_namespace(st.shared_fd) != 0)
+            exit(EXIT_FAILURE);
+        
+        /*
+         * The host's /run/xtables.lock would serialize our firewall
+         * against the parent's NAT setup, and is not writable rootless.
+         * It only guards this namespace's tables, so use a private one.
+         */
+        char lockfile[64];
+        snprintf(lockfile, sizeof(lockfile), "/tmp/ai-sandbox-xtables-%d.lock", st.owner);
+        setenv("XTABLES_LOCKFILE", lockfile, 1);
+        
+        if (phase_run(board, PHASE_SANDBOX, st.owner_fd) != 0)
         {
-            usleep(10000); /* 10ms */
+            fprintf(stderr, "[!] Sandbox setup failed\n");
+            exit(EXIT_FAILURE);
         }
+        phase_report(board, ph_ready);
+        unsetenv("XTABLES_LOCKFILE");
         
-        /* 5. Configure network inside sandbox */
-        setup_sandbox_network();
-        
-        /* 6. Apply firewall rules (inside sandbox namespace) */
-        setup_firewall_with_policy(&policy);
+        if (st.proxy)
+        {
+            char proxy_url[64];
+            snprintf(proxy_url, sizeof(proxy_url), "http://%s:%d", st.net.host_ip, PROXY_PORT);
+            setenv("http_proxy", proxy_url, 1);
+            setenv("https_proxy", proxy_url, 1);
+            setenv("HTTP_PROXY", proxy_url, 1);
+            setenv("HTTPS_PROXY", proxy_url, 1);
+            setenv("no_proxy", "localhost,127.0.0.1", 1);
+        }
         
-        /* 7. Enforce file restrictions */
-        const char *user = get_real_user();
+        /* Only if it really is ours: rootless on the host root it may not be */
+        struct stat ipc_stat;
+        int ipc_bound = st.ipc_dir[0] && stat(SANDBOX_IPC_DIR, &ipc_stat) == 0 &&
+                        ipc_stat.st_dev == st.ipc_dev && ipc_stat.st_ino == st.ipc_ino;
+        if (ipc_bound)
+            setenv(IPC_ENV, SANDBOX_IPC_DIR, 1);
         
-        for (int i = 0; i < policy.protected_count; i++)
+        /*
+         * Apply seccomp filter last, on the thread that execs. With
+         * audited syscalls nothing may run under it unsupervised: hand
+         * the listener over before anything else, and keep no copy -
+         * whoever holds it can answer for the sandbox.
+         */
+        int notify_fd = -1;
+        if (load_seccomp_program(&st.seccomp, st.audit_chan[1] >= 0 ? &notify_fd : NULL) != 0 &&
+            st.seccomp.audited > 0)
         {
-            char resolved_path[512];
-            struct stat st;
-            
-            if (policy.protected_files[i][0] == '~')
-            {
-                snprintf(resolved_path, sizeof(resolved_path),
-                         "/home/%s%s", user,
-                         policy.protected_files[i] + 1);
-            }
-            else
-            {
-                snprintf(resolved_path, sizeof(resolved_path),
-                         "%s", policy.protected_files[i]);
-            }
-            
-            if (stat(resolved_path, &st) == 0)
+            fprintf(stderr, "[!] Audited syscalls cannot be supervised, refusing to start\n");
+            exit(EXIT_FAILURE);
+        }
+        if (notify_fd >= 0)
+        {
+            if (supervisor_send_listener(st.audit_chan[1], notify_fd) != 0)
             {
-                if (S_ISDIR(st.st_mode))
-                    hide_directory(resolved_path);
-                else if (S_ISREG(st.st_mode))
-                    hide_file(resolved_path);
+                fprintf(stderr, "[!] Failed to reach the syscall supervisor\n");
+                exit(EXIT_FAILURE);
             }
+            close(notify_fd);
         }
+        if (st.audit_chan[1] >= 0)
+            close(st.audit_chan[1]);
         
-        /* 8. Apply seccomp filter (syscall restrictions) */
-        setup_seccomp_filter(&policy);
-        
-        /* 9. Launch sandbox shell */
+        /* Launch sandbox shell */
         printf("[+] Launching sandboxed shell...\n");
         printf("===========================================\n");
         printf("  AI SANDBOX ACTIVE\n");
-        printf("  Network: Enabled with DNS\n");
+        printf("  Network: %s\n", st.offline ? "None (loopback only)" : "Enabled with DNS");
         printf("  Protected files: Hidden\n");
-        if (policy.blocked_syscalls_count > 0)
+        if (st.policy.minimal_rootfs)
+        {
+            printf("  Root filesystem: minimal (workspace only)\n");
+        }
+        if (st.proxy)
+        {
+            printf("  Package proxy: http://%s:%d\n", st.net.host_ip, PROXY_PORT);
+        }
+        if (ipc_bound)
+        {
+            printf("  IPC channel: %s\n", SANDBOX_IPC_DIR);
+        }
+        for (int i = 0; i < st.policy.expose_count; i++)
+        {
+            printf("  Exposed: port %d <- host 127.0.0.1:%d\n",
+                   st.policy.expose_ports[i].sandbox, st.policy.expose_ports[i].host);
+        }
+        if (st.policy.blocked_syscalls_count > 0)
         {
-            printf("  Blocked syscalls: %d\n", policy.blocked_syscalls_count);
+            printf("  Blocked syscalls: %d\n", st.policy.blocked_syscalls_count);
+        }
+        if (st.seccomp.audited > 0)
+        {
+            printf("  Audited syscalls: %d (supervised by ai-run)\n", st.seccomp.audited);
         }
         printf("  Type 'exit' to leave sandbox\n");
         printf("===========================================\n");
+        fflush(stdout);
         
-        execl("/bin/bash", "/bin/bash", NULL);
-        perror("execl");
-        exit(EXIT_FAILURE);
+        if (st.owner_fd >= 0)
+            close(st.owner_fd);
+        
+        /* We stay behind as the namespace's init; the shell is PID 2 */
+        pid_t shell = fork();
+        if (shell < 0)
+        {
+            perror("fork");
+            exit(EXIT_FAILURE);
+        }
+        if (shell == 0)
+        {
+            execl("/bin/bash", "/bin/bash", NULL);
+            perror("execl");
+            _exit(127);
+        }
+        exit(run_sandbox_init(shell));
     }
     else
     {
         /* ======== PARENT PROCESS (stays in host namespace) ======== */
         
-        /* Wait for child to enter new namespace */
-        printf("[*] Parent: waiting for child to create namespace...\n");
-        while (!veth_ready)
+        int audit_id = -1;
+        
+        st.pid = pid;
+        if (st.audit_chan[1] >= 0)
+            close(st.audit_chan[1]);
+        if (st.owner_fd >= 0)
+            close(st.owner_fd);
+        
+        /* Old kernel or no clone3: move it now, before the shell exists */
+        if (cgroup_fd < 0 && st.cgroup.path[0])
+            sandbox_cgroup_add(&st.cgroup, pid);
+        
+        /* Its own cores (cpu_cores), settled before the shell starts */
+        if (st.policy.cpu_cores > 0 &&
+            placement_join(pid, st.policy.cpu_cores, &st.cgroup, &st.placement) == 0)
         {
-            usleep(10000); /* 10ms */
+            printf("[+] Placed on CPUs %s (memory node %s)\n", st.placement.cpus, st.placement.mems);
         }
         
-        /* Small delay to ensure namespace is fully established */
-        usleep(100000); /* 100ms */
+        if (phase_run(board, PHASE_HOST, pidfd) != 0)
+        {
+            fprintf(stderr, "[!] Sandbox setup failed\n");
+            signal_sandbox(pidfd, pid, SIGKILL);
+        }
         
-        /* Setup veth pair from host side */
-        if (setup_veth_from_host(pid) != 0)
+        /*
+         * Supervise audited syscalls from here on; the listener may
+         * already be waiting in the channel. The whitelist was just
+         * resolved, so connect() sees what the firewall allows.
+         */
+        if (st.audit_chan[0] >= 0)
         {
-            fprintf(stderr, "[!] Failed to setup veth pair\n");
-            kill(pid, SIGTERM);
-            exit(EXIT_FAILURE);
+            if (supervisor_start() == 0)
+                audit_id = supervisor_add_sandbox(pid, &st.policy, st.resolved,
+                                                  st.proxy ? st.net.host_ip : "", st.audit_chan[0]);
+            if (audit_id < 0)
+            {
+                /* Audited calls would hang with nobody to answer them */
+                fprintf(stderr, "[!] Syscall supervisor unavailable, stopping sandbox\n");
+                close(st.audit_chan[0]);
+                signal_sandbox(pidfd, pid, SIGKILL);
+            }
         }
         
-        /* Setup NAT for internet access */
-        setup_nat();
+        if (st.shared_fd >= 0)
+        {
+            /* Child joined the pinned namespace itself; only the flow logger needed it here */
+            close(st.shared_fd);
+        }
         
-        /* Register session for dashboard tracking */
-        char cwd[512];
-        if (getcwd(cwd, sizeof(cwd)) == NULL)
+        if (st.shared_fd < 0 && !st.published)
         {
-            strcpy(cwd, "unknown");
+            /* Not shared after all - clean up like a normal session */
+            st.netns_hash[0] = '\0';
         }
-        register_session(pid, policy_file, get_real_user(), cwd);
         
-        /* Signal child that veth is ready */
-        kill(pid, SIGUSR1);
+        if (netns_lock >= 0)
+        {
+            close(netns_lock);
+            netns_lock = -1;
+        }
         
-        /* Wait for child (sandbox) to exit */
-        int status;
-        waitpid(pid, &status, 0);
+        /*
+         * Wait for child (sandbox) to exit, freezing the session while
+         * it sits idle (idle_freeze) or when asked to (ai-run freeze),
+         * and stopping it when a max_*_time limit runs out
+         */
+        SessionMonitor mon = {
+            .pid = pid,
+            .pidfd = pidfd,
+            .cgroup = &st.cgroup,
+            .idle_freeze = st.policy.idle_freeze,
+            .idle_reclaim = st.policy.idle_reclaim,
+            .max_wall_time = st.policy.max_wall_time,
+            .max_cpu_time = st.policy.max_cpu_time,
+            .max_idle_time = st.policy.max_idle_time,
+        };
+        monitor_session(&mon);
+        if (mon.freezes > 0)
+        {
+            printf("[+] Session was frozen %d time(s), %lds in total\n",
+                   mon.freezes, mon.frozen_seconds);
+        }
+        if (mon.end_reason[0])
+        {
+            printf("[+] Session stopped: %s\n", mon.end_reason);
+        }
+        record_session_end(pid, st.policy_file, st.real_user, &mon);
+        
+        /*
+         * Its PID namespace is gone with it; the cgroup also catches
+         * anything that joined the session from outside. One write,
+         * however many processes are left.
+         */
+        if (sandbox_cgroup_kill(&st.cgroup) == 0)
+            sandbox_cgroup_remove(&st.cgroup);
         
         /* Cleanup */
-        printf("[+] Cleaning up network...\n");
-        cleanup_veth();
+        if (audit_id >= 0)
+        {
+            unsigned long allowed, denied;
+            
+            supervisor_stop();
+            supervisor_counts(audit_id, &allowed, &denied);
+            printf("[+] Supervisor answered %lu audited calls (%lu denied)\n",
+                   allowed + denied, denied);
+        }
+        if (pidfd >= 0)
+            close(pidfd);
+        phase_board_destroy(board);
+        munmap(st.resolved, sizeof(ResolvedWhitelist));
         unregister_session(pid);
+        remove_session_state(pid);
+        if (st.policy.cpu_cores > 0)
+        {
+            /* Spread the remaining sessions over the cores we gave up */
+            placement_rebalance();
+        }
+        
+        if (st.slirp_pid > 0)
+        {
+            stop_user_network(st.slirp_pid, st.slirp_exit_fd);
+        }
+        stop_package_proxy(st.proxy_pid);
+        stop_dns_stub(st.dns_pid);
+        stop_port_exposer(st.expose_pid);
+        stop_flow_logger(st.flowlog_pid);
+        ipc_channel_remove(st.ipc_dir);
+        
+        /*
+         * Network teardown is handed to a detached reaper that batches
+         * link and rule deletions across sessions, so we return as soon
+         * as the sandbox exits. Fall back to inline cleanup if the
+         * queue can't be written.
+         */
+        if (st.host_net)
+        {
+            SandboxNet *net = &st.net;
+            
+            if (queue_network_teardown(net, st.netns_hash, getpid()) == 0)
+            {
+                printf("[+] Network cleanup queued\n");
+                spawn_network_reaper();
+            }
+            else if (st.netns_hash[0])
+            {
+                int slot = shared_netns_release(st.netns_hash, getpid());
+                if (slot > 0)
+                {
+                    sandbox_net_from_slot(slot, net);
+                    cleanup_nat(net);
+                    cleanup_veth(net);
+                    release_sandbox_net(net);
+                }
+            }
+            else
+            {
+                printf("[+] Cleaning up network...\n");
+                cleanup_nat(net);
+                cleanup_veth(net);
+                release_sandbox_net(net);
+            }
+        }
         
         printf("[+] Sandbox session ended\n");
     }
 }
 
+/*
+ * Reclaim host resources of sandboxes whose ai-run process is gone
+ * (veth pairs, per-session NAT chains, pinned namespaces, slots,
+ * IPC channel directories).
+ * Live sessions are left untouched.
+ */
 void destroy_sandbox(void)
 {
+    check_root();
+    
     printf("[+] Cleaning up...\n");
-    cleanup_veth();
-    printf("[+] Cleanup complete\n");
+    int reclaimed = gc_sandbox_networks();
+    int cgroups = gc_sandbox_cgroups();
+    int channels = gc_ipc_channels();
+    printf("[+] Cleanup complete (%d stale session network(s), %d cgroup(s), "
+           "%d IPC channel(s) removed)\n", reclaimed, cgroups, channels);
+    
+    /* Cores held by crashed sessions go back to the live ones */
+    placement_rebalance();
 }
 
 /* ---------- MAIN ---------- */
@@ -405,10 +1242,29 @@ int main(int argc, char *argv[])
         }
         run_sandbox(argv[2]);
     }
+    else if (strcmp(argv[1], "reload") == 0)
+    {
+        if (argc < 4)
+        {
+            fprintf(stderr, "Error: session pid and policy file required\n");
+            fprintf(stderr, "Usage: ai-run reload <pid> <policy.yaml>\n");
+            exit(EXIT_FAILURE);
+        }
+        check_root();
+        if (reload_session(atoi(argv[2]), argv[3]) != 0)
+        {
+            return 1;
+        }
+    }
     else if (strcmp(argv[1], "list") == 0)
     {
         list_sessions();
     }
+    else if (strcmp(argv[1], "stats") == 0)
+    {
+        print_network_stats();
+        print_admission_stats();
+    }
     else if (strcmp(argv[1], "gui") == 0)
     {
         /* Launch the web dashboard */
@@ -424,6 +1280,55 @@ int main(int argc, char *argv[])
     {
         destroy_sandbox();
     }
+    else if (strcmp(argv[1], "freeze") == 0 || strcmp(argv[1], "thaw") == 0 ||
+             strcmp(argv[1], "status") == 0)
+    {
+        if (argc < 3)
+        {
+            fprintf(stderr, "Error: session pid required\n");
+            fprintf(stderr, "Usage: ai-run %s <pid>\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
+        return session_control(atoi(argv[2]), argv[1]) == 0 ? 0 : 1;
+    }
+    else if (strcmp(argv[1], "ipc") == 0)
+    {
+        char path[512];
+        
+        if (argc < 3)
+        {
+            fprintf(stderr, "Error: session pid required\n");
+            fprintf(stderr, "Usage: ai-run ipc <pid>\n");
+            exit(EXIT_FAILURE);
+        }
+        if (ipc_channel_path(atoi(argv[2]), path, sizeof(path)) != 0)
+        {
+            fprintf(stderr, "[!] Session %s has no IPC channel\n", argv[2]);
+            return 1;
+        }
+        printf("%s\n", path);
+    }
+    else if (strcmp(argv[1], "layer") == 0)
+    {
+        if (argc >= 3 && strcmp(argv[2], "list") == 0)
+        {
+            return layer_list() == 0 ? 0 : 1;
+        }
+        if (argc >= 4 && strcmp(argv[2], "add") == 0)
+        {
+            check_root();
+            return layer_add(argv[3], argc >= 5 ? argv[4] : NULL) == 0 ? 0 : 1;
+        }
+        if (argc >= 4 && strcmp(argv[2], "rm") == 0)
+        {
+            check_root();
+            return layer_remove(argv[3]) == 0 ? 0 : 1;
+        }
+        fprintf(stderr, "Usage: ai-run layer add <dir|image.squashfs> [name]\n"
+                        "       ai-run layer list\n"
+                        "       ai-run layer rm <name|digest>\n");
+        return 1;
+    }
     else
     {
         fprintf(stderr, "Unknown command: %s\n", argv[1]);
@@ -0,0 +1,565 @@
+/*
+ * monitor.c - Session monitor: freeze idle sandboxes, thaw on activity
+ *
+ * WHY: Agent sessions stay open for hours between tasks. The idle
+ * shell costs nothing, but the dev servers, file watchers and language
+ * servers left running in it keep waking up, burning CPU and holding
+ * memory other sessions could use.
+ *
+ * HOW IT WORKS:
+ * 1. Instead of a bare waitpid(), ai-run waits in an epoll loop on the
+ *    sandbox's pidfd, a once-a-second timerfd and the session's control
+ *    socket (SESSION_RUN_DIR/<pid>/control)
+ * 2. Every tick samples three activity signals: the terminal's access
+ *    and modify times (the tty bumps them on every read and write, at
+ *    8 second granularity), the cgroup's CPU time (cpu.stat) and the
+ *    byte counters of the sandbox's interfaces (/proc/<pid>/net/dev)
+ * 3. After idle_freeze seconds with none of them moving the session
+ *    cgroup is frozen - cgroup.freeze stops the whole tree at once,
+ *    without a signal anything in it could see - and with idle_reclaim
+ *    its memory is pushed out to swap/zswap through memory.reclaim
+ * 4. While frozen, stdin joins the epoll set: new terminal input thaws
+ *    the session and stays queued for whatever reads it. New incoming
+ *    traffic and "thaw" on the control socket (dashboard, ai-run thaw)
+ *    do too
+ *
+ * The same loop enforces the lifetime limits. max_wall_time is a
+ * one-shot CLOCK_BOOTTIME timerfd (suspend counts); max_cpu_time and
+ * max_idle_time are checked on the tick, with frozen time counting as
+ * idle. When one runs out everything in the session gets SIGTERM, the
+ * shell is hung up once it is the only thing left (an interactive bash
+ * ignores SIGTERM), and a grace timerfd SIGKILLs whatever remains.
+ * ai-run then tears the session down as if the shell had exited.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "monitor.h"
+#include "reload.h"
+
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+
+/* epoll tags */
+enum { EV_EXIT, EV_TICK, EV_CONTROL, EV_STDIN, EV_WALL, EV_GRACE };
+
+typedef struct {
+    long long cpu_usec;
+    unsigned long long net_bytes;
+    struct timespec tty_atime;
+    struct timespec tty_mtime;
+} ActivitySample;
+
+/* rx + tx bytes of every interface but lo in the sandbox's namespace */
+static unsigned long long sandbox_net_bytes(pid_t pid)
+{
+    char path[64];
+    char line[512];
+    unsigned long long total = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/net/dev", pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        char name[32];
+        unsigned long long rx, tx;
+
+        /* "  eth0: rx_bytes packets errs drop fifo frame compressed multicast tx_bytes ..." */
+        if (sscanf(line, " %31[^:]: %llu %*u %*u %*u %*u %*u %*u %*u %llu",
+                   name, &rx, &tx) != 3)
+            continue;
+        if (strcmp(name, "lo") != 0)
+            total += rx + tx;
+    }
+    fclose(f);
+    return total;
+}
+
+static void sample_activity(const SessionMonitor *mon, int tty, ActivitySample *s)
+{
+    struct stat st;
+
+    s->cpu_usec = mon->cgroup ? sandbox_cgroup_cpu_usec(mon->cgroup) : -1;
+    s->net_bytes = sandbox_net_bytes(mon->pid);
+    if (tty && fstat(STDIN_FILENO, &st) == 0)
+    {
+        s->tty_atime = st.st_atim;
+        s->tty_mtime = st.st_mtim;
+    }
+}
+
+static int is_active(const ActivitySample *prev, const ActivitySample *now, int seconds)
+{
+    if (now->tty_atime.tv_sec != prev->tty_atime.tv_sec ||
+        now->tty_mtime.tv_sec != prev->tty_mtime.tv_sec)
+        return 1;
+    if (now->net_bytes != prev->net_bytes)
+        return 1;
+    if (now->cpu_usec >= 0 && prev->cpu_usec >= 0 &&
+        now->cpu_usec - prev->cpu_usec > (long long)IDLE_CPU_USEC_PER_SEC * seconds)
+        return 1;
+    return 0;
+}
+
+static int open_control_socket(pid_t pid)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%d/%s",
+             SESSION_RUN_DIR, pid, SESSION_CONTROL_NAME);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+
+    /* No session directory (rootless without /run access): no control socket */
+    unlink(addr.sun_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    chmod(addr.sun_path, 0600);
+    return fd;
+}
+
+typedef struct {
+    SessionMonitor *mon;
+    int epfd;
+    int tty;
+    int frozen;
+    int idle;                   /* seconds without activity */
+    int queued;                 /* unread input on the tty when frozen */
+    int stopping;               /* a limit ran out, SIGTERM sent */
+    int hung_up;
+    int grace_fd;
+    struct timespec frozen_at;
+    ActivitySample last;
+} MonitorState;
+
+static int has_cgroup(const SessionMonitor *mon)
+{
+    return mon->cgroup && mon->cgroup->path[0];
+}
+
+static void signal_init(const SessionMonitor *mon, int sig)
+{
+    syscall(SYS_pidfd_send_signal, mon->pidfd, sig, NULL, 0);
+}
+
+static int freeze_session(MonitorState *ms, const char *why)
+{
+    if (ms->frozen)
+        return 0;
+    if (ms->stopping || !has_cgroup(ms->mon))
+        return -1;
+    if (sandbox_cgroup_freeze(ms->mon->cgroup, 1) != 0)
+    {
+        printf("[!] Could not freeze session cgroup (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    ms->frozen = 1;
+    ms->mon->freezes++;
+    clock_gettime(CLOCK_MONOTONIC, &ms->frozen_at);
+
+    /*
+     * Edge-triggered, and only input beyond what was already queued
+     * counts: typeahead nobody reads would otherwise thaw the session
+     * again right after every freeze
+     */
+    if (ms->tty)
+    {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.u32 = EV_STDIN };
+        if (ioctl(STDIN_FILENO, FIONREAD, &ms->queued) != 0)
+            ms->queued = 0;
+        epoll_ctl(ms->epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+    }
+
+    printf("\n[+] Sandbox %s%s\n", why, ms->tty ? " - press any key to resume" : "");
+    fflush(stdout);
+
+    if (ms->mon->idle_reclaim)
+    {
+        long long freed = sandbox_cgroup_reclaim(ms->mon->cgroup);
+        if (freed > 0)
+            printf("[+] Reclaimed %lld MB from the frozen session\n", freed >> 20);
+        else if (freed < 0 && ms->mon->freezes == 1)
+            printf("[!] memory.reclaim unavailable (no memory controller) - memory stays resident\n");
+        fflush(stdout);
+    }
+    return 0;
+}
+
+static int thaw_session(MonitorState *ms)
+{
+    struct timespec now;
+
+    if (!ms->frozen)
+        return 0;
+    if (sandbox_cgroup_freeze(ms->mon->cgroup, 0) != 0)
+    {
+        printf("[!] Could not thaw session cgroup (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    ms->frozen = 0;
+    ms->idle = 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms->mon->frozen_seconds += now.tv_sec - ms->frozen_at.tv_sec;
+    if (ms->tty)
+        epoll_ctl(ms->epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+
+    /* Don't count the thaw itself as the next interval's activity */
+    sample_activity(ms->mon, ms->tty, &ms->last);
+    return 0;
+}
+
+/* One short request per connection: "<command>\n" -> "<state>\n" */
+static void handle_control(MonitorState *ms, int listen_fd)
+{
+    char cmd[32];
+    const char *reply;
+    struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    ssize_t n = read(fd, cmd, sizeof(cmd) - 1);
+    if (n <= 0)
+    {
+        close(fd);
+        return;
+    }
+    cmd[n] = '\0';
+    cmd[strcspn(cmd, "\r\n")] = '\0';
+
+    if (strcmp(cmd, "freeze") == 0 && freeze_session(ms, "frozen on request") != 0)
+        reply = ms->stopping ? "error: session is stopping\n" : "error: no session cgroup\n";
+    else if (strcmp(cmd, "thaw") == 0 && thaw_session(ms) != 0)
+        reply = "error: thaw failed\n";
+    else if (strcmp(cmd, "freeze") != 0 && strcmp(cmd, "thaw") != 0 && strcmp(cmd, "status") != 0)
+        reply = "error: unknown command\n";
+    else
+        reply = ms->stopping ? "stopping\n" : ms->frozen ? "frozen\n" : "running\n";
+
+    if (write(fd, reply, strlen(reply)) < 0)
+    {
+        /* Client gave up; nothing to tell it */
+    }
+    close(fd);
+}
+
+/*
+ * A limit ran out: ask everything in the session to terminate and give
+ * it SESSION_STOP_GRACE_SEC before the grace timer kills it
+ */
+static void stop_session(MonitorState *ms, const char *limit, int seconds)
+{
+    SessionMonitor *mon = ms->mon;
+    struct itimerspec its = { .it_value = { SESSION_STOP_GRACE_SEC, 0 } };
+
+    if (ms->stopping)
+        return;
+
+    snprintf(mon->end_reason, sizeof(mon->end_reason), "%s (%ds)", limit, seconds);
+    printf("\n[!] Session reached %s - stopping sandbox\n", mon->end_reason);
+    fflush(stdout);
+
+    /* Signals to a frozen tree would wait for the thaw */
+    thaw_session(ms);
+    ms->stopping = 1;
+
+    /* The init forwards SIGTERM to the shell; without a cgroup hang it up now */
+    if (!has_cgroup(mon) || sandbox_cgroup_signal(mon->cgroup, SIGTERM) < 0)
+    {
+        signal_init(mon, SIGTERM);
+        signal_init(mon, SIGHUP);
+        ms->hung_up = 1;
+    }
+    timerfd_settime(ms->grace_fd, 0, &its, NULL);
+}
+
+/* Once a tick: activity, idle freeze and the CPU and idle limits */
+static void monitor_tick(MonitorState *ms, int ticks)
+{
+    SessionMonitor *mon = ms->mon;
+    ActivitySample now;
+
+    memset(&now, 0, sizeof(now));
+    sample_activity(mon, ms->tty, &now);
+
+    if (ms->stopping)
+    {
+        /* Only init and the shell left: hang the shell up like a closed terminal */
+        if (!ms->hung_up && sandbox_cgroup_signal(mon->cgroup, 0) <= 2)
+        {
+            signal_init(mon, SIGHUP);
+            ms->hung_up = 1;
+        }
+        return;
+    }
+
+    if (ms->frozen)
+    {
+        /* Only the outside can move the counters now */
+        if (now.net_bytes != ms->last.net_bytes)
+            thaw_session(ms);
+        else
+            ms->idle += ticks;
+    }
+    else
+    {
+        if (is_active(&ms->last, &now, ticks))
+            ms->idle = 0;
+        else
+            ms->idle += ticks;
+        ms->last = now;
+
+        if (mon->idle_freeze > 0 && ms->idle >= mon->idle_freeze)
+        {
+            char why[48];
+            snprintf(why, sizeof(why), "idle for %ds, frozen", ms->idle);
+            freeze_session(ms, why);
+        }
+    }
+
+    if (mon->max_cpu_time > 0 && now.cpu_usec >= (long long)mon->max_cpu_time * 1000000)
+        stop_session(ms, "max_cpu_time", mon->max_cpu_time);
+    else if (mon->max_idle_time > 0 && ms->idle >= mon->max_idle_time)
+        stop_session(ms, "max_idle_time", mon->max_idle_time);
+}
+
+int monitor_session(SessionMonitor *mon)
+{
+    MonitorState ms;
+    int status = 0;
+
+    struct timespec started, ended;
+
+    mon->freezes = 0;
+    mon->frozen_seconds = 0;
+    mon->end_reason[0] = '\0';
+    clock_gettime(CLOCK_BOOTTIME, &started);
+
+    memset(&ms, 0, sizeof(ms));
+    ms.mon = mon;
+    ms.tty = isatty(STDIN_FILENO);
+    ms.epfd = -1;
+    ms.grace_fd = -1;
+
+    int tick_fd = -1, wall_fd = -1, control_fd = -1;
+
+    if (mon->pidfd < 0)
+    {
+        if (mon->idle_freeze > 0 || mon->max_wall_time > 0 ||
+            mon->max_cpu_time > 0 || mon->max_idle_time > 0)
+            printf("[!] No pidfd for the sandbox - idle freeze and session limits disabled\n");
+        goto wait_only;
+    }
+    if (!has_cgroup(mon))
+    {
+        if (mon->idle_freeze > 0)
+            printf("[!] Idle freeze needs a session cgroup - disabled\n");
+        if (mon->max_cpu_time > 0)
+            printf("[!] max_cpu_time needs a session cgroup - not enforced\n");
+    }
+
+    ms.epfd = epoll_create1(EPOLL_CLOEXEC);
+    tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    wall_fd = timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+    ms.grace_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    control_fd = open_control_socket(mon->pid);
+
+    struct itimerspec tick = { .it_interval = { 1, 0 }, .it_value = { 1, 0 } };
+    struct itimerspec wall = { .it_value = { mon->max_wall_time, 0 } };
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    if (ms.epfd < 0 || tick_fd < 0 || wall_fd < 0 || ms.grace_fd < 0 ||
+        timerfd_settime(tick_fd, 0, &tick, NULL) != 0)
+    {
+        printf("[!] Session monitor unavailable (%s) - idle freeze and session limits disabled\n",
+               strerror(errno));
+        goto wait_only;
+    }
+    /* it_value 0 leaves it disarmed: no wall-clock limit */
+    timerfd_settime(wall_fd, 0, &wall, NULL);
+
+    ev.data.u32 = EV_EXIT;
+    epoll_ctl(ms.epfd, EPOLL_CTL_ADD, mon->pidfd, &ev);
+    ev.data.u32 = EV_TICK;
+    epoll_ctl(ms.epfd, EPOLL_CTL_ADD, tick_fd, &ev);
+    ev.data.u32 = EV_WALL;
+    epoll_ctl(ms.epfd, EPOLL_CTL_ADD, wall_fd, &ev);
+    ev.data.u32 = EV_GRACE;
+    epoll_ctl(ms.epfd, EPOLL_CTL_ADD, ms.grace_fd, &ev);
+    if (control_fd >= 0)
+    {
+        ev.data.u32 = EV_CONTROL;
+        epoll_ctl(ms.epfd, EPOLL_CTL_ADD, control_fd, &ev);
+    }
+
+    sample_activity(mon, ms.tty, &ms.last);
+
+    for (;;)
+    {
+        struct epoll_event events[4];
+        int exited = 0;
+
+        int n = epoll_wait(ms.epfd, events, 4, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            switch (events[i].data.u32)
+            {
+            case EV_EXIT:
+                exited = 1;
+                break;
+
+            case EV_TICK:
+            {
+                unsigned long long ticks = 0;
+                if (read(tick_fd, &ticks, sizeof(ticks)) == sizeof(ticks))
+                    monitor_tick(&ms, (int)ticks);
+                break;
+            }
+
+            case EV_WALL:
+            {
+                unsigned long long expirations;
+                if (read(wall_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                    stop_session(&ms, "max_wall_time", mon->max_wall_time);
+                break;
+            }
+
+            case EV_GRACE:
+            {
+                unsigned long long expirations;
+                if (read(ms.grace_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                    break;
+                printf("[!] Sandbox still running after %ds - killing it\n", SESSION_STOP_GRACE_SEC);
+                if (has_cgroup(mon))
+                    sandbox_cgroup_kill(mon->cgroup);
+                signal_init(mon, SIGKILL);
+                break;
+            }
+
+            case EV_CONTROL:
+                handle_control(&ms, control_fd);
+                break;
+
+            case EV_STDIN:
+            {
+                int queued = 0;
+                if (ioctl(STDIN_FILENO, FIONREAD, &queued) != 0 || queued > ms.queued)
+                    thaw_session(&ms);
+                break;
+            }
+            }
+        }
+        if (exited)
+            break;
+    }
+
+wait_only:
+    waitpid(mon->pid, &status, 0);
+
+    clock_gettime(CLOCK_BOOTTIME, &ended);
+    mon->wall_seconds = ended.tv_sec - started.tv_sec;
+    long long cpu_usec = has_cgroup(mon) ? sandbox_cgroup_cpu_usec(mon->cgroup) : -1;
+    mon->cpu_seconds = cpu_usec >= 0 ? (long)(cpu_usec / 1000000) : -1;
+
+    if (ms.frozen)
+    {
+        /* Killed while frozen; count it, the cgroup goes away next */
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        mon->frozen_seconds += now.tv_sec - ms.frozen_at.tv_sec;
+    }
+    if (control_fd >= 0)
+    {
+        char path[128];
+        snprintf(path, sizeof(path), "%s/%d/%s", SESSION_RUN_DIR, mon->pid, SESSION_CONTROL_NAME);
+        unlink(path);
+        close(control_fd);
+    }
+    if (tick_fd >= 0)
+        close(tick_fd);
+    if (wall_fd >= 0)
+        close(wall_fd);
+    if (ms.grace_fd >= 0)
+        close(ms.grace_fd);
+    if (ms.epfd >= 0)
+        close(ms.epfd);
+    return status;
+}
+
+int session_control(pid_t pid, const char *command)
+{
+    struct sockaddr_un addr;
+    char buf[64];
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%d/%s",
+             SESSION_RUN_DIR, pid, SESSION_CONTROL_NAME);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        fprintf(stderr, "[!] No session %d (or it has no control socket): %s\n",
+                pid, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    ssize_t n = -1;
+    int len = snprintf(buf, sizeof(buf), "%s\n", command);
+    if (write(fd, buf, len) == len)
+        n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+    {
+        fprintf(stderr, "[!] Session %d did not answer\n", pid);
+        return -1;
+    }
+
+    buf[n] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    if (strncmp(buf, "error", 5) == 0)
+    {
+        fprintf(stderr, "[!] Session %d: %s\n", pid, buf);
+        return -1;
+    }
+    printf("[+] Session %d: %s\n", pid, buf);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <sys/types.h>
+#include "cgroup.h"
+
+/* Unix socket in SESSION_RUN_DIR/<pid>/ taking "freeze", "thaw", "status" */
+#define SESSION_CONTROL_NAME "control"
+
+/* Below this much CPU per second the session counts as idle (1%) */
+#define IDLE_CPU_USEC_PER_SEC 10000
+
+/* After a limit runs out: SIGTERM, then SIGKILL this much later */
+#define SESSION_STOP_GRACE_SEC 10
+
+typedef struct {
+    pid_t pid;                  /* sandbox, as seen from the host */
+    int pidfd;                  /* -1 = plain waitpid, nothing monitored */
+    const SandboxCgroup *cgroup;
+    int idle_freeze;            /* seconds idle before freezing, 0 = only on request */
+    int idle_reclaim;           /* memory.reclaim once frozen */
+    int max_wall_time;          /* lifetime limits in seconds, 0 = none */
+    int max_cpu_time;
+    int max_idle_time;
+
+    /* Filled in by monitor_session */
+    int freezes;
+    long frozen_seconds;
+    long wall_seconds;
+    long cpu_seconds;           /* -1 without a session cgroup */
+    char end_reason[64];        /* "" = it exited by itself, else the limit */
+} SessionMonitor;
+
+/*
+ * Wait for the sandbox to exit, freezing it while idle and thawing it
+ * on activity or request, and stopping it when a lifetime limit runs
+ * out. Returns its waitpid() status.
+ */
+int monitor_session(SessionMonitor *mon);
+
+/* ai-run freeze|thaw|status <pid>: ask a session's monitor; 0 or -1 */
+int session_control(pid_t pid, const char *command);
+
+#endif
@@ -2,9 +2,304 @@
 #include <sched.h>
 #include <sys/mount.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/statvfs.h>
+#include <sys/wait.h>
+#include <limits.h>
 #include "namespace.h"
+#include "ipc.h"
+
+/*
+ * Write a single line to a /proc control file
+ */
+static int write_proc_file(const char *path, const char *data)
+{
+    int fd = open(path, O_WRONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    ssize_t len = (ssize_t)strlen(data);
+    ssize_t n = write(fd, data, len);
+    close(fd);
+
+    if (n != len)
+    {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+#ifndef SYS_clone3
+#define SYS_clone3 435
+#endif
+
+/* New mount API (5.2+, mount_setattr 5.12+) - raw syscalls for older libcs */
+#ifndef SYS_open_tree
+#define SYS_open_tree 428
+#endif
+#ifndef SYS_move_mount
+#define SYS_move_mount 429
+#endif
+#ifndef SYS_fsopen
+#define SYS_fsopen 430
+#endif
+#ifndef SYS_fsconfig
+#define SYS_fsconfig 431
+#endif
+#ifndef SYS_fsmount
+#define SYS_fsmount 432
+#endif
+#ifndef SYS_mount_setattr
+#define SYS_mount_setattr 442
+#endif
+#ifndef SYS_pivot_root
+#define SYS_pivot_root 155
+#endif
+#ifndef OPEN_TREE_CLONE
+#define OPEN_TREE_CLONE 1
+#endif
+#ifndef MOVE_MOUNT_F_EMPTY_PATH
+#define MOVE_MOUNT_F_EMPTY_PATH 0x00000004
+#endif
+#ifndef FSOPEN_CLOEXEC
+#define FSOPEN_CLOEXEC 0x00000001
+#endif
+#ifndef FSMOUNT_CLOEXEC
+#define FSMOUNT_CLOEXEC 0x00000001
+#endif
+#ifndef FSCONFIG_SET_STRING
+#define FSCONFIG_SET_STRING 1
+#endif
+#ifndef FSCONFIG_CMD_CREATE
+#define FSCONFIG_CMD_CREATE 6
+#endif
+#ifndef MOUNT_ATTR_RDONLY
+#define MOUNT_ATTR_RDONLY 0x00000001
+#endif
+#ifndef MOUNT_ATTR_NOSUID
+#define MOUNT_ATTR_NOSUID 0x00000002
+#endif
+#ifndef MOUNT_ATTR_NODEV
+#define MOUNT_ATTR_NODEV 0x00000004
+#endif
+#ifndef MOUNT_ATTR_NOEXEC
+#define MOUNT_ATTR_NOEXEC 0x00000008
+#endif
+#ifndef AT_RECURSIVE
+#define AT_RECURSIVE 0x8000
+#endif
+
+/* Layout of struct mount_attr (MOUNT_ATTR_SIZE_VER0) */
+struct sandbox_mount_attr {
+    uint64_t attr_set;
+    uint64_t attr_clr;
+    uint64_t propagation;
+    uint64_t userns_fd;
+};
+
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+/* Layout of struct clone_args (CLONE_ARGS_SIZE_VER2) */
+struct sandbox_clone_args {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+};
+
+/*
+ * Create the sandbox process with all of its namespaces at once
+ *
+ * WHY: fork() followed by unshare() calls in the child means the
+ * parent can't touch the network namespace until the child reports
+ * back. With the namespaces created by the kernel as part of the
+ * clone, they exist the moment we get the pid, so host-side network
+ * setup runs in parallel with the child's mount work.
+ *
+ * HOW: clone3() with the namespace flags and CLONE_PIDFD. Where
+ * clone3 is unavailable (old kernels, container seccomp profiles
+ * that return ENOSYS) fall back to the legacy clone syscall, which
+ * takes the same flags and returns the pidfd through parent_tid.
+ * No stack is passed, so both behave like fork(): the child returns
+ * 0 on a copy of our stack.
+ *
+ * With *cgroup_fd >= 0 the child starts inside that cgroup
+ * (CLONE_INTO_CGROUP), before it can fork anything. If the kernel
+ * can't do that, *cgroup_fd is set to -1 and the caller has to move
+ * the child itself.
+ *
+ * Returns like fork(). *pidfd is -1 in the child or on failure.
+ */
+pid_t clone_sandbox(unsigned long ns_flags, int *cgroup_fd, int *pidfd)
+{
+    struct sandbox_clone_args args;
+    int fd = -1;
+    long ret;
+
+    /* Don't duplicate buffered output into the child */
+    fflush(NULL);
+
+    memset(&args, 0, sizeof(args));
+    args.flags = ns_flags | CLONE_PIDFD;
+    args.pidfd = (uint64_t)(uintptr_t)&fd;
+    args.exit_signal = SIGCHLD;
+    if (*cgroup_fd >= 0)
+    {
+        args.flags |= CLONE_INTO_CGROUP;
+        args.cgroup = (uint64_t)*cgroup_fd;
+    }
+
+    ret = syscall(SYS_clone3, &args, sizeof(args));
+    if (ret == -1 && errno != ENOSYS && *cgroup_fd >= 0)
+    {
+        /* Before 5.7, or a cgroup we may create but not clone into */
+        args.flags &= ~CLONE_INTO_CGROUP;
+        args.cgroup = 0;
+        *cgroup_fd = -1;
+        ret = syscall(SYS_clone3, &args, sizeof(args));
+    }
+    if (ret == -1 && errno == ENOSYS)
+    {
+        /* Argument order as on x86-64 and arm64 */
+        *cgroup_fd = -1;
+        ret = syscall(SYS_clone, ns_flags | CLONE_PIDFD | SIGCHLD, NULL, &fd, NULL, 0);
+    }
+
+    if (ret == -1)
+    {
+        perror("clone3");
+        *pidfd = -1;
+        return -1;
+    }
+
+    *pidfd = ret == 0 ? -1 : fd;
+    return (pid_t)ret;
+}
+
+/*
+ * Mount a /proc that matches the sandbox's PID namespace
+ *
+ * The inherited one still lists every host process. Not fatal: the
+ * namespace isolates signals and reaping either way.
+ */
+int mount_pid_proc(void)
+{
+    if (mount("proc", "/proc", "proc", MS_NOSUID | MS_NODEV | MS_NOEXEC, NULL) == -1)
+    {
+        printf("[!] Warning: Could not mount /proc for the PID namespace (%s)\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static pid_t init_shell = -1;
+
+static void forward_to_shell(int sig)
+{
+    kill(init_shell, sig);
+}
+
+/*
+ * PID 1 of the sandbox's PID namespace
+ *
+ * WHY: Orphans in a PID namespace are reparented to its init, and
+ * when init exits the kernel SIGKILLs everything left in it. A shell
+ * as PID 1 would leave orphans as zombies and can't be stopped with
+ * SIGTERM (init only receives signals it has a handler for).
+ *
+ * HOW: The shell runs as our child. We reap whatever reaches us,
+ * pass SIGTERM/SIGHUP on to the shell and exit with its status,
+ * which takes every background process of the session with us.
+ * Terminal signals go to the whole foreground group anyway, so we
+ * ignore those - after the fork, so the shell doesn't inherit that.
+ */
+int run_sandbox_init(pid_t shell)
+{
+    struct sigaction sa;
+
+    init_shell = shell;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = forward_to_shell;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    for (;;)
+    {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+
+        if (pid == shell)
+            return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        if (pid < 0 && errno == ECHILD)
+            return EXIT_FAILURE;
+    }
+}
+
+/*
+ * Map the invoking user to root inside a rootless sandbox
+ *
+ * WHY: Owning a user namespace grants CAP_SYS_ADMIN and CAP_NET_ADMIN
+ * over the mount and network namespaces created with it, so the whole
+ * sandbox can be built without sudo - but only once uid/gid 0 map to
+ * a real id (files created by unmapped ids fail with EOVERFLOW).
+ *
+ * HOW: Written from the parent right after clone. A single-line
+ * mapping of our own ids is the one case the kernel allows without
+ * privilege; setgroups must be denied first.
+ */
+int setup_user_mapping(pid_t pid, uid_t uid, gid_t gid)
+{
+    char path[64];
+    char map[64];
+
+    snprintf(path, sizeof(path), "/proc/%d/setgroups", pid);
+    if (write_proc_file(path, "deny") != 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "/proc/%d/uid_map", pid);
+    snprintf(map, sizeof(map), "0 %u 1", (unsigned)uid);
+    if (write_proc_file(path, map) != 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "/proc/%d/gid_map", pid);
+    snprintf(map, sizeof(map), "0 %u 1", (unsigned)gid);
+    if (write_proc_file(path, map) != 0)
+        return -1;
+
+    printf("[+] User namespace mapped (uid %u -> 0)\n", (unsigned)uid);
+    return 0;
+}
 
 /*
  * Create a new mount namespace for filesystem isolation
@@ -22,6 +317,14 @@ int create_mount_namespace(void)
 
     printf("[+] Mount namespace created successfully\n");
 
+    return make_mounts_private();
+}
+
+/*
+ * Stop mount events propagating between the sandbox and the host
+ */
+int make_mounts_private(void)
+{
     // Make all mounts private (changes don't propagate to host)
     printf("[+] Making all mounts private...\n");
     if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) == -1)
@@ -43,9 +346,8 @@ int hide_directory(const char *path)
     // Mount empty tmpfs over the target directory
     if (mount("tmpfs", path, "tmpfs", 0, "size=1k") == -1)
     {
-        // Don't fail if directory doesn't exist, just warn
-        printf("[!] Warning: Could not hide %s (%s)\n", path, strerror(errno));
-        return 0; // Continue anyway
+        printf("[!] Could not hide %s (%s)\n", path, strerror(errno));
+        return -1;
     }
 
     printf("[+] Successfully hidden: %s\n", path);
@@ -61,10 +363,556 @@ int hide_file(const char *path)
     // Bind mount /dev/null over the target file
     if (mount("/dev/null", path, NULL, MS_BIND, NULL) == -1)
     {
-        printf("[!] Warning: Could not hide %s (%s)\n", path, strerror(errno));
-        return 0;
+        printf("[!] Could not hide %s (%s)\n", path, strerror(errno));
+        return -1;
     }
 
     printf("[+] Successfully hidden: %s\n", path);
     return 0;
 }
+
+/*
+ * Expand a protected_files entry to an absolute path
+ */
+void resolve_protected_path(const char *entry, const char *user, char *out, size_t out_len)
+{
+    if (entry[0] == '~')
+        snprintf(out, out_len, "/home/%s%s", user, entry + 1);
+    else
+        snprintf(out, out_len, "%s", entry);
+}
+
+/*
+ * Hide a path if it exists, picking tmpfs or /dev/null by type.
+ * Returns -1 only if it exists and could not be hidden.
+ */
+int hide_path(const char *path)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+        return 0;
+
+    if (S_ISDIR(st.st_mode))
+        return hide_directory(path);
+    if (S_ISREG(st.st_mode))
+        return hide_file(path);
+    return 0;
+}
+
+/*
+ * Reveal a previously hidden path by detaching the mount on top of it
+ */
+int unhide_path(const char *path)
+{
+    printf("[+] Unhiding: %s\n", path);
+
+    if (umount2(path, MNT_DETACH) == -1)
+    {
+        printf("[!] Warning: Could not unhide %s (%s)\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Create the detached templates every hidden path is cloned from
+ *
+ * One read-only empty tmpfs for directories (a single superblock
+ * for all of them - read-only, so nothing written under one hidden
+ * path can show up under another) and one bind of /dev/null for
+ * files, made read-only with a single mount_setattr. Clones made
+ * with OPEN_TREE_CLONE inherit these attributes.
+ */
+static int make_hide_templates(int need_dir, int need_file, int *dir_fd, int *file_fd)
+{
+    *dir_fd = -1;
+    *file_fd = -1;
+
+    if (need_dir)
+    {
+        int fs = (int)syscall(SYS_fsopen, "tmpfs", FSOPEN_CLOEXEC);
+        if (fs < 0)
+            return -1;
+
+        if (syscall(SYS_fsconfig, fs, FSCONFIG_SET_STRING, "size", "1k", 0) != 0 ||
+            syscall(SYS_fsconfig, fs, FSCONFIG_CMD_CREATE, NULL, NULL, 0) != 0)
+        {
+            close(fs);
+            return -1;
+        }
+
+        *dir_fd = (int)syscall(SYS_fsmount, fs, FSMOUNT_CLOEXEC,
+                               MOUNT_ATTR_RDONLY | MOUNT_ATTR_NOSUID |
+                               MOUNT_ATTR_NODEV | MOUNT_ATTR_NOEXEC);
+        close(fs);
+        if (*dir_fd < 0)
+            return -1;
+    }
+
+    if (need_file)
+    {
+        *file_fd = (int)syscall(SYS_open_tree, AT_FDCWD, "/dev/null",
+                                OPEN_TREE_CLONE | O_CLOEXEC);
+        if (*file_fd < 0)
+        {
+            if (*dir_fd >= 0)
+                close(*dir_fd);
+            *dir_fd = -1;
+            return -1;
+        }
+
+        struct sandbox_mount_attr attr = {
+            .attr_set = MOUNT_ATTR_RDONLY | MOUNT_ATTR_NOSUID | MOUNT_ATTR_NOEXEC,
+        };
+
+        /* Not fatal before 5.12: the files are then hidden read-write as before */
+        if (syscall(SYS_mount_setattr, *file_fd, "", AT_EMPTY_PATH | AT_RECURSIVE,
+                    &attr, sizeof(attr)) != 0)
+        {
+            printf("[!] Warning: mount_setattr unavailable, hidden files stay writable\n");
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Attach a clone of a template mount on top of path
+ */
+static int attach_clone(int template_fd, const char *path)
+{
+    int fd = (int)syscall(SYS_open_tree, template_fd, "",
+                          OPEN_TREE_CLONE | O_CLOEXEC | AT_EMPTY_PATH);
+    if (fd < 0)
+        return -1;
+
+    int rc = (int)syscall(SYS_move_mount, fd, "", AT_FDCWD, path, MOVE_MOUNT_F_EMPTY_PATH);
+    close(fd);
+    return rc;
+}
+
+/*
+ * Hide a batch of paths (directories and files) in one plan
+ *
+ * WHY: hide_directory() creates a new tmpfs superblock per directory
+ * and every path costs a full mount(). With many protected entries
+ * that adds up at startup.
+ *
+ * HOW: stat everything first, build the two templates once (see
+ * make_hide_templates), then attach a cheap clone per path with
+ * open_tree(OPEN_TREE_CLONE) + move_mount(). If the new mount API is
+ * unavailable (kernel < 5.2, or blocked), or a clone can't be attached,
+ * fall back to hide_path(). Returns -1 if any existing path stays
+ * visible: the sandbox must not start with it exposed.
+ */
+int hide_paths(const char *const paths[], int count)
+{
+    int is_dir[count > 0 ? count : 1];
+    int need_dir = 0, need_file = 0;
+    int dir_fd, file_fd;
+
+    for (int i = 0; i < count; i++)
+    {
+        struct stat st;
+
+        is_dir[i] = -1;     /* missing or special: skipped */
+        if (stat(paths[i], &st) != 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+        {
+            is_dir[i] = 1;
+            need_dir = 1;
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            is_dir[i] = 0;
+            need_file = 1;
+        }
+    }
+
+    if (!need_dir && !need_file)
+        return 0;
+
+    if (make_hide_templates(need_dir, need_file, &dir_fd, &file_fd) != 0)
+    {
+        printf("[!] New mount API unavailable, hiding paths one by one\n");
+        int rc = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (is_dir[i] >= 0 && hide_path(paths[i]) != 0)
+                rc = -1;
+        }
+        return rc;
+    }
+
+    int hidden = 0, failed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (is_dir[i] < 0)
+            continue;
+
+        if (attach_clone(is_dir[i] ? dir_fd : file_fd, paths[i]) == 0)
+        {
+            printf("[+] Successfully hidden: %s\n", paths[i]);
+            hidden++;
+        }
+        else
+        {
+            /* e.g. EINVAL cloning the detached tmpfs on older kernels */
+            printf("[!] Could not attach hiding mount on %s (%s), mounting one\n",
+                   paths[i], strerror(errno));
+            if (hide_path(paths[i]) == 0)
+                hidden++;
+            else
+                failed++;
+        }
+    }
+
+    if (dir_fd >= 0)
+        close(dir_fd);
+    if (file_fd >= 0)
+        close(file_fd);
+
+    printf("[+] Hidden %d protected path(s)\n", hidden);
+    if (failed > 0)
+    {
+        fprintf(stderr, "[!] %d protected path(s) could not be hidden\n", failed);
+        return -1;
+    }
+    return 0;
+}
+
+/* Where the host root is reachable while the minimal root is built */
+#define OLD_ROOT "/.oldroot"
+
+/* System directories bound read-only into a minimal root */
+static const char *rootfs_system_dirs[] = {
+    "/usr", "/bin", "/sbin", "/lib", "/lib32", "/lib64", "/libx32", NULL
+};
+
+/*
+ * /etc entries a shell and common toolchains need. Everything else
+ * (shadow, sudoers, ssh host keys, credentials...) simply isn't there.
+ */
+static const char *rootfs_etc_entries[] = {
+    "passwd", "group", "hosts", "hostname", "nsswitch.conf", "host.conf",
+    "ld.so.cache", "ld.so.conf", "ld.so.conf.d", "localtime", "timezone",
+    "alternatives", "ssl", "ca-certificates", "ca-certificates.conf",
+    "profile", "profile.d", "bash.bashrc", "inputrc", "environment",
+    "os-release", "lsb-release", "debian_version", "terminfo", "mime.types",
+    "protocols", "services", "gitconfig", "locale.alias", "locale.gen",
+    "mtab", "iproute2", "xtables.conf", NULL
+};
+
+/*
+ * Make a mount tree read-only. Prefers one recursive mount_setattr;
+ * falls back to a bind remount that keeps the flags the kernel may
+ * have locked (nosuid, nodev... - required inside a user namespace).
+ */
+static int make_readonly(const char *path)
+{
+    struct sandbox_mount_attr attr = { .attr_set = MOUNT_ATTR_RDONLY };
+
+    if (syscall(SYS_mount_setattr, AT_FDCWD, path, AT_RECURSIVE, &attr, sizeof(attr)) == 0)
+        return 0;
+
+    struct statvfs sv;
+    unsigned long flags = MS_REMOUNT | MS_BIND | MS_RDONLY;
+
+    if (statvfs(path, &sv) == 0)
+    {
+        if (sv.f_flag & ST_NOSUID)
+            flags |= MS_NOSUID;
+        if (sv.f_flag & ST_NODEV)
+            flags |= MS_NODEV;
+        if (sv.f_flag & ST_NOEXEC)
+            flags |= MS_NOEXEC;
+    }
+    return mount(NULL, path, NULL, flags, NULL);
+}
+
+/*
+ * Create every missing directory along path (like mkdir -p)
+ */
+static int make_dirs(const char *path, mode_t mode)
+{
+    char buf[PATH_MAX];
+
+    snprintf(buf, sizeof(buf), "%s", path);
+    for (char *p = buf + 1; *p; p++)
+    {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        if (mkdir(buf, mode) == -1 && errno != EEXIST)
+            return -1;
+        *p = '/';
+    }
+    if (mkdir(buf, mode) == -1 && errno != EEXIST)
+        return -1;
+    return 0;
+}
+
+/*
+ * Bring one entry of the old root into the new one at the same path:
+ * symlinks are recreated, directories and files are bind-mounted
+ */
+static int import_entry(const char *path, int readonly)
+{
+    char src[PATH_MAX];
+    struct stat st;
+
+    snprintf(src, sizeof(src), "%s%s", OLD_ROOT, path);
+    if (lstat(src, &st) != 0)
+        return 0;   /* not on this host - fine */
+
+    if (S_ISLNK(st.st_mode))
+    {
+        char target[PATH_MAX];
+        ssize_t n = readlink(src, target, sizeof(target) - 1);
+        if (n < 0)
+            return -1;
+        target[n] = '\0';
+        return symlink(target, path);
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        if (make_dirs(path, 0755) != 0)
+            return -1;
+    }
+    else
+    {
+        int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return -1;
+        close(fd);
+    }
+
+    if (mount(src, path, NULL, MS_BIND | MS_REC, NULL) == -1)
+        return -1;
+    return readonly ? make_readonly(path) : 0;
+}
+
+/*
+ * Bind one layer read-only at target, creating the mount point if asked
+ * (only possible while building the minimal root - the host root is
+ * not ours to add directories to)
+ */
+static int bind_layer(const char *source, const char *target, int create)
+{
+    struct stat st;
+
+    if (create && make_dirs(target, 0755) != 0)
+        return -1;
+    if (stat(target, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        errno = ENOTDIR;
+        return -1;
+    }
+    if (mount(source, target, NULL, MS_BIND | MS_REC, NULL) == -1)
+        return -1;
+    return make_readonly(target);
+}
+
+/*
+ * Bind shared layers over the host root. The layer store keeps one
+ * copy of each toolchain, so every sandbox that binds it shares the
+ * same inodes and page cache instead of its own copy.
+ */
+int bind_layers(const BindMount *binds, int count)
+{
+    int bound = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (bind_layer(binds[i].source, binds[i].target, 0) != 0)
+        {
+            printf("[!] Warning: Could not bind layer at %s (%s)\n",
+                   binds[i].target, strerror(errno));
+            continue;
+        }
+        bound++;
+    }
+
+    if (count > 0)
+        printf("[+] Bound %d/%d read-only layers\n", bound, count);
+    return 0;
+}
+
+static int mount_scratch(const char *path, const char *options)
+{
+    if (make_dirs(path, 0755) != 0)
+        return -1;
+    return mount("tmpfs", path, "tmpfs", MS_NOSUID | MS_NODEV, options);
+}
+
+/* The only host device nodes a minimal root gets */
+static const char *const rootfs_devices[] = {
+    "null", "zero", "full", "random", "urandom", "tty", NULL
+};
+
+/*
+ * A /dev of its own: the host's would hand the sandbox's root every
+ * disk (/dev/sda*, /dev/nvme*) and with it every protected file
+ */
+static int setup_minimal_dev(void)
+{
+    char path[64];
+
+    if (mount_scratch("/dev", "mode=755,size=64k") == -1)
+        return -1;
+
+    for (int i = 0; rootfs_devices[i]; i++)
+    {
+        snprintf(path, sizeof(path), "/dev/%s", rootfs_devices[i]);
+        if (import_entry(path, 0) != 0)
+            printf("[!] Warning: Could not bind %s (%s)\n", path, strerror(errno));
+    }
+
+    /* A private pty instance; the session's own terminal stays open on fds 0-2 */
+    mkdir("/dev/pts", 0755);
+    if (mount("devpts", "/dev/pts", "devpts", MS_NOSUID | MS_NOEXEC,
+              "newinstance,ptmxmode=0666,mode=0620") == -1)
+        printf("[!] Warning: Could not mount /dev/pts (%s)\n", strerror(errno));
+    if (symlink("pts/ptmx", "/dev/ptmx") == -1 ||
+        symlink("/proc/self/fd", "/dev/fd") == -1 ||
+        symlink("/proc/self/fd/0", "/dev/stdin") == -1 ||
+        symlink("/proc/self/fd/1", "/dev/stdout") == -1 ||
+        symlink("/proc/self/fd/2", "/dev/stderr") == -1)
+        return -1;
+
+    return mount_scratch("/dev/shm", "mode=1777");
+}
+
+/*
+ * Replace the host root with a minimal one ("rootfs: minimal")
+ *
+ * WHY: Hiding protected files one by one leaves the rest of the host
+ * visible, and tools that crawl the filesystem (ripgrep, language
+ * servers, indexers) walk all of it. A root that only contains what
+ * a shell needs is both faster to crawl and protected by
+ * construction rather than by a growing denylist.
+ *
+ * HOW:
+ * 1. Mount an empty tmpfs on /tmp and pivot_root into it; the host
+ *    root stays reachable under /.oldroot while we build
+ * 2. Bind /usr, /bin, /sbin, /lib* and an allowlist of /etc
+ *    read-only; bind /proc and /sys (read-only) recursively. /dev is
+ *    a fresh tmpfs with null, zero, full, random, urandom and tty
+ *    bound in, its own devpts and /dev/shm
+ * 3. Fresh tmpfs for /tmp, /run, /home and /root, then bind the
+ *    workspace read-write at its original path, any layers read-only
+ *    and the session's IPC channel
+ * 4. Detach the old root and make / itself read-only
+ *
+ * Must run after make_mounts_private() and before anything that
+ * execs, since binaries are missing while the root is being built.
+ */
+int setup_minimal_rootfs(const char *workspace, const char *user,
+                         const BindMount *binds, int bind_count, const char *ipc_dir)
+{
+    char path[PATH_MAX];
+
+    printf("[+] Building minimal root filesystem...\n");
+
+    /* 1. New root: an empty tmpfs, mounted where the host has a directory */
+    if (mount("tmpfs", "/tmp", "tmpfs", MS_NOSUID | MS_NODEV, "mode=755,size=1m") == -1)
+    {
+        perror("mount(new root)");
+        return -1;
+    }
+    if (mkdir("/tmp" OLD_ROOT, 0700) == -1 ||
+        syscall(SYS_pivot_root, "/tmp", "/tmp" OLD_ROOT) == -1)
+    {
+        perror("pivot_root");
+        return -1;
+    }
+    if (chdir("/") == -1)
+    {
+        perror("chdir");
+        return -1;
+    }
+
+    /* 2. Read-only system directories and a filtered /etc */
+    for (int i = 0; rootfs_system_dirs[i]; i++)
+    {
+        if (import_entry(rootfs_system_dirs[i], 1) != 0)
+            printf("[!] Warning: Could not bind %s (%s)\n", rootfs_system_dirs[i], strerror(errno));
+    }
+
+    mkdir("/etc", 0755);
+    for (int i = 0; rootfs_etc_entries[i]; i++)
+    {
+        snprintf(path, sizeof(path), "/etc/%s", rootfs_etc_entries[i]);
+        if (import_entry(path, 1) != 0)
+            printf("[!] Warning: Could not bind %s (%s)\n", path, strerror(errno));
+    }
+
+    /* Placeholder for setup_dns() to bind over (the host's may be a dangling symlink here) */
+    int fd = open("/etc/resolv.conf", O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0)
+        close(fd);
+
+    if (setup_minimal_dev() != 0 || import_entry("/proc", 0) != 0)
+    {
+        perror("mount /dev, /proc");
+        return -1;
+    }
+    if (import_entry("/sys", 1) != 0)
+        printf("[!] Warning: Could not bind /sys (%s)\n", strerror(errno));
+
+    /* 3. Scratch space and the workspace */
+    if (mount_scratch("/tmp", "mode=1777") == -1 ||
+        mount_scratch("/run", "mode=755") == -1 ||
+        mount_scratch("/home", "mode=755") == -1 ||
+        mount_scratch("/root", "mode=700") == -1)
+    {
+        perror("mount(tmpfs scratch)");
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "/home/%s", user);
+    mkdir(path, 0755);
+
+    if (workspace && strcmp(workspace, "/") != 0 && import_entry(workspace, 0) != 0)
+    {
+        fprintf(stderr, "[!] Could not bind workspace %s: %s\n", workspace, strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < bind_count; i++)
+    {
+        snprintf(path, sizeof(path), "%s%s", OLD_ROOT, binds[i].source);
+        if (bind_layer(path, binds[i].target, 1) != 0)
+            printf("[!] Warning: Could not bind layer at %s (%s)\n",
+                   binds[i].target, strerror(errno));
+    }
+
+    /* /run is fresh here, so unlike on the host root the mount point always exists */
+    if (ipc_dir)
+    {
+        snprintf(path, sizeof(path), "%s%s", OLD_ROOT, ipc_dir);
+        ipc_channel_bind(path);
+    }
+
+    /* 4. Drop the host root and freeze the skeleton */
+    if (umount2(OLD_ROOT, MNT_DETACH) == -1)
+    {
+        perror("umount(old root)");
+        return -1;
+    }
+    rmdir(OLD_ROOT);
+
+    struct sandbox_mount_attr attr = { .attr_set = MOUNT_ATTR_RDONLY };
+    if (syscall(SYS_mount_setattr, AT_FDCWD, "/", 0, &attr, sizeof(attr)) == -1)
+        mount(NULL, "/", NULL, MS_REMOUNT | MS_BIND | MS_RDONLY | MS_NOSUID | MS_NODEV, NULL);
+
+    if (workspace && chdir(workspace) == -1)
+        chdir("/");
+
+    printf("[+] Minimal root ready (workspace: %s)\n", workspace ? workspace : "none");
+    return 0;
+}
@@ -1,12 +1,49 @@
 #ifndef NAMESPACE_H
 #define NAMESPACE_H
 
+#include <stddef.h>
+#include <sys/types.h>
+
+// Fork the sandbox process directly into new namespaces (clone3 + pidfd),
+// optionally into a cgroup (*cgroup_fd is set to -1 if that wasn't possible)
+pid_t clone_sandbox(unsigned long ns_flags, int *cgroup_fd, int *pidfd);
+// Mount /proc for the sandbox's own PID namespace
+int mount_pid_proc(void);
+// Act as PID 1 of the sandbox: reap orphans until the shell exits, return its status
+int run_sandbox_init(pid_t shell);
+// Map uid/gid to root in the child's user namespace (rootless mode)
+int setup_user_mapping(pid_t pid, uid_t uid, gid_t gid);
+
 // Create a new mount namespace for the current process
 int create_mount_namespace(void);
+// Make all mounts private in an already-created mount namespace
+int make_mounts_private(void);
+
+// A host directory to bind read-only at another path (policy "layers:")
+typedef struct {
+    char source[512];
+    char target[256];
+} BindMount;
+
+// pivot_root into a minimal read-only root plus the workspace ("rootfs: minimal"),
+// with the session's IPC channel directory (or NULL) bound in
+int setup_minimal_rootfs(const char *workspace, const char *user,
+                         const BindMount *binds, int bind_count, const char *ipc_dir);
+// Bind layers read-only over the host root (targets must already exist)
+int bind_layers(const BindMount *binds, int count);
 
 // Hide a directory inside the mount namespace
 int hide_directory(const char *path);
 // Hide a single file
 int hide_file(const char *path);
 
+// Expand a protected_files entry ("~/..." is relative to user's home)
+void resolve_protected_path(const char *entry, const char *user, char *out, size_t out_len);
+// Hide whatever is at path (directory or regular file)
+int hide_path(const char *path);
+// Hide many paths at once by cloning shared read-only templates
+int hide_paths(const char *const paths[], int count);
+// Undo hide_path (used when a policy reload unprotects a path)
+int unhide_path(const char *path);
+
 #endif
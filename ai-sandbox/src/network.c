@@ -10,17 +10,47 @@
 #include <sys/wait.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/route.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include "network.h"
+#include "policy.h"
 
 /* Network configuration constants */
-#define VETH_HOST "veth-host"
-#define VETH_SANDBOX "veth-sandbox"
-#define SANDBOX_IP "10.200.1.2"
-#define HOST_IP "10.200.1.1"
+#define SUBNET_PREFIX "10.200"
 #define SUBNET_MASK "24"
-#define DNS_SERVER "8.8.8.8"
+#define SUBNET6_PREFIX "fd61:6973:6278"
+#define SUBNET6_MASK "64"
+#define MAX_SLOTS 254
+
+/* Names used before per-session slots existed (cleaned up by destroy) */
+#define LEGACY_VETH_HOST "veth-host"
+#define LEGACY_SUBNET "10.200.1.0/24"
+
+/* Bind-mounted network namespaces shared between sessions */
+#define RUN_DIR "/run/ai-sandbox"
+#define NETNS_DIR RUN_DIR "/netns"
+
+/* One file per allocated slot, content is the owner */
+#define SLOT_DIR RUN_DIR "/slots"
+/* An owner is written right after the claim; empty for longer means a crash in between */
+#define SLOT_CLAIM_GRACE_SEC 10
+
+/* Pending teardowns, drained in batches by a detached reaper */
+#define REAP_DIR RUN_DIR "/reap"
+#define REAP_LOCK RUN_DIR "/reap.lock"
+
+/* What enable_ipv6_forwarding() changed: "<interface> <setting> <old value>" lines */
+#define IPV6_FWD_STATE RUN_DIR "/ipv6-forwarding"
+#define IPV6_FWD_LOCK RUN_DIR "/ipv6-forwarding.lock"
 
 /*
  * Execute a command and return the exit status
@@ -40,18 +70,150 @@ static int run_cmd(const char *cmd)
  */
 static int run_cmd_quiet(const char *cmd)
 {
-    char full_cmd[512];
+    char full_cmd[1024];
     snprintf(full_cmd, sizeof(full_cmd), "%s >/dev/null 2>&1", cmd);
     return system(full_cmd);
 }
 
+/* iptables for IPv4 rules, ip6tables for IPv6 */
+static const char *xtables(int v6)
+{
+    return v6 ? "ip6tables" : "iptables";
+}
+
+/*
+ * Feed a rule set to iptables-restore (ip6tables-restore) in one
+ * transaction
+ *
+ * WHY:
+ * - iptables-restore commits the whole batch or nothing, so a session
+ *   never ends up with half of its rules installed
+ * - --noflush leaves everyone else's rules alone
+ */
+static int iptables_restore(const char *rules, int v6, int quiet)
+{
+    char cmd[96];
+
+    snprintf(cmd, sizeof(cmd), "%s-restore --noflush%s", xtables(v6),
+             quiet ? " >/dev/null 2>&1" : "");
+    FILE *p = popen(cmd, "w");
+    if (!p)
+    {
+        perror("popen iptables-restore");
+        return -1;
+    }
+    fputs(rules, p);
+    return pclose(p) == 0 ? 0 : -1;
+}
+
+/*
+ * Check whether a recorded owner pid is still alive
+ */
+static int pid_alive(pid_t pid)
+{
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+/* ---------- Per-session slots ---------- */
+
+/*
+ * Derive interface names, addresses and chain name from a slot number
+ */
+void sandbox_net_from_slot(int slot, SandboxNet *net)
+{
+    memset(net, 0, sizeof(*net));
+    net->slot = slot;
+    snprintf(net->veth_host, sizeof(net->veth_host), "aisb%d-h", slot);
+    snprintf(net->veth_sandbox, sizeof(net->veth_sandbox), "aisb%d-s", slot);
+    snprintf(net->host_ip, sizeof(net->host_ip), SUBNET_PREFIX ".%d.1", slot);
+    snprintf(net->sandbox_ip, sizeof(net->sandbox_ip), SUBNET_PREFIX ".%d.2", slot);
+    snprintf(net->subnet, sizeof(net->subnet), SUBNET_PREFIX ".%d.0/" SUBNET_MASK, slot);
+    snprintf(net->chain, sizeof(net->chain), "AISB-%d", slot);
+    snprintf(net->host_ip6, sizeof(net->host_ip6), SUBNET6_PREFIX ":%x::1", slot);
+    snprintf(net->sandbox_ip6, sizeof(net->sandbox_ip6), SUBNET6_PREFIX ":%x::2", slot);
+    snprintf(net->subnet6, sizeof(net->subnet6), SUBNET6_PREFIX ":%x::/" SUBNET6_MASK, slot);
+}
+
+/*
+ * Record who is responsible for tearing a slot down
+ *
+ * Owner is either the pid of the ai-run process that will clean up,
+ * or "netns:<hash>" once the namespace is pinned for reuse.
+ */
+int set_sandbox_net_owner(const SandboxNet *net, const char *owner)
+{
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/%d", SLOT_DIR, net->slot);
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        perror("fopen slot");
+        return -1;
+    }
+    fprintf(f, "%s\n", owner);
+    fclose(f);
+    return 0;
+}
+
+/*
+ * Reserve a free slot for a new session
+ *
+ * O_EXCL makes the reservation atomic between concurrent launches.
+ * If every slot is taken, leftovers from crashed sessions are
+ * collected once before giving up.
+ */
+int alloc_sandbox_net(SandboxNet *net)
+{
+    char path[256];
+    char owner[32];
+
+    mkdir(RUN_DIR, 0755);
+    mkdir(SLOT_DIR, 0755);
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        for (int slot = 1; slot <= MAX_SLOTS; slot++)
+        {
+            snprintf(path, sizeof(path), "%s/%d", SLOT_DIR, slot);
+            int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            if (fd < 0)
+                continue;
+            close(fd);
+
+            sandbox_net_from_slot(slot, net);
+            snprintf(owner, sizeof(owner), "%d", getpid());
+            set_sandbox_net_owner(net, owner);
+            return 0;
+        }
+
+        gc_sandbox_networks();
+    }
+
+    fprintf(stderr, "[!] No free sandbox network slots\n");
+    return -1;
+}
+
+/*
+ * Free a slot after its veth and chains are gone
+ */
+void release_sandbox_net(const SandboxNet *net)
+{
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/%d", SLOT_DIR, net->slot);
+    unlink(path);
+}
+
 /*
- * Cleanup any existing veth interfaces from previous runs
+ * Remove this session's veth pair (deleting one end removes both)
  */
-int cleanup_veth(void)
+int cleanup_veth(const SandboxNet *net)
 {
-    /* Remove existing veth pair if it exists */
-    run_cmd_quiet("ip link delete " VETH_HOST);
+    char cmd[128];
+
+    snprintf(cmd, sizeof(cmd), "ip link delete %s", net->veth_host);
+    run_cmd_quiet(cmd);
     return 0;
 }
 
@@ -91,16 +253,69 @@ int create_network_namespace(void)
  *
  * COMMAND EQUIVALENT:
  * - Similar to: ip link set lo up
+ * - Done with one rtnetlink request instead of forking ip(8), which
+ *   matters for loopback-only sandboxes where this is the whole setup
  */
+static int set_link_up(const char *ifname)
+{
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi;
+    } req;
+    char reply[512];
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+
+    unsigned int index = if_nametoindex(ifname);
+    if (index == 0)
+        return -1;
+
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0)
+        return -1;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.nh.nlmsg_type = RTM_NEWLINK;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    req.nh.nlmsg_seq = 1;
+    req.ifi.ifi_family = AF_UNSPEC;
+    req.ifi.ifi_index = (int)index;
+    req.ifi.ifi_flags = IFF_UP;
+    req.ifi.ifi_change = IFF_UP;
+
+    if (sendto(fd, &req, req.nh.nlmsg_len, 0,
+               (struct sockaddr *)&kernel, sizeof(kernel)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    /* Kernel answers with NLMSG_ERROR; error 0 is the ACK */
+    ssize_t len = recv(fd, reply, sizeof(reply), 0);
+    close(fd);
+    if (len < (ssize_t)NLMSG_LENGTH(sizeof(struct nlmsgerr)))
+        return -1;
+
+    struct nlmsghdr *nh = (struct nlmsghdr *)reply;
+    if (nh->nlmsg_type != NLMSG_ERROR)
+        return -1;
+
+    struct nlmsgerr *err = NLMSG_DATA(nh);
+    if (err->error != 0)
+    {
+        errno = -err->error;
+        return -1;
+    }
+    return 0;
+}
+
 int setup_loopback(void)
 {
     printf("[+] Enabling loopback interface...\n");
 
-    int ret = run_cmd_quiet("ip link set lo up");
-
-    if (ret != 0)
+    if (set_link_up("lo") != 0)
     {
-        fprintf(stderr, "[!] Warning: Could not enable loopback (install iproute2)\n");
+        fprintf(stderr, "[!] Warning: Could not enable loopback (%s)\n", strerror(errno));
         return -1;
     }
 
@@ -122,19 +337,19 @@ int setup_loopback(void)
  *   veth-sandbox                 veth-host
  *   10.200.1.2   <--> veth <-->  10.200.1.1 --> Internet
  */
-int setup_veth_from_host(pid_t sandbox_pid)
+int setup_veth_from_host(const SandboxNet *net, pid_t sandbox_pid)
 {
     char cmd[256];
     
     printf("[+] Setting up veth pair from host namespace...\n");
     
-    /* Cleanup any existing veth from previous runs */
-    cleanup_veth();
+    /* Cleanup any stale veth left in this slot */
+    cleanup_veth(net);
     
     /* Create veth pair */
     snprintf(cmd, sizeof(cmd),
              "ip link add %s type veth peer name %s",
-             VETH_HOST, VETH_SANDBOX);
+             net->veth_host, net->veth_sandbox);
     if (run_cmd(cmd) != 0)
     {
         fprintf(stderr, "[!] Failed to create veth pair\n");
@@ -144,7 +359,7 @@ int setup_veth_from_host(pid_t sandbox_pid)
     /* Move sandbox end into the sandbox namespace */
     snprintf(cmd, sizeof(cmd),
              "ip link set %s netns %d",
-             VETH_SANDBOX, sandbox_pid);
+             net->veth_sandbox, sandbox_pid);
     if (run_cmd(cmd) != 0)
     {
         fprintf(stderr, "[!] Failed to move veth to sandbox namespace\n");
@@ -154,13 +369,27 @@ int setup_veth_from_host(pid_t sandbox_pid)
     /* Configure host end */
     snprintf(cmd, sizeof(cmd),
              "ip addr add %s/%s dev %s",
-             HOST_IP, SUBNET_MASK, VETH_HOST);
+             net->host_ip, SUBNET_MASK, net->veth_host);
     run_cmd(cmd);
     
-    snprintf(cmd, sizeof(cmd), "ip link set %s up", VETH_HOST);
+    /* nodad: usable at once instead of after duplicate detection */
+    if (net->ipv6)
+    {
+        snprintf(cmd, sizeof(cmd),
+                 "ip -6 addr add %s/%s dev %s nodad",
+                 net->host_ip6, SUBNET6_MASK, net->veth_host);
+        run_cmd(cmd);
+    }
+    
+    /* Router advertisements from the sandbox's side must never route the host */
+    snprintf(cmd, sizeof(cmd), "sysctl -w net.ipv6.conf.%s.accept_ra=0", net->veth_host);
+    run_cmd_quiet(cmd);
+    
+    snprintf(cmd, sizeof(cmd), "ip link set %s up", net->veth_host);
     run_cmd(cmd);
     
-    printf("[+] Host side veth configured (IP: %s)\n", HOST_IP);
+    printf("[+] Host side veth configured (%s, IP: %s%s%s)\n", net->veth_host, net->host_ip,
+           net->ipv6 ? ", " : "", net->ipv6 ? net->host_ip6 : "");
     return 0;
 }
 
@@ -169,8 +398,13 @@ int setup_veth_from_host(pid_t sandbox_pid)
  *
  * Called after veth-sandbox has been moved into the namespace.
  * Configures IP address and default route.
+ *
+ * Without ipv6 the interface gets no IPv6 at all, not even a
+ * link-local address: with no IPv6 route, connect() to an IPv6
+ * address fails at once and resolvers configured with AI_ADDRCONFIG
+ * stop asking for AAAA records.
  */
-int setup_veth_in_sandbox(void)
+int setup_veth_in_sandbox(const SandboxNet *net)
 {
     char cmd[256];
     
@@ -179,105 +413,1394 @@ int setup_veth_in_sandbox(void)
     /* Assign IP to sandbox end */
     snprintf(cmd, sizeof(cmd),
              "ip addr add %s/%s dev %s",
-             SANDBOX_IP, SUBNET_MASK, VETH_SANDBOX);
+             net->sandbox_ip, SUBNET_MASK, net->veth_sandbox);
     run_cmd(cmd);
     
+    if (net->ipv6)
+    {
+        snprintf(cmd, sizeof(cmd),
+                 "ip -6 addr add %s/%s dev %s nodad",
+                 net->sandbox_ip6, SUBNET6_MASK, net->veth_sandbox);
+        run_cmd(cmd);
+    }
+    else
+    {
+        /* Fails harmlessly on kernels without IPv6 */
+        snprintf(cmd, sizeof(cmd), "sysctl -w net.ipv6.conf.%s.disable_ipv6=1", net->veth_sandbox);
+        run_cmd_quiet(cmd);
+    }
+    
     /* Bring up the interface */
-    snprintf(cmd, sizeof(cmd), "ip link set %s up", VETH_SANDBOX);
+    snprintf(cmd, sizeof(cmd), "ip link set %s up", net->veth_sandbox);
     run_cmd(cmd);
     
     /* Add default route via host */
     snprintf(cmd, sizeof(cmd),
              "ip route add default via %s dev %s",
-             HOST_IP, VETH_SANDBOX);
+             net->host_ip, net->veth_sandbox);
     run_cmd(cmd);
     
-    printf("[+] Sandbox veth configured (IP: %s, Gateway: %s)\n", SANDBOX_IP, HOST_IP);
+    if (net->ipv6)
+    {
+        snprintf(cmd, sizeof(cmd),
+                 "ip -6 route add default via %s dev %s",
+                 net->host_ip6, net->veth_sandbox);
+        run_cmd(cmd);
+    }
+    
+    printf("[+] Sandbox veth configured (IP: %s, Gateway: %s)\n", net->sandbox_ip, net->host_ip);
+    if (net->ipv6)
+    {
+        printf("[+] Sandbox IPv6 configured (IP: %s, Gateway: %s)\n", net->sandbox_ip6, net->host_ip6);
+    }
     return 0;
 }
 
+/*
+ * Is there an IPv6 default route on the host?
+ *
+ * Giving a sandbox an IPv6 route on a host without one would only make
+ * every IPv6 attempt from inside wait for an unreachable answer, so
+ * ipv6: true falls back to IPv4 only there. Read from
+ * /proc/net/ipv6_route; the "unreachable" default on lo doesn't count.
+ */
+int host_has_ipv6(void)
+{
+    char line[256];
+    char dest[33];
+    char dev[32];
+    unsigned int plen, flags;
+    int found = 0;
+
+    FILE *f = fopen("/proc/net/ipv6_route", "r");
+    if (!f)
+        return 0;
+    while (!found && fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "%32s %x %*s %*x %*s %*x %*x %*x %x %31s",
+                   dest, &plen, &flags, dev) != 4)
+            continue;
+        found = plen == 0 && strspn(dest, "0") == 32 &&
+                (flags & RTF_UP) && !(flags & RTF_REJECT) && strcmp(dev, "lo") != 0;
+    }
+    fclose(f);
+    return found;
+}
+
+static int read_ipv6_conf(const char *iface, const char *key, char *value, size_t len)
+{
+    char path[128];
+
+    snprintf(path, sizeof(path), "/proc/sys/net/ipv6/conf/%s/%s", iface, key);
+    FILE *f = fopen(path, "re");
+    if (!f)
+        return -1;
+    if (!fgets(value, (int)len, f))
+        value[0] = '\0';
+    value[strcspn(value, "\n")] = '\0';
+    fclose(f);
+    return value[0] ? 0 : -1;
+}
+
+static int write_ipv6_conf(const char *iface, const char *key, const char *value)
+{
+    char path[128];
+
+    snprintf(path, sizeof(path), "/proc/sys/net/ipv6/conf/%s/%s", iface, key);
+    FILE *f = fopen(path, "we");
+    if (!f)
+        return -1;
+    fprintf(f, "%s\n", value);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/* Serializes enabling forwarding against restoring it */
+static int lock_ipv6_forwarding(void)
+{
+    mkdir(RUN_DIR, 0755);
+    int fd = open(IPV6_FWD_LOCK, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd >= 0)
+        flock(fd, LOCK_EX);
+    return fd;
+}
+
+/*
+ * Interfaces whose default route came from a router advertisement
+ * (RTF_ADDRCONF). Sandbox veths never count.
+ */
+static int ra_default_interfaces(char names[][IFNAMSIZ], int max)
+{
+    char line[256];
+    char dest[33];
+    char dev[IFNAMSIZ];
+    unsigned int plen, flags;
+    int count = 0;
+
+    FILE *f = fopen("/proc/net/ipv6_route", "re");
+    if (!f)
+        return 0;
+    while (count < max && fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "%32s %x %*s %*x %*s %*x %*x %*x %x %15s",
+                   dest, &plen, &flags, dev) != 4)
+            continue;
+        if (plen != 0 || strspn(dest, "0") != 32 || !(flags & RTF_ADDRCONF) ||
+            strcmp(dev, "lo") == 0 || strncmp(dev, "aisb", 4) == 0)
+            continue;
+
+        int dup = 0;
+        for (int i = 0; i < count; i++)
+            dup |= strcmp(names[i], dev) == 0;
+        if (!dup)
+            snprintf(names[count++], IFNAMSIZ, "%s", dev);
+    }
+    fclose(f);
+    return count;
+}
+
+/*
+ * Turn on IPv6 forwarding without costing the host its own IPv6
+ *
+ * With forwarding on, interfaces at accept_ra=1 ignore router
+ * advertisements, so a host configured by SLAAC would lose its default
+ * route when the advertised one expires. Only the interfaces carrying
+ * such a route are moved to 2 (accept even when forwarding) - never
+ * "all", "default" (inherited by every new veth) or a sandbox veth.
+ * Every change is recorded in IPV6_FWD_STATE so that
+ * restore_ipv6_forwarding() can undo it when the last IPv6 session
+ * ends. Forwarding an administrator turned on is left alone.
+ */
+static void enable_ipv6_forwarding(void)
+{
+    char ifaces[16][IFNAMSIZ];
+    char value[8];
+    int lock = lock_ipv6_forwarding();
+
+    if (read_ipv6_conf("all", "forwarding", value, sizeof(value)) != 0 || value[0] == '1')
+    {
+        if (lock >= 0)
+            close(lock);
+        return;
+    }
+
+    FILE *state = fopen(IPV6_FWD_STATE, "we");
+    if (!state)
+        fprintf(stderr, "[!] Warning: Could not record %s (%s) - IPv6 forwarding stays on after the session\n",
+                IPV6_FWD_STATE, strerror(errno));
+    else
+        fprintf(state, "all forwarding %s\n", value);
+
+    int count = ra_default_interfaces(ifaces, 16);
+    for (int i = 0; i < count; i++)
+    {
+        if (read_ipv6_conf(ifaces[i], "accept_ra", value, sizeof(value)) != 0 || strcmp(value, "1") != 0)
+            continue;
+        if (write_ipv6_conf(ifaces[i], "accept_ra", "2") == 0 && state)
+            fprintf(state, "%s accept_ra %s\n", ifaces[i], value);
+    }
+    if (state)
+        fclose(state);
+
+    write_ipv6_conf("all", "forwarding", "1");
+    if (lock >= 0)
+        close(lock);
+}
+
 /*
  * Setup NAT (Network Address Translation) on host
  *
  * WHY NEEDED:
- * - Sandbox has private IP (10.200.1.2) - not routable on internet
+ * - Sandbox has private IP (10.200.<slot>.2) - not routable on internet
  * - Host needs to translate sandbox traffic to its own IP
  * - This is same as how your home router works
  *
- * COMMANDS:
- * - Enable IP forwarding (allow kernel to route packets)
- * - Add MASQUERADE rule (replace source IP with host's IP)
+ * LAYOUT:
+ * - Every session gets its own AISB-<slot> chain in nat and filter
+ * - POSTROUTING/FORWARD only hold one jump per live session, and
+ *   packets from other sessions never walk this session's rules
+ * - The whole set is installed in one iptables-restore transaction
+ *   and removed the same way in cleanup_nat()
+ * - With ipv6 the same chains go into ip6tables, masquerading the
+ *   sandbox's ULA address behind the host's (NAT66)
  */
-int setup_nat(void)
+int setup_nat(const SandboxNet *net)
 {
+    char rules[1024];
+    char limit[256] = "";
+
     printf("[+] Setting up NAT for sandbox internet access...\n");
     
-    /* Enable IP forwarding */
+    /* Enable IP forwarding (IPv6 once the chains exist, see restore_ipv6_forwarding) */
     run_cmd("sysctl -w net.ipv4.ip_forward=1 >/dev/null 2>&1");
     
-    /* Add MASQUERADE rule for sandbox subnet */
-    run_cmd("iptables -t nat -A POSTROUTING -s 10.200.1.0/24 ! -o " VETH_HOST " -j MASQUERADE");
+    /* Drop anything a crashed session left in this slot */
+    cleanup_nat(net);
+    
+    /* Cap concurrent connections; new SYNs over the limit get a RST */
+    if (net->max_connections > 0)
+    {
+        snprintf(limit, sizeof(limit),
+                 "-A %s -i %s -p tcp --syn -m connlimit --connlimit-above %d"
+                 " --connlimit-mask 0 -j REJECT --reject-with tcp-reset\n",
+                 net->chain, net->veth_host, net->max_connections);
+    }
+    
+    for (int v6 = 0; v6 <= net->ipv6; v6++)
+    {
+        snprintf(rules, sizeof(rules),
+                 "*nat\n"
+                 ":%1$s - [0:0]\n"
+                 "-A %1$s ! -o %2$s -j MASQUERADE\n"
+                 "-A POSTROUTING -s %3$s -j %1$s\n"
+                 "COMMIT\n"
+                 "*filter\n"
+                 ":%1$s - [0:0]\n"
+                 "%4$s"
+                 "-A %1$s -j ACCEPT\n"
+                 "-A FORWARD -i %2$s -j %1$s\n"
+                 "-A FORWARD -o %2$s -j %1$s\n"
+                 "COMMIT\n",
+                 net->chain, net->veth_host, v6 ? net->subnet6 : net->subnet, limit);
+        
+        if (iptables_restore(rules, v6, 0) != 0)
+        {
+            fprintf(stderr, "[!] Failed to install %sNAT chain %s\n", v6 ? "IPv6 " : "", net->chain);
+            return -1;
+        }
+    }
     
-    /* Allow forwarding for sandbox traffic */
-    run_cmd("iptables -A FORWARD -i " VETH_HOST " -j ACCEPT");
-    run_cmd("iptables -A FORWARD -o " VETH_HOST " -j ACCEPT");
+    if (net->ipv6)
+    {
+        enable_ipv6_forwarding();
+    }
     
-    printf("[+] NAT configured - sandbox can access internet\n");
+    printf("[+] NAT configured (chain %s%s) - sandbox can access internet\n", net->chain,
+           net->ipv6 ? ", IPv4 and IPv6" : "");
     return 0;
 }
 
 /*
- * Setup DNS resolver inside sandbox
+ * Mark the slots that have AISB-<slot> chains in the live ruleset
+ */
+static void scan_chains(int v6, int *seen)
+{
+    char cmd[64];
+    char line[512];
+    int slot;
+
+    snprintf(cmd, sizeof(cmd), "%s-save 2>/dev/null", xtables(v6));
+    FILE *p = popen(cmd, "r");
+    if (!p)
+        return;
+    while (fgets(line, sizeof(line), p))
+    {
+        if (sscanf(line, ":AISB-%d", &slot) == 1 && slot >= 1 && slot <= MAX_SLOTS)
+            seen[slot] = 1;
+    }
+    pclose(p);
+}
+
+/*
+ * Remove one family's NAT/forward chains and their jump rules
  *
- * WHY NEEDED:
- * - /etc/resolv.conf tells the system where to send DNS queries
- * - We bind-mount our own resolv.conf pointing to 8.8.8.8
- * - This ensures DNS works even if host has complex DNS setup
+ * Tries one atomic transaction first; if the set is only partially
+ * present (e.g. a crash mid-teardown) falls back to deleting each
+ * piece individually so the slot always ends up clean.
  */
-int setup_dns(void)
+static int cleanup_nat_family(const SandboxNet *net, int v6)
 {
-    printf("[+] Configuring DNS resolver...\n");
-    
-    /* Create temporary resolv.conf */
-    const char *tmp_resolv = "/tmp/sandbox_resolv.conf";
-    FILE *f = fopen(tmp_resolv, "w");
-    if (!f)
+    char rules[1024];
+    char cmd[256];
+    const char *xt = xtables(v6);
+    const char *subnet = v6 ? net->subnet6 : net->subnet;
+
+    snprintf(rules, sizeof(rules),
+             "*nat\n"
+             "-D POSTROUTING -s %3$s -j %1$s\n"
+             "-F %1$s\n"
+             "-X %1$s\n"
+             "COMMIT\n"
+             "*filter\n"
+             "-D FORWARD -i %2$s -j %1$s\n"
+             "-D FORWARD -o %2$s -j %1$s\n"
+             "-F %1$s\n"
+             "-X %1$s\n"
+             "COMMIT\n",
+             net->chain, net->veth_host, subnet);
+
+    if (iptables_restore(rules, v6, 1) == 0)
+        return 0;
+
+    snprintf(cmd, sizeof(cmd), "%s -t nat -D POSTROUTING -s %s -j %s", xt, subnet, net->chain);
+    run_cmd_quiet(cmd);
+    snprintf(cmd, sizeof(cmd), "%s -t nat -F %s", xt, net->chain);
+    run_cmd_quiet(cmd);
+    snprintf(cmd, sizeof(cmd), "%s -t nat -X %s", xt, net->chain);
+    run_cmd_quiet(cmd);
+    snprintf(cmd, sizeof(cmd), "%s -D FORWARD -i %s -j %s", xt, net->veth_host, net->chain);
+    run_cmd_quiet(cmd);
+    snprintf(cmd, sizeof(cmd), "%s -D FORWARD -o %s -j %s", xt, net->veth_host, net->chain);
+    run_cmd_quiet(cmd);
+    snprintf(cmd, sizeof(cmd), "%s -F %s", xt, net->chain);
+    run_cmd_quiet(cmd);
+    snprintf(cmd, sizeof(cmd), "%s -X %s", xt, net->chain);
+    run_cmd_quiet(cmd);
+    return 0;
+}
+
+/*
+ * Undo enable_ipv6_forwarding() once no session has IPv6 chains left.
+ * Sessions enable forwarding only after installing their chains, and
+ * both sides hold IPV6_FWD_LOCK, so a session starting meanwhile is
+ * either seen here or turns forwarding back on itself.
+ */
+static void restore_ipv6_forwarding(void)
+{
+    int seen6[MAX_SLOTS + 1] = {0};
+    char iface[IFNAMSIZ], key[16], value[8];
+    int lock = lock_ipv6_forwarding();
+
+    FILE *state = fopen(IPV6_FWD_STATE, "re");
+    if (state)
     {
-        perror("fopen resolv.conf");
-        return -1;
+        int used = 0;
+        scan_chains(1, seen6);
+        for (int slot = 1; slot <= MAX_SLOTS; slot++)
+            used |= seen6[slot];
+
+        /* Forwarding goes first, so RAs are never ignored in between */
+        while (!used && fscanf(state, "%15s %15s %7s", iface, key, value) == 3)
+            write_ipv6_conf(iface, key, value);
+        if (!used)
+            unlink(IPV6_FWD_STATE);
+        fclose(state);
     }
-    
-    fprintf(f, "# Sandbox DNS configuration\n");
-    fprintf(f, "nameserver %s\n", DNS_SERVER);
-    fprintf(f, "nameserver 8.8.4.4\n");
-    fclose(f);
-    
-    /* Bind mount over /etc/resolv.conf */
-    if (mount(tmp_resolv, "/etc/resolv.conf", NULL, MS_BIND, NULL) == -1)
+    if (lock >= 0)
+        close(lock);
+}
+
+/*
+ * Remove this session's NAT/forward chains and their jump rules
+ *
+ * IPv6 chains only exist for ipv6 sessions, and callers tearing down
+ * a slot don't know which it was, so the ip6tables ruleset is looked
+ * at first rather than trying (and failing) every deletion.
+ */
+int cleanup_nat(const SandboxNet *net)
+{
+    int seen6[MAX_SLOTS + 1] = {0};
+
+    cleanup_nat_family(net, 0);
+
+    scan_chains(1, seen6);
+    if (net->slot >= 1 && net->slot <= MAX_SLOTS && seen6[net->slot])
     {
-        /* If bind mount fails, try direct copy as fallback */
-        fprintf(stderr, "[!] Bind mount failed, trying copy...\n");
-        char cmd[256];
-        snprintf(cmd, sizeof(cmd), "cp %s /etc/resolv.conf 2>/dev/null || true", tmp_resolv);
-        system(cmd);
+        cleanup_nat_family(net, 1);
+        restore_ipv6_forwarding();
     }
-    
-    printf("[+] DNS configured (using %s)\n", DNS_SERVER);
     return 0;
 }
 
 /*
- * Full network setup for sandbox with external connectivity
+ * Shape sandbox traffic on the host end of the veth pair
  *
- * This is the main entry point that orchestrates all network setup.
- * Returns the sandbox PID for the parent process to configure veth.
+ * HOW IT WORKS:
+ * - Root tbf qdisc caps traffic going INTO the sandbox (downloads),
+ *   with fq underneath so one bulk flow can't starve the others
+ * - An ingress police action caps traffic coming OUT of the sandbox
+ *   (uploads) at the same rate
+ * - Both live on the veth, so they vanish when the veth is deleted
+ *
+ * COMMAND EQUIVALENT:
+ *   tc qdisc replace dev aisbN-h root handle 1: tbf rate R burst B latency 50ms
+ *   tc qdisc replace dev aisbN-h parent 1:1 handle 10: fq
+ *   tc filter add dev aisbN-h parent ffff: matchall action police rate R burst B drop
  */
-int setup_sandbox_network(void)
+int setup_traffic_shaping(const SandboxNet *net)
 {
-    /* Setup from inside sandbox namespace */
-    setup_loopback();
-    setup_veth_in_sandbox();
-    setup_dns();
-    
+    char cmd[512];
+    const char *burst = net->egress_burst[0] ? net->egress_burst : "64kb";
+
+    if (net->egress_rate[0] == '\0')
+        return 0;
+
+    printf("[+] Shaping sandbox traffic to %s (burst %s)...\n", net->egress_rate, burst);
+
+    snprintf(cmd, sizeof(cmd),
+             "tc qdisc replace dev %s root handle 1: tbf rate %s burst %s latency 50ms",
+             net->veth_host, net->egress_rate, burst);
+    if (run_cmd(cmd) != 0)
+        return -1;
+
+    snprintf(cmd, sizeof(cmd),
+             "tc qdisc replace dev %s parent 1:1 handle 10: fq", net->veth_host);
+    run_cmd_quiet(cmd);
+
+    snprintf(cmd, sizeof(cmd), "tc qdisc replace dev %s handle ffff: ingress", net->veth_host);
+    run_cmd(cmd);
+
+    snprintf(cmd, sizeof(cmd),
+             "tc filter replace dev %s parent ffff: protocol all prio 1 matchall"
+             " action police rate %s burst %s drop",
+             net->veth_host, net->egress_rate, burst);
+    run_cmd(cmd);
+
+    printf("[+] Traffic shaping active on %s\n", net->veth_host);
     return 0;
 }
+
+/*
+ * Read one counter from /sys/class/net/<dev>/statistics
+ */
+static unsigned long long read_link_stat(const char *dev, const char *name)
+{
+    char path[256];
+    unsigned long long value = 0;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/%s", dev, name);
+    FILE *f = fopen(path, "r");
+    if (f)
+    {
+        if (fscanf(f, "%llu", &value) != 1)
+            value = 0;
+        fclose(f);
+    }
+    return value;
+}
+
+/*
+ * Sum the "dropped" counters tc reports for a device
+ */
+static unsigned long long read_tc_drops(const char *dev)
+{
+    char cmd[128];
+    char line[512];
+    unsigned long long total = 0, dropped;
+
+    snprintf(cmd, sizeof(cmd), "tc -s qdisc show dev %s root 2>/dev/null", dev);
+    FILE *p = popen(cmd, "r");
+    if (!p)
+        return 0;
+    while (fgets(line, sizeof(line), p))
+    {
+        char *d = strstr(line, "dropped ");
+        if (d && sscanf(d, "dropped %llu", &dropped) == 1)
+            total += dropped;
+    }
+    pclose(p);
+    return total;
+}
+
+/*
+ * Packets rejected by the connlimit rule of a session chain
+ */
+static unsigned long long read_connlimit_rejects(const char *chain)
+{
+    char cmd[128];
+    char line[512];
+    unsigned long long pkts = 0;
+
+    snprintf(cmd, sizeof(cmd), "iptables -L %s -n -v -x 2>/dev/null", chain);
+    FILE *p = popen(cmd, "r");
+    if (!p)
+        return 0;
+    while (fgets(line, sizeof(line), p))
+    {
+        if (strstr(line, "connlimit"))
+            sscanf(line, "%llu", &pkts);
+    }
+    pclose(p);
+    return pkts;
+}
+
+/*
+ * Export per-session traffic counters
+ *
+ * One JSON object per live slot, so the dashboard and scripts can
+ * consume it directly. rx/tx are from the host end of the veth:
+ * rx = sent by the sandbox, tx = received by the sandbox.
+ */
+int print_network_stats(void)
+{
+    SandboxNet net;
+    int count = 0;
+
+    DIR *dir = opendir(SLOT_DIR);
+    if (!dir)
+    {
+        printf("No sandbox networks\n");
+        return 0;
+    }
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        char path[256];
+        char owner[128] = {0};
+        int slot = atoi(ent->d_name);
+
+        if (slot < 1 || slot > MAX_SLOTS)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%d", SLOT_DIR, slot);
+        FILE *f = fopen(path, "r");
+        if (f)
+        {
+            if (!fgets(owner, sizeof(owner), f))
+                owner[0] = '\0';
+            fclose(f);
+        }
+        owner[strcspn(owner, "\n")] = '\0';
+
+        sandbox_net_from_slot(slot, &net);
+        printf("{\"slot\":%d,\"owner\":\"%s\",\"veth\":\"%s\","
+               "\"rx_bytes\":%llu,\"tx_bytes\":%llu,"
+               "\"rx_packets\":%llu,\"tx_packets\":%llu,"
+               "\"shaped_drops\":%llu,\"connlimit_rejects\":%llu}\n",
+               slot, owner, net.veth_host,
+               read_link_stat(net.veth_host, "rx_bytes"),
+               read_link_stat(net.veth_host, "tx_bytes"),
+               read_link_stat(net.veth_host, "rx_packets"),
+               read_link_stat(net.veth_host, "tx_packets"),
+               read_tc_drops(net.veth_host),
+               read_connlimit_rejects(net.chain));
+        count++;
+    }
+    closedir(dir);
+
+    if (count == 0)
+        printf("No sandbox networks\n");
+    return count;
+}
+
+/*
+ * Setup DNS resolver inside sandbox
+ *
+ * WHY NEEDED:
+ * - /etc/resolv.conf tells the system where to send DNS queries
+ * - We bind-mount our own resolv.conf naming the session's DNS stub
+ *   (or the upstream directly when there is no stub)
+ * - This ensures DNS works even if host has complex DNS setup
+ *
+ * The file gets a unique name and is unlinked once mounted, so
+ * concurrent sessions never see each other's copy.
+ */
+int setup_dns(const char *nameserver)
+{
+    printf("[+] Configuring DNS resolver...\n");
+    
+    /* Create temporary resolv.conf */
+    char tmp_resolv[] = "/tmp/.ai-sandbox-resolv.XXXXXX";
+    int fd = mkstemp(tmp_resolv);
+    if (fd < 0)
+    {
+        perror("mkstemp resolv.conf");
+        return -1;
+    }
+    fchmod(fd, 0644);
+    dprintf(fd, "# Sandbox DNS configuration\n");
+    dprintf(fd, "nameserver %s\n", nameserver);
+    close(fd);
+    
+    /* Bind mount over /etc/resolv.conf */
+    if (mount(tmp_resolv, "/etc/resolv.conf", NULL, MS_BIND, NULL) == -1)
+    {
+        /* If bind mount fails, try direct copy as fallback */
+        fprintf(stderr, "[!] Bind mount failed, trying copy...\n");
+        char cmd[256];
+        snprintf(cmd, sizeof(cmd), "cp %s /etc/resolv.conf 2>/dev/null || true", tmp_resolv);
+        system(cmd);
+    }
+    unlink(tmp_resolv);
+    
+    printf("[+] DNS configured (using %s)\n", nameserver);
+    return 0;
+}
+
+/*
+ * Full network setup for sandbox with external connectivity
+ *
+ * This is the main entry point that orchestrates all network setup.
+ * Returns the sandbox PID for the parent process to configure veth.
+ */
+int setup_sandbox_network(const SandboxNet *net)
+{
+    /* Setup from inside sandbox namespace */
+    setup_loopback();
+    setup_veth_in_sandbox(net);
+    setup_dns(DNS_DEFAULT_UPSTREAM);
+    
+    return 0;
+}
+
+/* ---------- Shared network namespaces ---------- */
+
+/*
+ * Update the user list of a shared namespace and return how many live
+ * users remain.
+ *
+ * The .ref file holds one ai-run pid per line rather than a bare
+ * counter, so sessions that crashed without releasing can be pruned
+ * instead of pinning the namespace forever. Pass 0 to skip add/remove.
+ * Caller holds the policy lock.
+ */
+static int update_users(const char *hash, pid_t add, pid_t remove)
+{
+    char path[256];
+    pid_t users[256];
+    int count = 0;
+    int pid;
+
+    snprintf(path, sizeof(path), "%s/%s.ref", NETNS_DIR, hash);
+
+    FILE *f = fopen(path, "r");
+    if (f)
+    {
+        while (count < 255 && fscanf(f, "%d", &pid) == 1)
+        {
+            if (pid != remove && pid_alive(pid))
+                users[count++] = pid;
+        }
+        fclose(f);
+    }
+
+    if (add > 0)
+        users[count++] = add;
+
+    if (count == 0)
+    {
+        unlink(path);
+        return 0;
+    }
+
+    f = fopen(path, "w");
+    if (!f)
+    {
+        perror("fopen refcount");
+        return -1;
+    }
+    for (int i = 0; i < count; i++)
+        fprintf(f, "%d\n", users[i]);
+    fclose(f);
+    return count;
+}
+
+/*
+ * Take the per-policy lock that serializes create/attach/teardown
+ *
+ * WHY NEEDED:
+ * - Two sessions with the same policy may start at the same time
+ * - Only one of them must build the namespace, the other attaches
+ *
+ * Returns the lock fd (close it to unlock) or -1.
+ */
+int shared_netns_lock(const char *hash)
+{
+    char path[256];
+
+    mkdir(RUN_DIR, 0755);
+    mkdir(NETNS_DIR, 0755);
+
+    snprintf(path, sizeof(path), "%s/%s.lock", NETNS_DIR, hash);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        perror("open netns lock");
+        return -1;
+    }
+    if (flock(fd, LOCK_EX) == -1)
+    {
+        perror("flock");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Unpin a shared namespace (returns its host-side slot) or unpin it
+ * and release that slot right away. Caller holds the policy lock.
+ */
+static int unpin_shared_netns(const char *hash)
+{
+    char path[256];
+
+    printf("[+] Last user gone, removing network namespace %s\n", hash);
+
+    snprintf(path, sizeof(path), "%s/%s", NETNS_DIR, hash);
+    umount2(path, MNT_DETACH);
+    unlink(path);
+
+    /* Namespace is gone once unpinned; the host side is now unowned */
+    int slot = shared_netns_slot(hash);
+    snprintf(path, sizeof(path), "%s/%s.slot", NETNS_DIR, hash);
+    unlink(path);
+    return slot;
+}
+
+static void teardown_shared_netns(const char *hash)
+{
+    int slot = unpin_shared_netns(hash);
+
+    if (slot > 0)
+    {
+        SandboxNet net;
+        sandbox_net_from_slot(slot, &net);
+        cleanup_nat(&net);
+        cleanup_veth(&net);
+        release_sandbox_net(&net);
+    }
+}
+
+/*
+ * Attach to an already configured namespace for this policy
+ *
+ * Must be called with the policy lock held. On success this process
+ * is added to the user list and an fd for setns() is returned; -1
+ * means no namespace exists yet and the caller should build one.
+ */
+int shared_netns_acquire(const char *hash)
+{
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/%s", NETNS_DIR, hash);
+
+    if (update_users(hash, 0, 0) <= 0)
+    {
+        /* Every previous user died without cleaning up */
+        if (access(path, F_OK) == 0)
+            teardown_shared_netns(hash);
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    int users = update_users(hash, getpid(), 0);
+    printf("[+] Reusing network namespace %s (%d sessions)\n", hash, users);
+    return fd;
+}
+
+/*
+ * Pin a freshly configured sandbox namespace under NETNS_DIR
+ *
+ * HOW IT WORKS:
+ * - Same trick as "ip netns add": bind-mount /proc/<pid>/ns/net
+ *   onto a regular file, which keeps the namespace alive after
+ *   the creating process exits
+ * - Veth, routes and firewall rules live in the namespace, so
+ *   later sessions get all of them for free
+ * - The host-side slot now belongs to the namespace, not to us
+ *
+ * Must be called from the host mount namespace with the lock held.
+ */
+int shared_netns_publish(const char *hash, pid_t sandbox_pid, const SandboxNet *net)
+{
+    char path[256];
+    char ns_path[64];
+    char owner[64];
+
+    snprintf(path, sizeof(path), "%s/%s", NETNS_DIR, hash);
+    snprintf(ns_path, sizeof(ns_path), "/proc/%d/ns/net", sandbox_pid);
+
+    int fd = open(path, O_RDONLY | O_CREAT | O_CLOEXEC, 0444);
+    if (fd < 0)
+    {
+        perror("create netns file");
+        return -1;
+    }
+    close(fd);
+
+    if (mount(ns_path, path, NULL, MS_BIND, NULL) == -1)
+    {
+        fprintf(stderr, "[!] Could not pin network namespace: %s\n", strerror(errno));
+        unlink(path);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s.slot", NETNS_DIR, hash);
+    FILE *f = fopen(path, "w");
+    if (f)
+    {
+        fprintf(f, "%d\n", net->slot);
+        fclose(f);
+    }
+
+    snprintf(owner, sizeof(owner), "netns:%s", hash);
+    set_sandbox_net_owner(net, owner);
+
+    update_users(hash, getpid(), 0);
+    printf("[+] Network namespace pinned at %s/%s\n", NETNS_DIR, hash);
+    return 0;
+}
+
+/*
+ * Host-side slot of a pinned namespace (0 if unknown)
+ */
+int shared_netns_slot(const char *hash)
+{
+    char path[256];
+    int slot = 0;
+
+    snprintf(path, sizeof(path), "%s/%s.slot", NETNS_DIR, hash);
+    FILE *f = fopen(path, "r");
+    if (f)
+    {
+        if (fscanf(f, "%d", &slot) != 1)
+            slot = 0;
+        fclose(f);
+    }
+    return slot;
+}
+
+/*
+ * Drop a session's reference; the last user unpins the namespace
+ *
+ * Returns the slot whose veth/chains the caller must now remove, or 0
+ * if other sessions still use the namespace.
+ */
+int shared_netns_release(const char *hash, pid_t user)
+{
+    int slot = 0;
+    int lock = shared_netns_lock(hash);
+    int users = update_users(hash, 0, user);
+
+    if (users > 0)
+        printf("[+] Network namespace still used by %d session(s)\n", users);
+    else
+        slot = unpin_shared_netns(hash);
+
+    if (lock >= 0)
+        close(lock);
+    return slot;
+}
+
+/*
+ * Enter an existing network namespace (called by the child)
+ */
+int join_network_namespace(int netns_fd)
+{
+    printf("[+] Joining shared network namespace...\n");
+
+    if (setns(netns_fd, CLONE_NEWNET) == -1)
+    {
+        perror("setns(CLONE_NEWNET)");
+        return -1;
+    }
+
+    close(netns_fd);
+    printf("[+] Network namespace joined\n");
+    return 0;
+}
+
+/* ---------- Garbage collection ---------- */
+
+/*
+ * Remove the global rules older versions appended on every run
+ * (one MASQUERADE and two FORWARD rules per session, never deleted)
+ */
+static void cleanup_legacy_nat(void)
+{
+    int removed = 0;
+
+    while (removed < 4096 &&
+           run_cmd_quiet("iptables -t nat -D POSTROUTING -s " LEGACY_SUBNET
+                         " ! -o " LEGACY_VETH_HOST " -j MASQUERADE") == 0)
+        removed++;
+    while (removed < 4096 && run_cmd_quiet("iptables -D FORWARD -i " LEGACY_VETH_HOST " -j ACCEPT") == 0)
+        removed++;
+    while (removed < 4096 && run_cmd_quiet("iptables -D FORWARD -o " LEGACY_VETH_HOST " -j ACCEPT") == 0)
+        removed++;
+    run_cmd_quiet("ip link delete " LEGACY_VETH_HOST);
+
+    if (removed > 0)
+        printf("[+] Removed %d legacy NAT/forward rules\n", removed);
+}
+
+/*
+ * Is this slot still owned by something alive?
+ */
+static int slot_in_use(int slot)
+{
+    char path[256];
+    char owner[128] = {0};
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s/%d", SLOT_DIR, slot);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    if (!fgets(owner, sizeof(owner), f))
+        owner[0] = '\0';
+    int claimed_recently = fstat(fileno(f), &st) == 0 &&
+                           time(NULL) - st.st_mtime < SLOT_CLAIM_GRACE_SEC;
+    fclose(f);
+    owner[strcspn(owner, "\n")] = '\0';
+
+    if (strncmp(owner, "netns:", 6) == 0)
+    {
+        /* Pinned namespaces are reclaimed through their user list */
+        const char *hash = owner + 6;
+        int lock = shared_netns_lock(hash);
+        int users = update_users(hash, 0, 0);
+        if (users <= 0)
+            teardown_shared_netns(hash);
+        if (lock >= 0)
+            close(lock);
+        return users > 0;
+    }
+
+    /* Empty owner: reserved a moment ago, or its ai-run died before writing it */
+    if (owner[0] == '\0')
+        return claimed_recently;
+
+    return pid_alive(atoi(owner));
+}
+
+/*
+ * Garbage-collect host network state of sessions that died
+ *
+ * Walks both the slot directory and the live iptables ruleset, so
+ * chains survive neither a crashed ai-run nor a wiped /run.
+ */
+int gc_sandbox_networks(void)
+{
+    int reclaimed = 0;
+    int seen[MAX_SLOTS + 1] = {0};
+    SandboxNet net;
+
+    /* Finish queued teardowns first so they aren't counted as leaks */
+    reap_network_teardowns();
+
+    /* Slots recorded on disk */
+    DIR *dir = opendir(SLOT_DIR);
+    if (dir)
+    {
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL)
+        {
+            int slot = atoi(ent->d_name);
+            if (slot >= 1 && slot <= MAX_SLOTS)
+                seen[slot] = 1;
+        }
+        closedir(dir);
+    }
+
+    /* Chains present in the kernel even if the slot file is gone */
+    scan_chains(0, seen);
+    scan_chains(1, seen);
+
+    for (int slot = 1; slot <= MAX_SLOTS; slot++)
+    {
+        if (!seen[slot] || slot_in_use(slot))
+            continue;
+
+        sandbox_net_from_slot(slot, &net);
+        cleanup_nat(&net);
+        cleanup_veth(&net);
+        release_sandbox_net(&net);
+        printf("[+] Reclaimed stale sandbox network %s (%s)\n", net.chain, net.subnet);
+        reclaimed++;
+    }
+
+    cleanup_legacy_nat();
+    return reclaimed;
+}
+
+/* ---------- Asynchronous teardown ---------- */
+
+/*
+ * Queue a finished session's network for removal
+ *
+ * WHY:
+ * - Deleting a veth (and the netns behind it) waits for an RCU grace
+ *   period and can take tens of milliseconds; iptables-restore adds
+ *   more. None of that should delay the caller of "ai-run run".
+ * - The entry is a small file, so a crash between queueing and
+ *   reaping loses nothing: the next reaper or "ai-run destroy"
+ *   picks it up.
+ *
+ * Entry name: <ai-run pid>-<slot>, content: "slot <n>" or "netns <hash>".
+ */
+int queue_network_teardown(const SandboxNet *net, const char *netns_hash, pid_t owner)
+{
+    char path[256];
+    char tmp[280];
+
+    mkdir(RUN_DIR, 0755);
+    mkdir(REAP_DIR, 0755);
+
+    snprintf(path, sizeof(path), "%s/%d-%d", REAP_DIR, owner, net->slot);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *f = fopen(tmp, "w");
+    if (!f)
+        return -1;
+    if (netns_hash && netns_hash[0])
+        fprintf(f, "netns %s\n", netns_hash);
+    else
+        fprintf(f, "slot %d\n", net->slot);
+    fclose(f);
+
+    /* rename() so the reaper never sees a half-written entry */
+    if (rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Delete the chains of many slots in one transaction; -1 if any of
+ * them wasn't complete (nothing is deleted then)
+ */
+static int delete_chains_batched(const int *slots, int count, int v6)
+{
+    SandboxNet net;
+    char line[512];
+
+    size_t cap = (size_t)count * 512 + 64;
+    char *rules = malloc(cap);
+    if (!rules)
+        return -1;
+
+    size_t len = 0;
+    len += snprintf(rules + len, cap - len, "*nat\n");
+    for (int i = 0; i < count; i++)
+    {
+        sandbox_net_from_slot(slots[i], &net);
+        snprintf(line, sizeof(line),
+                 "-D POSTROUTING -s %s -j %s\n-F %s\n-X %s\n",
+                 v6 ? net.subnet6 : net.subnet, net.chain, net.chain, net.chain);
+        len += snprintf(rules + len, cap - len, "%s", line);
+    }
+    len += snprintf(rules + len, cap - len, "COMMIT\n*filter\n");
+    for (int i = 0; i < count; i++)
+    {
+        sandbox_net_from_slot(slots[i], &net);
+        snprintf(line, sizeof(line),
+                 "-D FORWARD -i %s -j %s\n-D FORWARD -o %s -j %s\n-F %s\n-X %s\n",
+                 net.veth_host, net.chain, net.veth_host, net.chain,
+                 net.chain, net.chain);
+        len += snprintf(rules + len, cap - len, "%s", line);
+    }
+    snprintf(rules + len, cap - len, "COMMIT\n");
+
+    int ret = iptables_restore(rules, v6, 1);
+    free(rules);
+    return ret;
+}
+
+/*
+ * Remove the veths and chains of many slots with one ip(8) and one
+ * iptables-restore invocation (two with IPv6) instead of ~8 processes
+ * per slot
+ */
+static void teardown_slots_batched(const int *slots, int count)
+{
+    SandboxNet net;
+
+    if (count == 0)
+        return;
+
+    /* Links: -force keeps going past already-deleted ones */
+    FILE *p = popen("ip -force -batch - >/dev/null 2>&1", "w");
+    if (p)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            sandbox_net_from_slot(slots[i], &net);
+            fprintf(p, "link delete %s\n", net.veth_host);
+        }
+        pclose(p);
+    }
+
+    /* Rules: one transaction per family for every chain */
+    if (delete_chains_batched(slots, count, 0) != 0)
+    {
+        /* Some chain was already partly gone - fall back per slot */
+        for (int i = 0; i < count; i++)
+        {
+            sandbox_net_from_slot(slots[i], &net);
+            cleanup_nat_family(&net, 0);
+        }
+    }
+
+    /* IPv6 chains only for the slots of ipv6 sessions */
+    int seen6[MAX_SLOTS + 1] = {0};
+    int slots6[MAX_SLOTS];
+    int count6 = 0;
+
+    scan_chains(1, seen6);
+    for (int i = 0; i < count; i++)
+    {
+        if (slots[i] >= 1 && slots[i] <= MAX_SLOTS && seen6[slots[i]] && count6 < MAX_SLOTS)
+            slots6[count6++] = slots[i];
+    }
+    if (count6 > 0 && delete_chains_batched(slots6, count6, 1) != 0)
+    {
+        for (int i = 0; i < count6; i++)
+        {
+            sandbox_net_from_slot(slots6[i], &net);
+            cleanup_nat_family(&net, 1);
+        }
+    }
+    if (count6 > 0)
+        restore_ipv6_forwarding();
+
+    for (int i = 0; i < count; i++)
+    {
+        sandbox_net_from_slot(slots[i], &net);
+        release_sandbox_net(&net);
+    }
+}
+
+/*
+ * Drain the teardown queue
+ *
+ * Serialized by REAP_LOCK. Entries queued while a batch is running are
+ * picked up by the next loop iteration (or by the next reaper, which
+ * blocks on the lock until this one is done).
+ */
+int reap_network_teardowns(void)
+{
+    int total = 0;
+
+    int lock = open(REAP_LOCK, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock < 0)
+        return 0;
+    flock(lock, LOCK_EX);
+
+    while (1)
+    {
+        int slots[MAX_SLOTS];
+        char names[MAX_SLOTS][64];
+        int nslots = 0, nnames = 0;
+
+        DIR *dir = opendir(REAP_DIR);
+        if (!dir)
+            break;
+
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL && nnames < MAX_SLOTS)
+        {
+            char path[320];
+            char kind[16], arg[64];
+            int owner = 0;
+
+            if (ent->d_name[0] == '.')
+                continue;
+
+            snprintf(path, sizeof(path), "%s/%s", REAP_DIR, ent->d_name);
+
+            /* Half-written: still being queued, or left by an ai-run that died doing it */
+            if (strstr(ent->d_name, ".tmp"))
+            {
+                if (!pid_alive(atoi(ent->d_name)))
+                    unlink(path);
+                continue;
+            }
+            FILE *f = fopen(path, "r");
+            if (!f)
+                continue;
+            int fields = fscanf(f, "%15s %63s", kind, arg);
+            fclose(f);
+
+            snprintf(names[nnames++], sizeof(names[0]), "%.63s", ent->d_name);
+            if (fields != 2)
+                continue;
+
+            if (strcmp(kind, "slot") == 0)
+            {
+                int slot = atoi(arg);
+                if (slot >= 1 && slot <= MAX_SLOTS)
+                    slots[nslots++] = slot;
+            }
+            else if (strcmp(kind, "netns") == 0)
+            {
+                owner = atoi(ent->d_name);
+                int slot = shared_netns_release(arg, owner);
+                if (slot >= 1 && slot <= MAX_SLOTS)
+                    slots[nslots++] = slot;
+            }
+        }
+        closedir(dir);
+
+        if (nnames == 0)
+            break;
+
+        teardown_slots_batched(slots, nslots);
+
+        for (int i = 0; i < nnames; i++)
+        {
+            char path[320];
+            snprintf(path, sizeof(path), "%s/%.63s", REAP_DIR, names[i]);
+            unlink(path);
+        }
+        total += nslots;
+    }
+
+    close(lock);
+    return total;
+}
+
+/*
+ * Start a detached reaper for the teardown queue
+ *
+ * Double fork + setsid so the reaper is re-parented to init and the
+ * caller can exit (and its terminal can close) right away.
+ */
+int spawn_network_reaper(void)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+
+    if (pid == 0)
+    {
+        setsid();
+        if (fork() != 0)
+            _exit(0);
+
+        /* Reaper runs after the user is back at their prompt - keep quiet */
+        int null = open("/dev/null", O_RDWR);
+        if (null >= 0)
+        {
+            dup2(null, STDIN_FILENO);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            if (null > STDERR_FILENO)
+                close(null);
+        }
+
+        reap_network_teardowns();
+        _exit(0);
+    }
+
+    waitpid(pid, NULL, 0);
+    return 0;
+}
+
+/*
+ * Start user-mode networking for a rootless sandbox
+ *
+ * WHY: Without root we can't create veth pairs or NAT rules on the
+ * host. slirp4netns runs as the invoking user, joins the sandbox's
+ * user and network namespaces and forwards traffic through ordinary
+ * host sockets, so egress still works without any privilege.
+ *
+ * HOW: slirp4netns --configure creates tap0 (10.0.2.100/24, gateway
+ * 10.0.2.2; with ipv6 also fd00::100/64, NATed by slirp itself)
+ * inside the namespace and writes to --ready-fd once it is
+ * up. It exits when the write end of --exit-fd is closed, which we
+ * keep until the session ends (see stop_user_network).
+ *
+ * Returns the helper's pid, or -1 if it could not be started
+ * (e.g. slirp4netns not installed).
+ */
+pid_t start_user_network(pid_t sandbox_pid, int ipv6, int *exit_fd)
+{
+    int ready_pipe[2];
+    int exit_pipe[2];
+    
+    printf("[+] Starting user-mode networking (slirp4netns)...\n");
+    
+    if (pipe(ready_pipe) == -1)
+    {
+        perror("pipe");
+        return -1;
+    }
+    if (pipe(exit_pipe) == -1)
+    {
+        perror("pipe");
+        close(ready_pipe[0]);
+        close(ready_pipe[1]);
+        return -1;
+    }
+    
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        close(ready_pipe[0]);
+        close(ready_pipe[1]);
+        close(exit_pipe[0]);
+        close(exit_pipe[1]);
+        return -1;
+    }
+    
+    if (pid == 0)
+    {
+        char ready_arg[16], exit_arg[16], pid_arg[16];
+        
+        close(ready_pipe[0]);
+        close(exit_pipe[1]);
+        
+        int devnull = open("/dev/null", O_RDWR);
+        if (devnull >= 0)
+        {
+            dup2(devnull, STDIN_FILENO);
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            if (devnull > STDERR_FILENO)
+                close(devnull);
+        }
+        
+        snprintf(ready_arg, sizeof(ready_arg), "%d", ready_pipe[1]);
+        snprintf(exit_arg, sizeof(exit_arg), "%d", exit_pipe[0]);
+        snprintf(pid_arg, sizeof(pid_arg), "%d", sandbox_pid);
+        
+        if (ipv6)
+        {
+            execlp("slirp4netns", "slirp4netns",
+                   "--configure", "--mtu=65520", "--disable-host-loopback", "--enable-ipv6",
+                   "--ready-fd", ready_arg, "--exit-fd", exit_arg,
+                   pid_arg, "tap0", (char *)NULL);
+        }
+        else
+        {
+            execlp("slirp4netns", "slirp4netns",
+                   "--configure", "--mtu=65520", "--disable-host-loopback",
+                   "--ready-fd", ready_arg, "--exit-fd", exit_arg,
+                   pid_arg, "tap0", (char *)NULL);
+        }
+        _exit(127);
+    }
+    
+    close(ready_pipe[1]);
+    close(exit_pipe[0]);
+    
+    /* Don't let later children (shell-outs) keep the helper alive */
+    fcntl(exit_pipe[1], F_SETFD, FD_CLOEXEC);
+    
+    char c;
+    ssize_t n;
+    do
+    {
+        n = read(ready_pipe[0], &c, 1);
+    } while (n == -1 && errno == EINTR);
+    close(ready_pipe[0]);
+    
+    if (n != 1)
+    {
+        /* Helper exited (or failed to exec) before the interface came up */
+        close(exit_pipe[1]);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    
+    *exit_fd = exit_pipe[1];
+    printf("[+] User-mode networking ready (tap0)\n");
+    return pid;
+}
+
+/*
+ * Stop the slirp4netns helper started by start_user_network
+ */
+void stop_user_network(pid_t helper_pid, int exit_fd)
+{
+    close(exit_fd);
+    waitpid(helper_pid, NULL, 0);
+}
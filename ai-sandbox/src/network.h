@@ -3,22 +3,84 @@
 
 #include <sys/types.h>
 
+/*
+ * Host-side resources owned by one sandbox network namespace.
+ * Each session gets its own slot so concurrent sandboxes don't
+ * collide on interface names, subnets or iptables chains.
+ */
+typedef struct {
+    int  slot;              /* 1..254, selects 10.200.<slot>.0/24 */
+    char veth_host[16];     /* aisb<slot>-h */
+    char veth_sandbox[16];  /* aisb<slot>-s */
+    char host_ip[16];
+    char sandbox_ip[16];
+    char subnet[24];
+    char chain[32];         /* AISB-<slot> in nat and filter tables */
+
+    /* IPv6 (policy ipv6: true): fd61:6973:6278:<slot>::/64, NAT66 */
+    int  ipv6;
+    char host_ip6[48];
+    char sandbox_ip6[48];
+    char subnet6[48];
+
+    /* Per-session limits applied on the host end (empty/0 = none) */
+    char egress_rate[32];   /* tc rate, e.g. "50mbit" */
+    char egress_burst[32];  /* tc burst, e.g. "256kb" */
+    int  max_connections;   /* concurrent TCP connections */
+} SandboxNet;
+
+/* Per-session slot allocation (owner is a pid or "netns:<hash>") */
+int alloc_sandbox_net(SandboxNet *net);
+void sandbox_net_from_slot(int slot, SandboxNet *net);
+int set_sandbox_net_owner(const SandboxNet *net, const char *owner);
+void release_sandbox_net(const SandboxNet *net);
+
 /* Network namespace management */
 int create_network_namespace(void);
 int setup_loopback(void);
 
 /* Veth pair setup (for external connectivity) */
-int cleanup_veth(void);
-int setup_veth_from_host(pid_t sandbox_pid);
-int setup_veth_in_sandbox(void);
+int cleanup_veth(const SandboxNet *net);
+int setup_veth_from_host(const SandboxNet *net, pid_t sandbox_pid);
+int setup_veth_in_sandbox(const SandboxNet *net);
+
+/* Does the host have an IPv6 default route to give sandboxes? */
+int host_has_ipv6(void);
+
+/* NAT for internet access (per-session chain, removed on exit) */
+int setup_nat(const SandboxNet *net);
+int cleanup_nat(const SandboxNet *net);
 
-/* NAT for internet access */
-int setup_nat(void);
+/* Bandwidth shaping on the host-side veth */
+int setup_traffic_shaping(const SandboxNet *net);
 
-/* DNS configuration */
-int setup_dns(void);
+/* Print per-session traffic counters as JSON lines */
+int print_network_stats(void);
+
+/* Private /etc/resolv.conf naming one nameserver (an address) */
+int setup_dns(const char *nameserver);
 
 /* Main network setup function (called from inside sandbox) */
-int setup_sandbox_network(void);
+int setup_sandbox_network(const SandboxNet *net);
+
+/* Remove veths, chains and slots left behind by dead sessions */
+int gc_sandbox_networks(void);
+
+/* Asynchronous, batched teardown of finished sessions */
+int queue_network_teardown(const SandboxNet *net, const char *netns_hash, pid_t owner);
+int reap_network_teardowns(void);
+int spawn_network_reaper(void);
+
+/* User-mode networking for rootless sandboxes (slirp4netns) */
+pid_t start_user_network(pid_t sandbox_pid, int ipv6, int *exit_fd);
+void stop_user_network(pid_t helper_pid, int exit_fd);
+
+/* Persistent per-policy network namespaces (reuse_network_namespace) */
+int shared_netns_lock(const char *hash);
+int shared_netns_acquire(const char *hash);
+int shared_netns_publish(const char *hash, pid_t sandbox_pid, const SandboxNet *net);
+int shared_netns_release(const char *hash, pid_t user);
+int shared_netns_slot(const char *hash);
+int join_network_namespace(int netns_fd);
 
 #endif
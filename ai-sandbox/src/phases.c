@@ -0,0 +1,287 @@
+/*
+ * phases.c - Dependency-graph executor for sandbox startup
+ *
+ * HOW IT WORKS:
+ * 1. run_sandbox() registers every startup phase (veth, NAT, mounts,
+ *    firewall...) with the phases it needs, before cloning the child
+ * 2. The board holding phase state is a MAP_SHARED mapping, so after
+ *    the clone parent and child see the same done/failed flags
+ * 3. Each process starts one thread per phase of its own side; a
+ *    thread sleeps on a process-shared condition variable until its
+ *    dependencies are done, runs, then wakes everyone up
+ * 4. Start/end times let us walk back from the last phase along the
+ *    latest-finishing dependency to report the critical path
+ *
+ * Phases touching per-thread state (setns, seccomp) must not be run
+ * here - do them on the main thread before or after phase_run().
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "phases.h"
+
+typedef struct {
+    char name[24];
+    PhaseSide side;
+    PhaseFn fn;
+    void *arg;
+    unsigned deps;
+    long long start_us;
+    long long end_us;
+} Phase;
+
+struct PhaseBoard {
+    pthread_mutex_t lock;       /* process-shared, robust */
+    pthread_cond_t changed;     /* broadcast whenever a phase finishes */
+    unsigned done_mask;
+    int failed;
+    int count;
+    long long t0_us;
+    Phase phases[MAX_PHASES];
+};
+
+typedef struct {
+    PhaseBoard *board;
+    int id;
+    int peer_pidfd;
+    int rc;
+} PhaseTask;
+
+static long long now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Lock the board, recovering if the other process died holding it
+ */
+static void board_lock(PhaseBoard *board)
+{
+    if (pthread_mutex_lock(&board->lock) == EOWNERDEAD)
+    {
+        board->failed = 1;
+        pthread_mutex_consistent(&board->lock);
+    }
+}
+
+static int peer_exited(int pidfd)
+{
+    struct pollfd pfd = { .fd = pidfd, .events = POLLIN };
+    return pidfd >= 0 && poll(&pfd, 1, 0) > 0;
+}
+
+PhaseBoard *phase_board_create(void)
+{
+    PhaseBoard *board = mmap(NULL, sizeof(PhaseBoard), PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (board == MAP_FAILED)
+    {
+        perror("mmap phase board");
+        return NULL;
+    }
+    memset(board, 0, sizeof(*board));
+
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&board->lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&board->changed, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    board->t0_us = now_us();
+    return board;
+}
+
+void phase_board_destroy(PhaseBoard *board)
+{
+    if (board)
+        munmap(board, sizeof(PhaseBoard));
+}
+
+int phase_add(PhaseBoard *board, const char *name, PhaseSide side,
+              PhaseFn fn, void *arg, unsigned deps)
+{
+    if (board->count >= MAX_PHASES)
+    {
+        fprintf(stderr, "[!] Too many startup phases\n");
+        return -1;
+    }
+
+    int id = board->count++;
+    Phase *ph = &board->phases[id];
+
+    snprintf(ph->name, sizeof(ph->name), "%s", name);
+    ph->side = side;
+    ph->fn = fn;
+    ph->arg = arg;
+    ph->deps = deps;
+    return id;
+}
+
+/*
+ * Block until all dependencies of a phase are done
+ * Returns -1 if any phase failed or the other process went away
+ */
+static int wait_for_deps(PhaseBoard *board, int id, int peer_pidfd)
+{
+    unsigned deps = board->phases[id].deps;
+    int rc = 0;
+
+    board_lock(board);
+    while ((deps & ~board->done_mask) != 0)
+    {
+        if (board->failed)
+        {
+            rc = -1;
+            break;
+        }
+
+        if (peer_exited(peer_pidfd))
+        {
+            board->failed = 1;
+            pthread_cond_broadcast(&board->changed);
+            rc = -1;
+            break;
+        }
+
+        /* Timed so a dead peer is noticed even if nobody broadcasts */
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_nsec += 20 * 1000000L;
+        if (ts.tv_nsec >= 1000000000L)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&board->changed, &board->lock, &ts) == EOWNERDEAD)
+        {
+            board->failed = 1;
+            pthread_mutex_consistent(&board->lock);
+        }
+    }
+    pthread_mutex_unlock(&board->lock);
+    return rc;
+}
+
+static void *phase_thread(void *arg)
+{
+    PhaseTask *task = arg;
+    PhaseBoard *board = task->board;
+    Phase *ph = &board->phases[task->id];
+
+    task->rc = wait_for_deps(board, task->id, task->peer_pidfd);
+    if (task->rc != 0)
+        return NULL;
+
+    ph->start_us = now_us();
+    task->rc = ph->fn ? ph->fn(ph->arg) : 0;
+    ph->end_us = now_us();
+
+    board_lock(board);
+    if (task->rc == 0)
+    {
+        board->done_mask |= 1u << task->id;
+    }
+    else
+    {
+        fprintf(stderr, "[!] Startup phase '%s' failed\n", ph->name);
+        board->failed = 1;
+    }
+    pthread_cond_broadcast(&board->changed);
+    pthread_mutex_unlock(&board->lock);
+    return NULL;
+}
+
+int phase_run(PhaseBoard *board, PhaseSide side, int peer_pidfd)
+{
+    pthread_t threads[MAX_PHASES];
+    PhaseTask tasks[MAX_PHASES];
+    int started[MAX_PHASES] = {0};
+    int rc = 0;
+
+    for (int id = 0; id < board->count; id++)
+    {
+        if (board->phases[id].side != side)
+            continue;
+
+        tasks[id].board = board;
+        tasks[id].id = id;
+        tasks[id].peer_pidfd = peer_pidfd;
+        tasks[id].rc = 0;
+
+        if (pthread_create(&threads[id], NULL, phase_thread, &tasks[id]) == 0)
+        {
+            started[id] = 1;
+        }
+        else
+        {
+            /* Run it inline: its dependencies are checked the same way */
+            phase_thread(&tasks[id]);
+        }
+    }
+
+    for (int id = 0; id < board->count; id++)
+    {
+        if (board->phases[id].side != side)
+            continue;
+
+        if (started[id])
+            pthread_join(threads[id], NULL);
+        if (tasks[id].rc != 0)
+            rc = -1;
+    }
+
+    return rc;
+}
+
+void phase_report(const PhaseBoard *board, int last)
+{
+    int path[MAX_PHASES];
+    int len = 0;
+
+    if (last < 0 || last >= board->count)
+        return;
+
+    /* Walk back along whichever dependency finished last */
+    for (int id = last; id >= 0 && len < MAX_PHASES; )
+    {
+        const Phase *ph = &board->phases[id];
+        long long latest = -1;
+        int next = -1;
+
+        path[len++] = id;
+        for (int dep = 0; dep < board->count; dep++)
+        {
+            if ((ph->deps & (1u << dep)) && board->phases[dep].end_us > latest)
+            {
+                latest = board->phases[dep].end_us;
+                next = dep;
+            }
+        }
+        id = next;
+    }
+
+    printf("[+] Sandbox ready in %.1f ms (critical path:",
+           (board->phases[last].end_us - board->t0_us) / 1000.0);
+    for (int i = len - 1; i >= 0; i--)
+    {
+        const Phase *ph = &board->phases[path[i]];
+        printf("%s %s %.1f ms", i == len - 1 ? "" : " ->", ph->name,
+               (ph->end_us - ph->start_us) / 1000.0);
+    }
+    printf(")\n");
+}
@@ -0,0 +1,46 @@
+#ifndef PHASES_H
+#define PHASES_H
+
+/*
+ * Dependency-graph executor for sandbox startup
+ *
+ * Phases are registered up front with the side (host = parent,
+ * sandbox = child) that runs them and the phases they depend on.
+ * Each process then runs its own side; independent phases run
+ * concurrently and a phase may wait on one from the other process.
+ */
+
+#define MAX_PHASES 24
+
+/* Dependency mask for a phase id; a missing phase (-1) adds nothing */
+#define PHASE_DEP(id) ((id) >= 0 ? 1u << (id) : 0u)
+
+typedef enum {
+    PHASE_HOST = 0,     /* runs in the parent, host namespaces */
+    PHASE_SANDBOX = 1   /* runs in the sandbox child */
+} PhaseSide;
+
+typedef int (*PhaseFn)(void *arg);
+
+typedef struct PhaseBoard PhaseBoard;
+
+/* Board lives in shared memory: create before fork/clone */
+PhaseBoard *phase_board_create(void);
+void phase_board_destroy(PhaseBoard *board);
+
+/* Returns the phase id, or -1 if the board is full */
+int phase_add(PhaseBoard *board, const char *name, PhaseSide side,
+              PhaseFn fn, void *arg, unsigned deps);
+
+/*
+ * Run every phase of one side, one thread each, until all have
+ * finished. peer_pidfd (or -1) is the other process: if it exits
+ * while we wait on one of its phases the run fails instead of hanging.
+ * Returns 0 if all phases succeeded, -1 otherwise.
+ */
+int phase_run(PhaseBoard *board, PhaseSide side, int peer_pidfd);
+
+/* Print total time to finish `last` and the chain of phases that bounded it */
+void phase_report(const PhaseBoard *board, int last);
+
+#endif
@@ -0,0 +1,559 @@
+/*
+ * placement.c - CPU and NUMA placement of concurrent sandboxes
+ *
+ * WHY: Packed onto one host, every sandbox floats over every core and
+ * memory node. Compile-heavy agents then keep evicting each other's
+ * caches and pull memory across the interconnect.
+ *
+ * HOW IT WORKS:
+ * 1. The topology comes from sysfs: online CPUs, which node each one
+ *    is on, and which of them are SMT siblings of one physical core.
+ *    Cores are ordered by node, so neighbouring picks share a node
+ * 2. A session asking for cpu_cores writes its request into its
+ *    session state (SESSION_RUN_DIR/<pid>/placement) and, under one
+ *    host-wide lock, every placed session is laid out again: largest
+ *    request first, each on the node with the most free cores, spilling
+ *    onto the next node only when one is too small. When the host is
+ *    oversubscribed the next round of sessions shares cores evenly
+ * 3. Each result goes to cpuset.cpus/cpuset.mems of the session's
+ *    cgroup, which moves every task in it at once. Without the cpuset
+ *    controller (cgroup v1 hosts), the affinity of every thread in the
+ *    cgroup - or, with no cgroup at all, of every process in the
+ *    sandbox's PID namespace - is set instead. New processes inherit
+ *    it, memory nodes are then left to the kernel
+ * 4. When a session ends its record goes with its state directory and
+ *    the rest are laid out again, so freed cores are picked up
+ *
+ * Requests are laid out from scratch in a fixed order (size, then
+ * pid), so a session only moves when the set of sessions changes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "placement.h"
+#include "reload.h"
+
+#ifndef SYS_CPU_DIR
+#define SYS_CPU_DIR  "/sys/devices/system/cpu"
+#endif
+#ifndef SYS_NODE_DIR
+#define SYS_NODE_DIR "/sys/devices/system/node"
+#endif
+
+#define MAX_CPUS      1024
+#define MAX_NODES     64
+#define MAX_PLACED    256
+
+/* One physical core: its logical CPUs and node */
+typedef struct {
+    int node;
+    int key;                    /* package << 16 | core_id, for grouping */
+    int ncpus;
+    int cpus[8];
+    int used;                   /* sessions placed on it */
+    int mine;                   /* taken by the session being placed */
+} Core;
+
+typedef struct {
+    Core cores[MAX_CPUS];
+    int ncores;
+} Topology;
+
+typedef struct {
+    pid_t pid;
+    int cores;
+    char cgroup[512];
+    SessionPlacement placement;
+} PlacedSession;
+
+/* "0-3,8,10-11" -> mask; returns how many were set */
+static int parse_cpulist(const char *list, unsigned char *mask, int max)
+{
+    const char *p = list;
+    int count = 0;
+
+    while (*p && *p != '\n')
+    {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        long hi = lo;
+
+        if (end == p)
+            break;
+        if (*end == '-')
+            hi = strtol(end + 1, &end, 10);
+        for (long i = lo; i <= hi && i < max; i++)
+        {
+            if (i >= 0 && !mask[i])
+            {
+                mask[i] = 1;
+                count++;
+            }
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+/* mask -> "0-3,8,10-11" */
+static void format_cpulist(const unsigned char *mask, int max, char *out, size_t len)
+{
+    size_t pos = 0;
+
+    out[0] = '\0';
+    for (int i = 0; i < max; i++)
+    {
+        if (!mask[i])
+            continue;
+        int j = i;
+        while (j + 1 < max && mask[j + 1])
+            j++;
+        int n = j > i ? snprintf(out + pos, len - pos, "%s%d-%d", pos ? "," : "", i, j)
+                      : snprintf(out + pos, len - pos, "%s%d", pos ? "," : "", i);
+        if (n < 0 || (size_t)n >= len - pos)
+            break;
+        pos += (size_t)n;
+        i = j;
+    }
+}
+
+static int read_line(const char *path, char *buf, size_t len)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    int ok = fgets(buf, (int)len, f) != NULL;
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+static int read_int(const char *path, int fallback)
+{
+    char buf[32];
+    return read_line(path, buf, sizeof(buf)) == 0 ? atoi(buf) : fallback;
+}
+
+static int cmp_core(const void *a, const void *b)
+{
+    const Core *x = a, *y = b;
+    if (x->node != y->node)
+        return x->node - y->node;
+    return x->key - y->key;
+}
+
+/*
+ * Online CPUs we may use (our own affinity, which a container's cpuset
+ * narrows), grouped into cores and sorted by node
+ */
+static int read_topology(Topology *topo)
+{
+    unsigned char online[MAX_CPUS] = {0};
+    int node_of[MAX_CPUS];
+    char path[256];
+    char buf[1024];
+    cpu_set_t allowed;
+
+    topo->ncores = 0;
+    snprintf(path, sizeof(path), "%s/online", SYS_CPU_DIR);
+    if (read_line(path, buf, sizeof(buf)) != 0 || parse_cpulist(buf, online, MAX_CPUS) == 0)
+        return -1;
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (int cpu = 0; cpu < MAX_CPUS && cpu < CPU_SETSIZE; cpu++)
+        {
+            if (!CPU_ISSET(cpu, &allowed))
+                online[cpu] = 0;
+        }
+    }
+
+    /* No node directories (non-NUMA kernel): everything is node 0 */
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+        node_of[cpu] = 0;
+    for (int node = 0; node < MAX_NODES; node++)
+    {
+        unsigned char mask[MAX_CPUS] = {0};
+
+        snprintf(path, sizeof(path), "%s/node%d/cpulist", SYS_NODE_DIR, node);
+        if (read_line(path, buf, sizeof(buf)) != 0)
+            continue;
+        parse_cpulist(buf, mask, MAX_CPUS);
+        for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+        {
+            if (mask[cpu])
+                node_of[cpu] = node;
+        }
+    }
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        if (!online[cpu])
+            continue;
+
+        snprintf(path, sizeof(path), "%s/cpu%d/topology/core_id", SYS_CPU_DIR, cpu);
+        int core_id = read_int(path, cpu);
+        snprintf(path, sizeof(path), "%s/cpu%d/topology/physical_package_id", SYS_CPU_DIR, cpu);
+        int package = read_int(path, 0);
+        int key = (package << 16) | (core_id & 0xffff);
+
+        Core *core = NULL;
+        for (int i = 0; i < topo->ncores; i++)
+        {
+            if (topo->cores[i].key == key && topo->cores[i].node == node_of[cpu])
+            {
+                core = &topo->cores[i];
+                break;
+            }
+        }
+        if (!core)
+        {
+            core = &topo->cores[topo->ncores++];
+            memset(core, 0, sizeof(*core));
+            core->node = node_of[cpu];
+            core->key = key;
+        }
+        if (core->ncpus < (int)(sizeof(core->cpus) / sizeof(core->cpus[0])))
+            core->cpus[core->ncpus++] = cpu;
+    }
+
+    qsort(topo->cores, topo->ncores, sizeof(Core), cmp_core);
+    return topo->ncores > 0 ? 0 : -1;
+}
+
+/* Take the least-used core on the node with the most of them left */
+static Core *pick_core(Topology *topo, const unsigned char *nodes_taken)
+{
+    int level = -1;
+    int free_on[MAX_NODES] = {0};
+
+    for (int i = 0; i < topo->ncores; i++)
+    {
+        if (!topo->cores[i].mine && (level < 0 || topo->cores[i].used < level))
+            level = topo->cores[i].used;
+    }
+    for (int i = 0; i < topo->ncores; i++)
+    {
+        if (!topo->cores[i].mine && topo->cores[i].used == level)
+            free_on[topo->cores[i].node]++;
+    }
+
+    /* Stay on a node this session already has if it still has room */
+    int best = -1;
+    for (int node = 0; node < MAX_NODES; node++)
+    {
+        if (free_on[node] == 0)
+            continue;
+        if (best < 0 ||
+            (nodes_taken[node] && !nodes_taken[best]) ||
+            (nodes_taken[node] == nodes_taken[best] && free_on[node] > free_on[best]))
+            best = node;
+    }
+
+    for (int i = 0; i < topo->ncores; i++)
+    {
+        if (!topo->cores[i].mine && topo->cores[i].node == best && topo->cores[i].used == level)
+            return &topo->cores[i];
+    }
+    return NULL;
+}
+
+static void place_session(Topology *topo, PlacedSession *s)
+{
+    unsigned char cpus[MAX_CPUS] = {0};
+    unsigned char nodes[MAX_NODES] = {0};
+    int want = s->cores < topo->ncores ? s->cores : topo->ncores;
+
+    for (int i = 0; i < topo->ncores; i++)
+        topo->cores[i].mine = 0;
+    for (int n = 0; n < want; n++)
+    {
+        Core *core = pick_core(topo, nodes);
+        if (!core)
+            break;
+        core->used++;
+        core->mine = 1;
+        nodes[core->node] = 1;
+        for (int c = 0; c < core->ncpus; c++)
+            cpus[core->cpus[c]] = 1;
+    }
+
+    format_cpulist(cpus, MAX_CPUS, s->placement.cpus, sizeof(s->placement.cpus));
+    format_cpulist(nodes, MAX_NODES, s->placement.mems, sizeof(s->placement.mems));
+}
+
+static int write_file(const char *dir, const char *file, const char *data)
+{
+    char path[640];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t len = (ssize_t)strlen(data);
+    ssize_t n = write(fd, data, len);
+    close(fd);
+    return n == len ? 0 : -1;
+}
+
+/* Pin every thread listed in a tasks file (cgroup.threads or /proc/<pid>/task) */
+static void set_task_affinity(pid_t pid, const cpu_set_t *set)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR *d = opendir(path);
+    if (!d)
+        return;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+        int tid = atoi(ent->d_name);
+        if (tid > 0)
+            sched_setaffinity(tid, sizeof(*set), set);
+    }
+    closedir(d);
+}
+
+static void set_affinity_all(const char *cpus, const char *cgroup, pid_t pid)
+{
+    unsigned char mask[MAX_CPUS] = {0};
+    char path[640];
+    struct stat ns, other;
+    cpu_set_t set;
+    int tid;
+
+    parse_cpulist(cpus, mask, MAX_CPUS);
+    CPU_ZERO(&set);
+    for (int cpu = 0; cpu < MAX_CPUS && cpu < CPU_SETSIZE; cpu++)
+    {
+        if (mask[cpu])
+            CPU_SET(cpu, &set);
+    }
+
+    if (cgroup[0])
+    {
+        snprintf(path, sizeof(path), "%s/cgroup.threads", cgroup);
+        FILE *f = fopen(path, "r");
+        if (f)
+        {
+            while (fscanf(f, "%d", &tid) == 1)
+                sched_setaffinity(tid, sizeof(set), &set);
+            fclose(f);
+            return;
+        }
+    }
+
+    /*
+     * No cgroup: every process whose PID namespace is the sandbox's.
+     * Processes in namespaces nested inside it are not found, but
+     * inherit the mask when they are forked later.
+     */
+    snprintf(path, sizeof(path), "/proc/%d/ns/pid", pid);
+    if (stat(path, &ns) != 0)
+        return;
+    DIR *d = opendir("/proc");
+    if (!d)
+        return;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+        pid_t other_pid = atoi(ent->d_name);
+        if (other_pid <= 0)
+            continue;
+        snprintf(path, sizeof(path), "/proc/%d/ns/pid", other_pid);
+        if (stat(path, &other) == 0 && other.st_ino == ns.st_ino && other.st_dev == ns.st_dev)
+            set_task_affinity(other_pid, &set);
+    }
+    closedir(d);
+}
+
+/* cpuset if the session cgroup has it, affinity otherwise */
+static void apply_placement(const PlacedSession *s)
+{
+    if (s->cgroup[0] &&
+        write_file(s->cgroup, "cpuset.mems", s->placement.mems) == 0 &&
+        write_file(s->cgroup, "cpuset.cpus", s->placement.cpus) == 0)
+        return;
+    set_affinity_all(s->placement.cpus, s->cgroup, s->pid);
+}
+
+static int record_path(pid_t pid, char *out, size_t len)
+{
+    return snprintf(out, len, "%s/%d/%s", SESSION_RUN_DIR, pid, PLACEMENT_FILE_NAME) < (int)len ? 0 : -1;
+}
+
+static int write_record(const PlacedSession *s)
+{
+    char path[256];
+    char tmp[272];
+
+    record_path(s->pid, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f)
+        return -1;
+    fprintf(f, "cores=%d\ncgroup=%s\ncpus=%s\nmems=%s\n",
+            s->cores, s->cgroup, s->placement.cpus, s->placement.mems);
+    if (fclose(f) != 0 || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Copy a record value, truncated to the field */
+static void copy_value(char *dst, size_t len, const char *src)
+{
+    size_t n = strlen(src);
+
+    if (n >= len)
+        n = len - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+}
+
+static int read_record(pid_t pid, PlacedSession *s)
+{
+    char path[256];
+    char line[600];
+
+    record_path(pid, path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    memset(s, 0, sizeof(*s));
+    s->pid = pid;
+    while (fgets(line, sizeof(line), f))
+    {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "cores=", 6) == 0)
+            s->cores = atoi(line + 6);
+        else if (strncmp(line, "cgroup=", 7) == 0)
+            copy_value(s->cgroup, sizeof(s->cgroup), line + 7);
+        else if (strncmp(line, "cpus=", 5) == 0)
+            copy_value(s->placement.cpus, sizeof(s->placement.cpus), line + 5);
+        else if (strncmp(line, "mems=", 5) == 0)
+            copy_value(s->placement.mems, sizeof(s->placement.mems), line + 5);
+    }
+    fclose(f);
+    return s->cores > 0 ? 0 : -1;
+}
+
+static int cmp_session(const void *a, const void *b)
+{
+    const PlacedSession *x = a, *y = b;
+    if (x->cores != y->cores)
+        return y->cores - x->cores;
+    return x->pid - y->pid;
+}
+
+/* Lay out every live placed session again; caller holds the lock */
+static int rebalance_locked(void)
+{
+    static PlacedSession sessions[MAX_PLACED];
+    static Topology topo;
+    int count = 0;
+
+    if (read_topology(&topo) != 0)
+    {
+        printf("[!] Could not read CPU topology - sandboxes are not placed\n");
+        return -1;
+    }
+
+    DIR *d = opendir(SESSION_RUN_DIR);
+    if (!d)
+        return 0;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL && count < MAX_PLACED)
+    {
+        pid_t pid = (pid_t)atoi(ent->d_name);
+
+        /* Session state of a crashed ai-run: its sandbox is gone too */
+        if (pid <= 0 || (kill(pid, 0) != 0 && errno == ESRCH))
+            continue;
+        if (read_record(pid, &sessions[count]) == 0)
+            count++;
+    }
+    closedir(d);
+
+    qsort(sessions, count, sizeof(PlacedSession), cmp_session);
+    for (int i = 0; i < count; i++)
+    {
+        place_session(&topo, &sessions[i]);
+        apply_placement(&sessions[i]);
+        write_record(&sessions[i]);
+    }
+    return count;
+}
+
+static int lock_placement(void)
+{
+    mkdir("/run/ai-sandbox", 0755);
+    int fd = open(PLACEMENT_LOCK, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return -1;
+    if (flock(fd, LOCK_EX) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int placement_join(pid_t pid, int cores, const SandboxCgroup *cg, SessionPlacement *out)
+{
+    PlacedSession self;
+    char path[256];
+
+    memset(&self, 0, sizeof(self));
+    self.pid = pid;
+    self.cores = cores;
+    snprintf(self.cgroup, sizeof(self.cgroup), "%s", cg->path);
+
+    int lock = lock_placement();
+    if (lock < 0)
+    {
+        printf("[!] Warning: Could not take the placement lock - sandbox not placed\n");
+        return -1;
+    }
+
+    /* The record is the request; rebalancing fills in the result */
+    mkdir(SESSION_RUN_DIR, 0755);
+    snprintf(path, sizeof(path), "%s/%d", SESSION_RUN_DIR, pid);
+    mkdir(path, 0700);
+    if (write_record(&self) != 0)
+    {
+        printf("[!] Warning: Could not record placement for %d - sandbox not placed\n", pid);
+        close(lock);
+        return -1;
+    }
+
+    int ret = rebalance_locked() > 0 && read_record(pid, &self) == 0 ? 0 : -1;
+    close(lock);
+
+    if (ret == 0)
+        *out = self.placement;
+    return ret;
+}
+
+int placement_rebalance(void)
+{
+    int lock = lock_placement();
+    if (lock < 0)
+        return -1;
+    int count = rebalance_locked();
+    close(lock);
+    return count;
+}
@@ -0,0 +1,32 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <sys/types.h>
+#include "cgroup.h"
+
+/* Per-session placement record, in SESSION_RUN_DIR/<pid>/ */
+#define PLACEMENT_FILE_NAME "placement"
+#define PLACEMENT_LOCK      "/run/ai-sandbox/placement.lock"
+
+/* Where a session runs: CPU and memory node lists ("0-3,8-11", "0") */
+typedef struct {
+    char cpus[256];
+    char mems[64];
+} SessionPlacement;
+
+/*
+ * Give a new session cores cores (with their SMT siblings) and the
+ * memory nodes they sit on, rebalancing every placed session on the
+ * host around it. Applied through cpuset.cpus/cpuset.mems in the
+ * session cgroup, or CPU affinity where the cpuset controller isn't
+ * available. Returns 0 and fills out, or -1.
+ */
+int placement_join(pid_t pid, int cores, const SandboxCgroup *cg, SessionPlacement *out);
+
+/*
+ * Re-spread the placed sessions that are still alive; called when one
+ * ends (its record gone with the session state). Returns how many.
+ */
+int placement_rebalance(void);
+
+#endif
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <arpa/inet.h>
 #include <yaml.h>
 #include "policy.h"
 
@@ -13,9 +15,261 @@ typedef enum {
     STATE_NETWORK_WHITELIST,
     STATE_DEFAULT_NETWORK_POLICY,
     STATE_ALLOW_ALL_HTTPS,
-    STATE_BLOCKED_SYSCALLS
+    STATE_REUSE_NETNS,
+    STATE_NETWORK,
+    STATE_EGRESS_RATE,
+    STATE_EGRESS_BURST,
+    STATE_MAX_CONNECTIONS,
+    STATE_IDLE_FREEZE,
+    STATE_IDLE_RECLAIM,
+    STATE_MAX_WALL_TIME,
+    STATE_MAX_CPU_TIME,
+    STATE_MAX_IDLE_TIME,
+    STATE_CPU_CORES,
+    STATE_ADMIT_MEMORY_PRESSURE,
+    STATE_ADMIT_IO_PRESSURE,
+    STATE_ADMIT_CPU_PRESSURE,
+    STATE_ADMIT_MAX_WAIT,
+    STATE_ADMIT_MAX_QUEUE,
+    STATE_ROOTFS,
+    STATE_PACKAGE_PROXY,
+    STATE_IPV6,
+    STATE_DNS_UPSTREAM,
+    STATE_EXPOSE_PORTS,
+    STATE_FLOW_LOG,
+    STATE_BLOCKED_SYSCALLS,
+    STATE_AUDITED_SYSCALLS,
+    STATE_BLOCKED_EXECUTABLES,
+    STATE_LAYERS
 } ParseState;
 
+/*
+ * Check a tc rate/size like "50mbit", "1.5gbit" or "256kb"
+ */
+static int is_tc_size(const char *val)
+{
+    size_t len = strlen(val);
+    size_t i = 0;
+
+    if (len == 0 || len >= 32)
+        return 0;
+    while (i < len && ((val[i] >= '0' && val[i] <= '9') || val[i] == '.'))
+        i++;
+    if (i == 0)
+        return 0;
+    while (i < len && ((val[i] >= 'a' && val[i] <= 'z') || (val[i] >= 'A' && val[i] <= 'Z')))
+        i++;
+    return i == len;
+}
+
+/* "443", "8000-8100" or "*" -> inclusive range; -1 if malformed */
+static int parse_port_range(const char *val, int *lo, int *hi)
+{
+    char *end;
+
+    if (strcmp(val, "*") == 0)
+    {
+        *lo = 1;
+        *hi = 65535;
+        return 0;
+    }
+    if (!isdigit((unsigned char)val[0]))
+        return -1;
+    long a = strtol(val, &end, 10);
+    long b = a;
+    if (*end == '-')
+    {
+        if (!isdigit((unsigned char)end[1]))
+            return -1;
+        b = strtol(end + 1, &end, 10);
+    }
+    if (*end != '\0' || a < 1 || b > 65535 || a > b)
+        return -1;
+    *lo = (int)a;
+    *hi = (int)b;
+    return 0;
+}
+
+/* A single port, or -1 */
+static int parse_port(const char *val)
+{
+    int lo, hi;
+
+    if (parse_port_range(val, &lo, &hi) != 0 || lo != hi)
+        return -1;
+    return lo;
+}
+
+int parse_dns_server(const char *spec, int *family, void *addr, int *port)
+{
+    char host[64];
+    const char *port_str = NULL;
+
+    if (spec[0] == '[')
+    {
+        const char *close = strchr(spec, ']');
+        if (!close || (close[1] != '\0' && close[1] != ':'))
+            return -1;
+        snprintf(host, sizeof(host), "%.*s", (int)(close - spec - 1), spec + 1);
+        if (close[1] == ':')
+            port_str = close + 2;
+    }
+    else
+    {
+        /* Only one ':' is a port; more is a bare IPv6 address */
+        const char *colon = strchr(spec, ':');
+        if (colon && !strchr(colon + 1, ':'))
+        {
+            snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+            port_str = colon + 1;
+        }
+        else
+        {
+            snprintf(host, sizeof(host), "%s", spec);
+        }
+    }
+
+    *port = 53;
+    if (port_str)
+    {
+        *port = parse_port(port_str);
+        if (*port < 0)
+            return -1;
+    }
+
+    if (inet_pton(AF_INET, host, addr) == 1)
+        *family = AF_INET;
+    else if (inet_pton(AF_INET6, host, addr) == 1)
+        *family = AF_INET6;
+    else
+        return -1;
+    return 0;
+}
+
+int parse_whitelist_entry(const char *entry, WhitelistTarget *out)
+{
+    char host[MAX_LEN];
+    char ports[MAX_LEN] = "";
+    size_t len = strlen(entry);
+
+    memset(out, 0, sizeof(*out));
+    if (len == 0 || len >= MAX_LEN)
+        return -1;
+
+    if (entry[0] == '[')
+    {
+        /* [v6addr]:ports */
+        const char *close = strchr(entry, ']');
+        if (!close || (close[1] != '\0' && close[1] != ':'))
+            return -1;
+        snprintf(host, sizeof(host), "%.*s", (int)(close - entry - 1), entry + 1);
+        if (close[1] == ':')
+            snprintf(ports, sizeof(ports), "%s", close + 2);
+    }
+    else
+    {
+        /* A second ':' means a bare IPv6 address, which takes no ports */
+        const char *colon = strchr(entry, ':');
+        if (colon && !strchr(colon + 1, ':'))
+        {
+            snprintf(host, sizeof(host), "%.*s", (int)(colon - entry), entry);
+            snprintf(ports, sizeof(ports), "%s", colon + 1);
+        }
+        else
+        {
+            snprintf(host, sizeof(host), "%s", entry);
+        }
+    }
+
+    /* Address or CIDR */
+    int prefix = -1;
+    char *slash = strchr(host, '/');
+    if (slash)
+    {
+        char *end;
+        *slash = '\0';
+        if (!isdigit((unsigned char)slash[1]))
+            return -1;
+        prefix = (int)strtol(slash + 1, &end, 10);
+        if (*end != '\0')
+            return -1;
+    }
+
+    if (inet_pton(AF_INET, host, out->addr) == 1)
+    {
+        out->family = AF_INET;
+    }
+    else if (inet_pton(AF_INET6, host, out->addr) == 1)
+    {
+        out->family = AF_INET6;
+    }
+    else
+    {
+        /* Domain: hostname characters only (ends up in rules and logs) */
+        if (slash || host[0] == '\0')
+            return -1;
+        for (const char *c = host; *c; c++)
+        {
+            if (!isalnum((unsigned char)*c) && *c != '.' && *c != '-' && *c != '_')
+                return -1;
+        }
+    }
+
+    if (out->family)
+    {
+        int bits = out->family == AF_INET ? 32 : 128;
+        if (prefix > bits)
+            return -1;
+        out->prefix = prefix < 0 ? bits : prefix;
+        for (int i = out->prefix; i < bits; i++)
+            out->addr[i / 8] &= (unsigned char)~(0x80 >> (i % 8));
+    }
+    snprintf(out->host, sizeof(out->host), "%s", host);
+
+    if (ports[0] == '\0')
+    {
+        if (entry[len - 1] == ':')
+            return -1;
+        out->ports[0].lo = out->ports[0].hi = 80;
+        out->ports[1].lo = out->ports[1].hi = 443;
+        out->port_count = 2;
+        return 0;
+    }
+
+    char *save = NULL;
+    for (char *tok = strtok_r(ports, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        if (out->port_count == WL_MAX_PORT_RANGES ||
+            parse_port_range(tok, &out->ports[out->port_count].lo,
+                             &out->ports[out->port_count].hi) != 0)
+            return -1;
+        out->port_count++;
+    }
+    return out->port_count > 0 ? 0 : -1;
+}
+
+/* "90", "90s", "30m", "2h", "1d" -> seconds; -1 if malformed */
+static int parse_duration(const char *val)
+{
+    char *end;
+    long n = strtol(val, &end, 10);
+
+    if (end == val || n < 0)
+        return -1;
+    switch (*end)
+    {
+    case '\0':
+    case 's': break;
+    case 'm': n *= 60; break;
+    case 'h': n *= 3600; break;
+    case 'd': n *= 86400; break;
+    default: return -1;
+    }
+    if (*end && end[1] != '\0')
+        return -1;
+    return n > 0x7fffffff ? -1 : (int)n;
+}
+
 int load_policy(const char *filename, Policy *policy)
 {
     FILE *fh = fopen(filename, "r");
@@ -36,7 +290,32 @@ int load_policy(const char *filename, Policy *policy)
     policy->whitelist_count = 0;
     policy->network_mode = NET_POLICY_DENY;  /* Default: deny all */
     policy->allow_all_https = 0;
+    policy->reuse_netns = 0;
+    policy->package_proxy = 0;
+    policy->flow_log = 1;
+    policy->ipv6 = 0;
+    policy->dns_upstream[0] = '\0';
+    policy->expose_count = 0;
+    policy->loopback_only = 0;
+    policy->minimal_rootfs = 0;
+    policy->layer_count = 0;
+    policy->egress_rate[0] = '\0';
+    policy->egress_burst[0] = '\0';
+    policy->max_connections = 0;
+    policy->idle_freeze = 0;
+    policy->idle_reclaim = 0;
+    policy->max_wall_time = 0;
+    policy->max_cpu_time = 0;
+    policy->max_idle_time = 0;
+    policy->cpu_cores = 0;
+    policy->admit_memory_pressure = 20;
+    policy->admit_io_pressure = 40;
+    policy->admit_cpu_pressure = 0;
+    policy->admit_max_wait = 300;
+    policy->admit_max_queue = 32;
     policy->blocked_syscalls_count = 0;
+    policy->audited_syscalls_count = 0;
+    policy->blocked_executables_count = 0;
 
     ParseState state = STATE_NONE;
     int expecting_value = 0;
@@ -73,10 +352,131 @@ int load_policy(const char *filename, Policy *policy)
                 pending_scalar_state = STATE_ALLOW_ALL_HTTPS;
                 expecting_value = 1;
             }
+            else if (strcmp(val, "reuse_network_namespace") == 0)
+            {
+                pending_scalar_state = STATE_REUSE_NETNS;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "package_proxy") == 0)
+            {
+                pending_scalar_state = STATE_PACKAGE_PROXY;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "ipv6") == 0)
+            {
+                pending_scalar_state = STATE_IPV6;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "dns_upstream") == 0)
+            {
+                pending_scalar_state = STATE_DNS_UPSTREAM;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "flow_log") == 0)
+            {
+                pending_scalar_state = STATE_FLOW_LOG;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "network") == 0)
+            {
+                pending_scalar_state = STATE_NETWORK;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "egress_rate") == 0)
+            {
+                pending_scalar_state = STATE_EGRESS_RATE;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "egress_burst") == 0)
+            {
+                pending_scalar_state = STATE_EGRESS_BURST;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "max_connections") == 0)
+            {
+                pending_scalar_state = STATE_MAX_CONNECTIONS;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "idle_freeze") == 0)
+            {
+                pending_scalar_state = STATE_IDLE_FREEZE;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "idle_reclaim") == 0)
+            {
+                pending_scalar_state = STATE_IDLE_RECLAIM;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "max_wall_time") == 0)
+            {
+                pending_scalar_state = STATE_MAX_WALL_TIME;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "max_cpu_time") == 0)
+            {
+                pending_scalar_state = STATE_MAX_CPU_TIME;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "max_idle_time") == 0)
+            {
+                pending_scalar_state = STATE_MAX_IDLE_TIME;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "cpu_cores") == 0)
+            {
+                pending_scalar_state = STATE_CPU_CORES;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "admit_memory_pressure") == 0)
+            {
+                pending_scalar_state = STATE_ADMIT_MEMORY_PRESSURE;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "admit_io_pressure") == 0)
+            {
+                pending_scalar_state = STATE_ADMIT_IO_PRESSURE;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "admit_cpu_pressure") == 0)
+            {
+                pending_scalar_state = STATE_ADMIT_CPU_PRESSURE;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "admit_max_wait") == 0)
+            {
+                pending_scalar_state = STATE_ADMIT_MAX_WAIT;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "admit_max_queue") == 0)
+            {
+                pending_scalar_state = STATE_ADMIT_MAX_QUEUE;
+                expecting_value = 1;
+            }
+            else if (strcmp(val, "rootfs") == 0)
+            {
+                pending_scalar_state = STATE_ROOTFS;
+                expecting_value = 1;
+            }
             else if (strcmp(val, "blocked_syscalls") == 0)
             {
                 state = STATE_BLOCKED_SYSCALLS;
             }
+            else if (strcmp(val, "audited_syscalls") == 0)
+            {
+                state = STATE_AUDITED_SYSCALLS;
+            }
+            else if (strcmp(val, "blocked_executables") == 0)
+            {
+                state = STATE_BLOCKED_EXECUTABLES;
+            }
+            else if (strcmp(val, "layers") == 0)
+            {
+                state = STATE_LAYERS;
+            }
+            else if (strcmp(val, "expose_ports") == 0)
+            {
+                state = STATE_EXPOSE_PORTS;
+            }
             else if (expecting_value)
             {
                 /* Process the value based on pending state */
@@ -98,6 +498,139 @@ int load_policy(const char *filename, Policy *policy)
                         policy->allow_all_https = 1;
                     }
                 }
+                else if (pending_scalar_state == STATE_NETWORK)
+                {
+                    if (strcmp(val, "none") == 0 || strcmp(val, "loopback_only") == 0)
+                    {
+                        policy->loopback_only = 1;
+                    }
+                }
+                else if (pending_scalar_state == STATE_EGRESS_RATE ||
+                         pending_scalar_state == STATE_EGRESS_BURST)
+                {
+                    /* Goes to tc(8) on a command line - accept only "<number><unit>" */
+                    char *dst = pending_scalar_state == STATE_EGRESS_RATE
+                                    ? policy->egress_rate : policy->egress_burst;
+                    if (is_tc_size(val))
+                    {
+                        snprintf(dst, sizeof(policy->egress_rate), "%s", val);
+                    }
+                    else
+                    {
+                        fprintf(stderr, "[!] Ignoring invalid rate/burst: %s\n", val);
+                    }
+                }
+                else if (pending_scalar_state == STATE_MAX_CONNECTIONS)
+                {
+                    policy->max_connections = atoi(val);
+                }
+                else if (pending_scalar_state == STATE_IDLE_FREEZE ||
+                         pending_scalar_state == STATE_MAX_WALL_TIME ||
+                         pending_scalar_state == STATE_MAX_CPU_TIME ||
+                         pending_scalar_state == STATE_MAX_IDLE_TIME ||
+                         pending_scalar_state == STATE_ADMIT_MAX_WAIT)
+                {
+                    int seconds = parse_duration(val);
+                    int *dst = pending_scalar_state == STATE_IDLE_FREEZE ? &policy->idle_freeze
+                             : pending_scalar_state == STATE_MAX_WALL_TIME ? &policy->max_wall_time
+                             : pending_scalar_state == STATE_MAX_CPU_TIME ? &policy->max_cpu_time
+                             : pending_scalar_state == STATE_MAX_IDLE_TIME ? &policy->max_idle_time
+                             : &policy->admit_max_wait;
+                    if (seconds >= 0)
+                    {
+                        *dst = seconds;
+                    }
+                    else
+                    {
+                        fprintf(stderr, "[!] Ignoring invalid duration: %s\n", val);
+                    }
+                }
+                else if (pending_scalar_state == STATE_CPU_CORES)
+                {
+                    policy->cpu_cores = atoi(val) > 0 ? atoi(val) : 0;
+                }
+                else if (pending_scalar_state == STATE_ADMIT_MEMORY_PRESSURE ||
+                         pending_scalar_state == STATE_ADMIT_IO_PRESSURE ||
+                         pending_scalar_state == STATE_ADMIT_CPU_PRESSURE)
+                {
+                    int percent = atoi(val);
+                    int *dst = pending_scalar_state == STATE_ADMIT_MEMORY_PRESSURE ? &policy->admit_memory_pressure
+                             : pending_scalar_state == STATE_ADMIT_IO_PRESSURE ? &policy->admit_io_pressure
+                             : &policy->admit_cpu_pressure;
+                    if (percent >= 0 && percent <= 100)
+                    {
+                        *dst = percent;
+                    }
+                    else
+                    {
+                        fprintf(stderr, "[!] Ignoring invalid pressure threshold: %s\n", val);
+                    }
+                }
+                else if (pending_scalar_state == STATE_ADMIT_MAX_QUEUE)
+                {
+                    policy->admit_max_queue = atoi(val) > 0 ? atoi(val) : 0;
+                }
+                else if (pending_scalar_state == STATE_IDLE_RECLAIM)
+                {
+                    if (strcmp(val, "true") == 0 || strcmp(val, "yes") == 0 || strcmp(val, "1") == 0)
+                    {
+                        policy->idle_reclaim = 1;
+                    }
+                }
+                else if (pending_scalar_state == STATE_ROOTFS)
+                {
+                    if (strcmp(val, "minimal") == 0)
+                    {
+                        policy->minimal_rootfs = 1;
+                    }
+                    else if (strcmp(val, "host") != 0)
+                    {
+                        fprintf(stderr, "[!] Unknown rootfs mode '%s', using host\n", val);
+                    }
+                }
+                else if (pending_scalar_state == STATE_REUSE_NETNS)
+                {
+                    if (strcmp(val, "true") == 0 || strcmp(val, "yes") == 0 || strcmp(val, "1") == 0)
+                    {
+                        policy->reuse_netns = 1;
+                    }
+                }
+                else if (pending_scalar_state == STATE_FLOW_LOG)
+                {
+                    if (strcmp(val, "false") == 0 || strcmp(val, "no") == 0 || strcmp(val, "0") == 0)
+                    {
+                        policy->flow_log = 0;
+                    }
+                }
+                else if (pending_scalar_state == STATE_PACKAGE_PROXY)
+                {
+                    if (strcmp(val, "true") == 0 || strcmp(val, "yes") == 0 || strcmp(val, "1") == 0)
+                    {
+                        policy->package_proxy = 1;
+                    }
+                }
+                else if (pending_scalar_state == STATE_IPV6)
+                {
+                    if (strcmp(val, "true") == 0 || strcmp(val, "yes") == 0 || strcmp(val, "1") == 0)
+                    {
+                        policy->ipv6 = 1;
+                    }
+                }
+                else if (pending_scalar_state == STATE_DNS_UPSTREAM)
+                {
+                    unsigned char addr[16];
+                    int family, port;
+                    
+                    if (strlen(val) < sizeof(policy->dns_upstream) &&
+                        parse_dns_server(val, &family, addr, &port) == 0)
+                    {
+                        snprintf(policy->dns_upstream, sizeof(policy->dns_upstream), "%s", val);
+                    }
+                    else
+                    {
+                        fprintf(stderr, "[!] Ignoring invalid dns_upstream: %s\n", val);
+                    }
+                }
                 expecting_value = 0;
                 pending_scalar_state = STATE_NONE;
             }
@@ -110,10 +643,54 @@ int load_policy(const char *filename, Policy *policy)
             }
             else if (state == STATE_NETWORK_WHITELIST && policy->whitelist_count < MAX_PATHS)
             {
-                strncpy(policy->network_whitelist[policy->whitelist_count],
-                        val, MAX_LEN - 1);
-                policy->network_whitelist[policy->whitelist_count][MAX_LEN - 1] = '\0';
-                policy->whitelist_count++;
+                WhitelistTarget target;
+                if (parse_whitelist_entry(val, &target) == 0)
+                {
+                    strncpy(policy->network_whitelist[policy->whitelist_count],
+                            val, MAX_LEN - 1);
+                    policy->network_whitelist[policy->whitelist_count][MAX_LEN - 1] = '\0';
+                    policy->whitelist_count++;
+                }
+                else
+                {
+                    fprintf(stderr, "[!] Ignoring invalid whitelist entry: %s\n", val);
+                }
+            }
+            else if (state == STATE_LAYERS && policy->layer_count < MAX_PATHS)
+            {
+                /* "<name|digest>:/absolute/mount/point" */
+                const char *sep = strchr(val, ':');
+                if (sep && sep != val && sep[1] == '/')
+                {
+                    strncpy(policy->layers[policy->layer_count], val, MAX_LEN - 1);
+                    policy->layers[policy->layer_count][MAX_LEN - 1] = '\0';
+                    policy->layer_count++;
+                }
+                else
+                {
+                    fprintf(stderr, "[!] Ignoring layer entry (want name:/path): %s\n", val);
+                }
+            }
+            else if (state == STATE_EXPOSE_PORTS && policy->expose_count < MAX_EXPOSED_PORTS)
+            {
+                /* "<port>" or "<host port>:<sandbox port>" */
+                char host[16];
+                const char *sep = strchr(val, ':');
+                
+                snprintf(host, sizeof(host), "%.*s", sep ? (int)(sep - val) : (int)strlen(val), val);
+                int host_port = parse_port(host);
+                int sandbox_port = sep ? parse_port(sep + 1) : host_port;
+                if (host_port > 0 && sandbox_port > 0)
+                {
+                    policy->expose_ports[policy->expose_count].host = host_port;
+                    policy->expose_ports[policy->expose_count].sandbox = sandbox_port;
+                    policy->expose_count++;
+                }
+                else
+                {
+                    fprintf(stderr, "[!] Ignoring expose_ports entry (want port or host:sandbox): %s\n",
+                            val);
+                }
             }
             else if (state == STATE_BLOCKED_SYSCALLS && policy->blocked_syscalls_count < MAX_PATHS)
             {
@@ -122,6 +699,21 @@ int load_policy(const char *filename, Policy *policy)
                 policy->blocked_syscalls[policy->blocked_syscalls_count][MAX_LEN - 1] = '\0';
                 policy->blocked_syscalls_count++;
             }
+            else if (state == STATE_AUDITED_SYSCALLS && policy->audited_syscalls_count < MAX_PATHS)
+            {
+                strncpy(policy->audited_syscalls[policy->audited_syscalls_count],
+                        val, MAX_LEN - 1);
+                policy->audited_syscalls[policy->audited_syscalls_count][MAX_LEN - 1] = '\0';
+                policy->audited_syscalls_count++;
+            }
+            else if (state == STATE_BLOCKED_EXECUTABLES &&
+                     policy->blocked_executables_count < MAX_PATHS)
+            {
+                strncpy(policy->blocked_executables[policy->blocked_executables_count],
+                        val, MAX_LEN - 1);
+                policy->blocked_executables[policy->blocked_executables_count][MAX_LEN - 1] = '\0';
+                policy->blocked_executables_count++;
+            }
         }
 
         if (event.type == YAML_SEQUENCE_END_EVENT)
@@ -149,6 +741,7 @@ void print_policy(const Policy *policy)
     
     /* Protected files */
     printf("\n[File Protection]\n");
+    printf("  Root filesystem: %s\n", policy->minimal_rootfs ? "minimal" : "host");
     printf("  Protected paths (%d):\n", policy->protected_count);
     for (int i = 0; i < policy->protected_count; i++)
     {
@@ -157,6 +750,10 @@ void print_policy(const Policy *policy)
     
     /* Network policy */
     printf("\n[Network Policy]\n");
+    if (policy->loopback_only)
+    {
+        printf("  Network: none (loopback only)\n");
+    }
     printf("  Default mode: %s\n", 
            policy->network_mode == NET_POLICY_ALLOW ? "ALLOW" : "DENY");
     
@@ -174,6 +771,63 @@ void print_policy(const Policy *policy)
     }
     
     printf("  Allow all HTTPS: %s\n", policy->allow_all_https ? "yes" : "no");
+    printf("  Reuse namespace: %s\n", policy->reuse_netns ? "yes" : "no");
+    printf("  Flow log: %s\n", policy->flow_log ? "yes" : "no");
+    printf("  Package proxy: %s\n", policy->package_proxy ? "yes (whitelist by hostname)" : "no");
+    printf("  IPv6: %s\n", policy->ipv6 ? "yes (NAT66)" : "no (refused)");
+    for (int i = 0; i < policy->expose_count; i++)
+    {
+        printf("  Exposed port: 127.0.0.1:%d -> sandbox :%d\n",
+               policy->expose_ports[i].host, policy->expose_ports[i].sandbox);
+    }
+    printf("  DNS upstream: %s\n", policy->dns_upstream[0] ? policy->dns_upstream
+                                                        : DNS_DEFAULT_UPSTREAM " (default)");
+    if (policy->egress_rate[0])
+    {
+        printf("  Bandwidth limit: %s (burst %s)\n", policy->egress_rate,
+               policy->egress_burst[0] ? policy->egress_burst : "default");
+    }
+    if (policy->max_connections > 0)
+    {
+        printf("  Max connections: %d\n", policy->max_connections);
+    }
+    if (policy->idle_freeze > 0)
+    {
+        printf("  Idle freeze: after %ds%s\n", policy->idle_freeze,
+               policy->idle_reclaim ? " (memory reclaimed)" : "");
+    }
+    if (policy->cpu_cores > 0)
+    {
+        printf("  CPU cores: %d (placed)\n", policy->cpu_cores);
+    }
+    if (policy->max_wall_time > 0)
+    {
+        printf("  Max wall time: %ds\n", policy->max_wall_time);
+    }
+    if (policy->max_cpu_time > 0)
+    {
+        printf("  Max CPU time: %ds\n", policy->max_cpu_time);
+    }
+    if (policy->max_idle_time > 0)
+    {
+        printf("  Max idle time: %ds\n", policy->max_idle_time);
+    }
+    if (policy->admit_memory_pressure > 0 || policy->admit_io_pressure > 0 ||
+        policy->admit_cpu_pressure > 0)
+    {
+        printf("  Admission: memory < %d%%, I/O < %d%%, CPU < %d%% (0 = ignored), wait <= %ds\n",
+               policy->admit_memory_pressure, policy->admit_io_pressure,
+               policy->admit_cpu_pressure, policy->admit_max_wait);
+    }
+    
+    if (policy->layer_count > 0)
+    {
+        printf("\n[Layers]\n");
+        for (int i = 0; i < policy->layer_count; i++)
+        {
+            printf("    - %s\n", policy->layers[i]);
+        }
+    }
     
     /* Blocked syscalls */
     printf("\n[Syscall Restrictions]\n");
@@ -189,6 +843,72 @@ void print_policy(const Policy *policy)
     {
         printf("  Blocked syscalls: (none)\n");
     }
+    if (policy->audited_syscalls_count > 0)
+    {
+        printf("  Audited syscalls (%d):\n", policy->audited_syscalls_count);
+        for (int i = 0; i < policy->audited_syscalls_count; i++)
+        {
+            printf("    - %s\n", policy->audited_syscalls[i]);
+        }
+    }
+    for (int i = 0; i < policy->blocked_executables_count; i++)
+    {
+        printf("  Blocked executable: %s\n", policy->blocked_executables[i]);
+    }
     
     printf("\n======================================\n\n");
 }
+
+/*
+ * FNV-1a over everything that ends up in the sandbox network stack.
+ * Two policies with the same digest can safely share one netns.
+ */
+static unsigned long long fnv1a(unsigned long long h, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+void policy_network_hash(const Policy *policy, char *out, size_t out_len)
+{
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    int mode = policy->network_mode;
+
+    h = fnv1a(h, &mode, sizeof(mode));
+    h = fnv1a(h, &policy->allow_all_https, sizeof(policy->allow_all_https));
+    if (!policy->flow_log)
+    {
+        /* Firewall has no NFLOG rules (hashed only when off, like below) */
+        h = fnv1a(h, &policy->flow_log, sizeof(policy->flow_log));
+    }
+    if (policy->package_proxy)
+    {
+        /* Only when set, so hashes of existing pinned namespaces still match */
+        h = fnv1a(h, &policy->package_proxy, sizeof(policy->package_proxy));
+    }
+    if (policy->ipv6)
+    {
+        h = fnv1a(h, &policy->ipv6, sizeof(policy->ipv6));
+    }
+    if (policy->dns_upstream[0])
+    {
+        /* Sessions on one namespace share the DNS stub's address */
+        h = fnv1a(h, policy->dns_upstream, strlen(policy->dns_upstream) + 1);
+    }
+    h = fnv1a(h, policy->egress_rate, strlen(policy->egress_rate) + 1);
+    h = fnv1a(h, policy->egress_burst, strlen(policy->egress_burst) + 1);
+    h = fnv1a(h, &policy->max_connections, sizeof(policy->max_connections));
+    for (int i = 0; i < policy->whitelist_count; i++)
+    {
+        /* Include the terminator so "a","bc" differs from "ab","c" */
+        h = fnv1a(h, policy->network_whitelist[i],
+                  strlen(policy->network_whitelist[i]) + 1);
+    }
+
+    snprintf(out, out_len, "%016llx", h);
+}
@@ -1,9 +1,20 @@
 #ifndef POLICY_H
 #define POLICY_H
 
+#include <stddef.h>
+
 #define MAX_PATHS 32
 #define MAX_LEN   256
 
+/* Port ranges in one whitelist entry ("host:22,80,8000-8100") */
+#define WL_MAX_PORT_RANGES 8
+
+/* expose_ports entries */
+#define MAX_EXPOSED_PORTS 16
+
+/* Where DNS lookups go when the policy names no dns_upstream */
+#define DNS_DEFAULT_UPSTREAM "8.8.8.8"
+
 /* Network policy modes */
 typedef enum {
     NET_POLICY_DENY,    /* Deny all, allow only whitelisted */
@@ -15,7 +26,8 @@ typedef struct {
     char protected_files[MAX_PATHS][MAX_LEN];
     int protected_count;
     
-    /* Network whitelist - domains or IPs */
+    /* Network whitelist - domains, IPs or CIDRs, each optionally with
+     * ports (see parse_whitelist_entry) */
     char network_whitelist[MAX_PATHS][MAX_LEN];
     int whitelist_count;
     
@@ -25,12 +37,130 @@ typedef struct {
     /* Allow all HTTPS (when domain filtering not possible) */
     int allow_all_https;
     
+    /* Share one configured network namespace between sessions with
+     * the same network policy instead of rebuilding it every run */
+    int reuse_netns;
+    
+    /* Route HTTP(S) through the host-side caching proxy, which
+     * enforces the whitelist by hostname; the firewall allows only it */
+    int package_proxy;
+    
+    /* Log every connection and rejected attempt (default on) */
+    int flow_log;
+    
+    /* Give the sandbox IPv6 (its own ULA address, NAT66 on the host)
+     * next to IPv4; off, IPv6 is disabled and refused on the spot */
+    int ipv6;
+    
+    /* Server the session's caching DNS stub forwards to: "addr",
+     * "addr:port" or "[v6addr]:port" (empty = DNS_DEFAULT_UPSTREAM) */
+    char dns_upstream[64];
+    
+    /* Sandbox servers reachable from the host: 127.0.0.1:<host> on the
+     * host is relayed to 127.0.0.1:<sandbox> inside ("3000", "8080:3000") */
+    struct {
+        int host;
+        int sandbox;
+    } expose_ports[MAX_EXPOSED_PORTS];
+    int expose_count;
+    
+    /* "network: none" - isolated netns with only loopback; no veth,
+     * NAT, DNS or firewall is set up */
+    int loopback_only;
+    
+    /* "rootfs: minimal" - pivot_root into a new root holding only
+     * read-only system directories, a filtered /etc and the workspace */
+    int minimal_rootfs;
+    
+    /* Read-only layers from the layer store, "<name|digest>:/mount/point" */
+    char layers[MAX_PATHS][MAX_LEN];
+    int layer_count;
+    
+    /* Traffic shaping on the host-side veth (empty/0 = unlimited) */
+    char egress_rate[32];
+    char egress_burst[32];
+    int max_connections;
+    
+    /* Freeze the session's cgroup after this many seconds without
+     * input, CPU or network activity (0 = never); idle_reclaim also
+     * pushes its memory out (memory.reclaim) once frozen */
+    int idle_freeze;
+    int idle_reclaim;
+    
+    /* Session lifetime limits in seconds (0 = none): elapsed time, CPU
+     * time of everything in the session, and time without activity.
+     * The session is stopped (SIGTERM, then SIGKILL) when one runs out */
+    int max_wall_time;
+    int max_cpu_time;
+    int max_idle_time;
+    
+    /* Physical cores (with SMT siblings) to give the session to itself,
+     * on as few NUMA nodes as possible; 0 = float over all CPUs */
+    int cpu_cores;
+    
+    /* Admission control: launches wait in a queue while PSI "some
+     * avg10" (host or sandboxes, percent) is at or above one of these
+     * (0 = ignored), for at most admit_max_wait seconds (0 = reject at
+     * once) behind at most admit_max_queue other launches */
+    int admit_memory_pressure;
+    int admit_io_pressure;
+    int admit_cpu_pressure;
+    int admit_max_wait;
+    int admit_max_queue;
+    
     /* Blocked system calls (seccomp) */
     char blocked_syscalls[MAX_PATHS][MAX_LEN];
     int blocked_syscalls_count;
+    
+    /* Syscalls handed to the supervisor in ai-run (seccomp user
+     * notification) instead of being allowed or denied outright */
+    char audited_syscalls[MAX_PATHS][MAX_LEN];
+    int audited_syscalls_count;
+    
+    /* execve of these (full path, or bare name = any directory) fails
+     * with EPERM when execve is audited */
+    char blocked_executables[MAX_PATHS][MAX_LEN];
+    int blocked_executables_count;
 } Policy;
 
+/* One network_whitelist entry, taken apart */
+typedef struct {
+    char host[MAX_LEN];         /* domain, or the address as written */
+    int  family;                /* AF_INET/AF_INET6 for addresses, 0 for a domain */
+    unsigned char addr[16];     /* network address (host bits cleared) */
+    int  prefix;                /* CIDR prefix length, 32/128 for one address */
+    int  port_count;
+    struct {
+        int lo;
+        int hi;
+    } ports[WL_MAX_PORT_RANGES];  /* TCP ports; default 80 and 443 */
+} WhitelistTarget;
+
 int load_policy(const char *filename, Policy *policy);
 void print_policy(const Policy *policy);
 
+/*
+ * Parse a whitelist entry:
+ *   github.com              domain, ports 80 and 443
+ *   registry.local:5000     domain, one port
+ *   10.0.0.0/8:5432         CIDR, one port
+ *   db.internal:5432-5439   port range
+ *   example.com:22,443      several ports/ranges
+ *   api.local:*             every port
+ *   2001:db8::/32           IPv6 (no port)
+ *   [2001:db8::1]:8443      IPv6 with ports
+ * Returns 0, or -1 if the entry is malformed.
+ */
+int parse_whitelist_entry(const char *entry, WhitelistTarget *out);
+
+/*
+ * Parse a dns_upstream value ("1.1.1.1", "10.0.0.2:5353", "2606:4700::1111",
+ * "[2606:4700::1111]:53") into family, address (in_addr/in6_addr) and
+ * port (53 if none). Returns 0, or -1 if malformed.
+ */
+int parse_dns_server(const char *spec, int *family, void *addr, int *port);
+
+/* Stable hex digest of the network-relevant part of a policy */
+void policy_network_hash(const Policy *policy, char *out, size_t out_len);
+
 #endif
@@ -0,0 +1,985 @@
+/*
+ * proxy.c - Host-side caching proxy for package registries
+ *
+ * WHY: Most sandbox egress is the same pip/npm/apt downloads over and
+ * over, each going out through NAT. The IP-based whitelist also has to
+ * guess which addresses a CDN-hosted registry will use.
+ *
+ * HOW IT WORKS:
+ * 1. With "package_proxy: true" the sandbox firewall only allows
+ *    <host veth ip>:3128, and http_proxy/https_proxy point there
+ * 2. CONNECT host:port is allowed if a network_whitelist entry covers
+ *    host and port (80/443 unless the entry names ports), and the TLS
+ *    ClientHello must name an allowed host (SNI) as well. The
+ *    tunnel itself is opaque: HTTPS is checked, never cached
+ * 3. Plain-HTTP GETs of package artifacts (.whl, .tgz, .deb...) are
+ *    kept in PROXY_CACHE_DIR/objects/<sha256 of body>, indexed by
+ *    urls/<sha256 of URL>; the next request for that URL, from any
+ *    session, is served from disk
+ * 4. One thread per connection. The whitelist is reloaded when the
+ *    session's live policy copy changes (ai-run reload)
+ *
+ * Upstream addresses that belong to the host itself (loopback, the
+ * veth gateways, LAN addresses - anything on a local interface), to
+ * another sandbox's veth subnet, or are link-local are refused, so the
+ * proxy can't be used to reach services bound on the host.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include "proxy.h"
+#include "reload.h"
+#include "sha256.h"
+#include "whitelist.h"
+
+#ifndef SYS_close_range
+#define SYS_close_range 436
+#endif
+
+#define PROXY_OBJECTS_DIR PROXY_CACHE_DIR "/objects"
+#define PROXY_URLS_DIR    PROXY_CACHE_DIR "/urls"
+#define PROXY_TMP_DIR     PROXY_CACHE_DIR "/tmp"
+
+#define HEAD_MAX        16384
+#define TLS_RECORD_MAX  (16384 + 5)
+#define HEAD_TIMEOUT_MS 30000
+#define IDLE_TIMEOUT_MS 300000
+
+/* Registry artifacts are immutable per URL; index pages are not */
+static const char *artifact_suffixes[] = {
+    ".whl", ".tar.gz", ".tgz", ".tar.bz2", ".tar.xz", ".zip", ".egg",
+    ".deb", ".rpm", ".apk", ".jar", ".gem", ".crate", ".nupkg", NULL
+};
+
+static Policy proxy_policy;
+static pthread_mutex_t policy_lock = PTHREAD_MUTEX_INITIALIZER;
+static char live_policy_path[256];
+static struct timespec live_mtime;
+
+/* ---------- Whitelist ---------- */
+
+/*
+ * Pick up "ai-run reload" changes: it rewrites the live policy copy
+ */
+static void refresh_policy(void)
+{
+    struct stat st;
+    Policy next;
+
+    pthread_mutex_lock(&policy_lock);
+    if (stat(live_policy_path, &st) == 0 &&
+        (st.st_mtim.tv_sec != live_mtime.tv_sec || st.st_mtim.tv_nsec != live_mtime.tv_nsec))
+    {
+        live_mtime = st.st_mtim;
+        if (load_policy(live_policy_path, &next) == 0)
+        {
+            proxy_policy = next;
+            printf("RELOAD whitelist (%d entries)\n", next.whitelist_count);
+        }
+    }
+    pthread_mutex_unlock(&policy_lock);
+}
+
+/*
+ * Same decision the IP firewall makes, by name: no whitelist or
+ * allow_all_https means any host on the web ports, otherwise an entry
+ * naming the host (or an address/CIDR holding it) with that port
+ */
+static int host_allowed(const char *host, int port)
+{
+    WhitelistTarget target;
+    int allowed;
+
+    refresh_policy();
+
+    pthread_mutex_lock(&policy_lock);
+    allowed = (proxy_policy.allow_all_https || proxy_policy.whitelist_count == 0) &&
+              (port == 443 || port == 80);
+    for (int i = 0; !allowed && i < proxy_policy.whitelist_count; i++)
+    {
+        if (parse_whitelist_entry(proxy_policy.network_whitelist[i], &target) == 0 &&
+            whitelist_target_matches(&target, host, port))
+            allowed = 1;
+    }
+    pthread_mutex_unlock(&policy_lock);
+    return allowed;
+}
+
+/* ---------- Socket helpers ---------- */
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void send_status(int fd, const char *status)
+{
+    char buf[256];
+
+    int len = snprintf(buf, sizeof(buf),
+                       "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+    write_all(fd, buf, (size_t)len);
+}
+
+/*
+ * Read until the end of an HTTP header block
+ * Returns the header length (bytes up to and including the blank
+ * line); *len is everything read, which may include body bytes
+ */
+static int read_head(int fd, char *buf, size_t cap, size_t *len)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+    *len = 0;
+    while (*len < cap - 1)
+    {
+        if (poll(&pfd, 1, HEAD_TIMEOUT_MS) <= 0)
+            return -1;
+
+        ssize_t n = read(fd, buf + *len, cap - 1 - *len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        *len += (size_t)n;
+        buf[*len] = '\0';
+
+        char *end = strstr(buf, "\r\n\r\n");
+        if (end)
+            return (int)(end + 4 - buf);
+    }
+    return -1;
+}
+
+/* Raw address bytes of an AF_INET/AF_INET6 sockaddr; 0 for anything else */
+static size_t address_bytes(const struct sockaddr *sa, const unsigned char **out)
+{
+    if (sa->sa_family == AF_INET)
+    {
+        *out = (const unsigned char *)&((const struct sockaddr_in *)sa)->sin_addr;
+        return 4;
+    }
+    if (sa->sa_family == AF_INET6)
+    {
+        *out = (const unsigned char *)&((const struct sockaddr_in6 *)sa)->sin6_addr;
+        return 16;
+    }
+    return 0;
+}
+
+/*
+ * Whether sa is one of the host's own addresses, or inside the subnet
+ * of a sandbox veth ("aisb<slot>-h"): that is another sandbox
+ */
+static int is_host_address(const struct sockaddr *sa)
+{
+    const unsigned char *addr, *local, *mask;
+    struct ifaddrs *ifs;
+    int found = 0;
+
+    size_t len = address_bytes(sa, &addr);
+    if (getifaddrs(&ifs) != 0)
+        return 1;   /* can't tell: refuse */
+
+    for (struct ifaddrs *ifa = ifs; ifa && !found; ifa = ifa->ifa_next)
+    {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != sa->sa_family ||
+            address_bytes(ifa->ifa_addr, &local) != len)
+            continue;
+
+        int sandbox_veth = strncmp(ifa->ifa_name, "aisb", 4) == 0 && ifa->ifa_netmask &&
+                           address_bytes(ifa->ifa_netmask, &mask) == len;
+        found = 1;
+        for (size_t i = 0; i < len && found; i++)
+        {
+            unsigned char m = sandbox_veth ? mask[i] : 0xff;
+            found = (addr[i] & m) == (local[i] & m);
+        }
+    }
+
+    freeifaddrs(ifs);
+    return found;
+}
+
+/*
+ * Addresses the proxy must never connect to on the sandbox's behalf
+ */
+int proxy_address_is_internal(const struct sockaddr *sa)
+{
+    if (sa->sa_family == AF_INET)
+    {
+        uint32_t a = ntohl(((const struct sockaddr_in *)sa)->sin_addr.s_addr);
+        if ((a >> 24) == 127 || (a >> 24) == 0 || (a >> 16) == 0xa9fe ||
+            (a >> 28) == 0xe || a == 0xffffffff)
+            return 1;
+    }
+    else if (sa->sa_family == AF_INET6)
+    {
+        const struct in6_addr *a = &((const struct sockaddr_in6 *)sa)->sin6_addr;
+        if (IN6_IS_ADDR_LOOPBACK(a) || IN6_IS_ADDR_LINKLOCAL(a) ||
+            IN6_IS_ADDR_UNSPECIFIED(a) || IN6_IS_ADDR_V4MAPPED(a) || IN6_IS_ADDR_MULTICAST(a))
+            return 1;
+    }
+    else
+    {
+        return 1;
+    }
+
+    /* The veth gateway, LAN addresses...: services bound to 0.0.0.0 answer on all of them */
+    return is_host_address(sa);
+}
+
+static int connect_upstream(const char *host, int port)
+{
+    struct addrinfo hints, *res, *p;
+    char service[8];
+    int fd = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", port);
+
+    if (getaddrinfo(host, service, &hints, &res) != 0)
+        return -1;
+
+    for (p = res; p != NULL; p = p->ai_next)
+    {
+        if (proxy_address_is_internal(p->ai_addr))
+            continue;
+
+        fd = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+    return fd;
+}
+
+/*
+ * Copy both directions until both sides have finished sending
+ */
+static void relay(int client, int upstream)
+{
+    int ends[2] = { client, upstream };
+    struct pollfd fds[2] = {
+        { .fd = client, .events = POLLIN },
+        { .fd = upstream, .events = POLLIN },
+    };
+    char buf[65536];
+    int open_dirs = 2;
+
+    while (open_dirs > 0)
+    {
+        if (poll(fds, 2, IDLE_TIMEOUT_MS) <= 0)
+            return;
+
+        for (int i = 0; i < 2; i++)
+        {
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                shutdown(ends[1 - i], SHUT_WR);
+                fds[i].fd = -1;
+                open_dirs--;
+                continue;
+            }
+            if (write_all(ends[1 - i], buf, (size_t)n) != 0)
+                return;
+        }
+    }
+}
+
+/* ---------- CONNECT (HTTPS) ---------- */
+
+/*
+ * Extract server_name from a TLS ClientHello record
+ * Returns 1 if found, 0 if the hello has none, -1 if buf isn't one
+ */
+static int parse_sni(const unsigned char *p, size_t len, char *out, size_t out_len)
+{
+    size_t pos = 5;
+
+    if (len < 5 || p[0] != 0x16)
+        return -1;
+    if (((size_t)p[3] << 8 | p[4]) + 5 < len)
+        len = ((size_t)p[3] << 8 | p[4]) + 5;
+
+    /* handshake header, client version, random */
+    if (pos + 4 > len || p[pos] != 0x01)
+        return -1;
+    pos += 4 + 2 + 32;
+
+    /* session id, cipher suites, compression methods */
+    if (pos + 1 > len)
+        return -1;
+    pos += 1 + p[pos];
+    if (pos + 2 > len)
+        return -1;
+    pos += 2 + ((size_t)p[pos] << 8 | p[pos + 1]);
+    if (pos + 1 > len)
+        return -1;
+    pos += 1 + p[pos];
+
+    if (pos + 2 > len)
+        return 0;
+    size_t ext_end = pos + 2 + ((size_t)p[pos] << 8 | p[pos + 1]);
+    pos += 2;
+    if (ext_end > len)
+        return -1;
+
+    while (pos + 4 <= ext_end)
+    {
+        unsigned type = (unsigned)p[pos] << 8 | p[pos + 1];
+        size_t ext_len = (size_t)p[pos + 2] << 8 | p[pos + 3];
+
+        pos += 4;
+        if (pos + ext_len > ext_end)
+            return -1;
+
+        if (type == 0)
+        {
+            /* server_name_list: list length, name type (0 = host), name length */
+            if (ext_len < 5 || p[pos + 2] != 0)
+                return -1;
+            size_t name_len = (size_t)p[pos + 3] << 8 | p[pos + 4];
+            if (5 + name_len > ext_len || name_len >= out_len)
+                return -1;
+            memcpy(out, p + pos + 5, name_len);
+            out[name_len] = '\0';
+            return 1;
+        }
+        pos += ext_len;
+    }
+    return 0;
+}
+
+/*
+ * Read the client's first TLS record (the ClientHello)
+ */
+static ssize_t read_client_hello(int fd, unsigned char *buf, size_t cap, size_t have)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+    while (have < 5 || have < ((size_t)buf[3] << 8 | buf[4]) + 5)
+    {
+        if (have >= cap || poll(&pfd, 1, HEAD_TIMEOUT_MS) <= 0)
+            break;
+
+        ssize_t n = read(fd, buf + have, cap - have);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        have += (size_t)n;
+    }
+    return (ssize_t)have;
+}
+
+static void handle_connect(int client, const char *target, const char *extra, size_t extra_len)
+{
+    char host[256];
+    unsigned char hello[TLS_RECORD_MAX];
+    char sni[256];
+    int port = 443;
+
+    /* host:port, or [v6addr]:port */
+    if (target[0] == '[')
+    {
+        if (sscanf(target, "[%255[^]]]:%d", host, &port) < 1)
+            host[0] = '\0';
+    }
+    else if (sscanf(target, "%255[^:]:%d", host, &port) < 1)
+    {
+        host[0] = '\0';
+    }
+
+    if (host[0] == '\0' || !host_allowed(host, port))
+    {
+        printf("DENY CONNECT %s\n", target);
+        send_status(client, "403 Forbidden");
+        return;
+    }
+
+    int upstream = connect_upstream(host, port);
+    if (upstream < 0)
+    {
+        send_status(client, "502 Bad Gateway");
+        return;
+    }
+
+    const char *ok = "HTTP/1.1 200 Connection Established\r\n\r\n";
+    if (write_all(client, ok, strlen(ok)) != 0)
+    {
+        close(upstream);
+        return;
+    }
+
+    /* The name the client actually asks the server for must be allowed too */
+    if (extra_len > sizeof(hello))
+        extra_len = sizeof(hello);
+    memcpy(hello, extra, extra_len);
+
+    ssize_t len = read_client_hello(client, hello, sizeof(hello), extra_len);
+    int found = len > 0 ? parse_sni(hello, (size_t)len, sni, sizeof(sni)) : -1;
+    if (found < 0 || (found == 1 && strcasecmp(sni, host) != 0 && !host_allowed(sni, port)))
+    {
+        printf("DENY CONNECT %s (TLS server name: %s)\n", target,
+               found == 1 ? sni : "not a TLS ClientHello");
+        close(upstream);
+        return;
+    }
+
+    if (write_all(upstream, hello, (size_t)len) == 0)
+        relay(client, upstream);
+    close(upstream);
+}
+
+/* ---------- Plain HTTP and the cache ---------- */
+
+static int is_artifact(const char *path)
+{
+    char clean[2048];
+    size_t plen;
+
+    /* Ignore the query string */
+    snprintf(clean, sizeof(clean), "%s", path);
+    clean[strcspn(clean, "?#")] = '\0';
+    plen = strlen(clean);
+
+    for (int i = 0; artifact_suffixes[i]; i++)
+    {
+        size_t slen = strlen(artifact_suffixes[i]);
+        if (plen > slen && strcasecmp(clean + plen - slen, artifact_suffixes[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Case-insensitive header lookup in a header block
+ * Returns a pointer to the value (up to the next CRLF), or NULL
+ */
+static const char *find_header(const char *head, const char *name)
+{
+    size_t nlen = strlen(name);
+
+    for (const char *line = strstr(head, "\r\n"); line; line = strstr(line, "\r\n"))
+    {
+        line += 2;
+        if (strncasecmp(line, name, nlen) == 0 && line[nlen] == ':')
+        {
+            const char *v = line + nlen + 1;
+            while (*v == ' ' || *v == '\t')
+                v++;
+            return v;
+        }
+    }
+    return NULL;
+}
+
+static int header_contains(const char *head, const char *name, const char *token)
+{
+    const char *v = find_header(head, name);
+    if (!v)
+        return 0;
+
+    char value[512];
+    snprintf(value, sizeof(value), "%.*s", (int)strcspn(v, "\r\n"), v);
+    return strcasestr(value, token) != NULL;
+}
+
+static void url_key(const char *url, char key[SHA256_HEX_LEN])
+{
+    Sha256 ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, "GET ", 4);
+    sha256_update(&ctx, url, strlen(url));
+    sha256_final_hex(&ctx, key);
+}
+
+/*
+ * Answer from the cache if this URL has been stored before
+ */
+static int serve_cached(int client, const char *url)
+{
+    char key[SHA256_HEX_LEN];
+    char path[PATH_MAX];
+    char digest[SHA256_HEX_LEN] = "";
+    char type[256] = "application/octet-stream";
+    char head[512];
+    struct stat st;
+
+    url_key(url, key);
+    snprintf(path, sizeof(path), "%s/%s", PROXY_URLS_DIR, key);
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    if (!fgets(digest, sizeof(digest), f))
+        digest[0] = '\0';
+    if (fgets(type, sizeof(type), f) == NULL)
+        type[0] = '\0';
+    fclose(f);
+    digest[strcspn(digest, "\r\n")] = '\0';
+    type[strcspn(type, "\r\n")] = '\0';
+
+    snprintf(path, sizeof(path), "%s/%s", PROXY_OBJECTS_DIR, digest);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (digest[0] == '\0' || fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    int len = snprintf(head, sizeof(head),
+                       "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\nContent-Type: %s\r\n"
+                       "X-Cache: HIT\r\nConnection: close\r\n\r\n",
+                       (long long)st.st_size, type[0] ? type : "application/octet-stream");
+    if (write_all(client, head, (size_t)len) == 0)
+    {
+        off_t off = 0;
+        while (off < st.st_size)
+        {
+            if (sendfile(client, fd, &off, (size_t)(st.st_size - off)) <= 0)
+                break;
+        }
+    }
+    close(fd);
+    printf("HIT %s\n", url);
+    return 0;
+}
+
+/*
+ * Relay a cacheable response to the client, storing the body as it
+ * streams past. Only complete 200 responses with a Content-Length and
+ * nothing that marks them private are kept.
+ */
+static void relay_and_store(int client, int upstream, const char *url)
+{
+    char head[HEAD_MAX];
+    char buf[65536];
+    size_t len;
+
+    int head_len = read_head(upstream, head, sizeof(head), &len);
+    if (head_len < 0)
+    {
+        send_status(client, "502 Bad Gateway");
+        return;
+    }
+    if (write_all(client, head, len) != 0)
+        return;
+
+    char saved = head[head_len];
+    head[head_len] = '\0';
+    const char *clen = find_header(head, "Content-Length");
+    long long expected = clen ? atoll(clen) : -1;
+    int storable = strncmp(head + 8, " 200", 4) == 0 && expected >= 0 &&
+                   !find_header(head, "Set-Cookie") &&
+                   !find_header(head, "Transfer-Encoding") &&
+                   !header_contains(head, "Cache-Control", "no-store") &&
+                   !header_contains(head, "Cache-Control", "private");
+    char type[256] = "";
+    const char *ct = find_header(head, "Content-Type");
+    if (ct)
+        snprintf(type, sizeof(type), "%.*s", (int)strcspn(ct, "\r\n"), ct);
+    head[head_len] = saved;
+
+    char tmp_path[PATH_MAX];
+    int tmp_fd = -1;
+    Sha256 ctx;
+    long long stored = 0;
+
+    if (storable)
+    {
+        snprintf(tmp_path, sizeof(tmp_path), "%s/body-XXXXXX", PROXY_TMP_DIR);
+        tmp_fd = mkstemp(tmp_path);
+        sha256_init(&ctx);
+    }
+
+    /* Body bytes that came in with the header */
+    if (tmp_fd >= 0 && len > (size_t)head_len)
+    {
+        size_t n = len - (size_t)head_len;
+        sha256_update(&ctx, head + head_len, n);
+        if (write_all(tmp_fd, head + head_len, n) != 0)
+        {
+            close(tmp_fd);
+            unlink(tmp_path);
+            tmp_fd = -1;
+        }
+        stored += (long long)n;
+    }
+
+    for (;;)
+    {
+        struct pollfd pfd = { .fd = upstream, .events = POLLIN };
+        if (poll(&pfd, 1, IDLE_TIMEOUT_MS) <= 0)
+            break;
+
+        ssize_t n = read(upstream, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        if (write_all(client, buf, (size_t)n) != 0)
+            break;
+
+        if (tmp_fd >= 0)
+        {
+            sha256_update(&ctx, buf, (size_t)n);
+            if (write_all(tmp_fd, buf, (size_t)n) != 0)
+            {
+                close(tmp_fd);
+                unlink(tmp_path);
+                tmp_fd = -1;
+            }
+            stored += n;
+        }
+    }
+
+    if (tmp_fd < 0)
+    {
+        printf("MISS %s\n", url);
+        return;
+    }
+    close(tmp_fd);
+
+    if (stored != expected)
+    {
+        unlink(tmp_path);
+        printf("MISS %s (incomplete, not stored)\n", url);
+        return;
+    }
+
+    /* Publish: object first, then the URL index entry pointing at it */
+    char digest[SHA256_HEX_LEN];
+    char key[SHA256_HEX_LEN];
+    char path[PATH_MAX];
+    char index_tmp[PATH_MAX];
+
+    sha256_final_hex(&ctx, digest);
+    snprintf(path, sizeof(path), "%s/%s", PROXY_OBJECTS_DIR, digest);
+    chmod(tmp_path, 0644);
+    if (rename(tmp_path, path) != 0)
+    {
+        unlink(tmp_path);
+        return;
+    }
+
+    url_key(url, key);
+    snprintf(index_tmp, sizeof(index_tmp), "%s/index-XXXXXX", PROXY_TMP_DIR);
+    int fd = mkstemp(index_tmp);
+    if (fd < 0)
+        return;
+    FILE *f = fdopen(fd, "w");
+    if (!f)
+    {
+        close(fd);
+        unlink(index_tmp);
+        return;
+    }
+    fprintf(f, "%s\n%s\n", digest, type);
+    fchmod(fd, 0644);
+    fclose(f);
+
+    snprintf(path, sizeof(path), "%s/%s", PROXY_URLS_DIR, key);
+    if (rename(index_tmp, path) != 0)
+        unlink(index_tmp);
+    else
+        printf("MISS %s (stored %lld bytes)\n", url, stored);
+}
+
+static void handle_http(int client, const char *method, const char *url,
+                        const char *head, size_t head_len, const char *body, size_t body_len)
+{
+    char host[256] = "";
+    char path[2048] = "/";
+    int port = 80;
+
+    /* Absolute form: http://host[:port][/path] */
+    const char *rest = url + 7;
+    size_t hlen = strcspn(rest, ":/?");
+    if (hlen == 0 || hlen >= sizeof(host))
+    {
+        send_status(client, "400 Bad Request");
+        return;
+    }
+    memcpy(host, rest, hlen);
+    host[hlen] = '\0';
+    rest += hlen;
+    if (*rest == ':')
+    {
+        port = atoi(rest + 1);
+        rest += strcspn(rest, "/?");
+    }
+    if (*rest)
+        snprintf(path, sizeof(path), "%s%s", *rest == '?' ? "/" : "", rest);
+
+    if (!host_allowed(host, port))
+    {
+        printf("DENY %s %s\n", method, url);
+        send_status(client, "403 Forbidden");
+        return;
+    }
+
+    int cacheable = strcmp(method, "GET") == 0 && is_artifact(path) &&
+                    !find_header(head, "Authorization") &&
+                    !find_header(head, "Cookie") &&
+                    !find_header(head, "Range");
+
+    if (cacheable && serve_cached(client, url) == 0)
+        return;
+
+    int upstream = connect_upstream(host, port);
+    if (upstream < 0)
+    {
+        send_status(client, "502 Bad Gateway");
+        return;
+    }
+
+    /* Origin-form request line, hop-by-hop headers dropped, one request per connection */
+    char out[HEAD_MAX + 2048];
+    size_t olen = (size_t)snprintf(out, sizeof(out), "%s %s HTTP/1.1\r\n", method, path);
+    const char *line = strstr(head, "\r\n") + 2;
+    const char *end = head + head_len - 2;
+
+    while (line < end)
+    {
+        const char *eol = strstr(line, "\r\n");
+        size_t llen = (size_t)(eol - line) + 2;
+
+        if (strncasecmp(line, "Proxy-", 6) != 0 &&
+            strncasecmp(line, "Connection:", 11) != 0 &&
+            strncasecmp(line, "Keep-Alive:", 11) != 0 &&
+            olen + llen < sizeof(out) - 32)
+        {
+            memcpy(out + olen, line, llen);
+            olen += llen;
+        }
+        line = eol + 2;
+    }
+    olen += (size_t)snprintf(out + olen, sizeof(out) - olen, "Connection: close\r\n\r\n");
+
+    if (write_all(upstream, out, olen) == 0 &&
+        (body_len == 0 || write_all(upstream, body, body_len) == 0))
+    {
+        if (cacheable)
+            relay_and_store(client, upstream, url);
+        else
+            relay(client, upstream);
+    }
+    close(upstream);
+}
+
+static void *handle_client(void *arg)
+{
+    int client = (int)(intptr_t)arg;
+    char head[HEAD_MAX];
+    char method[16], target[2048], version[16];
+    size_t len;
+
+    int head_len = read_head(client, head, sizeof(head), &len);
+    if (head_len < 0 ||
+        sscanf(head, "%15s %2047s %15s", method, target, version) != 3)
+    {
+        close(client);
+        return NULL;
+    }
+
+    /* Bytes after the header belong to the body (or the TLS handshake) */
+    char body[HEAD_MAX];
+    size_t body_len = len - (size_t)head_len;
+    memcpy(body, head + head_len, body_len);
+    head[head_len] = '\0';
+
+    if (strcmp(method, "CONNECT") == 0)
+    {
+        handle_connect(client, target, body, body_len);
+    }
+    else if (strncasecmp(target, "http://", 7) == 0)
+    {
+        handle_http(client, method, target, head, (size_t)head_len, body, body_len);
+    }
+    else
+    {
+        send_status(client, "400 Bad Request");
+    }
+
+    close(client);
+    return NULL;
+}
+
+/* ---------- Helper process ---------- */
+
+static void make_cache_dirs(void)
+{
+    mkdir("/var/cache/ai-sandbox", 0755);
+    mkdir(PROXY_CACHE_DIR, 0755);
+    mkdir(PROXY_OBJECTS_DIR, 0755);
+    mkdir(PROXY_URLS_DIR, 0755);
+    mkdir(PROXY_TMP_DIR, 0700);
+}
+
+static void proxy_main(int listen_fd, const Policy *policy, pid_t session_pid, pid_t owner)
+{
+    char log_path[256];
+    struct stat st;
+
+    proxy_policy = *policy;
+    snprintf(live_policy_path, sizeof(live_policy_path), "%s/%d/policy.yaml",
+             SESSION_RUN_DIR, session_pid);
+    if (stat(live_policy_path, &st) == 0)
+        live_mtime = st.st_mtim;
+
+    /* The sandbox shell owns the terminal: log to the session directory */
+    snprintf(log_path, sizeof(log_path), "%s/%d/proxy.log", SESSION_RUN_DIR, session_pid);
+    int log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0)
+        log_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    dup2(log_fd, STDOUT_FILENO);
+    dup2(log_fd, STDERR_FILENO);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    /*
+     * We are forked from a startup thread, and PR_SET_PDEATHSIG fires
+     * when that thread ends - so watch for ai-run itself going away
+     */
+    while (getppid() == owner)
+    {
+        struct pollfd pfd = { .fd = listen_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 1000) <= 0)
+            continue;
+
+        int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, handle_client, (void *)(intptr_t)client) != 0)
+            close(client);
+        pthread_attr_destroy(&attr);
+    }
+}
+
+pid_t start_package_proxy(const char *listen_ip, const Policy *policy, pid_t session_pid)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror("socket(proxy)");
+        return -1;
+    }
+
+    /* Sessions sharing a network namespace also share its host address */
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PROXY_PORT);
+    if (inet_pton(AF_INET, listen_ip, &addr.sin_addr) != 1 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(fd, 128) == -1)
+    {
+        fprintf(stderr, "[!] Package proxy cannot listen on %s:%d: %s\n",
+                listen_ip, PROXY_PORT, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    make_cache_dirs();
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork(proxy)");
+        close(fd);
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        /* Don't hold the session's locks or pidfds open */
+        pid_t owner = getppid();
+        dup2(fd, 3);
+        if (syscall(SYS_close_range, 4, ~0U, 0) != 0)
+        {
+            for (int i = 4; i < 1024; i++)
+                close(i);
+        }
+
+        proxy_main(3, policy, session_pid, owner);
+        _exit(0);
+    }
+
+    close(fd);
+    printf("[+] Package proxy on %s:%d (cache: %s)\n", listen_ip, PROXY_PORT, PROXY_CACHE_DIR);
+    return pid;
+}
+
+void stop_package_proxy(pid_t proxy_pid)
+{
+    if (proxy_pid <= 0)
+        return;
+
+    kill(proxy_pid, SIGTERM);
+    waitpid(proxy_pid, NULL, 0);
+}
@@ -0,0 +1,28 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "policy.h"
+
+/* Host-side caching proxy for package registries (package_proxy: true) */
+#define PROXY_PORT      3128
+#define PROXY_CACHE_DIR "/var/cache/ai-sandbox/proxy"
+
+/*
+ * Listen on listen_ip:PROXY_PORT (the host end of the sandbox veth)
+ * and serve the sandbox from a forked helper. The whitelist is re-read
+ * from the session's live policy copy when "ai-run reload" changes it.
+ * Returns the helper's pid, or -1.
+ */
+pid_t start_package_proxy(const char *listen_ip, const Policy *policy, pid_t session_pid);
+void stop_package_proxy(pid_t proxy_pid);
+
+/*
+ * Whether the proxy refuses to connect to sa: loopback, link-local,
+ * multicast, any address of the host's own interfaces (the veth
+ * gateways included) and other sandboxes' veth subnets
+ */
+int proxy_address_is_internal(const struct sockaddr *sa);
+
+#endif
@@ -0,0 +1,356 @@
+/*
+ * reload.c - Apply policy changes to a running sandbox
+ *
+ * HOW IT WORKS:
+ * 1. Each session keeps a copy of its live policy under
+ *    /run/ai-sandbox/sessions/<pid>/
+ * 2. "ai-run reload" loads that copy and the new policy and diffs them
+ * 3. Only the delta is applied, each part by a helper that enters one
+ *    namespace of the sandbox (setns on /proc/<pid>/ns/...):
+ *    - whitelist entries are added/removed in one iptables transaction
+ *      from the network namespace alone, so the host's iptables, ipset
+ *      and shell run - never binaries from the sandbox's filesystem.
+ *      Domains are resolved on the host first, as at startup
+ *    - newly protected paths are hidden, unprotected ones revealed
+ *      from the mount namespace
+ * 4. On success the new policy becomes the live copy. Whatever was
+ *    fixed when the sandbox was built (network mode, ipv6, DNS stub,
+ *    bandwidth and connection limits, a shared namespace's firewall)
+ *    is refused instead of being recorded without taking effect
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "reload.h"
+#include "policy.h"
+#include "firewall.h"
+#include "namespace.h"
+
+/*
+ * Copy a file byte for byte (policy snapshots are small)
+ */
+static int copy_file(const char *src, const char *dst)
+{
+    char buf[4096];
+    size_t n;
+    int ret = 0;
+
+    FILE *in = fopen(src, "r");
+    if (!in)
+        return -1;
+    FILE *out = fopen(dst, "w");
+    if (!out)
+    {
+        fclose(in);
+        return -1;
+    }
+
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    {
+        if (fwrite(buf, 1, n, out) != n)
+        {
+            ret = -1;
+            break;
+        }
+    }
+
+    fclose(in);
+    if (fclose(out) != 0)
+        ret = -1;
+    return ret;
+}
+
+int save_session_state(pid_t pid, const char *policy_file, const char *user)
+{
+    char path[256];
+
+    mkdir("/run/ai-sandbox", 0755);
+    mkdir(SESSION_RUN_DIR, 0755);
+
+    snprintf(path, sizeof(path), "%s/%d", SESSION_RUN_DIR, pid);
+    if (mkdir(path, 0700) == -1 && errno != EEXIST)
+    {
+        /* Rootless: /run/ai-sandbox is root's */
+        fprintf(stderr, "[!] Could not save live policy in %s (%s) - reload unavailable\n",
+                SESSION_RUN_DIR, strerror(errno));
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/%d/policy.yaml", SESSION_RUN_DIR, pid);
+    if (copy_file(policy_file, path) != 0)
+    {
+        fprintf(stderr, "[!] Could not save live policy (reload unavailable)\n");
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/%d/user", SESSION_RUN_DIR, pid);
+    FILE *f = fopen(path, "w");
+    if (f)
+    {
+        fprintf(f, "%s\n", user);
+        fclose(f);
+    }
+    return 0;
+}
+
+void remove_session_state(pid_t pid)
+{
+    char dir_path[256];
+    char path[512];
+
+    snprintf(dir_path, sizeof(dir_path), "%s/%d", SESSION_RUN_DIR, pid);
+    DIR *dir = opendir(dir_path);
+    if (!dir)
+        return;
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (ent->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir_path, ent->d_name);
+        unlink(path);
+    }
+    closedir(dir);
+    rmdir(dir_path);
+}
+
+static int has_protected(const Policy *policy, const char *entry)
+{
+    for (int i = 0; i < policy->protected_count; i++)
+    {
+        if (strcmp(policy->protected_files[i], entry) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int same_network_policy(const Policy *a, const Policy *b)
+{
+    char ha[32], hb[32];
+
+    policy_network_hash(a, ha, sizeof(ha));
+    policy_network_hash(b, hb, sizeof(hb));
+    return strcmp(ha, hb) == 0;
+}
+
+/*
+ * Enter one namespace of the sandbox process
+ */
+static int enter_namespace(pid_t pid, const char *name, int nstype)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/proc/%d/ns/%s", pid, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "[!] Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (setns(fd, nstype) == -1)
+    {
+        fprintf(stderr, "[!] setns(%s) failed: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+typedef struct {
+    const Policy *live;
+    const Policy *next;
+    const char *user;
+    const ResolvedWhitelist *resolved;
+} ReloadDelta;
+
+/*
+ * Run apply() in a forked helper that has entered one namespace of
+ * the sandbox; the caller's namespaces stay as they are
+ */
+static int run_in_namespace(pid_t pid, const char *name, int nstype,
+                            int (*apply)(const ReloadDelta *), const ReloadDelta *delta)
+{
+    fflush(stdout);
+    pid_t helper = fork();
+    if (helper < 0)
+    {
+        perror("fork");
+        return -1;
+    }
+    if (helper == 0)
+    {
+        int ret = enter_namespace(pid, name, nstype) == 0 ? apply(delta) : -1;
+        fflush(stdout);
+        _exit(ret == 0 ? 0 : 1);
+    }
+
+    int status;
+    if (waitpid(helper, &status, 0) != helper || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    return 0;
+}
+
+/* Network namespace only: host filesystem, host iptables */
+static int apply_network_delta(const ReloadDelta *d)
+{
+    return update_firewall_whitelist(d->live, d->next, d->resolved);
+}
+
+/* Mount namespace only */
+static int apply_paths_delta(const ReloadDelta *d)
+{
+    const Policy *live = d->live;
+    const Policy *next = d->next;
+    const char *user = d->user;
+
+    for (int i = 0; i < live->protected_count; i++)
+    {
+        if (!has_protected(next, live->protected_files[i]))
+        {
+            char resolved[512];
+            resolve_protected_path(live->protected_files[i], user, resolved, sizeof(resolved));
+            unhide_path(resolved);
+        }
+    }
+
+    for (int i = 0; i < next->protected_count; i++)
+    {
+        if (!has_protected(live, next->protected_files[i]))
+        {
+            char resolved[512];
+            resolve_protected_path(next->protected_files[i], user, resolved, sizeof(resolved));
+            if (hide_path(resolved) != 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+int reload_session(pid_t pid, const char *policy_file)
+{
+    char live_path[256];
+    char user_path[256];
+    char user[128] = {0};
+    Policy live, next;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (pid <= 0 || kill(pid, 0) == -1)
+    {
+        fprintf(stderr, "[!] No running sandbox with pid %d\n", pid);
+        return -1;
+    }
+
+    snprintf(live_path, sizeof(live_path), "%s/%d/policy.yaml", SESSION_RUN_DIR, pid);
+    snprintf(user_path, sizeof(user_path), "%s/%d/user", SESSION_RUN_DIR, pid);
+
+    FILE *f = fopen(user_path, "r");
+    if (!f || !fgets(user, sizeof(user), f))
+    {
+        fprintf(stderr, "[!] No live policy recorded for session %d\n", pid);
+        if (f)
+            fclose(f);
+        return -1;
+    }
+    fclose(f);
+    user[strcspn(user, "\n")] = '\0';
+
+    if (load_policy(live_path, &live) != 0 || load_policy(policy_file, &next) != 0)
+    {
+        fprintf(stderr, "[!] Failed to load policy\n");
+        return -1;
+    }
+
+    /* Things that decide how the sandbox was built can't change live */
+    if (live.loopback_only != next.loopback_only || live.reuse_netns != next.reuse_netns ||
+        live.package_proxy != next.package_proxy || live.flow_log != next.flow_log)
+    {
+        fprintf(stderr, "[!] Network mode changed - restart the sandbox to apply\n");
+        return -1;
+    }
+    if (live.ipv6 != next.ipv6 || strcmp(live.dns_upstream, next.dns_upstream) != 0)
+    {
+        fprintf(stderr, "[!] ipv6 or dns_upstream changed - restart the sandbox to apply\n");
+        return -1;
+    }
+    if (strcmp(live.egress_rate, next.egress_rate) != 0 ||
+        strcmp(live.egress_burst, next.egress_burst) != 0 ||
+        live.max_connections != next.max_connections)
+    {
+        fprintf(stderr, "[!] Bandwidth or connection limits changed - restart the sandbox to apply\n");
+        return -1;
+    }
+
+    int update_network = !live.loopback_only && !same_network_policy(&live, &next);
+    if (update_network && live.reuse_netns)
+    {
+        /* Other sessions share this namespace and its firewall */
+        fprintf(stderr, "[!] Session uses a shared network namespace - "
+                        "restart its sessions to change the network policy\n");
+        return -1;
+    }
+    if (update_network && live.package_proxy)
+    {
+        /* The proxy re-reads the live policy copy written below */
+        printf("[+] Whitelist changes go to the package proxy\n");
+        update_network = 0;
+    }
+
+    printf("[+] Reloading policy for sandbox %d...\n", pid);
+
+    ReloadDelta delta = { &live, &next, user, NULL };
+    ResolvedWhitelist *resolved = NULL;
+    if (update_network)
+    {
+        /* Looked up with the host's resolver, like the startup firewall */
+        resolved = malloc(sizeof(*resolved));
+        if (resolved)
+            resolve_whitelist(&next, resolved);
+        delta.resolved = resolved;
+    }
+
+    int ret = 0;
+    if (update_network)
+        ret = run_in_namespace(pid, "net", CLONE_NEWNET, apply_network_delta, &delta);
+    if (ret == 0)
+    {
+        ret = run_in_namespace(pid, "mnt", CLONE_NEWNS, apply_paths_delta, &delta);
+
+        /* Keep the firewall matching the live copy, which stays as it was */
+        ReloadDelta undo = { &next, &live, user, NULL };
+        if (ret != 0 && update_network &&
+            run_in_namespace(pid, "net", CLONE_NEWNET, apply_network_delta, &undo) != 0)
+            fprintf(stderr, "[!] Could not restore the previous whitelist\n");
+    }
+    free(resolved);
+    if (ret != 0)
+    {
+        fprintf(stderr, "[!] Reload failed - live policy unchanged\n");
+        return -1;
+    }
+
+    if (copy_file(policy_file, live_path) != 0)
+    {
+        fprintf(stderr, "[!] Applied, but could not update live policy copy\n");
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("[+] Policy reloaded in %.1f ms\n",
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    return 0;
+}
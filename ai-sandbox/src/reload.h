@@ -0,0 +1,25 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include <sys/types.h>
+
+/* Per-session runtime state: live policy snapshot and owning user */
+#define SESSION_RUN_DIR "/run/ai-sandbox/sessions"
+
+/*
+ * Record the policy a session was started with, so a later reload
+ * can diff against what is actually applied
+ */
+int save_session_state(pid_t pid, const char *policy_file, const char *user);
+
+/* Remove a session's runtime state directory */
+void remove_session_state(pid_t pid);
+
+/*
+ * Apply the difference between the live policy of a running sandbox
+ * and a new policy file, without restarting it
+ * Returns 0 on success, -1 on failure
+ */
+int reload_session(pid_t pid, const char *policy_file);
+
+#endif
@@ -2,12 +2,21 @@
  * seccomp.c - System call filtering using seccomp-bpf
  *
  * Uses libseccomp to create a filter that blocks specified syscalls.
- * Blocked syscalls return EPERM (Operation not permitted).
+ * Blocked syscalls return EPERM (Operation not permitted). Audited
+ * syscalls are turned into user notifications that the supervisor
+ * thread in ai-run (supervisor.c) answers.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/seccomp.h>
 #include <seccomp.h>
 #include "seccomp.h"
 
@@ -27,25 +36,34 @@ static int get_syscall_number(const char *name)
 }
 
 /*
- * Setup seccomp filter based on policy
+ * Build the filter for a policy and compile it to BPF
  *
  * HOW IT WORKS:
  * 1. Create a seccomp filter context with default ALLOW action
  * 2. For each blocked syscall in policy, add ERRNO rule
- * 3. Load the filter into the kernel
+ * 3. For each audited syscall, add NOTIFY rule (blocked wins if both)
+ * 4. Export the generated BPF program into memory
  *
- * The filter persists across exec() due to SCMP_FLTATR_CTL_NNP
+ * Only the listed syscalls leave the kernel: everything else is
+ * decided by the BPF program alone, so auditing costs nothing on
+ * syscalls the policy doesn't name.
+ *
+ * Compiling is independent of everything else in sandbox startup,
+ * so it can run early and in parallel; loading has to happen last,
+ * on the thread that goes on to exec.
  */
-int setup_seccomp_filter(const Policy *policy)
+int compile_seccomp_filter(const Policy *policy, SeccompProgram *prog)
 {
-    if (policy->blocked_syscalls_count == 0)
+    memset(prog, 0, sizeof(*prog));
+
+    if (policy->blocked_syscalls_count == 0 && policy->audited_syscalls_count == 0)
     {
         printf("[+] Seccomp: No syscalls blocked (none specified)\n");
         return 0;
     }
 
-    printf("[+] Setting up seccomp filter (%d syscalls to block)...\n",
-           policy->blocked_syscalls_count);
+    printf("[+] Setting up seccomp filter (%d syscalls to block, %d to audit)...\n",
+           policy->blocked_syscalls_count, policy->audited_syscalls_count);
 
     /* Create filter context - default action is ALLOW */
     scmp_filter_ctx ctx = seccomp_init(SCMP_ACT_ALLOW);
@@ -81,26 +99,167 @@ int setup_seccomp_filter(const Policy *policy)
         blocked++;
     }
 
-    if (blocked == 0)
+    /* Audited syscalls: the calling thread sleeps until the supervisor answers */
+    int audited = 0;
+    for (int i = 0; i < policy->audited_syscalls_count; i++)
+    {
+        const char *syscall_name = policy->audited_syscalls[i];
+        int syscall_nr = get_syscall_number(syscall_name);
+
+        if (syscall_nr < 0)
+            continue;
+
+        /* The listener is handed to ai-run with sendmsg after loading */
+        if (strcmp(syscall_name, "sendmsg") == 0)
+        {
+            fprintf(stderr, "[!] Cannot audit sendmsg (used to reach the supervisor), skipping\n");
+            continue;
+        }
+
+        /* Blocked outright already - nothing left to audit */
+        int is_blocked = 0;
+        for (int j = 0; j < policy->blocked_syscalls_count; j++)
+        {
+            if (strcmp(policy->blocked_syscalls[j], syscall_name) == 0)
+                is_blocked = 1;
+        }
+        if (is_blocked)
+            continue;
+
+        int rc = seccomp_rule_add(ctx, SCMP_ACT_NOTIFY, syscall_nr, 0);
+        if (rc < 0)
+        {
+            fprintf(stderr, "[!] Not auditing %s: %s\n", syscall_name, strerror(-rc));
+            continue;
+        }
+
+        printf("    -> Audited: %s (syscall #%d)\n", syscall_name, syscall_nr);
+        audited++;
+    }
+
+    if (blocked == 0 && audited == 0)
     {
         printf("[+] Seccomp: No valid syscalls to block\n");
         seccomp_release(ctx);
         return 0;
     }
 
-    /* Load the filter into the kernel */
-    int rc = seccomp_load(ctx);
-    if (rc < 0)
+    /* libseccomp only exports to an fd - use an anonymous memory file */
+    int fd = memfd_create("seccomp-bpf", MFD_CLOEXEC);
+    if (fd < 0)
     {
-        fprintf(stderr, "[!] Failed to load seccomp filter: %s\n", strerror(-rc));
+        perror("memfd_create");
         seccomp_release(ctx);
         return -1;
     }
 
-    printf("[+] Seccomp filter loaded: %d syscalls blocked\n", blocked);
-
-    /* Release the context (filter remains active in kernel) */
+    int rc = seccomp_export_bpf(ctx, fd);
     seccomp_release(ctx);
+    if (rc < 0)
+    {
+        fprintf(stderr, "[!] Failed to compile seccomp filter: %s\n", strerror(-rc));
+        close(fd);
+        return -1;
+    }
 
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 ||
+        st.st_size % (off_t)sizeof(struct sock_filter) != 0)
+    {
+        fprintf(stderr, "[!] Unexpected seccomp program size\n");
+        close(fd);
+        return -1;
+    }
+
+    prog->filter = malloc(st.st_size);
+    if (!prog->filter || pread(fd, prog->filter, st.st_size, 0) != st.st_size)
+    {
+        fprintf(stderr, "[!] Failed to read seccomp program\n");
+        free(prog->filter);
+        prog->filter = NULL;
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    prog->len = (unsigned short)(st.st_size / sizeof(struct sock_filter));
+    prog->blocked = blocked;
+    prog->audited = audited;
     return 0;
 }
+
+/*
+ * Install a compiled filter on the calling thread
+ *
+ * The filter persists across exec(). NO_NEW_PRIVS is required to
+ * install a filter without CAP_SYS_ADMIN and stops setuid binaries
+ * from escaping it. A program with NOTIFY rules has to go through
+ * seccomp(2) itself: only that returns the listener fd.
+ */
+int load_seccomp_program(const SeccompProgram *prog, int *notify_fd)
+{
+    if (notify_fd)
+        *notify_fd = -1;
+
+    if (prog->len == 0)
+        return 0;
+
+    if (prog->audited > 0 && !notify_fd)
+    {
+        fprintf(stderr, "[!] Seccomp program audits syscalls but nobody supervises them\n");
+        return -1;
+    }
+
+    struct sock_fprog fprog = {
+        .len = prog->len,
+        .filter = prog->filter,
+    };
+
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0)
+    {
+        perror("prctl(PR_SET_NO_NEW_PRIVS)");
+        return -1;
+    }
+
+    if (prog->audited > 0)
+    {
+        int fd = (int)syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER,
+                              SECCOMP_FILTER_FLAG_NEW_LISTENER, &fprog);
+        if (fd < 0)
+        {
+            fprintf(stderr, "[!] Failed to load seccomp filter: %s\n", strerror(errno));
+            return -1;
+        }
+        *notify_fd = fd;
+    }
+    else if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &fprog) != 0)
+    {
+        fprintf(stderr, "[!] Failed to load seccomp filter: %s\n", strerror(errno));
+        return -1;
+    }
+
+    printf("[+] Seccomp filter loaded: %d syscalls blocked, %d audited\n",
+           prog->blocked, prog->audited);
+    return 0;
+}
+
+void free_seccomp_program(SeccompProgram *prog)
+{
+    free(prog->filter);
+    memset(prog, 0, sizeof(*prog));
+}
+
+/*
+ * Setup seccomp filter based on policy (compile and load in one go)
+ */
+int setup_seccomp_filter(const Policy *policy)
+{
+    SeccompProgram prog;
+
+    if (compile_seccomp_filter(policy, &prog) != 0)
+        return -1;
+
+    int rc = load_seccomp_program(&prog, NULL);
+    free_seccomp_program(&prog);
+    return rc;
+}
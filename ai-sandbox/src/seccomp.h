@@ -1,12 +1,30 @@
 #ifndef SECCOMP_H
 #define SECCOMP_H
 
+#include <linux/filter.h>
 #include "policy.h"
 
+/* BPF program compiled ahead of time, installed later */
+typedef struct {
+    struct sock_filter *filter;
+    unsigned short len;     /* 0 = nothing to block */
+    int blocked;            /* number of syscalls blocked */
+    int audited;            /* number sent to the supervisor (USER_NOTIF) */
+} SeccompProgram;
+
 /*
  * Setup seccomp filter to block specified system calls
  * Returns 0 on success, -1 on failure
  */
 int setup_seccomp_filter(const Policy *policy);
 
+/*
+ * Split form of setup_seccomp_filter: compile early, load just before exec.
+ * If the program audits syscalls, *notify_fd receives the listener the
+ * supervisor answers them on (-1 otherwise); pass NULL to refuse audits.
+ */
+int compile_seccomp_filter(const Policy *policy, SeccompProgram *prog);
+int load_seccomp_program(const SeccompProgram *prog, int *notify_fd);
+void free_seccomp_program(SeccompProgram *prog);
+
 #endif
@@ -0,0 +1,24 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_LEN 32
+#define SHA256_HEX_LEN    65    /* 64 hex chars + NUL */
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t bitlen;
+    uint8_t  buf[64];
+    size_t   buflen;
+} Sha256;
+
+void sha256_init(Sha256 *ctx);
+void sha256_update(Sha256 *ctx, const void *data, size_t len);
+void sha256_final(Sha256 *ctx, uint8_t out[SHA256_DIGEST_LEN]);
+
+/* Finish and write the digest as lowercase hex */
+void sha256_final_hex(Sha256 *ctx, char out[SHA256_HEX_LEN]);
+
+#endif
@@ -0,0 +1,741 @@
+/*
+ * supervisor.c - Answers audited syscalls (seccomp user notification)
+ *
+ * WHY: blocked_syscalls can only say EPERM to every call. Some calls
+ * should depend on their arguments - connect() to an address the
+ * policy doesn't allow, execve() of a particular binary - and even
+ * allowed ones are worth a record of which process made them.
+ *
+ * HOW IT WORKS:
+ * 1. Syscalls listed in audited_syscalls get a SECCOMP_RET_USER_NOTIF
+ *    rule; the sandbox loads the filter just before exec and sends
+ *    the listener fd to ai-run over a socketpair (SCM_RIGHTS)
+ * 2. One thread in ai-run waits on an epoll set holding the channel
+ *    and listener fds of every supervised sandbox. A notification
+ *    only costs a wakeup on the audited syscalls - everything else is
+ *    decided in the kernel by the BPF program alone
+ * 3. connect() is checked against the same rules as the firewall
+ *    (loopback, DNS, whitelist, allow_all_https, package proxy) and
+ *    execve()/execveat() against blocked_executables. Other audited
+ *    syscalls are only logged. Allowed calls continue in the kernel
+ *    (SECCOMP_USER_NOTIF_FLAG_CONTINUE), denied ones fail with EPERM
+ * 4. Every answer is appended to SESSION_RUN_DIR/<pid>/audit.log; the
+ *    whitelist and blocked_executables follow "ai-run reload". A new
+ *    whitelist is resolved on a thread of its own and swapped in under
+ *    the lock, so DNS never stalls the epoll thread; the old sets
+ *    answer until then
+ *
+ * Arguments are read from the caller's memory, which another thread
+ * of the caller could change before the kernel acts on a CONTINUE.
+ * The firewall stays the hard boundary for the network; this adds
+ * attribution and an early, explicit failure on top of it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/seccomp.h>
+#include <seccomp.h>
+#include "supervisor.h"
+#include "proxy.h"
+#include "reload.h"
+#include "whitelist.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_getfd
+#define SYS_pidfd_getfd 438
+#endif
+
+#define SUPERVISOR_EVENTS 64
+
+typedef enum {
+    WATCH_STOP,         /* eventfd that ends the thread */
+    WATCH_CHANNEL,      /* socket the sandbox sends listeners over */
+    WATCH_LISTENER      /* seccomp notify fd */
+} WatchKind;
+
+/* What one epoll entry stands for */
+typedef struct {
+    WatchKind kind;
+    int fd;
+    int sandbox;
+} Watch;
+
+typedef struct {
+    int in_use;
+    pid_t session_pid;
+    Policy policy;
+    ResolvedWhitelist resolved;
+    CompiledWhitelist whitelist;    /* from policy + resolved */
+    char proxy_ip[16];
+    int audit_nr[MAX_PATHS];        /* syscall numbers of audited_syscalls */
+    FILE *log;                      /* opened when the first listener arrives */
+    char live_path[256];
+    struct timespec live_mtime;
+    time_t live_checked;
+    unsigned reload_gen;            /* newest whitelist being resolved */
+    unsigned long allowed;
+    unsigned long denied;
+} Supervised;
+
+static Supervised sandboxes[MAX_SUPERVISED];
+static pthread_mutex_t sandboxes_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+static int started;
+static int epoll_fd = -1;
+static Watch stop_watch = { WATCH_STOP, -1, -1 };
+
+/* ---------- Epoll set ---------- */
+
+static int add_watch(WatchKind kind, int fd, int sandbox)
+{
+    Watch *w = malloc(sizeof(*w));
+    if (!w)
+        return -1;
+
+    w->kind = kind;
+    w->fd = fd;
+    w->sandbox = sandbox;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = w };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        perror("epoll_ctl");
+        free(w);
+        return -1;
+    }
+    return 0;
+}
+
+static void drop_watch(Watch *w)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->fd, NULL);
+    close(w->fd);
+    free(w);
+}
+
+/* ---------- Reading the caller ---------- */
+
+static int read_target(pid_t pid, uint64_t addr, void *buf, size_t len)
+{
+    struct iovec local = { buf, len };
+    struct iovec remote = { (void *)(uintptr_t)addr, len };
+
+    return process_vm_readv(pid, &local, 1, &remote, 1, 0) == (ssize_t)len ? 0 : -1;
+}
+
+/*
+ * NUL-terminated string from the caller, a page at a time so a string
+ * ending just before an unmapped page still reads
+ */
+static int read_target_string(pid_t pid, uint64_t addr, char *buf, size_t size)
+{
+    size_t got = 0;
+
+    while (got < size - 1)
+    {
+        size_t chunk = 4096 - ((addr + got) & 4095);
+        if (chunk > size - 1 - got)
+            chunk = size - 1 - got;
+
+        struct iovec local = { buf + got, chunk };
+        struct iovec remote = { (void *)(uintptr_t)(addr + got), chunk };
+        ssize_t n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+        if (n <= 0)
+            return -1;
+
+        if (memchr(buf + got, '\0', n))
+            return 0;
+        got += n;
+    }
+    buf[size - 1] = '\0';
+    return 0;
+}
+
+/*
+ * SO_TYPE of a socket in the caller. Notifications carry a thread id,
+ * and pidfd_open wants the thread group leader.
+ */
+static int target_socket_type(pid_t tid, int fd)
+{
+    char path[64];
+    char line[128];
+    pid_t tgid = tid;
+    int type = -1;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", tid);
+    FILE *f = fopen(path, "r");
+    if (f)
+    {
+        while (fgets(line, sizeof(line), f))
+        {
+            if (sscanf(line, "Tgid: %d", &tgid) == 1)
+                break;
+        }
+        fclose(f);
+    }
+
+    int pidfd = (int)syscall(SYS_pidfd_open, tgid, 0);
+    if (pidfd < 0)
+        return -1;
+
+    int sock = (int)syscall(SYS_pidfd_getfd, pidfd, fd, 0);
+    if (sock >= 0)
+    {
+        socklen_t len = sizeof(type);
+        if (getsockopt(sock, SOL_SOCKET, SO_TYPE, &type, &len) != 0)
+            type = -1;
+        close(sock);
+    }
+    close(pidfd);
+    return type;
+}
+
+/* ---------- Decisions ---------- */
+
+typedef struct {
+    int sandbox;
+    unsigned gen;
+    Policy policy;
+} ResolveJob;
+
+/*
+ * Same lookup the firewall update does, off the epoll thread. A
+ * slower, older job finishing last must not undo a newer reload.
+ */
+static void *resolve_thread(void *arg)
+{
+    ResolveJob *job = arg;
+    ResolvedWhitelist resolved;
+    CompiledWhitelist whitelist = { NULL, 0 };
+
+    resolve_whitelist(&job->policy, &resolved);
+    compile_whitelist(&job->policy, &resolved, job->policy.ipv6, &whitelist);
+
+    pthread_mutex_lock(&sandboxes_lock);
+    Supervised *sb = &sandboxes[job->sandbox];
+    if (started && sb->in_use && sb->reload_gen == job->gen)
+    {
+        CompiledWhitelist old = sb->whitelist;
+        sb->resolved = resolved;
+        sb->whitelist = whitelist;
+        whitelist = old;
+    }
+    pthread_mutex_unlock(&sandboxes_lock);
+
+    free_compiled_whitelist(&whitelist);
+    free(job);
+    return NULL;
+}
+
+static void start_resolve(Supervised *sb)
+{
+    ResolveJob *job = malloc(sizeof(*job));
+    pthread_t t;
+
+    if (!job)
+        return;
+    job->sandbox = (int)(sb - sandboxes);
+    job->gen = ++sb->reload_gen;
+    job->policy = sb->policy;
+
+    if (pthread_create(&t, NULL, resolve_thread, job) != 0)
+    {
+        free(job);
+        return;
+    }
+    pthread_detach(t);
+}
+
+/*
+ * Pick up "ai-run reload" changes, checked at most once a second.
+ * The filter itself is fixed, so audited_syscalls can't change.
+ * Called with sandboxes_lock held.
+ */
+static void refresh_policy(Supervised *sb)
+{
+    struct timespec now;
+    struct stat st;
+    Policy next;
+
+    if (!sb->live_path[0])
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    if (now.tv_sec == sb->live_checked)
+        return;
+    sb->live_checked = now.tv_sec;
+
+    if (stat(sb->live_path, &st) != 0 ||
+        (st.st_mtim.tv_sec == sb->live_mtime.tv_sec && st.st_mtim.tv_nsec == sb->live_mtime.tv_nsec))
+        return;
+    sb->live_mtime = st.st_mtim;
+
+    if (load_policy(sb->live_path, &next) != 0)
+        return;
+
+    memcpy(next.audited_syscalls, sb->policy.audited_syscalls, sizeof(next.audited_syscalls));
+    next.audited_syscalls_count = sb->policy.audited_syscalls_count;
+    sb->policy = next;
+
+    if (!sb->proxy_ip[0])
+        start_resolve(sb);
+
+    if (sb->log)
+        fprintf(sb->log, "RELOAD whitelist (%d entries), %d blocked executables\n",
+                sb->policy.whitelist_count, sb->policy.blocked_executables_count);
+}
+
+static int is_loopback(int family, const void *addr)
+{
+    if (family == AF_INET)
+        return (ntohl(((const struct in_addr *)addr)->s_addr) >> 24) == 127;
+    return IN6_IS_ADDR_LOOPBACK((const struct in6_addr *)addr);
+}
+
+static int same_address(const char *ip, int family, const void *addr)
+{
+    unsigned char want[16];
+
+    if (inet_pton(family, ip, want) != 1)
+        return 0;
+    return memcmp(want, addr, family == AF_INET ? 4 : 16) == 0;
+}
+
+/*
+ * The firewall's view of an outgoing TCP connection: loopback and DNS
+ * always, then the package proxy or the (resolved) whitelist
+ */
+static int destination_allowed(const Supervised *sb, int family, const void *addr, int port)
+{
+    const Policy *p = &sb->policy;
+
+    if (p->network_mode == NET_POLICY_ALLOW || is_loopback(family, addr) || port == 53)
+        return 1;
+
+    if (sb->proxy_ip[0])
+        return port == PROXY_PORT && same_address(sb->proxy_ip, family, addr);
+
+    /* No whitelist at all means every HTTP(S) destination */
+    if ((p->allow_all_https || p->whitelist_count == 0) && (port == 443 || port == 80))
+        return 1;
+
+    /* Same compiled sets as the firewall: addresses, CIDRs and ports */
+    return whitelist_allows(&sb->whitelist, family, addr, port);
+}
+
+static int check_connect(const Supervised *sb, const struct seccomp_notif *req,
+                         char *detail, size_t detail_len)
+{
+    struct sockaddr_storage ss;
+    socklen_t len = req->data.args[2] < sizeof(ss) ? (socklen_t)req->data.args[2] : sizeof(ss);
+    char ip[INET6_ADDRSTRLEN];
+    const void *addr;
+    int family, port;
+
+    /* Let the kernel report EFAULT/EINVAL itself */
+    memset(&ss, 0, sizeof(ss));
+    if (len < sizeof(sa_family_t) || read_target(req->pid, req->data.args[1], &ss, len) != 0)
+        return 0;
+
+    if (ss.ss_family == AF_INET && len >= sizeof(struct sockaddr_in))
+    {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+        family = AF_INET;
+        addr = &sin->sin_addr;
+        port = ntohs(sin->sin_port);
+    }
+    else if (ss.ss_family == AF_INET6 && len >= sizeof(struct sockaddr_in6))
+    {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+        family = AF_INET6;
+        addr = &sin6->sin6_addr;
+        port = ntohs(sin6->sin6_port);
+
+        /* ::ffff:a.b.c.d goes out as IPv4 */
+        if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr))
+        {
+            family = AF_INET;
+            addr = &sin6->sin6_addr.s6_addr[12];
+        }
+    }
+    else
+    {
+        /* Unix, netlink, ... sockets are not the firewall's business */
+        snprintf(detail, detail_len, "family=%d", ss.ss_family);
+        return 0;
+    }
+
+    inet_ntop(family, addr, ip, sizeof(ip));
+    snprintf(detail, detail_len, family == AF_INET6 ? "[%s]:%d" : "%s:%d", ip, port);
+
+    if (destination_allowed(sb, family, addr, port))
+        return 0;
+
+    /* UDP connect() only picks a peer - glibc does it to sort getaddrinfo results */
+    return target_socket_type(req->pid, (int)req->data.args[0]) != SOCK_DGRAM;
+}
+
+static int check_exec(const Supervised *sb, const struct seccomp_notif *req, int path_arg,
+                      char *detail, size_t detail_len)
+{
+    char path[PATH_MAX];
+
+    if (read_target_string(req->pid, req->data.args[path_arg], path, sizeof(path)) != 0)
+        return 0;
+    snprintf(detail, detail_len, "%s", path);
+
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+
+    /* "/usr/bin/nc" matches that path only, "nc" any directory */
+    for (int i = 0; i < sb->policy.blocked_executables_count; i++)
+    {
+        const char *entry = sb->policy.blocked_executables[i];
+        if (strcmp(entry, strchr(entry, '/') ? path : base) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static void audit_log(Supervised *sb, pid_t pid, const char *name, const char *detail, int denied)
+{
+    char path[64];
+    char comm[32] = "?";
+    char timestamp[32];
+    time_t now = time(NULL);
+
+    if (!sb->log)
+        return;
+
+    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+    FILE *f = fopen(path, "r");
+    if (f)
+    {
+        if (fgets(comm, sizeof(comm), f))
+            comm[strcspn(comm, "\n")] = '\0';
+        fclose(f);
+    }
+
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    fprintf(sb->log, "%s pid=%d comm=%s %s%s%s %s\n", timestamp, pid, comm, name,
+            detail[0] ? " " : "", detail, denied ? "DENY" : "ALLOW");
+}
+
+/*
+ * Receive one notification and answer it. The caller's memory is read
+ * before the answer, so the id is checked again afterwards: if the
+ * caller died and its pid was reused, what we read belongs to someone
+ * else and the answer must not go out.
+ */
+static void handle_notification(Supervised *sb, int fd)
+{
+    struct seccomp_notif req;
+    struct seccomp_notif_resp resp;
+    char detail[PATH_MAX + 32] = "";
+    const char *name = "syscall";
+    int deny = 0;
+
+    /* RECV insists on a zeroed buffer */
+    memset(&req, 0, sizeof(req));
+    if (ioctl(fd, SECCOMP_IOCTL_NOTIF_RECV, &req) != 0)
+        return;     /* ENOENT: caller was killed while waiting */
+
+    pthread_mutex_lock(&sandboxes_lock);
+    refresh_policy(sb);
+
+    for (int i = 0; i < sb->policy.audited_syscalls_count; i++)
+    {
+        if (sb->audit_nr[i] == req.data.nr)
+        {
+            name = sb->policy.audited_syscalls[i];
+            break;
+        }
+    }
+
+    if (req.data.nr == __NR_connect)
+        deny = check_connect(sb, &req, detail, sizeof(detail));
+    else if (req.data.nr == __NR_execve)
+        deny = check_exec(sb, &req, 0, detail, sizeof(detail));
+    else if (req.data.nr == __NR_execveat)
+        deny = check_exec(sb, &req, 1, detail, sizeof(detail));
+
+    memset(&resp, 0, sizeof(resp));
+    resp.id = req.id;
+    if (deny)
+        resp.error = -EPERM;
+    else
+        resp.flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+
+    if (ioctl(fd, SECCOMP_IOCTL_NOTIF_ID_VALID, &req.id) == 0 &&
+        ioctl(fd, SECCOMP_IOCTL_NOTIF_SEND, &resp) == 0)
+    {
+        if (deny)
+            sb->denied++;
+        else
+            sb->allowed++;
+        audit_log(sb, req.pid, name, detail, deny);
+    }
+    pthread_mutex_unlock(&sandboxes_lock);
+}
+
+/* ---------- Listener hand-off ---------- */
+
+int supervisor_send_listener(int channel_fd, int notify_fd)
+{
+    char byte = 0;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { &byte, 1 };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &notify_fd, sizeof(int));
+
+    return sendmsg(channel_fd, &msg, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+/* Returns the received fd, -1 if the message had none, -2 once the sandbox closed its end */
+static int recv_listener(int channel_fd)
+{
+    char byte;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { &byte, 1 };
+    struct msghdr msg;
+    int fd = -1;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    ssize_t n = recvmsg(channel_fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+        return -2;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (n > 0 && cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+/* ---------- Thread ---------- */
+
+static void *supervisor_loop(void *arg)
+{
+    struct epoll_event events[SUPERVISOR_EVENTS];
+
+    (void)arg;
+
+    for (;;)
+    {
+        int n = epoll_wait(epoll_fd, events, SUPERVISOR_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return NULL;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            Watch *w = events[i].data.ptr;
+            Supervised *sb = w->sandbox >= 0 ? &sandboxes[w->sandbox] : NULL;
+
+            if (w->kind == WATCH_STOP)
+                return NULL;
+
+            if (w->kind == WATCH_CHANNEL)
+            {
+                int fd = recv_listener(w->fd);
+                if (fd >= 0)
+                    supervisor_watch(w->sandbox, fd);
+                else if (fd == -2)
+                    drop_watch(w);
+                continue;
+            }
+
+            /* Pending notification first: HUP can come with the last one */
+            if (events[i].events & EPOLLIN)
+                handle_notification(sb, w->fd);
+            if (events[i].events & (EPOLLHUP | EPOLLERR))
+                drop_watch(w);      /* every process under the filter is gone */
+        }
+
+        pthread_mutex_lock(&sandboxes_lock);
+        for (int i = 0; i < MAX_SUPERVISED; i++)
+        {
+            if (sandboxes[i].log)
+                fflush(sandboxes[i].log);
+        }
+        pthread_mutex_unlock(&sandboxes_lock);
+    }
+}
+
+int supervisor_start(void)
+{
+    if (started)
+        return 0;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    stop_watch.fd = eventfd(0, EFD_CLOEXEC);
+    if (epoll_fd < 0 || stop_watch.fd < 0)
+    {
+        perror("supervisor");
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &stop_watch };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_watch.fd, &ev);
+
+    if (pthread_create(&thread, NULL, supervisor_loop, NULL) != 0)
+    {
+        fprintf(stderr, "[!] Failed to start syscall supervisor\n");
+        return -1;
+    }
+    started = 1;
+    return 0;
+}
+
+void supervisor_stop(void)
+{
+    uint64_t one = 1;
+
+    if (!started)
+        return;
+
+    if (write(stop_watch.fd, &one, sizeof(one)) != sizeof(one))
+        perror("supervisor");
+    pthread_join(thread, NULL);
+
+    /* Watches still registered belong to sandboxes that are gone by now */
+    close(epoll_fd);
+    close(stop_watch.fd);
+    pthread_mutex_lock(&sandboxes_lock);
+    started = 0;    /* resolver threads still running discard their result */
+    for (int i = 0; i < MAX_SUPERVISED; i++)
+    {
+        if (sandboxes[i].log)
+            fclose(sandboxes[i].log);
+        sandboxes[i].log = NULL;
+        free_compiled_whitelist(&sandboxes[i].whitelist);
+    }
+    pthread_mutex_unlock(&sandboxes_lock);
+}
+
+int supervisor_add_sandbox(pid_t session_pid, const Policy *policy,
+                           const ResolvedWhitelist *resolved, const char *proxy_ip,
+                           int channel_fd)
+{
+    int id = -1;
+
+    pthread_mutex_lock(&sandboxes_lock);
+    for (int i = 0; i < MAX_SUPERVISED; i++)
+    {
+        if (!sandboxes[i].in_use)
+        {
+            id = i;
+            break;
+        }
+    }
+    if (id < 0)
+    {
+        pthread_mutex_unlock(&sandboxes_lock);
+        fprintf(stderr, "[!] Supervisor full (%d sandboxes)\n", MAX_SUPERVISED);
+        return -1;
+    }
+
+    Supervised *sb = &sandboxes[id];
+    memset(sb, 0, sizeof(*sb));
+    sb->in_use = 1;
+    sb->session_pid = session_pid;
+    sb->policy = *policy;
+    snprintf(sb->proxy_ip, sizeof(sb->proxy_ip), "%s", proxy_ip);
+
+    if (resolved)
+    {
+        sb->resolved = *resolved;
+    }
+    else
+    {
+        for (int i = 0; i < MAX_PATHS; i++)
+            sb->resolved.entries[i].count = -1;
+    }
+    compile_whitelist(policy, &sb->resolved, policy->ipv6, &sb->whitelist);
+
+    for (int i = 0; i < policy->audited_syscalls_count; i++)
+        sb->audit_nr[i] = seccomp_syscall_resolve_name(policy->audited_syscalls[i]);
+
+    if (session_pid > 0)
+    {
+        struct stat st;
+        snprintf(sb->live_path, sizeof(sb->live_path), "%s/%d/policy.yaml",
+                 SESSION_RUN_DIR, session_pid);
+        if (stat(sb->live_path, &st) == 0)
+            sb->live_mtime = st.st_mtim;
+    }
+    pthread_mutex_unlock(&sandboxes_lock);
+
+    if (channel_fd >= 0 && add_watch(WATCH_CHANNEL, channel_fd, id) != 0)
+        return -1;
+    return id;
+}
+
+int supervisor_watch(int sandbox_id, int notify_fd)
+{
+    Supervised *sb = &sandboxes[sandbox_id];
+
+    /* Session directory exists by now (register phase) */
+    pthread_mutex_lock(&sandboxes_lock);
+    if (!sb->log && sb->session_pid > 0)
+    {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%d/audit.log", SESSION_RUN_DIR, sb->session_pid);
+        sb->log = fopen(path, "ae");
+    }
+    pthread_mutex_unlock(&sandboxes_lock);
+
+    if (add_watch(WATCH_LISTENER, notify_fd, sandbox_id) != 0)
+    {
+        close(notify_fd);
+        return -1;
+    }
+    return 0;
+}
+
+void supervisor_counts(int sandbox_id, unsigned long *allowed, unsigned long *denied)
+{
+    pthread_mutex_lock(&sandboxes_lock);
+    *allowed = sandboxes[sandbox_id].allowed;
+    *denied = sandboxes[sandbox_id].denied;
+    pthread_mutex_unlock(&sandboxes_lock);
+}
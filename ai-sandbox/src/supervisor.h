@@ -0,0 +1,37 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <sys/types.h>
+#include "policy.h"
+#include "firewall.h"
+
+/* How many sandboxes one supervisor thread can answer for */
+#define MAX_SUPERVISED 64
+
+/*
+ * Start the thread that answers seccomp user notifications for
+ * audited syscalls (policy: audited_syscalls). One thread, one epoll
+ * set, any number of sandboxes. Returns 0 on success, -1 on failure.
+ */
+int supervisor_start(void);
+void supervisor_stop(void);
+
+/*
+ * Supervise one sandbox. Its seccomp listener fds arrive over
+ * channel_fd (see supervisor_send_listener), or can be handed in with
+ * supervisor_watch. resolved may be NULL; proxy_ip is "" unless the
+ * sandbox uses the package proxy. session_pid 0 = no live policy or
+ * audit log. Returns a sandbox id, or -1.
+ */
+int supervisor_add_sandbox(pid_t session_pid, const Policy *policy,
+                           const ResolvedWhitelist *resolved, const char *proxy_ip,
+                           int channel_fd);
+int supervisor_watch(int sandbox_id, int notify_fd);
+
+/* Calls answered for a sandbox so far */
+void supervisor_counts(int sandbox_id, unsigned long *allowed, unsigned long *denied);
+
+/* Sandbox side: pass a freshly loaded listener to ai-run (SCM_RIGHTS) */
+int supervisor_send_listener(int channel_fd, int notify_fd);
+
+#endif
@@ -0,0 +1,375 @@
+/*
+ * whitelist.c - Compile the network whitelist into interval sets
+ *
+ * WHY: With ports, CIDRs and port ranges in the whitelist, one rule per
+ * entry and address would make every new connection walk a list that
+ * grows with the policy, and overlapping entries ("10.0.0.0/8:5432"
+ * next to "10.1.2.3:5432") would each cost their own rules.
+ *
+ * HOW IT WORKS:
+ * 1. Every entry becomes (address range, port range) items: a CIDR is
+ *    one range, a domain one range per resolved address
+ * 2. Per address family the port axis is cut at every range boundary,
+ *    so each piece is covered by the same entries throughout. The
+ *    address ranges of those entries are sorted and merged until none
+ *    overlap or touch
+ * 3. Neighbouring pieces that ended up with the same addresses are
+ *    joined again, so "a:80,443" and "b:80,443" stay two sets, not
+ *    six, and a policy with only default web ports compiles to two
+ * 4. The firewall turns each set into one ipset (or the fewest CIDR
+ *    rules); the supervisor looks destinations up by binary search
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <arpa/inet.h>
+#include "whitelist.h"
+
+typedef struct {
+    int family;
+    int port_lo;
+    int port_hi;
+    AddrRange range;
+} Item;
+
+typedef struct {
+    Item *items;
+    int count;
+    int cap;
+} ItemList;
+
+static int addr_len(int family)
+{
+    return family == AF_INET6 ? 16 : 4;
+}
+
+/* a += 1 over the family's length; 0 if it wrapped around */
+static int addr_inc(unsigned char *a, int len)
+{
+    for (int i = len - 1; i >= 0; i--)
+    {
+        if (++a[i] != 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* Set the low bits host bits of a */
+static void set_low_bits(unsigned char *a, int len, int bits)
+{
+    for (int i = 0; i < bits; i++)
+        a[len - 1 - i / 8] |= (unsigned char)(1 << (i % 8));
+}
+
+static int low_bit_set(const unsigned char *a, int len, int bit)
+{
+    return (a[len - 1 - bit / 8] >> (bit % 8)) & 1;
+}
+
+static void target_range(const WhitelistTarget *t, AddrRange *r)
+{
+    int len = addr_len(t->family);
+
+    memset(r, 0, sizeof(*r));
+    memcpy(r->lo, t->addr, len);
+    memcpy(r->hi, t->addr, len);
+    set_low_bits(r->hi, len, len * 8 - t->prefix);
+}
+
+static int add_item(ItemList *list, int family, const AddrRange *r, int port_lo, int port_hi)
+{
+    if (list->count == list->cap)
+    {
+        int cap = list->cap ? list->cap * 2 : 64;
+        Item *items = realloc(list->items, cap * sizeof(Item));
+        if (!items)
+            return -1;
+        list->items = items;
+        list->cap = cap;
+    }
+    Item *it = &list->items[list->count++];
+    it->family = family;
+    it->port_lo = port_lo;
+    it->port_hi = port_hi;
+    it->range = *r;
+    return 0;
+}
+
+static int add_target(ItemList *list, const WhitelistTarget *t, const AddrRange *r, int family)
+{
+    for (int i = 0; i < t->port_count; i++)
+    {
+        if (add_item(list, family, r, t->ports[i].lo, t->ports[i].hi) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+static int cmp_range(const void *a, const void *b)
+{
+    return memcmp(((const AddrRange *)a)->lo, ((const AddrRange *)b)->lo, 16);
+}
+
+/* Sort and merge overlapping or adjacent ranges in place; new count */
+static int merge_ranges(AddrRange *r, int count, int len)
+{
+    int out = 0;
+
+    qsort(r, count, sizeof(AddrRange), cmp_range);
+    for (int i = 0; i < count; i++)
+    {
+        if (out > 0)
+        {
+            unsigned char next[16];
+            memcpy(next, r[out - 1].hi, 16);
+            int wrapped = !addr_inc(next, len);
+
+            if (wrapped || memcmp(r[i].lo, next, 16) <= 0)
+            {
+                if (memcmp(r[i].hi, r[out - 1].hi, 16) > 0)
+                    memcpy(r[out - 1].hi, r[i].hi, 16);
+                continue;
+            }
+        }
+        r[out++] = r[i];
+    }
+    return out;
+}
+
+static int push_set(CompiledWhitelist *out, int *cap, const WhitelistSet *set)
+{
+    if (out->count == *cap)
+    {
+        int ncap = *cap ? *cap * 2 : 8;
+        WhitelistSet *sets = realloc(out->sets, ncap * sizeof(WhitelistSet));
+        if (!sets)
+            return -1;
+        out->sets = sets;
+        *cap = ncap;
+    }
+    out->sets[out->count++] = *set;
+    return 0;
+}
+
+/* Steps 2 and 3 for one family */
+static int compile_family(const ItemList *list, int family, CompiledWhitelist *out, int *cap)
+{
+    int len = addr_len(family);
+    int nb = 0;
+    int *bounds = malloc((size_t)list->count * 2 * sizeof(int) + sizeof(int));
+    AddrRange *ranges = malloc((size_t)list->count * sizeof(AddrRange) + sizeof(AddrRange));
+    if (!bounds || !ranges)
+    {
+        free(bounds);
+        free(ranges);
+        return -1;
+    }
+
+    for (int i = 0; i < list->count; i++)
+    {
+        if (list->items[i].family != family)
+            continue;
+        bounds[nb++] = list->items[i].port_lo;
+        bounds[nb++] = list->items[i].port_hi + 1;
+    }
+    qsort(bounds, nb, sizeof(int), cmp_int);
+
+    int first = out->count;
+    for (int b = 0; b + 1 < nb; b++)
+    {
+        int lo = bounds[b], hi = bounds[b + 1] - 1;
+        int n = 0;
+
+        if (bounds[b] == bounds[b + 1])
+            continue;
+        for (int i = 0; i < list->count; i++)
+        {
+            const Item *it = &list->items[i];
+            if (it->family == family && it->port_lo <= lo && it->port_hi >= hi)
+                ranges[n++] = it->range;
+        }
+        if (n == 0)
+            continue;
+        n = merge_ranges(ranges, n, len);
+
+        /* Same addresses as the piece just below: extend that set */
+        WhitelistSet *prev = out->count > first ? &out->sets[out->count - 1] : NULL;
+        if (prev && prev->port_hi + 1 == lo && prev->count == n &&
+            memcmp(prev->ranges, ranges, n * sizeof(AddrRange)) == 0)
+        {
+            prev->port_hi = hi;
+            continue;
+        }
+
+        WhitelistSet set = { family, lo, hi, malloc(n * sizeof(AddrRange)), n };
+        if (!set.ranges || push_set(out, cap, &set) != 0)
+        {
+            free(set.ranges);
+            free(bounds);
+            free(ranges);
+            return -1;
+        }
+        memcpy(set.ranges, ranges, n * sizeof(AddrRange));
+    }
+
+    free(bounds);
+    free(ranges);
+    return 0;
+}
+
+int compile_whitelist(const Policy *policy, const ResolvedWhitelist *resolved, int ipv6,
+                      CompiledWhitelist *out)
+{
+    ItemList list = {0};
+    WhitelistTarget t;
+    AddrRange r;
+    int cap = 0;
+    int ret = 0;
+
+    out->sets = NULL;
+    out->count = 0;
+
+    for (int i = 0; i < policy->whitelist_count && ret == 0; i++)
+    {
+        if (parse_whitelist_entry(policy->network_whitelist[i], &t) != 0)
+            continue;
+
+        if (t.family)
+        {
+            if (t.family == AF_INET6 && !ipv6)
+                continue;
+            target_range(&t, &r);
+            ret = add_target(&list, &t, &r, t.family);
+            continue;
+        }
+
+        /* Domain: every address it resolved to */
+        const ResolvedEntry *re = resolved ? &resolved->entries[i] : NULL;
+        for (int j = 0; re && j < re->count && ret == 0; j++)
+        {
+            int family = strchr(re->addrs[j], ':') ? AF_INET6 : AF_INET;
+            if (family == AF_INET6 && !ipv6)
+                continue;
+            memset(&r, 0, sizeof(r));
+            if (inet_pton(family, re->addrs[j], r.lo) != 1)
+                continue;
+            memcpy(r.hi, r.lo, 16);
+            ret = add_target(&list, &t, &r, family);
+        }
+    }
+
+    if (ret == 0)
+        ret = compile_family(&list, AF_INET, out, &cap);
+    if (ret == 0)
+        ret = compile_family(&list, AF_INET6, out, &cap);
+    free(list.items);
+
+    if (ret != 0)
+        free_compiled_whitelist(out);
+    return ret;
+}
+
+void free_compiled_whitelist(CompiledWhitelist *wl)
+{
+    for (int i = 0; i < wl->count; i++)
+        free(wl->sets[i].ranges);
+    free(wl->sets);
+    wl->sets = NULL;
+    wl->count = 0;
+}
+
+int whitelist_allows(const CompiledWhitelist *wl, int family, const void *addr, int port)
+{
+    unsigned char a[16] = {0};
+
+    memcpy(a, addr, addr_len(family));
+    for (int i = 0; i < wl->count; i++)
+    {
+        const WhitelistSet *set = &wl->sets[i];
+        if (set->family != family || port < set->port_lo || port > set->port_hi)
+            continue;
+
+        /* Last range starting at or below a */
+        int lo = 0, hi = set->count - 1, found = -1;
+        while (lo <= hi)
+        {
+            int mid = (lo + hi) / 2;
+            if (memcmp(set->ranges[mid].lo, a, 16) <= 0)
+            {
+                found = mid;
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid - 1;
+            }
+        }
+        return found >= 0 && memcmp(a, set->ranges[found].hi, 16) <= 0;
+    }
+    return 0;
+}
+
+int whitelist_target_matches(const WhitelistTarget *target, const char *host, int port)
+{
+    int port_ok = 0;
+
+    for (int i = 0; i < target->port_count; i++)
+    {
+        if (port >= target->ports[i].lo && port <= target->ports[i].hi)
+            port_ok = 1;
+    }
+    if (!port_ok)
+        return 0;
+
+    if (!target->family)
+        return strcasecmp(target->host, host) == 0;
+
+    /* Address entries match literal addresses inside their prefix */
+    unsigned char a[16] = {0};
+    AddrRange r;
+    if (inet_pton(target->family, host, a) != 1)
+        return 0;
+    target_range(target, &r);
+    return memcmp(a, r.lo, 16) >= 0 && memcmp(a, r.hi, 16) <= 0;
+}
+
+void for_each_cidr(int family, const AddrRange *range,
+                   void (*fn)(const char *cidr, void *arg), void *arg)
+{
+    int len = addr_len(family);
+    int bits = len * 8;
+    unsigned char lo[16];
+    char text[INET6_ADDRSTRLEN];
+    char cidr[INET6_ADDRSTRLEN + 4];
+
+    memcpy(lo, range->lo, 16);
+    for (;;)
+    {
+        /* Largest block aligned at lo that still ends within the range */
+        int host = 0;
+        while (host < bits && !low_bit_set(lo, len, host))
+        {
+            unsigned char end[16];
+            memcpy(end, lo, 16);
+            set_low_bits(end, len, host + 1);
+            if (memcmp(end, range->hi, 16) > 0)
+                break;
+            host++;
+        }
+
+        inet_ntop(family, lo, text, sizeof(text));
+        snprintf(cidr, sizeof(cidr), "%s/%d", text, bits - host);
+        fn(cidr, arg);
+
+        set_low_bits(lo, len, host);
+        if (memcmp(lo, range->hi, 16) >= 0 || !addr_inc(lo, len))
+            break;
+    }
+}
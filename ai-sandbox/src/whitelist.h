@@ -0,0 +1,47 @@
+#ifndef WHITELIST_H
+#define WHITELIST_H
+
+#include "policy.h"
+#include "firewall.h"
+
+/* Inclusive address range, big-endian; IPv4 uses the first 4 bytes */
+typedef struct {
+    unsigned char lo[16];
+    unsigned char hi[16];
+} AddrRange;
+
+/* Destinations reachable on one port range: sorted, merged, disjoint */
+typedef struct {
+    int family;
+    int port_lo;
+    int port_hi;
+    AddrRange *ranges;
+    int count;
+} WhitelistSet;
+
+/* A whole whitelist; no two sets of a family share a port */
+typedef struct {
+    WhitelistSet *sets;
+    int count;
+} CompiledWhitelist;
+
+/*
+ * Turn the whitelist (domains via resolved, which must be filled in)
+ * into sets of address ranges per port range. IPv6 destinations are
+ * left out unless ipv6 is set. Returns 0, or -1 if out of memory.
+ */
+int compile_whitelist(const Policy *policy, const ResolvedWhitelist *resolved, int ipv6,
+                      CompiledWhitelist *out);
+void free_compiled_whitelist(CompiledWhitelist *wl);
+
+/* Is a TCP connection to addr (in_addr/in6_addr) port allowed? */
+int whitelist_allows(const CompiledWhitelist *wl, int family, const void *addr, int port);
+
+/* Does an entry cover host (a name, or an address) on port? */
+int whitelist_target_matches(const WhitelistTarget *target, const char *host, int port);
+
+/* Call fn with the fewest CIDR blocks ("10.0.0.0/8") covering a range */
+void for_each_cidr(int family, const AddrRange *range,
+                   void (*fn)(const char *cidr, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * proxy_address_test.c - Upstream addresses the package proxy refuses
+ *
+ * The proxy runs in the host's network namespace, so any address of
+ * the host (above all the veth gateway the sandbox already talks to)
+ * would reach host services bound to 0.0.0.0. Checks the fixed ranges,
+ * every address of this host, and - as root, in a scratch network
+ * namespace - the gateway and subnet of a sandbox veth.
+ *
+ * Build and run: make test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "proxy.h"
+#include "network.h"
+
+static int failures;
+
+static void expect(const char *ip, int internal)
+{
+    struct sockaddr_storage ss;
+
+    memset(&ss, 0, sizeof(ss));
+    if (strchr(ip, ':'))
+    {
+        ss.ss_family = AF_INET6;
+        inet_pton(AF_INET6, ip, &((struct sockaddr_in6 *)&ss)->sin6_addr);
+    }
+    else
+    {
+        ss.ss_family = AF_INET;
+        inet_pton(AF_INET, ip, &((struct sockaddr_in *)&ss)->sin_addr);
+    }
+
+    int got = proxy_address_is_internal((struct sockaddr *)&ss);
+    printf("[%s] %-16s %s\n", got == internal ? "+" : "!", ip, got ? "refused" : "allowed");
+    if (got != internal)
+        failures++;
+}
+
+/* Every address this host has must be refused */
+static void expect_own_addresses(void)
+{
+    struct ifaddrs *ifs;
+    char ip[INET6_ADDRSTRLEN];
+
+    if (getifaddrs(&ifs) != 0)
+        return;
+    for (struct ifaddrs *ifa = ifs; ifa; ifa = ifa->ifa_next)
+    {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET)
+            continue;
+        inet_ntop(AF_INET, &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr, ip, sizeof(ip));
+        expect(ip, 1);
+    }
+    freeifaddrs(ifs);
+}
+
+/* A sandbox veth as setup_veth_from_host() leaves it, in a throwaway namespace */
+static void expect_sandbox_veth(void)
+{
+    SandboxNet net;
+    char cmd[320];
+
+    if (geteuid() != 0 || unshare(CLONE_NEWNET) != 0)
+    {
+        printf("[!] Skipping the veth gateway check (needs root)\n");
+        return;
+    }
+
+    sandbox_net_from_slot(7, &net);
+    snprintf(cmd, sizeof(cmd),
+             "ip link add %s type veth peer name %s && ip addr add %s/24 dev %s && ip link set %s up",
+             net.veth_host, net.veth_sandbox, net.host_ip, net.veth_host, net.veth_host);
+    if (system(cmd) != 0)
+    {
+        printf("[!] Could not create %s\n", net.veth_host);
+        failures++;
+        return;
+    }
+
+    expect(net.host_ip, 1);         /* the gateway every sandbox can reach */
+    expect(net.sandbox_ip, 1);      /* another session's sandbox */
+    expect("10.201.0.1", 0);
+}
+
+int main(void)
+{
+    expect("127.0.0.1", 1);
+    expect("169.254.169.254", 1);
+    expect("0.0.0.0", 1);
+    expect("224.0.0.251", 1);
+    expect("::1", 1);
+    expect("fe80::1", 1);
+    expect("::ffff:10.0.0.1", 1);
+    expect("93.184.215.14", 0);
+    expect("2606:4700::1111", 0);
+
+    expect_own_addresses();
+    expect_sandbox_veth();
+
+    if (failures > 0)
+    {
+        printf("[!] %d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("[+] All checks passed\n");
+    return 0;
+}